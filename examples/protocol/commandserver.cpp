@@ -9,18 +9,15 @@ enum {
 
 class MyServer : public CommandServer {
 public:
+  // Stop the connection thread while processIncomingMessage() is still valid
+  ~MyServer() { stop(); }
+
   void initiateConversation() {
     std::cout << "Server requesting order" << std::endl;
-    for (auto listener : mServerConnections) {
-      std::cout << "Sending command to " << listener->address() << ":"
-                << listener->port() << std::endl;
-      unsigned char message[8] = {0, 0};
-
-      message[0] = ASK_CLIENT_FOR_ORDER;
-      if (listener->send((const char *)message, 2) == 2) {
-      } else {
-        std::cerr << "ERROR sending command" << std::endl;
-      }
+    unsigned char message[1] = {ASK_CLIENT_FOR_ORDER};
+    // Sent to all connected clients
+    if (!sendMessage(message, 1)) {
+      std::cerr << "ERROR sending command" << std::endl;
     }
   }
 
@@ -37,6 +34,8 @@ public:
 
 class MyClient : public CommandClient {
 public:
+  ~MyClient() { stop(); }
+
   bool processIncomingMessage(Message &m, Socket *src) override {
 
     if (m.getByte() == ASK_CLIENT_FOR_ORDER) {
@@ -44,7 +43,7 @@ public:
 
       uint8_t message[7] = {TELL_SERVER_ORDER, 'w', 'a', 't', 'e', 'r', 0};
 
-      if (!(mSocket.send((const char *)message, 7) == 7)) {
+      if (!sendMessage(message, 7)) {
         std::cerr << "ERROR sending reply" << std::endl;
         return false;
       }
@@ -72,11 +71,13 @@ int main() {
     std::cerr << "ERROR starting command client2" << std::endl;
   }
 
-  // Wait until our client is connected
-  server.waitForConnections(1);
+  // Wait until our clients are connected
+  server.waitForConnections(2);
 
   //  Ping from server
-  server.ping();
+  for (auto pingTime : server.ping()) {
+    std::cout << "Ping time " << pingTime * 1000.0 << " ms" << std::endl;
+  }
 
   al_sleep(1.0);
   // Send message from server that generates a reply from the client
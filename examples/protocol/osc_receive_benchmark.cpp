@@ -0,0 +1,97 @@
+// Benchmark for parsing received OSC packets
+//
+// Parses single messages and bundles the way osc::Recv does for packets
+// arriving on its socket, comparing parsing in place with a handler to
+// parsing into a list of messages. Reports messages per second and heap
+// allocations per message, counted by replacing the global operator new.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "al/protocol/al_OSC.hpp"
+
+using namespace al;
+
+#define NUM_PACKETS (200000)
+#define BUNDLE_SIZE (16)
+
+static std::atomic<uint64_t> allocations{0};
+
+void *operator new(std::size_t size) {
+  allocations++;
+  void *p = std::malloc(size);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+class CountingHandler : public osc::PacketHandler {
+public:
+  void onMessage(osc::Message &m) override {
+    float value;
+    m >> value;
+    sum += value;
+    count++;
+  }
+
+  double sum{0};
+  uint64_t count{0};
+};
+
+template <class ParseFunction>
+void run(const char *name, const osc::Packet &packet, ParseFunction parse) {
+  CountingHandler handler;
+  // Warm up reused messages
+  parse(packet, handler);
+  handler.count = 0;
+
+  uint64_t allocationsBefore = allocations;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < NUM_PACKETS; i++) {
+    parse(packet, handler);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  uint64_t allocationCount = allocations - allocationsBefore;
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::cout << name << ": " << handler.count / seconds << " messages/s, "
+            << double(allocationCount) / handler.count
+            << " allocations/message" << std::endl;
+}
+
+int main() {
+  osc::Packet message;
+  message.addMessage("/synth/voice/frequency", 440.0f);
+
+  osc::Packet bundle(4096);
+  bundle.beginBundle(1);
+  for (int i = 0; i < BUNDLE_SIZE; i++) {
+    bundle.addMessage("/synth/voice" + std::to_string(i) + "/amplitude",
+                      0.5f);
+  }
+  bundle.endBundle();
+
+  auto inPlace = [](const osc::Packet &p, CountingHandler &handler) {
+    osc::Recv::parse(p.data(), int(p.size()), handler, "127.0.0.1");
+  };
+  auto toList = [](const osc::Packet &p, CountingHandler &handler) {
+    auto messages = osc::Recv::parse(p.data(), int(p.size()), 1, "127.0.0.1");
+    for (auto &m : messages) {
+      handler.onMessage(*m);
+    }
+  };
+
+  run("Message, in place", message, inPlace);
+  run("Message, list", message, toList);
+  run("Bundle, in place", bundle, inPlace);
+  run("Bundle, list", bundle, toList);
+  return 0;
+}
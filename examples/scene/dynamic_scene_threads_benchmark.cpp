@@ -0,0 +1,107 @@
+// Benchmark for threaded audio rendering in DynamicScene
+//
+// Renders a few hundred positioned voices through DBAP on a 60 speaker ring
+// with an increasing number of audio threads, and reports the time per block
+// and the speedup relative to rendering on the calling thread only.
+//
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#include "al/io/al_AudioIOData.hpp"
+#include "al/math/al_Random.hpp"
+#include "al/scene/al_DynamicScene.hpp"
+#include "al/sound/al_Dbap.hpp"
+#include "al/sound/al_Speaker.hpp"
+
+using namespace al;
+
+#define NUM_VOICES (512)
+#define NUM_CHANNELS (60)
+#define BLOCK_SIZE (512)
+#define NUM_BLOCKS (200)
+
+// A voice with a few oscillators, to give each voice some real work to do
+struct BenchmarkVoice : public PositionedVoice {
+  float mPhase{0.0f};
+  float mPhaseInc{0.0f};
+
+  void init() override {
+    mPhaseInc = float(2.0 * M_PI * rnd::uniform(880.0, 110.0) / 44100.0);
+  }
+
+  void onProcess(AudioIOData &io) override {
+    while (io()) {
+      float value = 0.0f;
+      for (int h = 1; h <= 8; h++) {
+        value += std::sin(mPhase * h) / h;
+      }
+      io.out(0) = value * 0.01f;
+      mPhase += mPhaseInc;
+      if (mPhase > 2.0 * M_PI) {
+        mPhase -= float(2.0 * M_PI);
+      }
+    }
+  }
+};
+
+double runBenchmark(int numThreads) {
+  AudioIOData audioData;
+  audioData.framesPerBuffer(BLOCK_SIZE);
+  audioData.framesPerSecond(44100);
+  audioData.channelsIn(0);
+  audioData.channelsOut(NUM_CHANNELS);
+
+  DynamicScene scene(numThreads);
+  scene.setAudioThreaded(numThreads > 0);
+  Speakers speakers = SpeakerRingLayout<NUM_CHANNELS>();
+  scene.setSpatializer<Dbap>(speakers);
+  scene.prepare(audioData);
+
+  for (int i = 0; i < NUM_VOICES; i++) {
+    auto *voice = scene.getVoice<BenchmarkVoice>();
+    voice->setPose(Pose(Vec3d(rnd::uniformS(8.0), rnd::uniformS(2.0),
+                              rnd::uniformS(8.0))));
+    scene.triggerOn(voice);
+  }
+
+  // Warm up and insert voices into the rendering chain
+  for (int i = 0; i < 10; i++) {
+    audioData.zeroOut();
+    scene.render(audioData);
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < NUM_BLOCKS; i++) {
+    audioData.zeroOut();
+    scene.render(audioData);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  scene.stopAudioThreads();
+  return std::chrono::duration<double, std::milli>(end - start).count() /
+         NUM_BLOCKS;
+}
+
+int main() {
+  int maxThreads = std::thread::hardware_concurrency();
+  if (maxThreads < 1) {
+    maxThreads = 1;
+  }
+  std::cout << NUM_VOICES << " voices, " << NUM_CHANNELS << " channels, "
+            << BLOCK_SIZE << " frames per block" << std::endl;
+  std::cout << "Block duration: " << 1000.0 * BLOCK_SIZE / 44100.0 << " ms"
+            << std::endl;
+
+  double singleThreadTime = runBenchmark(0);
+  std::cout << "1 thread : " << singleThreadTime << " ms per block"
+            << std::endl;
+  // Audio threads run in addition to the thread calling render()
+  for (int threads = 1; threads < maxThreads; threads++) {
+    double time = runBenchmark(threads);
+    std::cout << threads + 1 << " threads: " << time << " ms per block ("
+              << singleThreadTime / time << "x)" << std::endl;
+  }
+  return 0;
+}
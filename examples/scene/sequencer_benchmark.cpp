@@ -0,0 +1,129 @@
+// Benchmark for event scheduling in SynthSequencer
+//
+// Plays a sequence of one million short events and measures the time spent
+// sorting the sequence and dispatching events from the audio callback. Then
+// inserts events with addVoice() from several threads while rendering to
+// measure the insertion rate through the sequencer's lock free queue.
+//
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "al/io/al_AudioIOData.hpp"
+#include "al/math/al_Random.hpp"
+#include "al/scene/al_SynthSequencer.hpp"
+
+using namespace al;
+
+#define NUM_EVENTS (1000000)
+#define BLOCK_SIZE (512)
+#define SAMPLE_RATE (44100)
+#define NUM_INSERT_THREADS (4)
+#define EVENTS_PER_THREAD (100000)
+
+// Minimal voice so that dispatch dominates the measurement
+struct ClickVoice : public SynthVoice {
+  void init() override { createInternalTriggerParameter("amp", 0.1, 0, 1); }
+
+  void onProcess(AudioIOData &io) override {
+    float amp = getInternalParameterValue("amp");
+    while (io()) {
+      io.out(0) += amp;
+    }
+  }
+
+  void onTriggerOff() override { free(); }
+};
+
+double elapsedMs(std::chrono::high_resolution_clock::time_point start) {
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main() {
+  AudioIOData audioData;
+  audioData.framesPerBuffer(BLOCK_SIZE);
+  audioData.framesPerSecond(SAMPLE_RATE);
+  audioData.channelsIn(0);
+  audioData.channelsOut(2);
+
+  SynthSequencer sequencer(TimeMasterMode::TIME_MASTER_AUDIO);
+  sequencer.synth().registerSynthClass<ClickVoice>("ClickVoice");
+  sequencer.synth().allocatePolyphony<ClickVoice>(1024);
+
+  // Events are created in random order, spread over 100 seconds
+  const double sequenceDuration = 100.0;
+  std::vector<SynthSequencerEvent> events(NUM_EVENTS);
+  for (auto &event : events) {
+    event.type = SynthSequencerEvent::EVENT_PFIELDS;
+    event.startTime = rnd::uniform(sequenceDuration);
+    event.duration = 0.001;
+    event.fields.name = "ClickVoice";
+    event.fields.pFields = {0.1f};
+  }
+
+  auto start = std::chrono::high_resolution_clock::now();
+  sequencer.playEvents(std::move(events), 0.0);
+  double sortTime = elapsedMs(start);
+  std::cout << NUM_EVENTS << " events moved in and sorted in " << sortTime
+            << " ms" << std::endl;
+
+  int numBlocks = int(sequenceDuration * SAMPLE_RATE / BLOCK_SIZE) + 2;
+  start = std::chrono::high_resolution_clock::now();
+  for (int i = 0; i < numBlocks; i++) {
+    audioData.zeroOut();
+    sequencer.render(audioData);
+  }
+  double renderTime = elapsedMs(start);
+  std::cout << "Rendered " << numBlocks << " blocks in " << renderTime
+            << " ms (" << 1.0e6 * renderTime / NUM_EVENTS
+            << " ns per event including voice rendering)" << std::endl;
+  std::cout << "Average block: " << renderTime / numBlocks << " ms of "
+            << 1000.0 * BLOCK_SIZE / SAMPLE_RATE << " ms available"
+            << std::endl;
+
+  // Insert events from several threads while the audio thread renders. This
+  // includes allocating and initializing a voice for each event.
+  std::atomic<bool> inserting(true);
+  std::atomic<int> blocksRendered(0);
+  std::thread audioThread([&]() {
+    AudioIOData io;
+    io.framesPerBuffer(BLOCK_SIZE);
+    io.framesPerSecond(SAMPLE_RATE);
+    io.channelsIn(0);
+    io.channelsOut(2);
+    while (inserting) {
+      io.zeroOut();
+      sequencer.render(io);
+      blocksRendered++;
+    }
+  });
+
+  std::vector<std::thread> threads;
+  start = std::chrono::high_resolution_clock::now();
+  for (int t = 0; t < NUM_INSERT_THREADS; t++) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < EVENTS_PER_THREAD; i++) {
+        sequencer.add<ClickVoice>(rnd::uniform(1.0), 0.001);
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  double insertTime = elapsedMs(start);
+  inserting = false;
+  audioThread.join();
+  sequencer.stopSequence();
+
+  int numInserted = NUM_INSERT_THREADS * EVENTS_PER_THREAD;
+  std::cout << numInserted << " events inserted from " << NUM_INSERT_THREADS
+            << " threads in " << insertTime << " ms ("
+            << numInserted / insertTime / 1000.0
+            << " million events per second, " << blocksRendered
+            << " blocks rendered meanwhile)" << std::endl;
+  return 0;
+}
@@ -0,0 +1,73 @@
+// Benchmark for higher order Ambisonics encoding and decoding
+//
+// Encodes a number of moving sources to 7th order 3D Ambisonics and decodes
+// the result to 64 speakers spread evenly over a sphere. Reports the time
+// taken per block and the fraction of the block duration this represents.
+//
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "al/sound/al_Ambisonics.hpp"
+
+using namespace al;
+
+#define ORDER (7)
+#define NUM_SPEAKERS (64)
+#define NUM_SOURCES (16)
+#define BLOCK_SIZE (512)
+#define NUM_BLOCKS (500)
+#define SAMPLE_RATE (44100.0)
+
+int main() {
+  AmbiDecode decoder(3, ORDER, NUM_SPEAKERS, 1);
+  // Spread speakers over the sphere on a Fibonacci lattice
+  for (int i = 0; i < NUM_SPEAKERS; i++) {
+    float z = 1.0f - 2.0f * (i + 0.5f) / NUM_SPEAKERS;
+    float azimuth = std::fmod(i * 2.39996323f, float(2.0 * M_PI));
+    decoder.setSpeakerRadians(i, i, azimuth, std::asin(z));
+  }
+  AmbiEncode encoder(3, ORDER);
+
+  std::vector<float> input(BLOCK_SIZE);
+  for (int i = 0; i < BLOCK_SIZE; i++) {
+    input[i] = std::sin(i * 0.1f);
+  }
+  std::vector<float> ambiChans(encoder.channels() * BLOCK_SIZE);
+  std::vector<float> output(NUM_SPEAKERS * BLOCK_SIZE);
+
+  double encodeTime = 0.0;
+  double decodeTime = 0.0;
+  for (int block = 0; block < NUM_BLOCKS; block++) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::fill(ambiChans.begin(), ambiChans.end(), 0.0f);
+    for (int source = 0; source < NUM_SOURCES; source++) {
+      float angle = 0.01f * block + source;
+      encoder.direction(std::cos(angle), std::sin(angle),
+                        std::sin(0.3f * angle));
+      encoder.encode(ambiChans.data(), input.data(), BLOCK_SIZE);
+    }
+    auto mid = std::chrono::high_resolution_clock::now();
+    std::fill(output.begin(), output.end(), 0.0f);
+    decoder.decode(output.data(), ambiChans.data(), BLOCK_SIZE);
+    auto end = std::chrono::high_resolution_clock::now();
+    encodeTime +=
+        std::chrono::duration<double, std::micro>(mid - start).count();
+    decodeTime += std::chrono::duration<double, std::micro>(end - mid).count();
+  }
+  encodeTime /= NUM_BLOCKS;
+  decodeTime /= NUM_BLOCKS;
+
+  double blockTime = 1.0e6 * BLOCK_SIZE / SAMPLE_RATE;
+  std::cout << "Order " << ORDER << " (" << encoder.channels()
+            << " channels), " << NUM_SPEAKERS << " speakers, " << NUM_SOURCES
+            << " sources, " << BLOCK_SIZE << " frames per block" << std::endl;
+  std::cout << "Block duration: " << blockTime << " us" << std::endl;
+  std::cout << "Encode: " << encodeTime << " us per block ("
+            << 100.0 * encodeTime / blockTime << "%)" << std::endl;
+  std::cout << "Decode: " << decodeTime << " us per block ("
+            << 100.0 * decodeTime / blockTime << "%)" << std::endl;
+  return 0;
+}
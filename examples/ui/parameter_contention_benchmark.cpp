@@ -0,0 +1,121 @@
+// Benchmark for reading a ParameterPose while other threads write it
+//
+// A reader thread standing in for the audio thread calls get() in a loop
+// while N writer threads call set() as fast as they can. Reports read latency
+// percentiles and the number of torn values read, i.e. values mixing the
+// fields of two different writes. The mutex and cached value scheme
+// ParameterWrapper uses for types that are not read through a SeqLock is run
+// for comparison.
+//
+// Usage: parameter_contention_benchmark [max writers]
+//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "al/ui/al_Parameter.hpp"
+
+using namespace al;
+
+#define NUM_READS (1000000)
+
+// The try_lock() and cached value scheme from ParameterWrapper
+class MutexPose {
+public:
+  void set(const Pose &value) {
+    mValueCache = get();
+    std::lock_guard<std::mutex> lk(mMutex);
+    mValue = value;
+  }
+
+  Pose get() {
+    Pose current = mValueCache;
+    if (mMutex.try_lock()) {
+      current = mValue;
+      mMutex.unlock();
+    }
+    return current;
+  }
+
+private:
+  std::mutex mMutex;
+  Pose mValue;
+  Pose mValueCache;
+};
+
+// All fields of a written pose hold the same number
+Pose makePose(double value) {
+  return Pose(Vec3d(value, value, value), Quatd(value, value, value, value));
+}
+
+bool isTorn(const Pose &pose) {
+  const Vec3d &pos = pose.pos();
+  const Quatd &quat = pose.quat();
+  double value = pos.x;
+  return pos.y != value || pos.z != value || quat.w != value ||
+         quat.x != value || quat.y != value || quat.z != value;
+}
+
+template <class Param> void run(const char *name, int numWriters) {
+  Param param;
+  param.set(makePose(-1.0));
+  std::atomic<bool> running{true};
+  std::vector<std::thread> writers;
+  for (int i = 0; i < numWriters; i++) {
+    writers.emplace_back([&param, &running, i]() {
+      double value = i;
+      while (running.load(std::memory_order_relaxed)) {
+        param.set(makePose(value));
+        value += 1000.0;
+      }
+    });
+  }
+
+  std::vector<double> latencies(NUM_READS);
+  uint64_t torn = 0;
+  for (int i = 0; i < NUM_READS; i++) {
+    auto start = std::chrono::steady_clock::now();
+    Pose pose = param.get();
+    auto end = std::chrono::steady_clock::now();
+    latencies[i] =
+        std::chrono::duration<double, std::nano>(end - start).count();
+    if (isTorn(pose)) {
+      torn++;
+    }
+  }
+  running = false;
+  for (auto &writer : writers) {
+    writer.join();
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[size_t(p * (latencies.size() - 1))];
+  };
+  std::cout << name << ", " << numWriters
+            << " writers: p50 " << percentile(0.5) << " ns, p99 " << percentile(0.99) << " ns, p99.9 "
+            << percentile(0.999) << " ns, max " << latencies.back()
+            << " ns, torn reads " << torn << std::endl;
+}
+
+struct SeqLockPose : public ParameterPose {
+  SeqLockPose() : ParameterPose("pose") {}
+};
+
+int main(int argc, char *argv[]) {
+  int maxWriters = 4;
+  if (argc > 1) {
+    maxWriters = std::atoi(argv[1]);
+  }
+  for (int numWriters = 0; numWriters <= maxWriters; numWriters++) {
+    run<SeqLockPose>("ParameterPose", numWriters);
+    run<MutexPose>("Mutex and cache", numWriters);
+  }
+  return 0;
+}
@@ -0,0 +1,142 @@
+// Benchmark for recalling presets from a PresetBank and from preset files
+//
+// Stores NUM_PRESETS presets of NUM_PARAMETERS parameters both as text preset
+// files and in a single PresetBank file, then reports the time to open each
+// store and read its preset map, and the latency percentiles for loading
+// random presets. Preset files are parsed on every load, as PresetHandler
+// does the first time it recalls a preset. Also reports the time to replace a
+// single preset in the bank, which rewrites the whole file.
+//
+// Usage: preset_bank_benchmark [number of presets]
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "al/io/al_File.hpp"
+#include "al/ui/al_PresetBank.hpp"
+#include "al/ui/al_PresetHandler.hpp"
+
+using namespace al;
+
+#define NUM_PARAMETERS (100)
+#define NUM_LOADS (2000)
+
+typedef std::chrono::steady_clock SteadyClock;
+
+double elapsedMs(SteadyClock::time_point start) {
+  return std::chrono::duration<double, std::milli>(SteadyClock::now() -
+                                                   start)
+      .count();
+}
+
+PresetBank::ParameterStates makePreset(int number) {
+  PresetBank::ParameterStates values;
+  for (int i = 0; i < NUM_PARAMETERS; i++) {
+    std::string address = "/synth/voice" + std::to_string(i);
+    if (i % 10 == 0) {
+      values[address] = {float(number), float(i), float(number + i)};
+    } else {
+      values[address] = {float(number * NUM_PARAMETERS + i)};
+    }
+  }
+  return values;
+}
+
+template <class LoadFunction>
+void runLoads(const char *name, const std::vector<std::string> &names,
+              LoadFunction load) {
+  std::mt19937 random(1);
+  std::uniform_int_distribution<size_t> pick(0, names.size() - 1);
+  std::vector<double> latencies(NUM_LOADS);
+  for (int i = 0; i < NUM_LOADS; i++) {
+    const std::string &presetName = names[pick(random)];
+    auto start = SteadyClock::now();
+    PresetBank::ParameterStates values = load(presetName);
+    latencies[i] =
+        std::chrono::duration<double, std::micro>(SteadyClock::now() - start)
+            .count();
+    if (values.size() != NUM_PARAMETERS) {
+      std::cerr << "ERROR: Unexpected preset size" << std::endl;
+    }
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[size_t(p * (latencies.size() - 1))];
+  };
+  std::cout << name << " load: p50 " << percentile(0.5) << " us, p99 "
+            << percentile(0.99) << " us, max " << latencies.back() << " us"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  int numPresets = 10000;
+  if (argc > 1) {
+    numPresets = std::atoi(argv[1]);
+  }
+  std::string directory = "preset_bank_benchmark_data/";
+  std::string bankFile = "preset_bank_benchmark.bank";
+  File::remove(bankFile);
+  Dir::make(directory);
+
+  std::vector<std::string> names;
+  std::vector<PresetBank::Preset> presets;
+  std::map<int, std::string> presetsMap;
+  for (int i = 0; i < numPresets; i++) {
+    names.push_back("preset" + std::to_string(i));
+    presets.push_back({names.back(), i, makePreset(i)});
+    presetsMap[i] = names.back();
+  }
+
+  auto start = SteadyClock::now();
+  for (auto &preset : presets) {
+    PresetHandler::writePresetFile(directory + preset.name + ".preset",
+                                   preset.name, preset.values);
+  }
+  PresetHandler::writePresetMapFile(directory + "default.presetMap",
+                                    presetsMap);
+  std::cout << "Preset files: wrote " << numPresets << " presets in "
+            << elapsedMs(start) << " ms" << std::endl;
+
+  start = SteadyClock::now();
+  {
+    PresetBank bank(bankFile);
+    bank.store(presets);
+  }
+  std::cout << "Preset bank: wrote " << numPresets << " presets in "
+            << elapsedMs(start) << " ms, "
+            << MappedFile(bankFile).size() / 1024 << " KiB" << std::endl;
+  presets.clear();
+
+  start = SteadyClock::now();
+  auto fileMap =
+      PresetHandler::readPresetMapFile(directory + "default.presetMap");
+  std::cout << "Preset files: read preset map of " << fileMap.size()
+            << " presets in " << elapsedMs(start) << " ms" << std::endl;
+
+  start = SteadyClock::now();
+  PresetBank bank(bankFile);
+  auto bankMap = bank.presetMap();
+  std::cout << "Preset bank: opened and read preset map of " << bankMap.size()
+            << " presets in " << elapsedMs(start) << " ms" << std::endl;
+
+  runLoads("Preset files", names, [&](const std::string &presetName) {
+    return PresetHandler::readPresetFile(directory + presetName + ".preset");
+  });
+  runLoads("Preset bank", names, [&](const std::string &presetName) {
+    PresetBank::ParameterStates values;
+    bank.load(presetName, values);
+    return values;
+  });
+
+  start = SteadyClock::now();
+  bank.store(names[0], makePreset(-1));
+  std::cout << "Preset bank: replaced one preset in " << elapsedMs(start)
+            << " ms" << std::endl;
+  return 0;
+}
@@ -58,6 +58,10 @@ public:
     SocketReceiveMultiplexer();
     ~SocketReceiveMultiplexer();
 
+	// Largest datagram that can be received, larger ones are truncated.
+	// Only call before calling Run. Defaults to 4098 bytes.
+	void SetMaxPacketSize( int size );
+
 	// only call the attach/detach methods _before_ calling Run
 
     // only one listener per socket, each socket at most once
@@ -102,6 +106,22 @@ public:
 	// operating systems.
 	void SetAllowReuse( bool allowReuse );
 
+	// Size of the kernel receive buffer in bytes. Larger buffers absorb
+	// bursts of datagrams that arrive faster than they are read.
+	// Sets SO_RCVBUF.
+	void SetReceiveBufferSize( int size );
+
+	// Multicast options for sending. Interface addresses are in host byte
+	// order like IpEndpointName::address.
+	// Sets IP_MULTICAST_TTL, IP_MULTICAST_LOOP and IP_MULTICAST_IF.
+	void SetMulticastTTL( int ttl );
+	void SetMulticastLoopback( bool enableLoopback );
+	void SetMulticastInterface( unsigned long interfaceAddress );
+
+	// Receive datagrams sent to a multicast group on the given interface.
+	// Sets IP_ADD_MEMBERSHIP.
+	void JoinMulticastGroup( unsigned long groupAddress, unsigned long interfaceAddress );
+
 
 	// The socket is created in an unbound, unconnected state
 	// such a socket can only be used to send to an arbitrary
@@ -155,9 +175,12 @@ class UdpListeningReceiveSocket : public UdpSocket{
     SocketReceiveMultiplexer mux_;
     PacketListener *listener_;
 public:
-	UdpListeningReceiveSocket( const IpEndpointName& localEndpoint, PacketListener *listener )
+	UdpListeningReceiveSocket( const IpEndpointName& localEndpoint, PacketListener *listener,
+            bool allowReuse = false )
         : listener_( listener )
     {
+        if( allowReuse )
+            SetAllowReuse( true );
         Bind( localEndpoint );
         mux_.AttachSocketListener( this, listener_ );
     }
@@ -166,6 +189,7 @@ public:
         { mux_.DetachSocketListener( this, listener_ ); }
 
     // see SocketReceiveMultiplexer above for the behaviour of these methods...
+    void SetMaxPacketSize( int size ) { mux_.SetMaxPacketSize( size ); }
     void Run() { mux_.Run(); }
 	void RunUntilSigInt() { mux_.RunUntilSigInt(); }
     void Break() { mux_.Break(); }
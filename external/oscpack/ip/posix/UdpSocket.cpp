@@ -131,6 +131,40 @@ public:
 		setsockopt(socket_, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
 	}
 
+	void SetReceiveBufferSize( int size )
+	{
+		setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	}
+
+	void SetMulticastTTL( int ttl )
+	{
+		unsigned char value = (unsigned char)ttl;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof(value));
+	}
+
+	void SetMulticastLoopback( bool enableLoopback )
+	{
+		unsigned char loop = (enableLoopback) ? 1 : 0;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+	}
+
+	void SetMulticastInterface( unsigned long interfaceAddress )
+	{
+		struct in_addr addr;
+		addr.s_addr = htonl( interfaceAddress );
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_IF, &addr, sizeof(addr));
+	}
+
+	void JoinMulticastGroup( unsigned long groupAddress, unsigned long interfaceAddress )
+	{
+		struct ip_mreq request;
+		request.imr_multiaddr.s_addr = htonl( groupAddress );
+		request.imr_interface.s_addr = htonl( interfaceAddress );
+		if (setsockopt(socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0) {
+			throw std::runtime_error("unable to join multicast group\n");
+		}
+	}
+
 	void SetAllowReuse( bool allowReuse )
 	{
 		int reuseAddr = (allowReuse) ? 1 : 0; // int on posix
@@ -269,6 +303,31 @@ void UdpSocket::SetAllowReuse( bool allowReuse )
     impl_->SetAllowReuse( allowReuse );
 }
 
+void UdpSocket::SetReceiveBufferSize( int size )
+{
+    impl_->SetReceiveBufferSize( size );
+}
+
+void UdpSocket::SetMulticastTTL( int ttl )
+{
+    impl_->SetMulticastTTL( ttl );
+}
+
+void UdpSocket::SetMulticastLoopback( bool enableLoopback )
+{
+    impl_->SetMulticastLoopback( enableLoopback );
+}
+
+void UdpSocket::SetMulticastInterface( unsigned long interfaceAddress )
+{
+    impl_->SetMulticastInterface( interfaceAddress );
+}
+
+void UdpSocket::JoinMulticastGroup( unsigned long groupAddress, unsigned long interfaceAddress )
+{
+    impl_->JoinMulticastGroup( groupAddress, interfaceAddress );
+}
+
 IpEndpointName UdpSocket::LocalEndpointFor( const IpEndpointName& remoteEndpoint ) const
 {
 	return impl_->LocalEndpointFor( remoteEndpoint );
@@ -338,6 +397,7 @@ class SocketReceiveMultiplexer::Implementation{
 	std::vector< AttachedTimerListener > timerListeners_;
 
 	volatile bool break_;
+	int maxPacketSize_;
 	int breakPipe_[2]; // [0] is the reader descriptor and [1] the writer
 
 	double GetCurrentTimeMs() const
@@ -351,6 +411,7 @@ class SocketReceiveMultiplexer::Implementation{
 
 public:
     Implementation()
+		: maxPacketSize_( 4098 )
 	{
 		if( pipe(breakPipe_) != 0 )
 			throw std::runtime_error( "creation of asynchronous break pipes failed\n" );
@@ -362,6 +423,11 @@ public:
 		close( breakPipe_[1] );
 	}
 
+    void SetMaxPacketSize( int size )
+	{
+		maxPacketSize_ = size;
+	}
+
     void AttachSocketListener( UdpSocket *socket, PacketListener *listener )
 	{
 		assert( std::find( socketListeners_.begin(), socketListeners_.end(), std::make_pair(listener, socket) ) == socketListeners_.end() );
@@ -440,7 +506,7 @@ public:
                 timerQueue_.push_back( std::make_pair( currentTimeMs + i->initialDelayMs, *i ) );
             std::sort( timerQueue_.begin(), timerQueue_.end(), CompareScheduledTimerCalls );
 
-            const int MAX_BUFFER_SIZE = 4098;
+            const int MAX_BUFFER_SIZE = maxPacketSize_;
             data = new char[ MAX_BUFFER_SIZE ];
             IpEndpointName remoteEndpoint;
 
@@ -550,6 +616,11 @@ SocketReceiveMultiplexer::~SocketReceiveMultiplexer()
 	delete impl_;
 }
 
+void SocketReceiveMultiplexer::SetMaxPacketSize( int size )
+{
+	impl_->SetMaxPacketSize( size );
+}
+
 void SocketReceiveMultiplexer::AttachSocketListener( UdpSocket *socket, PacketListener *listener )
 {
 	impl_->AttachSocketListener( socket, listener );
@@ -36,6 +36,7 @@
 */
 
 #include <winsock2.h>   // this must come first to prevent errors with MSVC7
+#include <ws2tcpip.h>   // for ip_mreq
 #include <windows.h>
 #include <mmsystem.h>   // for timeGetTime()
 
@@ -127,6 +128,40 @@ public:
 		setsockopt(socket_, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
 	}
 
+	void SetReceiveBufferSize( int size )
+	{
+		setsockopt(socket_, SOL_SOCKET, SO_RCVBUF, (const char *)&size, sizeof(size));
+	}
+
+	void SetMulticastTTL( int ttl )
+	{
+		DWORD value = (DWORD)ttl;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_TTL, (const char *)&value, sizeof(value));
+	}
+
+	void SetMulticastLoopback( bool enableLoopback )
+	{
+		DWORD loop = (enableLoopback) ? 1 : 0;
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_LOOP, (const char *)&loop, sizeof(loop));
+	}
+
+	void SetMulticastInterface( unsigned long interfaceAddress )
+	{
+		struct in_addr addr;
+		addr.s_addr = htonl( interfaceAddress );
+		setsockopt(socket_, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&addr, sizeof(addr));
+	}
+
+	void JoinMulticastGroup( unsigned long groupAddress, unsigned long interfaceAddress )
+	{
+		struct ip_mreq request;
+		request.imr_multiaddr.s_addr = htonl( groupAddress );
+		request.imr_interface.s_addr = htonl( interfaceAddress );
+		if (setsockopt(socket_, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&request, sizeof(request)) != 0) {
+			throw std::runtime_error("unable to join multicast group\n");
+		}
+	}
+
 	void SetAllowReuse( bool allowReuse )
 	{
 		// Note: SO_REUSEADDR is non-deterministic for listening sockets on Win32. See MSDN article:
@@ -262,6 +297,31 @@ void UdpSocket::SetAllowReuse( bool allowReuse )
     impl_->SetAllowReuse( allowReuse );
 }
 
+void UdpSocket::SetReceiveBufferSize( int size )
+{
+    impl_->SetReceiveBufferSize( size );
+}
+
+void UdpSocket::SetMulticastTTL( int ttl )
+{
+    impl_->SetMulticastTTL( ttl );
+}
+
+void UdpSocket::SetMulticastLoopback( bool enableLoopback )
+{
+    impl_->SetMulticastLoopback( enableLoopback );
+}
+
+void UdpSocket::SetMulticastInterface( unsigned long interfaceAddress )
+{
+    impl_->SetMulticastInterface( interfaceAddress );
+}
+
+void UdpSocket::JoinMulticastGroup( unsigned long groupAddress, unsigned long interfaceAddress )
+{
+    impl_->JoinMulticastGroup( groupAddress, interfaceAddress );
+}
+
 IpEndpointName UdpSocket::LocalEndpointFor( const IpEndpointName& remoteEndpoint ) const
 {
 	return impl_->LocalEndpointFor( remoteEndpoint );
@@ -335,6 +395,7 @@ class SocketReceiveMultiplexer::Implementation{
 	std::vector< AttachedTimerListener > timerListeners_;
 
 	volatile bool break_;
+	int maxPacketSize_;
 	HANDLE breakEvent_;
 
 	double GetCurrentTimeMs() const
@@ -348,6 +409,7 @@ class SocketReceiveMultiplexer::Implementation{
 
 public:
     Implementation()
+		: maxPacketSize_( 4098 )
 	{
 		breakEvent_ = CreateEvent( NULL, FALSE, FALSE, NULL );
 	}
@@ -357,6 +419,11 @@ public:
 		CloseHandle( breakEvent_ );
 	}
 
+    void SetMaxPacketSize( int size )
+	{
+		maxPacketSize_ = size;
+	}
+
     void AttachSocketListener( UdpSocket *socket, PacketListener *listener )
 	{
 		assert( std::find( socketListeners_.begin(), socketListeners_.end(), std::make_pair(listener, socket) ) == socketListeners_.end() );
@@ -429,7 +496,7 @@ public:
 			timerQueue_.push_back( std::make_pair( currentTimeMs + i->initialDelayMs, *i ) );
 		std::sort( timerQueue_.begin(), timerQueue_.end(), CompareScheduledTimerCalls );
 
-		const int MAX_BUFFER_SIZE = 4098;
+		const int MAX_BUFFER_SIZE = maxPacketSize_;
 		char *data = new char[ MAX_BUFFER_SIZE ];
 		IpEndpointName remoteEndpoint;
 
@@ -515,6 +582,11 @@ SocketReceiveMultiplexer::~SocketReceiveMultiplexer()
 	delete impl_;
 }
 
+void SocketReceiveMultiplexer::SetMaxPacketSize( int size )
+{
+	impl_->SetMaxPacketSize( size );
+}
+
 void SocketReceiveMultiplexer::AttachSocketListener( UdpSocket *socket, PacketListener *listener )
 {
 	impl_->AttachSocketListener( socket, listener );
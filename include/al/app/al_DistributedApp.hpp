@@ -14,6 +14,7 @@
 #include "al/app/al_StateDistributionDomain.hpp"
 #include "al/io/al_Socket.hpp"
 #include "al/io/al_Toml.hpp"
+#include "al/protocol/al_ClusterSync.hpp"
 #include "al/scene/al_DistributedScene.hpp"
 #include "al/scene/al_DynamicScene.hpp"
 
@@ -62,6 +63,26 @@ broadcastAddress = "192.168.10.255"
   * The broadcast address is used for state sending and the node list sets the
   * role and capabilities of the application if the hostname matches one of the
   * nodes listed.
+  *
+  * State can be sent to a multicast group instead, so a single send reaches
+  * every replica:
+  *
+@code
+multicastGroup = "239.0.0.1"
+multicastInterface = "192.168.10.1" # Optional, system chosen by default
+multicastTTL = 1 # Optional
+multicastLoopback = true # Optional, replicas on the primary's machine
+@endcode
+  *
+  * Frames can be presented at the same time on all nodes. Replicas connect
+  * to the node with rank 0, which synchronizes their clocks and holds each
+  * frame until every replica has drawn it:
+  *
+@code
+frameSync = true
+frameSyncPort = 34460 # Optional
+frameSyncTimeout = 0.1 # Optional, longest wait for a node in seconds
+@endcode
   *
   * By default, if no configuration file is found, the application will be
   * primary if the primary port is available. if it is not, it will become a
@@ -92,10 +113,21 @@ public:
   Nav &nav() override;
   NavInputControl &navControl() override;
 
+  /// Frame synchronization on the primary. Provides statistics for each node.
+  ClusterSyncServer &frameSyncServer() { return mFrameSyncServer; }
+  /// Frame synchronization on replicas
+  ClusterSyncClient &frameSyncClient() { return mFrameSyncClient; }
+
   std::shared_ptr<GLFWOpenGLOmniRendererDomain> omniRendering;
   std::map<std::string, std::string> additionalConfig;
 
 private:
+  void startFrameSync();
+
+  ClusterSyncServer mFrameSyncServer;
+  ClusterSyncClient mFrameSyncClient;
+  std::string mPrimaryHost{"localhost"};
+
   AudioControl mAudioControl;
 
   bool initialized{false};
@@ -106,13 +138,14 @@ private:
 
 /**
  *
- * Provides a class to ditribute synchronous state. By default, OSC blobs are
- * used which are currently limited in size by the osc library, so it wil fail
- * even with small states. If cuttlebone is available through
- * al_ext/stateditribution you can have this app use cuttlebone instead.
+ * Provides a class to ditribute synchronous state. By default, the state is
+ * sent as OSC blobs split into packet sized fragments. If cuttlebone is
+ * available through al_ext/stateditribution you can have this app use
+ * cuttlebone instead.
  *
- * If you are feeling adventurous, you can modify oscpack to allow larger packet
- * buffer.
+ * On replicas, received states are swapped in rather than copied, so the
+ * object returned by state() changes between frames. Don't keep references
+ * to it across frames.
  *
  * Currently, the state simulation domain is injected as a subdomain of the
  * graphics domain i.e. it runs synchronously to graphics domain, calling
@@ -153,7 +186,18 @@ public:
         std::cout << "Running primary with state send" << std::endl;
         auto sender =
             distDomain->addStateSender("state", distDomain->statePtr());
-        sender->configure(10101, "state", additionalConfig["broadcastAddress"]);
+        if (additionalConfig.count("multicastGroup") > 0) {
+          sender->configure(10101, "state", additionalConfig["multicastGroup"]);
+          sender->setMulticastOptions(
+              additionalConfig.count("multicastTTL") > 0
+                  ? std::stoi(additionalConfig["multicastTTL"])
+                  : 1,
+              additionalConfig["multicastLoopback"] != "0",
+              additionalConfig["multicastInterface"]);
+        } else {
+          sender->configure(10101, "state",
+                            additionalConfig["broadcastAddress"]);
+        }
       } else {
         std::cout << "Not enabling state sending for primary." << std::endl;
       }
@@ -162,6 +206,10 @@ public:
       auto receiver =
           distDomain->addStateReceiver("state", distDomain->statePtr());
       receiver->configure(10101);
+      if (additionalConfig.count("multicastGroup") > 0) {
+        receiver->setMulticastGroup(additionalConfig["multicastGroup"],
+                                    additionalConfig["multicastInterface"]);
+      }
     }
     DistributedApp::start();
   }
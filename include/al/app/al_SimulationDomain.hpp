@@ -38,11 +38,13 @@ private:
 template <class TSharedState>
 class StateSimulationDomain : public SimulationDomain {
 public:
-  TSharedState &state() { return *mState; }
+  TSharedState &state() { return *std::atomic_load(&mState); }
 
-  std::shared_ptr<TSharedState> statePtr() { return mState; }
+  std::shared_ptr<TSharedState> statePtr() { return std::atomic_load(&mState); }
 
 protected:
+  // Replaced from the tick thread when states are received, so access it
+  // with std::atomic_load() and std::atomic_store()
   std::shared_ptr<TSharedState> mState{new TSharedState};
 };
 
@@ -1,7 +1,10 @@
 #ifndef STATEDISTRIBUTIONDOMAIN_H
 #define STATEDISTRIBUTIONDOMAIN_H
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
 #include <functional>
 #include <iostream>
@@ -60,6 +63,44 @@ protected:
 private:
 };
 
+/**
+ * @brief Wire format used by StateSendDomain and StateReceiveDomain
+ * @ingroup App
+ *
+ * Each state frame is sent as one or more "/_stateFrag" messages with type
+ * tags "siiiib": id, frame number, keyframe number, fragment index, fragment
+ * count and a blob. The blob holds records of a uint32_t byte offset into the
+ * state, a uint32_t byte count and the bytes themselves. Keyframes have equal
+ * frame and keyframe numbers and cover the whole state. Other frames hold
+ * only the byte ranges that differ from the keyframe they name.
+ */
+struct StateFragment {
+  static constexpr const char *address() { return "/_stateFrag"; }
+  static constexpr const char *typeTags() { return "siiiib"; }
+
+  /// Bytes used by a message besides the blob contents
+  static size_t overhead(const std::string &id) {
+    return 12 /* address */ + 8 /* type tags */ + ((id.size() + 4) & ~3) +
+           4 * 4 /* ints */ + 4 /* blob size */;
+  }
+
+  /// Bytes used by each record besides the state bytes
+  static const size_t recordHeaderSize = 2 * sizeof(uint32_t);
+
+  /// Largest datagram the receiving sockets accept
+  static const size_t maxPacketSize = 4096;
+};
+
+/**
+ * @brief Domain that receives state from StateSendDomain
+ * @ingroup App
+ *
+ * States are triple buffered. The network thread assembles incoming states
+ * in a free buffer and tick() swaps in the newest complete state without
+ * copying or locking. As a result the state object changes when a new state
+ * arrives, so state() must be queried again after each tick. Use
+ * registerStateChangeCallback() to follow the changes.
+ */
 template <class TSharedState = DefaultState>
 class StateReceiveDomain : public SynchronousDomain {
 public:
@@ -69,13 +110,23 @@ public:
     tickSubdomains(true);
 
     assert(mState); // State must have been set at this point
-    mRecvLock.lock();
-    if (newMessages > 0) {
-      mQueuedStates = newMessages;
-      std::memcpy(mState.get(), buf.get(), sizeof(TSharedState));
-      newMessages = 0;
+    if (mMiddle.load(std::memory_order_relaxed) & freshBit) {
+      uint8_t middle = mMiddle.exchange(mFront, std::memory_order_acq_rel);
+      mFront = middle & slotMask;
+      std::atomic_store(&mState, mSlots[mFront]);
+      for (auto &cb : mStateChangeCallbacks) {
+        cb(mSlots[mFront]);
+      }
     }
-    mRecvLock.unlock();
+    uint64_t received = mReceivedCount.load(std::memory_order_relaxed);
+    uint64_t dropped = mDroppedCount.load(std::memory_order_relaxed);
+    uint64_t late = mLateCount.load(std::memory_order_relaxed);
+    mQueuedStates = int(received - mLastReceivedCount);
+    mDroppedStates = int(dropped - mLastDroppedCount);
+    mLateStates = int(late - mLastLateCount);
+    mLastReceivedCount = received;
+    mLastDroppedCount = dropped;
+    mLastLateCount = late;
     tickSubdomains(false);
     return true;
   }
@@ -83,7 +134,10 @@ public:
   bool cleanup(ComputationDomain *parent = nullptr) override {
     cleanupSubdomains(true);
     mRecv = nullptr;
-    mState = nullptr;
+    std::atomic_store(&mState, std::shared_ptr<TSharedState>());
+    for (auto &slot : mSlots) {
+      slot = nullptr;
+    }
 
     //    std::cerr << "Not using Cuttlebone. Ignoring" << std::endl;
     cleanupSubdomains(false);
@@ -98,24 +152,63 @@ public:
     mPacketSize = packetSize;
   }
 
-  std::shared_ptr<TSharedState> state() { return mState; }
+  /// Current state. Changes when tick() takes in a new state.
+  std::shared_ptr<TSharedState> state() { return std::atomic_load(&mState); }
+
+  /// Set the initial state. Must be called before init().
+  void setStatePointer(std::shared_ptr<TSharedState> ptr) {
+    std::atomic_store(&mState, ptr);
+  }
+
+  /**
+   * @brief Receive state sent to a multicast group
+   * @param group Multicast group address, e.g. "239.0.0.1"
+   * @param interfaceAddress Address of network interface to join the group
+   * on. If empty, the system chooses the interface.
+   *
+   * Must be called before init(). The address set in configure() is ignored.
+   */
+  void setMulticastGroup(std::string group, std::string interfaceAddress = "") {
+    mMulticastGroup = group;
+    mMulticastInterface = interfaceAddress;
+  }
+
+  /// Called from tick() with the new state object when a state arrives
+  void registerStateChangeCallback(
+      std::function<void(std::shared_ptr<TSharedState>)> cb) {
+    mStateChangeCallbacks.push_back(cb);
+  }
 
-  void setStatePointer(std::shared_ptr<TSharedState> ptr) { mState = ptr; }
+  /// State handoff no longer requires locking. Kept for compatibility.
+  void lockState() {}
+  void unlockState() {}
 
-  void lockState() { mRecvLock.lock(); }
-  void unlockState() { mRecvLock.unlock(); }
+  /// Number of states completed between the last two ticks
   int newStates() { return mQueuedStates; }
 
+  /// Number of states between the last two ticks replaced by a newer state
+  /// before being taken in by tick()
+  int droppedStates() { return mDroppedStates; }
+
+  /// Number of states between the last two ticks discarded because they
+  /// were incomplete when a newer state arrived or arrived after it
+  int lateStates() { return mLateStates; }
+
   std::string id() const { return mId; }
 
   void setId(const std::string &id) { mId = id; }
 
 protected:
+  // Swapped by tick() while other threads may call state()
   std::shared_ptr<TSharedState> mState;
-  int mQueuedStates{1};
+  int mQueuedStates{0};
+  int mDroppedStates{0};
+  int mLateStates{0};
   std::string mAddress{"localhost"};
   uint16_t mPort = 10100;
   uint16_t mPacketSize = 1400;
+  std::string mMulticastGroup;
+  std::string mMulticastInterface;
 
 private:
   std::string mId;
@@ -125,17 +218,22 @@ private:
     StateReceiveDomain *mOscDomain;
     void onMessage(osc::Message &m) override {
       //      m.print();
-      if (m.addressPattern() == "/_state" && m.typeTags() == "sb") {
+      if (m.addressPattern() == StateFragment::address() &&
+          m.typeTags() == StateFragment::typeTags()) {
+        std::string id;
+        m >> id;
+        if (id == mOscDomain->mId) {
+          mOscDomain->receiveFragment(m);
+        }
+      } else if (m.addressPattern() == "/_state" && m.typeTags() == "sb") {
         std::string id;
         m >> id;
         if (id == mOscDomain->mId) {
           osc::Blob inBlob;
           m >> inBlob;
           if (sizeof(TSharedState) == inBlob.size) {
-            mOscDomain->mRecvLock.lock();
-            memcpy(mOscDomain->buf.get(), inBlob.data, sizeof(TSharedState));
-            mOscDomain->newMessages++;
-            mOscDomain->mRecvLock.unlock();
+            memcpy(mOscDomain->backSlot(), inBlob.data, sizeof(TSharedState));
+            mOscDomain->publishBackSlot();
           } else {
             std::cerr << "ERROR: received state size mismatch" << std::endl;
           }
@@ -144,24 +242,158 @@ private:
     }
   } mHandler;
 
-  std::unique_ptr<unsigned char[]> buf;
-
-  uint16_t newMessages = 0;
-  std::mutex mRecvLock;
   std::unique_ptr<osc::Recv> mRecv;
+
+  // Triple buffer. The front slot is owned by tick(), the back slot by the
+  // network thread. mMiddle holds the index of the remaining slot and
+  // freshBit when it holds a state tick() has not taken in yet.
+  static const uint8_t slotMask = 3;
+  static const uint8_t freshBit = 4;
+  std::shared_ptr<TSharedState> mSlots[3];
+  uint8_t mFront{0};
+  uint8_t mBack{2};
+  std::atomic<uint8_t> mMiddle{1};
+
+  std::atomic<uint64_t> mReceivedCount{0};
+  std::atomic<uint64_t> mDroppedCount{0};
+  std::atomic<uint64_t> mLateCount{0};
+  uint64_t mLastReceivedCount{0};
+  uint64_t mLastDroppedCount{0};
+  uint64_t mLastLateCount{0};
+
+  std::vector<std::function<void(std::shared_ptr<TSharedState>)>>
+      mStateChangeCallbacks;
+
+  unsigned char *backSlot() {
+    return reinterpret_cast<unsigned char *>(mSlots[mBack].get());
+  }
+
+  void publishBackSlot() {
+    uint8_t previous =
+        mMiddle.exchange(mBack | freshBit, std::memory_order_acq_rel);
+    if (previous & freshBit) {
+      mDroppedCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    mBack = previous & slotMask;
+    mReceivedCount.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Frame reassembly. Only accessed from the network thread.
+  std::unique_ptr<unsigned char[]> mKeyframe;
+  std::vector<bool> mFragmentsReceived;
+  int mFragmentsPending{0};
+  int32_t mAssemblyFrame{0};
+  int32_t mAssemblyKeyframe{0};
+  int32_t mLastFrame{0};
+  int32_t mKeyframeNumber{0};
+  bool mAssembling{false};
+  bool mHasFrame{false};
+  bool mHasKeyframe{false};
+
+  void receiveFragment(osc::Message &m);
 };
 
+template <class TSharedState>
+void StateReceiveDomain<TSharedState>::receiveFragment(osc::Message &m) {
+  int frame, keyframe, index, count;
+  osc::Blob blob;
+  m >> frame >> keyframe >> index >> count >> blob;
+  if (count <= 0 || index < 0 || index >= count) {
+    return;
+  }
+  if (!mAssembling || frame != mAssemblyFrame) {
+    // Fragments of frames older than the newest one seen are late. A frame
+    // far in the past means the sender has restarted.
+    int32_t age = int32_t(uint32_t(mLastFrame) - uint32_t(frame));
+    if (mHasFrame && age >= 0 && age < 1024) {
+      if (age > 0 && index == 0) {
+        mLateCount.fetch_add(1, std::memory_order_relaxed);
+      }
+      return;
+    }
+    if (mAssembling) { // Previous frame never completed
+      mLateCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    mHasFrame = true;
+    mLastFrame = frame;
+    mAssembling = false;
+    if (frame != keyframe) {
+      if (!mHasKeyframe || keyframe != mKeyframeNumber) {
+        return; // Wait for the next keyframe
+      }
+      std::memcpy(backSlot(), mKeyframe.get(), sizeof(TSharedState));
+    }
+    mAssembling = true;
+    mAssemblyFrame = frame;
+    mAssemblyKeyframe = keyframe;
+    mFragmentsReceived.assign(size_t(count), false);
+    mFragmentsPending = count;
+  }
+  if (size_t(count) != mFragmentsReceived.size() ||
+      mFragmentsReceived[size_t(index)]) {
+    return;
+  }
+  const unsigned char *data = static_cast<const unsigned char *>(blob.data);
+  size_t position = 0;
+  while (position + StateFragment::recordHeaderSize <= blob.size) {
+    uint32_t offset, size;
+    std::memcpy(&offset, data + position, sizeof(offset));
+    std::memcpy(&size, data + position + sizeof(offset), sizeof(size));
+    position += StateFragment::recordHeaderSize;
+    if (size > blob.size - position || offset > sizeof(TSharedState) ||
+        size > sizeof(TSharedState) - offset) {
+      std::cerr << "ERROR: corrupt state fragment" << std::endl;
+      mAssembling = false;
+      return;
+    }
+    std::memcpy(backSlot() + offset, data + position, size);
+    position += size;
+  }
+  mFragmentsReceived[size_t(index)] = true;
+  if (--mFragmentsPending > 0) {
+    return;
+  }
+  mAssembling = false;
+  if (mAssemblyFrame == mAssemblyKeyframe) {
+    std::memcpy(mKeyframe.get(), backSlot(), sizeof(TSharedState));
+    mKeyframeNumber = mAssemblyKeyframe;
+    mHasKeyframe = true;
+  }
+  publishBackSlot();
+}
+
 template <class TSharedState>
 bool StateReceiveDomain<TSharedState>::init(ComputationDomain *parent) {
   initializeSubdomains(true);
   assert(parent != nullptr);
 
-  buf = std::make_unique<unsigned char[]>(sizeof(TSharedState));
+  if (!mState) {
+    mState = std::make_shared<TSharedState>();
+  }
+  // The initial state is the front slot
+  mSlots[0] = mState;
+  mSlots[1] = std::make_shared<TSharedState>(*mState);
+  mSlots[2] = std::make_shared<TSharedState>(*mState);
+  mFront = 0;
+  mMiddle = 1;
+  mBack = 2;
+  mKeyframe = std::make_unique<unsigned char[]>(sizeof(TSharedState));
+  mHasFrame = false;
+  mHasKeyframe = false;
+  mAssembling = false;
   mRecv = std::make_unique<osc::Recv>();
-  if (!mRecv || !mRecv->open(mPort, mAddress.c_str())) {
+  bool opened =
+      mMulticastGroup.size() > 0
+          ? mRecv->openMulticast(mPort, mMulticastGroup.c_str(),
+                                 mMulticastInterface.c_str())
+          : mRecv->open(mPort, mAddress.c_str());
+  if (!opened) {
     std::cerr << "Error opening server" << std::endl;
     return false;
   }
+  // Room for a few frames of fragments arriving in a burst
+  mRecv->socketBufferSize(
+      int(std::max(sizeof(TSharedState) * 4, size_t(1) << 20)));
   mHandler.mOscDomain = this;
   mRecv->handler(mHandler);
   if (!mRecv->start()) {
@@ -169,17 +401,26 @@ bool StateReceiveDomain<TSharedState>::init(ComputationDomain *parent) {
     return false;
   }
 
-  std::cout << "Opened " << mAddress << ":" << mPort << std::endl;
+  std::cout << "Opened " << mRecv->address() << ":" << mPort << std::endl;
   initializeSubdomains(false);
   return true;
 }
 
+/**
+ * @brief Domain that sends state to StateReceiveDomain
+ * @ingroup App
+ *
+ * The state is split into fragments no larger than the configured packet
+ * size, so states of any size can be sent. In delta mode only the parts of
+ * the state that differ from the last keyframe are sent. Keyframes are sent
+ * periodically, so receivers that missed a keyframe recover.
+ */
 template <class TSharedState = DefaultState>
 class StateSendDomain : public SynchronousDomain {
 public:
   bool init(ComputationDomain *parent = nullptr) override {
     initializeSubdomains(true);
-
+    mFramesSinceKeyframe = mKeyframeInterval;
     initializeSubdomains(false);
     return true;
   }
@@ -188,17 +429,24 @@ public:
     tickSubdomains(true);
 
     assert(mState); // State must have been set at this point
-    //    assert(mSend);
-
-    //    osc::Blob b(&mState, sizeof(mState));
-    //    mSend->send("/_state", b);
 
     mStateLock.lock();
-    osc::Blob b(mState.get(), sizeof(TSharedState));
-    osc::Send s(mPort, mAddress.c_str());
-    //    std::cout << mAddress << ":" << mPort << std::endl;
-    s.send("/_state", mId, b);
-
+    if (!mSend) {
+      // The socket is kept open until the address changes
+      mSend = std::make_unique<osc::Send>(int(mPacketSize));
+      if (!mSend->open(mPort, mAddress.c_str())) {
+        mSend = nullptr;
+      } else if (mMulticast) {
+        mSend->multicastTTL(mMulticastTTL);
+        mSend->multicastLoopback(mMulticastLoopback);
+        if (mMulticastInterface.size() > 0) {
+          mSend->multicastInterface(mMulticastInterface.c_str());
+        }
+      }
+    }
+    if (mSend) {
+      sendState();
+    }
     mStateLock.unlock();
 
     tickSubdomains(false);
@@ -207,6 +455,7 @@ public:
 
   bool cleanup(ComputationDomain *parent = nullptr) override {
     cleanupSubdomains(true);
+    mSend = nullptr;
     mState = nullptr;
     //    std::cerr << "Not using Cuttlebone. Ignoring" << std::endl;
     cleanupSubdomains(false);
@@ -216,10 +465,45 @@ public:
   void configure(uint16_t port, std::string id = "state",
                  std::string address = "localhost",
                  uint16_t packetSize = 1400) {
+    std::unique_lock<std::mutex> lk(mStateLock);
     mPort = port;
     mId = id;
     mAddress = address;
-    mPacketSize = packetSize;
+    mPacketSize = std::min(packetSize, uint16_t(StateFragment::maxPacketSize));
+    mSend = nullptr;
+  }
+
+  /**
+   * @brief Send only the bytes that changed since the last keyframe
+   * @param deltaMode
+   * @param keyframeInterval number of frames between full keyframes
+   *
+   * Frames where most of the state has changed are sent as keyframes.
+   */
+  void setDeltaMode(bool deltaMode, unsigned int keyframeInterval = 60) {
+    std::unique_lock<std::mutex> lk(mStateLock);
+    mDeltaMode = deltaMode;
+    mKeyframeInterval = std::max(keyframeInterval, 1u);
+    mFramesSinceKeyframe = mKeyframeInterval;
+  }
+
+  bool deltaMode() const { return mDeltaMode; }
+
+  /**
+   * @brief Set multicast options, used when the address is a multicast group
+   * @param ttl Number of router hops packets can travel
+   * @param loopback Whether receivers on this machine get the state
+   * @param interfaceAddress Address of network interface to send from. If
+   * empty, the system chooses the interface.
+   */
+  void setMulticastOptions(int ttl = 1, bool loopback = true,
+                           std::string interfaceAddress = "") {
+    std::unique_lock<std::mutex> lk(mStateLock);
+    mMulticast = true;
+    mMulticastTTL = ttl;
+    mMulticastLoopback = loopback;
+    mMulticastInterface = interfaceAddress;
+    mSend = nullptr;
   }
 
   std::shared_ptr<TSharedState> state() { return mState; }
@@ -239,7 +523,11 @@ public:
 
   void setId(const std::string &id) { mId = id; }
 
-  void setAddress(std::string address) { mAddress = address; };
+  void setAddress(std::string address) {
+    std::unique_lock<std::mutex> lk(mStateLock);
+    mAddress = address;
+    mSend = nullptr;
+  };
 
 protected:
   std::shared_ptr<TSharedState> mState;
@@ -253,8 +541,123 @@ private:
   std::unique_ptr<osc::Send> mSend;
 
   std::string mId = "";
+
+  struct StateRange {
+    uint32_t offset;
+    uint32_t size;
+  };
+
+  bool mMulticast{false};
+  int mMulticastTTL{1};
+  bool mMulticastLoopback{true};
+  std::string mMulticastInterface;
+
+  bool mDeltaMode{false};
+  unsigned int mKeyframeInterval{60};
+  unsigned int mFramesSinceKeyframe{0};
+  int32_t mFrame{0};
+  int32_t mKeyframeNumber{0};
+  std::unique_ptr<unsigned char[]> mKeyframe;
+  // Reused across frames to avoid allocating while sending
+  std::vector<StateRange> mRanges;
+  std::vector<std::vector<unsigned char>> mFragments;
+
+  // Must be called with mStateLock held
+  void sendState();
 };
 
+template <class TSharedState>
+void StateSendDomain<TSharedState>::sendState() {
+  const unsigned char *state =
+      reinterpret_cast<const unsigned char *>(mState.get());
+  const size_t stateSize = sizeof(TSharedState);
+  bool keyframe = !mDeltaMode || !mKeyframe ||
+                  mFramesSinceKeyframe >= mKeyframeInterval;
+  mRanges.clear();
+  if (!keyframe) {
+    // Compare in blocks, merging adjacent dirty blocks into one range
+    const size_t blockSize = 64;
+    size_t dirtyBytes = 0;
+    for (size_t offset = 0; offset < stateSize; offset += blockSize) {
+      size_t size = std::min(blockSize, stateSize - offset);
+      if (std::memcmp(state + offset, mKeyframe.get() + offset, size) != 0) {
+        if (mRanges.size() > 0 &&
+            mRanges.back().offset + mRanges.back().size == offset) {
+          mRanges.back().size += uint32_t(size);
+        } else {
+          mRanges.push_back({uint32_t(offset), uint32_t(size)});
+        }
+        dirtyBytes += size;
+      }
+    }
+    keyframe = dirtyBytes > stateSize / 2;
+  }
+  if (keyframe) {
+    mRanges.clear();
+    mRanges.push_back({0, uint32_t(stateSize)});
+    mKeyframeNumber = mFrame;
+    mFramesSinceKeyframe = 0;
+    if (mDeltaMode) {
+      if (!mKeyframe) {
+        mKeyframe = std::make_unique<unsigned char[]>(stateSize);
+      }
+      std::memcpy(mKeyframe.get(), state, stateSize);
+    }
+  }
+
+  size_t overhead = StateFragment::overhead(mId);
+  // Blobs are padded to a multiple of 4 bytes, so a payload rounded up could
+  // overflow the send buffer and the fragment would not be sent
+  size_t payloadSize =
+      mPacketSize > overhead ? (mPacketSize - overhead) & ~size_t(3) : 0;
+  if (payloadSize <= StateFragment::recordHeaderSize) {
+    std::cerr << "ERROR: state packet size too small" << std::endl;
+    return;
+  }
+  size_t fragmentCount = 1;
+  if (mFragments.size() == 0) {
+    mFragments.resize(1);
+  }
+  mFragments[0].clear();
+  for (auto range : mRanges) {
+    while (range.size > 0) {
+      auto *fragment = &mFragments[fragmentCount - 1];
+      if (fragment->size() + StateFragment::recordHeaderSize >= payloadSize) {
+        fragmentCount++;
+        if (mFragments.size() < fragmentCount) {
+          mFragments.resize(fragmentCount);
+        }
+        fragment = &mFragments[fragmentCount - 1];
+        fragment->clear();
+      }
+      uint32_t size = uint32_t(std::min<size_t>(
+          range.size, payloadSize - fragment->size() -
+                          StateFragment::recordHeaderSize));
+      const unsigned char *header[2] = {
+          reinterpret_cast<const unsigned char *>(&range.offset),
+          reinterpret_cast<const unsigned char *>(&size)};
+      fragment->insert(fragment->end(), header[0], header[0] + 4);
+      fragment->insert(fragment->end(), header[1], header[1] + 4);
+      fragment->insert(fragment->end(), state + range.offset,
+                       state + range.offset + size);
+      range.offset += size;
+      range.size -= size;
+    }
+  }
+
+  // Frames without changes are still sent so receivers count them
+  for (size_t i = 0; i < fragmentCount; i++) {
+    mSend->beginMessage(StateFragment::address());
+    *mSend << mId << int(mFrame) << int(mKeyframeNumber) << int(i)
+           << int(fragmentCount)
+           << osc::Blob(mFragments[i].data(), mFragments[i].size());
+    mSend->endMessage();
+    mSend->send();
+  }
+  mFrame++;
+  mFramesSinceKeyframe++;
+}
+
 template <class TSharedState>
 std::shared_ptr<StateSendDomain<TSharedState>>
 StateDistributionDomain<TSharedState>::addStateSender(
@@ -275,6 +678,13 @@ StateDistributionDomain<TSharedState>::addStateReceiver(
       this->template newSubDomain<StateReceiveDomain<TSharedState>>(true);
   newDomain->setId(id);
   newDomain->setStatePointer(statePtr);
+  if (statePtr == this->statePtr()) {
+    // Received states are swapped in rather than copied
+    newDomain->registerStateChangeCallback(
+        [this](std::shared_ptr<TSharedState> state) {
+          std::atomic_store(&this->mState, state);
+        });
+  }
   mSendRecvDomains.push_back(newDomain);
   return newDomain;
 }
@@ -49,6 +49,7 @@
 #include <stdio.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <iostream>
 #include <list>
@@ -353,6 +354,29 @@ public:
   static bool searchBack(std::string &path, int maxDepth = 6);
 
   static al_sec modificationTime(const char *path);
+
+  /// Modification time and size of a file, compared to tell if it changed
+  struct Stamp {
+    int64_t modified{0}; ///< Nanoseconds since the Unix epoch
+    int64_t size{-1};    ///< -1 if the file does not exist
+
+    bool operator==(const Stamp &other) const {
+      return modified == other.modified && size == other.size;
+    }
+    bool operator!=(const Stamp &other) const { return !(*this == other); }
+  };
+
+  /// Get the modification time with the file system's full resolution
+  static Stamp stamp(const std::string &path);
+
+  /// Replace the contents of a file atomically
+
+  /// The data is written and flushed to a temporary file next to path, which
+  /// is then renamed over path. Readers see either the old or the new
+  /// contents, even if the process is interrupted.
+  /// \returns whether the file was written
+  static bool writeAtomic(const std::string &path, const char *data,
+                          size_t size);
   // TODO: Implement these.
   // static al_sec modified(const std::string& path){ return
   // File(path).modified(); } static al_sec accessed(const std::string& path){
@@ -391,6 +415,49 @@ private:
   static std::mutex mDirectoryLock; // Protects all instances of PushDirectory
 };
 
+/// Read only memory mapping of a file
+
+/// Pages are loaded by the operating system as they are accessed, so large
+/// files can be used without reading them into memory first. The mapping is
+/// released when the object is destroyed.
+///
+/// @ingroup IO
+class MappedFile {
+public:
+  MappedFile() {}
+
+  /// @param[in] path	path of file to map
+  MappedFile(const std::string &path) { open(path); }
+
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /// Map a file, releasing any previous mapping
+
+  /// \returns false if the file could not be opened or mapped, or is empty
+  bool open(const std::string &path);
+
+  /// Release mapping
+  void close();
+
+  /// Whether a file is currently mapped
+  bool opened() const { return mData != nullptr; }
+
+  /// Pointer to start of mapped contents
+  const char *data() const { return mData; }
+
+  /// Size of mapped contents in bytes
+  size_t size() const { return mSize; }
+
+private:
+  const char *mData{nullptr};
+  size_t mSize{0};
+  void *mFileHandle{nullptr};    // Windows only
+  void *mMappingHandle{nullptr}; // Windows only
+};
+
 /// Filesystem directory
 ///
 /// @ingroup IO
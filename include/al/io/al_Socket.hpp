@@ -45,6 +45,7 @@
         Lance Putnam, 2010, putnam.lance@gmail.com
 */
 
+#include <cstdint>
 #include <string>
 
 #include "al/system/al_Time.hpp"
@@ -98,6 +99,9 @@ public:
   /// Returns whether socket is open
   bool opened() const;
 
+  /// Native socket handle, for use with select() or epoll. -1 if not open.
+  intptr_t handle() const;
+
   /// Get IP address string
   const std::string &address() const;
 
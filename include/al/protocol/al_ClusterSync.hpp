@@ -0,0 +1,260 @@
+#ifndef INCLUDE_AL_CLUSTERSYNC_HPP
+#define INCLUDE_AL_CLUSTERSYNC_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Clock synchronization and frame barrier for render clusters.
+*/
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/protocol/al_CommandConnection.hpp"
+
+namespace al {
+
+/**
+ * @brief Estimates offset and drift of a remote clock
+ * @ingroup allocore
+ *
+ * Samples come from round trips: the local time a request was sent, the
+ * remote time it was answered and the local time the answer arrived. The
+ * remote time is assumed to be taken halfway through the round trip. Samples
+ * with the shortest round trips in the window are fitted with a line, so
+ * drift is estimated once the samples span more than a second.
+ */
+class ClockEstimator {
+public:
+  ClockEstimator(size_t windowSize = 64) : mWindowSize(windowSize) {}
+
+  void addSample(al_sec localSend, al_sec remote, al_sec localReceive);
+
+  /// Remote time minus local time at localTime
+  al_sec offset(al_sec localTime) const {
+    return mOffset + mDrift * (localTime - mReferenceTime);
+  }
+
+  /// Remote time minus local time at the reference time
+  al_sec offset() const { return mOffset; }
+
+  /// Rate difference of the remote clock, in seconds per second
+  double drift() const { return mDrift; }
+
+  /// Local time at which offset() applies
+  al_sec referenceTime() const { return mReferenceTime; }
+
+  /// Shortest round trip in the window. Half of it bounds the offset error.
+  al_sec roundTrip() const { return mRoundTrip; }
+
+  size_t samples() const { return mSamples.size(); }
+
+  al_sec toRemote(al_sec localTime) const {
+    return localTime + offset(localTime);
+  }
+
+  al_sec toLocal(al_sec remoteTime) const {
+    return (remoteTime - mOffset + mDrift * mReferenceTime) / (1.0 + mDrift);
+  }
+
+  void reset() {
+    mSamples.clear();
+    mOffset = mDrift = mReferenceTime = mRoundTrip = 0;
+  }
+
+private:
+  struct Sample {
+    al_sec time; // Local time halfway through the round trip
+    al_sec offset;
+    al_sec roundTrip;
+  };
+
+  size_t mWindowSize;
+  std::vector<Sample> mSamples;
+  al_sec mOffset{0};
+  double mDrift{0};
+  al_sec mReferenceTime{0};
+  al_sec mRoundTrip{0};
+};
+
+/// Synchronization state of a node, as seen by the ClusterSyncServer
+struct NodeSyncStats {
+  std::string address;
+  uint16_t port;
+  al_sec offset;    ///< Node clock minus server clock
+  double drift;     ///< Seconds per second
+  al_sec roundTrip; ///< Shortest recent round trip
+  size_t samples;
+  uint64_t readyFrame; ///< Last frame the node reached
+};
+
+/**
+ * @brief Reference clock and frame barrier for ClusterSyncClient nodes
+ * @ingroup allocore
+ *
+ * Pings the nodes periodically, estimates each node's clock offset and drift
+ * and sends the estimates back so nodes can convert server time to their own
+ * clock. Call frameBarrier() once per frame before presenting it. It waits
+ * for all nodes to reach the frame and tells them to present it at the same
+ * server time.
+ *
+ * Subclasses that override processIncomingMessage() must pass messages they
+ * don't handle to ClusterSyncServer::processIncomingMessage().
+ */
+class ClusterSyncServer : public CommandServer {
+public:
+  ~ClusterSyncServer();
+
+  bool start(uint16_t serverPort = 34460,
+             const char *serverAddr = "0.0.0.0") override;
+  void stop() override;
+
+  /// Time between pings once nodes are synchronized
+  void syncInterval(al_sec interval) { mSyncInterval = interval; }
+
+  /**
+   * @brief Set time between releasing the barrier and presenting the frame
+   *
+   * It must cover sending the release to the nodes. If negative, the default,
+   * the longest round trip to a node plus 1 ms is used.
+   */
+  void presentDelay(al_sec delay) { mPresentDelay = delay; }
+
+  /**
+   * @brief Wait for all nodes to reach the next frame
+   * @param timeout maximum time to wait for nodes
+   * @return false if some nodes did not reach the frame in time
+   *
+   * Returns at the time the frame should be presented on all nodes.
+   */
+  bool frameBarrier(al_sec timeout = 0.1);
+
+  /// Last frame released by frameBarrier()
+  uint64_t frame() const { return mFrame; }
+
+  /// Number of calls to frameBarrier() that timed out
+  uint64_t barrierTimeouts() const { return mBarrierTimeouts; }
+
+  std::vector<NodeSyncStats> stats();
+
+  bool processIncomingMessage(Message &message, Socket *src) override;
+
+protected:
+  void onConnection(Socket *newConnection) override;
+  void onPong(Socket *src, al_sec sendTime, al_sec remoteTime,
+              al_sec receiveTime) override;
+
+private:
+  struct Node {
+    ClockEstimator clock;
+    uint64_t readyFrame{0};
+    bool ready{false};
+  };
+
+  void syncLoop();
+  void sendEstimates();
+
+  std::mutex mSyncLock; // Protects mNodes
+  std::condition_variable mSyncCondition;
+  std::map<Socket *, Node> mNodes;
+  std::thread mSyncThread;
+  bool mSyncRunning{false};
+  al_sec mSyncInterval{0.25};
+  al_sec mPresentDelay{-1};
+  uint64_t mFrame{0};
+  uint64_t mBarrierTimeouts{0};
+};
+
+/**
+ * @brief Render node side of ClusterSyncServer
+ * @ingroup allocore
+ *
+ * Subclasses that override processIncomingMessage() must pass messages they
+ * don't handle to ClusterSyncClient::processIncomingMessage().
+ */
+class ClusterSyncClient : public CommandClient {
+public:
+  ~ClusterSyncClient();
+
+  bool start(uint16_t serverPort = 34460,
+             const char *serverAddr = "localhost") override;
+
+  /**
+   * @brief Report reaching the next frame and wait for its presentation time
+   * @param timeout maximum time to wait for the server
+   * @return false if the server did not release the frame in time
+   */
+  bool frameBarrier(al_sec timeout = 0.1);
+
+  /// Last frame released by the server
+  uint64_t frame();
+
+  /// Estimated server time at localTime()
+  al_sec serverTime();
+
+  /// This node's clock minus the server clock, estimated by the server
+  al_sec offset();
+
+  /// Rate difference of this node's clock, in seconds per second
+  double drift();
+
+  /// How late the last frame was presented relative to its target time
+  al_sec lastLateness() { return mLastLateness; }
+
+  bool processIncomingMessage(Message &message, Socket *src) override;
+
+private:
+  std::mutex mSyncLock;
+  std::condition_variable mSyncCondition;
+  // Maps server time to local time
+  al_sec mOffset{0};
+  double mDrift{0};
+  al_sec mReferenceTime{0};
+
+  bool mHaveFrame{false};
+  uint64_t mFrame{0};
+  al_sec mPresentTime{0};
+  al_sec mLastLateness{0};
+};
+
+} // namespace al
+
+#endif // INCLUDE_AL_CLUSTERSYNC_HPP
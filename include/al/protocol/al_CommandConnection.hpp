@@ -46,6 +46,7 @@
         Keehong Youn, 2017, younkeehong@gmail.com
 */
 
+#include <atomic>
 #include <cinttypes>
 #include <condition_variable>
 #include <iostream>
@@ -137,6 +138,21 @@ private:
   size_t mReadIndex{0};
 };
 
+/**
+ * @brief Base class for TCP command connections
+ *
+ * Messages are sent with sendMessage() and delivered to
+ * processIncomingMessage(). On the wire, each message is prefixed by its
+ * length as a little endian uint32, so messages always arrive whole, one per
+ * call to processIncomingMessage(). Writing to the sockets directly bypasses
+ * this framing and is not supported.
+ *
+ * All sockets are serviced by a single thread, using epoll on Linux and
+ * select elsewhere. processIncomingMessage() and onConnection() are called
+ * from this thread. Subclasses that override them must call stop() in their
+ * destructor, so the thread is not left calling into a partly destroyed
+ * object.
+ */
 class CommandConnection {
 public:
   typedef enum {
@@ -147,9 +163,15 @@ public:
     PING,
     PONG,
     COMMAND_QUIT,
+    CLOCK_ESTIMATE,
+    FRAME_READY,
+    FRAME_GO,
     COMMAND_LAST_INTERNAL = 32,
   } InternalCommands;
 
+  CommandConnection();
+  virtual ~CommandConnection();
+
   virtual bool start(uint16_t port, const char *addr) = 0;
   virtual void stop();
 
@@ -172,21 +194,54 @@ public:
    * @brief sendMessage
    * @param message
    * @param dst
-   * @return
+   * @return false if the message could not be queued for all destinations
    *
    * if dst is nullptr, the message is sent to all connected sockets
    * If src is not nullptr, the message will not be sent to it
+   *
+   * The message is framed once and shared by all destinations. Data that
+   * can't be written immediately is queued and written by the connection
+   * thread.
    */
   virtual bool sendMessage(uint8_t *message, size_t length,
-                           Socket *dst = nullptr, ValueSource *src = nullptr) {
-    return true;
-  };
+                           Socket *dst = nullptr, ValueSource *src = nullptr);
 
   void setVerbose(bool verbose) { mVerbose = verbose; }
 
+  /// Largest message accepted. Connections that send larger messages are
+  /// closed.
+  void maxMessageSize(uint32_t size) { mMaxMessageSize = size; }
+
+  /**
+   * @brief Limit data queued for a connection
+   * @param bytes maximum bytes queued for each connection
+   * @param timeout time sendMessage() waits for a full queue to drain
+   *
+   * If a connection's queue is still full after timeout, the message is
+   * dropped for that connection and sendMessage() returns false. Messages
+   * sent from processIncomingMessage() never wait.
+   */
+  void sendQueueLimit(size_t bytes, al_sec timeout = 1.0) {
+    mSendQueueLimit = bytes;
+    mSendTimeout = timeout;
+  }
+
 protected:
   virtual void onConnection(Socket *newConnection){};
 
+  /// Clock reported in replies to pings. Override to synchronize a clock other
+  /// than al_steady_time().
+  virtual al_sec localTime() { return al_steady_time(); }
+
+  /// Called on the server for replies to pings. sendTime and receiveTime are
+  /// server localTime(), remoteTime is the client's localTime() when it
+  /// replied.
+  virtual void onPong(Socket *src, al_sec sendTime, al_sec remoteTime,
+                      al_sec receiveTime) {}
+
+  // Start the connection thread. mSocket must be connected or listening.
+  bool startLoop();
+
   uint16_t mVersion = 0,
            mRevision = 0; // Subclasses must set these to ensure compatibility
 
@@ -194,21 +249,43 @@ protected:
   BarrierState mState{BarrierState::NONE};
   std::mutex mConnectionsLock;
 
-  bool mRunning{false};
-  std::vector<std::unique_ptr<std::thread>> mConnectionThreads;
-  std::vector<std::unique_ptr<std::thread>> mDataThreads;
+  std::atomic<bool> mRunning{false};
   std::vector<std::shared_ptr<al::Socket>>
       mServerConnections; // Only available on server.
   std::vector<std::pair<uint16_t, uint16_t>> mConnectionVersions;
   al::Socket mSocket; // Bootstrap socket for server, main socket for client.
   bool mVerbose{false};
+  std::condition_variable mConnectionsChanged;
+
+  struct Connection;
+  struct Loop;
+
+  // These are called from the connection thread
+  void readConnection(Connection &c);
+  void handleFrame(Connection &c, uint8_t *data, uint32_t length);
+  void closeConnection(Connection &c);
+
+  // Must be called with mConnectionsLock held
+  bool queueFrame(Connection &c,
+                  const std::shared_ptr<std::vector<uint8_t>> &frame,
+                  std::unique_lock<std::mutex> &lk);
+  void writeConnection(Connection &c);
+
+  std::unique_ptr<Loop> mLoop;
+  uint32_t mMaxMessageSize{1 << 24};
+  size_t mSendQueueLimit{1 << 23};
+  al_sec mSendTimeout{1.0};
+
+private:
+  void runLoop();
 };
 
 class CommandServer : public CommandConnection {
 public:
+  ~CommandServer() override;
+
   bool start(uint16_t serverPort = 34450,
              const char *serverAddr = "localhost") override;
-  void stop() override;
 
   /**
    * @brief Block until connectionCount connections are established
@@ -229,242 +306,18 @@ public:
   size_t connectionCount();
 
   std::vector<std::pair<std::string, uint16_t>> connections();
-  /**
-   * @brief sendMessage
-   * @param message
-   * @param dst
-   * @return
-   *
-   * if dst is nullptr, the message is sent to all registered sockets
-   */
-  bool sendMessage(uint8_t *message, size_t length, Socket *dst = nullptr,
-                   ValueSource *src = nullptr) override;
-
-protected:
-private:
-  std::unique_ptr<std::thread> mBootstrapServerThread;
-
-  uint16_t mPortOffset = 12000;
 };
 
 class CommandClient : public CommandConnection {
 public:
+  ~CommandClient() override;
+
   bool start(uint16_t serverPort = 34450,
              const char *serverAddr = "localhost") override;
 
-  bool sendMessage(uint8_t *message, size_t length, Socket *dst = nullptr,
-                   al::ValueSource *src = nullptr) override;
-
   bool isConnected() { return mRunning && mSocket.opened(); }
-
-protected:
-  void clientHandlePing(Socket &client);
-
-private:
-  uint16_t mPortOffset = 12000;
 };
 
-// bool NetworkBarrier::pingClients(double timeoutSecs) {
-//    if (mState != BarrierState::SERVER) {
-//        std::cerr << "ERROR: Should not call ping from server" << std::endl;
-//        return false;
-//    }
-
-//    bool allResponded = true;
-
-//    mConnectionsLock.lock();
-//    for (auto listener : mServerConnections) {
-//        std::cout << "pinging " << listener->address() << ":" <<
-//        listener->port()
-//                  << std::endl;
-//        auto startTime = al_steady_time();
-//        unsigned char message[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-
-//        message[0] = 1 << COMMAND_PING;
-//        listener->send((const char *)message, 8);
-//        size_t bytes = 0;
-//        auto previousTimeout = listener->timeout();
-//        listener->timeout(timeoutSecs);
-//        bytes = listener->recv((char *)message, 8);
-
-//        auto endTime = al_steady_time();
-//        if (bytes == 8) {
-//            std::cout << "Reply from " << listener->address() << ":"
-//                      << listener->port() << " in " << (endTime - startTime) *
-//                      1000.0
-//                      << " ms" << std::endl;
-//        } else {
-//            std::cout << "No response from: " << listener->address() << ":"
-//                      << listener->port() << std::endl;
-//        }
-//        listener->timeout(previousTimeout);
-//    }
-
-//    mConnectionsLock.unlock();
-
-//    return allResponded;
-//}
-
-// bool NetworkBarrier::trigger(uint32_t id, double waitTimeoutSecs) {
-//    if (mState == BarrierState::SERVER) {
-//        mConnectionsLock.lock();
-//        for (auto listener : mServerConnections) {
-//            //      std::cout << "synchronizing " << listener->address() <<
-//            ":"
-//            //                << listener->port() << std::endl;
-//            auto startTime = al_steady_time();
-//            unsigned char message[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-
-//            message[0] = 1 << COMMAND_TRIGGER;
-
-//            auto b = Convert::to_bytes(id);
-//            message[1] = b[0];
-//            message[2] = b[1];
-//            message[3] = b[2];
-//            message[4] = b[3];
-//            listener->send((const char *)message, 8);
-//            //      size_t bytes = 0;
-//            //      auto previousTimeout = listener->timeout();
-//            //      listener->timeout(waitTimeoutSecs);
-//            //      bytes = listener->recv((char *)message, 8);
-
-//            //      auto endTime = al_steady_time();
-//            //      if (bytes == 8) {
-//            //        uint32_t id;
-//            //        Convert::from_bytes((const uint8_t *)&message[1], id);
-
-//            //        //        std::cout << "Synced: " << listener->address()
-//            << ":"
-//            //        //                  << listener->port() << " id " << id
-//            <<
-//            //        std::endl;
-//            //      } else {
-//            //        std::cout << "No response from: " << listener->address()
-//            << ":"
-//            //                  << listener->port() << std::endl;
-//            //      }
-//            //      listener->timeout(previousTimeout);
-//        }
-
-//        mConnectionsLock.unlock();
-
-//    } else if (mState == BarrierState::CLIENT) {
-//        //    std::cout << "sync lock" << std::endl;
-//        if (mClientMessageLock.find(id) == mClientMessageLock.end()) {
-//            mClientMessageLock[id] = {std::make_unique<std::mutex>(),
-//                                      std::make_unique<std::condition_variable>()};
-//        }
-//        auto &lock = mClientMessageLock[id].first;
-//        auto &conditionVar = mClientMessageLock[id].second;
-//        std::unique_lock<std::mutex> lk(*lock);
-//        conditionVar->wait(lk);
-//        //    std::cout << "sync continue" << std::endl;
-//    }
-//    return false;
-//}
-
-// bool NetworkBarrier::synchronize(uint32_t id, double waitTimeoutSecs) {
-//    if (mState == BarrierState::SERVER) {
-//        mConnectionsLock.lock();
-//        unsigned char message[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-//        // Notify all
-//        for (auto listener : mServerConnections) {
-//            //      std::cout << "synchronizing " << listener->address() <<
-//            ":"
-//            //                << listener->port() << std::endl;
-//            //      auto startTime = al_steady_time();
-
-//            message[0] = 1 << COMMAND_SYNC_REQ;
-
-//            auto b = Convert::to_bytes(id);
-//            message[1] = b[0];
-//            message[2] = b[1];
-//            message[3] = b[2];
-//            message[4] = b[3];
-//            auto previousTimeout = listener->timeout();
-//            size_t bytes = listener->send((const char *)message, 8);
-//            listener->timeout(previousTimeout);
-//            if (bytes != 8) {
-//                std::cerr << "Error sending to " << listener->address() << ":"
-//                          << listener->port() << std::endl;
-//            }
-//        }
-
-//        // Get reply from all
-//        for (auto listener : mServerConnections) {
-//            size_t bytes = 0;
-//            auto previousTimeout = listener->timeout();
-//            listener->timeout(waitTimeoutSecs);
-//            bytes = listener->recv((char *)message, 8);
-
-//            //      auto endTime = al_steady_time();
-//            if (bytes == 8 && message[0] == 1 << COMMAND_SYNC_ACK) {
-//                uint32_t ackid;
-//                Convert::from_bytes((const uint8_t *)&message[1], ackid);
-//                if (ackid == id) {
-//                    std::cout << "Synced: " << listener->address() << ":"
-//                              << listener->port() << " id " << id <<
-//                              std::endl;
-//                } else {
-//                    std::cerr << "Unexpected ack id" << std::endl;
-//                }
-
-//            } else {
-//                std::cout << "No response from: " << listener->address() <<
-//                ":"
-//                          << listener->port() << std::endl;
-//            }
-//            listener->timeout(previousTimeout);
-//        }
-//        // Unlock all
-//        for (auto listener : mServerConnections) {
-//            //      std::cout << "synchronizing " << listener->address() <<
-//            ":"
-//            //                << listener->port() << std::endl;
-//            //      auto startTime = al_steady_time();
-
-//            message[0] = 1 << COMMAND_BARRIER_UNLOCK;
-
-//            auto b = Convert::to_bytes(id);
-//            message[1] = b[0];
-//            message[2] = b[1];
-//            message[3] = b[2];
-//            message[4] = b[3];
-//            auto previousTimeout = listener->timeout();
-//            size_t bytes = listener->send((const char *)message, 8);
-//            listener->timeout(previousTimeout);
-//            if (bytes != 8) {
-//                std::cerr << "Error sending to " << listener->address() << ":"
-//                          << listener->port() << std::endl;
-//            }
-//        }
-
-//        mConnectionsLock.unlock();
-
-//    } else if (mState == BarrierState::CLIENT) {
-//        //    std::cout << "sync lock" << std::endl;
-//        if (mRunning) {
-//            if (mClientMessageLock.find(id) == mClientMessageLock.end()) {
-
-//                mClientMessageLock[id] = {std::make_unique<std::mutex>(),
-//                                          std::make_unique<std::condition_variable>()};
-//            }
-//            auto &lock = mClientMessageLock[id].first;
-//            auto &conditionVar = mClientMessageLock[id].second;
-//            std::unique_lock<std::mutex> lk(*lock);
-//            if (waitTimeoutSecs > 0) {
-//                conditionVar->wait_for(
-//                    lk, std::chrono::milliseconds((int)(waitTimeoutSecs *
-//                    1000.0)));
-//            } else {
-//                conditionVar->wait(lk);
-//            }
-//        }
-//        //    std::cout << "sync continue" << std::endl;
-//    }
-//    return false;
-//}
-
 } // namespace al
 
 #endif // COMMANDCONNECTION_HPP
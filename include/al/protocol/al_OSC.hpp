@@ -225,6 +225,9 @@ public:
           const char *senderAddr = nullptr);
   ~Message();
 
+  Message(const Message &) = delete;
+  Message &operator=(const Message &) = delete;
+
   /// Pretty-print message information
   void print() const;
 
@@ -256,14 +259,40 @@ public:
   Message &operator>>(Blob &v); ///< Extract next stream element as Blob
 
 protected:
+  friend class Recv;
+
+  // Empty message that Recv reuses for many packets
+  Message();
+
+  // Point message at new data. Strings keep their capacity, so reusing a
+  // message doesn't allocate once it has seen the longest address.
+  void set(const char *message, int size, const TimeTag &timeTag,
+           const char *senderAddr);
+
   class Impl;
-  Impl *mImpl;
+  Impl *mImpl{nullptr};
+  // Impl is constructed in place to avoid an allocation per message
+  alignas(8) unsigned char mImplStorage[64];
   std::string mAddressPattern;
   std::string mTypeTags;
   TimeTag mTimeTag;
   char mSenderAddr[32];
 };
 
+/// Match an OSC address against an OSC address pattern
+
+/// Patterns can contain '?' (any character), '*' (any sequence of
+/// characters), '[abc]', '[a-z]' and '[!abc]' (character sets) and '{foo,bar}'
+/// (alternatives). Wildcards don't match across '/'.
+///
+/// @ingroup allocore
+bool patternMatches(const char *pattern, const char *address);
+
+/// Whether address contains OSC pattern characters
+///
+/// @ingroup allocore
+bool isPattern(const std::string &address);
+
 /// Interface for classes that can be registered as handlers with a osc::Recv
 /// server object
 ///
@@ -318,6 +347,19 @@ public:
   const std::string &address() const { return mAddress; }
   uint16_t port() const { return mPort; }
 
+  /// Set how many router hops multicast packets can travel
+
+  /// Multicast options apply when the address passed to open() is a multicast
+  /// group (224.0.0.0 to 239.255.255.255) and must be set after open().
+  /// \returns false if the socket is not open
+  bool multicastTTL(int ttl);
+
+  /// Set whether multicast packets are received by listeners on this machine
+  bool multicastLoopback(bool loopback);
+
+  /// Set address of the network interface multicast packets are sent from
+  bool multicastInterface(const char *interfaceAddress);
+
   /// Send and clear current packet contents
   size_t send();
 
@@ -399,6 +441,7 @@ public:
 class Recv {
   class SocketReceiver;
   std::unique_ptr<SocketReceiver> socketReceiver;
+  friend class RecvLoop; // Shares the parsing code
 
 public:
   Recv();
@@ -414,6 +457,16 @@ public:
 
   bool open(uint16_t port, const char *address = "", al_sec timeout = 0);
 
+  /// Open socket receiving packets sent to a multicast group
+
+  /// The port can be shared with other multicast receivers on this machine.
+  /// @param[in] port		Port number (valid range is 0-65535)
+  /// @param[in] group		Multicast group address, e.g. "239.0.0.1"
+  /// @param[in] interfaceAddress	Address of network interface to join the
+  /// group on. If empty, the system chooses the interface.
+  bool openMulticast(uint16_t port, const char *group,
+                     const char *interfaceAddress = "");
+
   bool isOpen() { return mOpen; }
 
   const std::string &address() const { return mAddress; }
@@ -422,11 +475,26 @@ public:
   /// Whether background polling is activated
   bool background() const { return mBackground; }
 
-  /// Get current received packet data
-  const char *data() const { return &mBuffer[0]; }
+  /// Get data of the packet being handled
+
+  /// Packets are parsed in place from the socket's buffer, so the data is
+  /// only valid while handlers are called.
+  const char *data() const { return mPacket; }
+
+  /// Set the largest datagram that can be received
 
-  /// Set size of internal buffer
-  void bufferSize(int n) { mBuffer.resize(n); }
+  /// Larger datagrams are truncated and dropped as malformed. Must be called
+  /// before start(). Defaults to 65507 bytes, the largest UDP payload.
+  bool maxPacketSize(int bytes);
+
+  /// Same as maxPacketSize()
+  void bufferSize(int n) { maxPacketSize(n); }
+
+  /// Set size of the socket's receive buffer in bytes
+
+  /// Increase when many packets arrive in bursts, e.g. fragmented state.
+  /// The operating system may limit the size.
+  bool socketBufferSize(int bytes);
 
   /// Set packet handling routine
   Recv &handler(PacketHandler &v) {
@@ -454,18 +522,35 @@ public:
   /// Stop the background polling
   void stop();
 
+  /// Parse packet in place and pass its messages to the registered handlers
   void parse(const char *packet, int size, const char *senderAddr);
   void loop();
 
   static bool portAvailable(uint16_t port, const char *address = "");
 
+  /// Parse packet in place and pass each message to handler
+
+  /// Bundles are unpacked recursively. Messages are reused and only valid
+  /// during onMessage(). Once warmed up, parsing doesn't allocate memory.
+  static void parse(const char *packet, int size, PacketHandler &handler,
+                    const char *senderAddr = nullptr, TimeTag timeTag = 1);
+
+  /// Parse packet into a list of messages
+
+  /// The messages point into the packet data, which must outlive them. This
+  /// allocates every message, prefer passing a handler on busy paths.
   static std::vector<std::shared_ptr<Message>>
   parse(const char *packet, int size, TimeTag timeTag = 1,
         const char *senderAddr = nullptr);
 
 protected:
+  static void dispatch(const char *packet, int size, const TimeTag &timeTag,
+                       const char *senderAddr, PacketHandler *const *handlers,
+                       size_t numHandlers);
+
   std::vector<PacketHandler *> mHandlers;
-  std::vector<char> mBuffer;
+  const char *mPacket{nullptr};
+  int mMaxPacketSize{65507};
   al::Thread mThread;
   bool mBackground;
   std::string mAddress = "";
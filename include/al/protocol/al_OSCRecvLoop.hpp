@@ -0,0 +1,116 @@
+#ifndef INCLUDE_AL_OSCRECVLOOP_HPP
+#define INCLUDE_AL_OSCRECVLOOP_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Receiving OSC on many ports from a single thread.
+*/
+
+#include <cstdint>
+#include <memory>
+
+#include "al/protocol/al_OSC.hpp"
+
+namespace al {
+
+namespace osc {
+
+/**
+ * @brief Receives OSC on many ports from a single thread
+ * @ingroup allocore
+ *
+ * Each osc::Recv runs its own thread, which adds up for applications with
+ * several servers and state receivers. RecvLoop waits on all its sockets at
+ * once. On Linux it uses epoll and reads bursts of datagrams with a single
+ * recvmmsg() call. Other platforms use select() and recvfrom().
+ *
+ * Handlers are called from the loop thread. Ports can be opened and handlers
+ * added while the loop runs, but not from within a handler.
+ *
+ * @code
+  osc::RecvLoop loop;
+  loop.open(9010);
+  loop.appendHandler(9010, parameterHandler);
+  loop.open(9100);
+  loop.appendHandler(9100, stateHandler);
+  loop.start();
+ @endcode
+ */
+class RecvLoop {
+public:
+  /// @param[in] maxPacketSize	largest datagram that can be received
+  /// @param[in] batchSize		datagrams read per system call
+  RecvLoop(int maxPacketSize = 65507, int batchSize = 16);
+
+  ~RecvLoop();
+
+  /// Receive on port. If address is empty, bind all network interfaces.
+  bool open(uint16_t port, const char *address = "");
+
+  /// Receive packets sent to a multicast group on port
+  bool openMulticast(uint16_t port, const char *group,
+                     const char *interfaceAddress = "");
+
+  /// Add handler for messages received on port. The port must be open.
+  bool appendHandler(uint16_t port, PacketHandler &handler);
+
+  /// Set size of the socket's receive buffer for port in bytes
+  bool socketBufferSize(uint16_t port, int bytes);
+
+  /// Start the loop thread
+  bool start();
+
+  /// Stop the loop thread
+  void stop();
+
+  bool running() const;
+
+  /// Number of datagrams received
+  uint64_t packets() const;
+
+  /// Number of system calls that returned datagrams
+  uint64_t reads() const;
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> mImpl;
+};
+
+} // namespace osc
+} // namespace al
+
+#endif // INCLUDE_AL_OSCRECVLOOP_HPP
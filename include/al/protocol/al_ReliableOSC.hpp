@@ -0,0 +1,237 @@
+#ifndef INCLUDE_AL_RELIABLEOSC_HPP
+#define INCLUDE_AL_RELIABLEOSC_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Reliable delivery of OSC packets over UDP using sequence numbers and
+        negative acknowledgements (NACKs).
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/protocol/al_OSC.hpp"
+
+namespace al {
+
+namespace osc {
+
+/**
+ * @brief Sends OSC packets that ReliableReceiver delivers without loss
+ * @ingroup allocore
+ *
+ * Each packet is wrapped in a "/_rel" message carrying a channel and a
+ * sequence number. Receivers detect gaps in the sequence and request the
+ * missing packets with "/_nack" messages sent to the NACK port. The last
+ * windowSize packets of each channel are kept for retransmission. Heartbeats
+ * are sent while a channel is idle so receivers also detect lost packets at
+ * the end of a burst. Envelopes and heartbeats also carry the oldest sequence
+ * still in the window, so a receiver requests the packets it missed before
+ * its first contact with the channel.
+ *
+ * Packets sent to several destinations share sequence numbers, and
+ * retransmissions only go to the receiver that requested them.
+ *
+ * Wire format:
+ * - "/_rel" iiiib: NACK port, channel, oldest sequence, sequence, packet
+ * - "/_relHB" iiii: NACK port, channel, oldest sequence, last sequence sent
+ * - "/_relGone" iiii: NACK port, channel, first sequence, count. Sent when
+ * requested packets have left the window.
+ * - "/_nack" iiii: receiver port, channel, first sequence, count
+ */
+class ReliableSender {
+public:
+  /// @param[in] windowSize	number of packets kept for retransmission per
+  /// channel
+  ReliableSender(unsigned int windowSize = 1024);
+
+  ~ReliableSender();
+
+  /// Open the socket that receives NACKs and start the heartbeat thread
+  bool open(uint16_t nackPort, const char *nackAddress = "0.0.0.0");
+
+  /// Stop receiving NACKs and sending heartbeats
+  void close();
+
+  /// Add a destination. The address can be a broadcast or multicast address.
+  bool addDestination(uint16_t port, const char *address);
+
+  /// Send packet to all destinations on a channel
+  void send(const Packet &p, int channel = 0);
+
+  /// Set time between heartbeats of an idle channel
+  void heartbeatInterval(al_sec interval) { mHeartbeatInterval = interval; }
+
+  /// Drop outgoing packets with this probability, for testing
+  void simulateLoss(float probability) { mLossProbability = probability; }
+
+  /// Number of packets retransmitted in response to NACKs
+  uint64_t retransmitted() const { return mRetransmitted; }
+
+  uint16_t nackPort() const { return mNackPort; }
+
+private:
+  struct SentPacket {
+    uint32_t sequence;
+    std::vector<char> data;
+  };
+
+  struct Channel {
+    uint32_t nextSequence{0};
+    uint32_t oldestSequence{0}; // Oldest sequence still in the window
+    std::vector<SentPacket> window; // Ring buffer indexed by sequence
+    al_sec lastSendTime{0};
+  };
+
+  class NackHandler : public PacketHandler {
+  public:
+    ReliableSender *sender;
+    void onMessage(Message &m) override;
+  } mNackHandler;
+
+  unsigned int mWindowSize;
+  uint16_t mNackPort{0};
+  std::mutex mLock; // Protects channels and sockets
+  std::map<int, Channel> mChannels;
+  std::vector<std::unique_ptr<Send>> mDestinations;
+  std::map<std::string, std::unique_ptr<Send>> mRetransmitSockets;
+  Send mEnvelope{65536};
+  std::unique_ptr<Recv> mNackRecv;
+
+  al_sec mHeartbeatInterval{0.05};
+  bool mRunning{false};
+  std::condition_variable mHeartbeatCondition;
+  std::thread mHeartbeatThread;
+
+  float mLossProbability{0.0f};
+  std::minstd_rand mRandom;
+  std::atomic<uint64_t> mRetransmitted{0};
+
+  // These must be called with mLock held
+  bool dropPacket();
+  void sendEnvelope(Send &socket, int channel, const Channel &c,
+                    const SentPacket &packet);
+  void retransmit(const std::string &address, uint16_t port, int channel,
+                  uint32_t first, uint32_t count);
+  void sendHeartbeats();
+};
+
+/**
+ * @brief Receives packets from ReliableSender
+ * @ingroup allocore
+ *
+ * Register a ReliableReceiver with an osc::Recv in place of the handler that
+ * should get the messages. Messages that are not part of the reliability
+ * protocol are passed through unchanged. Packets are delivered in sequence
+ * order per sender and channel by default. A stream starts at the oldest
+ * packet still in the sender's window when it is first seen. Packets that
+ * can't be recovered because they have left the sender's window are skipped.
+ *
+ * Messages are delivered from the thread that calls onMessage(), usually the
+ * osc::Recv thread.
+ */
+class ReliableReceiver : public PacketHandler {
+public:
+  /// @param[in] handler	handler that gets the delivered messages
+  /// @param[in] port		port of the osc::Recv this receiver is registered
+  /// with. Sent with NACKs so retransmissions reach this receiver.
+  /// @param[in] inOrder	deliver packets of each channel in sequence order
+  ReliableReceiver(PacketHandler &handler, uint16_t port,
+                   bool inOrder = true);
+
+  void onMessage(Message &m) override;
+
+  /**
+   * @brief Handle reliability protocol messages
+   * @return false if the message is not part of the protocol
+   *
+   * Useful for classes that are themselves packet handlers.
+   */
+  bool handleMessage(Message &m);
+
+  void port(uint16_t port) { mPort = port; }
+
+  /// Drop incoming packets and outgoing NACKs with this probability, for
+  /// testing
+  void simulateLoss(float probability) { mLossProbability = probability; }
+
+  /// Number of packets skipped because they could not be recovered
+  uint64_t lost() const { return mLost; }
+
+private:
+  struct Stream {
+    uint32_t nextSequence{0};
+    uint32_t highestSequence{0}; // Highest sequence received or announced
+    al_sec lastNackTime{0};
+    // Packets received ahead of nextSequence. In unordered mode the data is
+    // empty as packets have already been delivered.
+    std::map<uint32_t, std::vector<char>> pending;
+  };
+
+  PacketHandler &mHandler;
+  uint16_t mPort;
+  bool mInOrder;
+  std::map<std::string, Stream> mStreams;
+  std::map<std::string, std::unique_ptr<Send>> mNackSockets;
+  float mLossProbability{0.0f};
+  std::minstd_rand mRandom;
+  std::atomic<uint64_t> mLost{0};
+
+  Stream *stream(Message &m, int nackPort, int channel, uint32_t first);
+  void receivePacket(Message &m, int nackPort, int channel, uint32_t oldest,
+                     uint32_t sequence, const Blob &packet);
+  void deliver(const char *data, size_t size, const std::string &sender);
+  void deliverPending(Stream &s, const std::string &sender);
+  void skipTo(Stream &s, uint32_t sequence, const std::string &sender);
+  void sendNacks(Stream &s, const std::string &sender, int nackPort,
+                 int channel, uint32_t lastSequence);
+  // Socket for NACKs to the sender, or nullptr if it can't be opened
+  Send *nackSocket(const std::string &sender, int nackPort);
+};
+
+} // namespace osc
+} // namespace al
+
+#endif // INCLUDE_AL_RELIABLEOSC_HPP
@@ -0,0 +1,190 @@
+#ifndef AL_COMPILEDSEQUENCE_HPP
+#define AL_COMPILEDSEQUENCE_HPP
+
+/*	Allolib --
+        Multimedia / virtual environment application class library
+
+   Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology, UCSB.
+   Copyright (C) 2012-2018. The Regents of the University of California.
+   All rights reserved.
+
+   Redistribution and use in source and binary forms, with or without
+   modification, are permitted provided that the following conditions are
+   met:
+
+   Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+   Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the
+   distribution.
+
+   Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+   this software without specific prior written permission.
+
+   THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+   IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+        File description:
+        Binary compiled sequence format for SynthSequencer
+*/
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "al/io/al_File.hpp"
+#include "al/ui/al_Parameter.hpp"
+
+namespace al {
+
+/**
+@brief Memory mapped binary sequence
+@ingroup Scene
+
+A compiled sequence holds the events of a .synthSequence text file in a
+compact binary form that can be played without parsing. Includes, tempo
+changes, time offsets and note on/off pairs are resolved when compiling, so
+the file is a flat list of events sorted by start time.
+
+Voice names and string p-fields are interned in a string table. P-fields are
+stored as packed floats, with string fields holding an index into the string
+table. The file is mapped into memory and events are read directly from the
+mapping, so the time to open a sequence doesn't depend on its number of
+events.
+
+Files are written in the byte order of the machine that compiles them and
+are rejected when opened on a machine with a different byte order.
+
+File layout, all sections aligned to 8 bytes:
+- Header
+- Event array, sorted by start time
+- P-field values (float)
+- P-field types, one byte per value
+- String offsets (uint32_t), voice names first
+- String data, each string terminated by a null character
+*/
+class CompiledSequence {
+public:
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder; // Reads as 0x01020304 on a matching machine
+    uint64_t numEvents;
+    uint64_t numValues;
+    uint32_t numNames;
+    uint32_t numStrings; // Names plus string p-fields
+    uint64_t eventsOffset;
+    uint64_t valuesOffset;
+    uint64_t typesOffset;
+    uint64_t stringOffsetsOffset;
+    uint64_t stringDataOffset;
+    uint64_t stringDataSize;
+  };
+
+  enum FieldType : uint8_t { FIELD_FLOAT = 0, FIELD_STRING = 1 };
+
+  enum EventFlags : uint16_t { HAS_STRING_FIELDS = 1 };
+
+  struct Event {
+    double startTime;
+    double duration;    // Negative if the voice ends itself
+    uint64_t firstValue; // Index of first p-field in value array
+    uint32_t nameIndex;  // Index of voice name in string table
+    uint16_t numFields;
+    uint16_t flags;
+  };
+
+  static const uint32_t currentVersion = 1;
+
+  CompiledSequence() {}
+
+  CompiledSequence(const CompiledSequence &) = delete;
+  CompiledSequence &operator=(const CompiledSequence &) = delete;
+
+  /**
+   * @brief Compile a .synthSequence text file to the binary format
+   * @param textPath path to the text sequence
+   * @param outputPath path of the binary file to write
+   * @return true if the file was written
+   *
+   * Sequences included with '=' are looked up in the directory of textPath.
+   */
+  static bool compile(std::string textPath, std::string outputPath);
+
+  /**
+   * @brief Map a compiled sequence file
+   * @return false if the file can't be mapped or is not a valid compiled
+   * sequence
+   *
+   * Checks the sections and string table, but not the events, which are
+   * checked as they are played.
+   */
+  bool open(std::string path);
+
+  void close() { mFile.close(); }
+
+  bool opened() const { return mFile.opened(); }
+
+  /// Number of events
+  size_t size() const { return mEventCount; }
+
+  const Event &event(size_t index) const { return mEvents[index]; }
+
+  /// Pointer to first event, for iterating or searching
+  const Event *events() const { return mEvents; }
+
+  /// Number of voice names
+  uint32_t numNames() const { return mNameCount; }
+
+  /// Voice name by index, also used for event nameIndex
+  const char *name(uint32_t index) const;
+
+  /**
+   * @brief Float values of an event's p-fields
+   *
+   * String fields hold the index of the string in their slot and can be
+   * identified through fieldType() if the event has HAS_STRING_FIELDS set.
+   * Returns nullptr if the event refers to values outside the file.
+   */
+  const float *values(const Event &event) const;
+
+  FieldType fieldType(const Event &event, uint16_t field) const;
+
+  /// String p-field value
+  const char *stringField(const Event &event, uint16_t field) const;
+
+  /// Convert an event's p-fields. Allocates, so avoid in the audio thread.
+  std::vector<ParameterField> fields(const Event &event) const;
+
+  /// Time of the last event termination
+  double duration() const;
+
+private:
+  MappedFile mFile;
+  const Event *mEvents{nullptr};
+  size_t mEventCount{0};
+  const float *mValues{nullptr};
+  uint64_t mValueCount{0};
+  const uint8_t *mTypes{nullptr};
+  const uint32_t *mStringOffsets{nullptr};
+  uint32_t mStringCount{0};
+  uint32_t mNameCount{0};
+  const char *mStringData{nullptr};
+  uint64_t mStringDataSize{0};
+};
+
+} // namespace al
+
+#endif // AL_COMPILEDSEQUENCE_HPP
@@ -44,6 +44,7 @@
         Andrés Cabrera mantaraya36@gmail.com
 */
 
+#include <atomic>
 #include <condition_variable>
 #include <memory>
 #include <queue>
@@ -94,6 +95,46 @@ public:
     mAudioOutPositionOffsets = offsets;
   }
 
+  /**
+   * @brief Make room for the spatializer state of each audio output
+   * @param numChannels number of audio outputs that will be rendered
+   * @param numSpeakers number of speakers in the spatializer
+   *
+   * DynamicScene calls this when the voice is triggered so that
+   * spatializerSources() doesn't allocate on the audio thread.
+   */
+  void prepareSpatializerSources(unsigned int numChannels,
+                                 unsigned int numSpeakers) {
+    if (mSpatializerSources.size() < numChannels) {
+      mSpatializerSources.resize(numChannels);
+    }
+    for (auto &source : mSpatializerSources) {
+      source.gains.reserve(numSpeakers);
+    }
+  }
+
+  /**
+   * @brief Spatializer state for each audio output, kept between blocks
+   * @param numChannels number of audio outputs that will be rendered
+   * @return pointer to numChannels consecutive sources, or nullptr if
+   * prepareSpatializerSources() didn't make room for them
+   *
+   * The state is reset whenever the voice is triggered with a new id, so a
+   * reused voice does not ramp from the gains of its previous note.
+   */
+  SpatializerSource *spatializerSources(unsigned int numChannels) {
+    if (mSpatializerSources.size() < numChannels) {
+      return nullptr;
+    }
+    for (auto &source : mSpatializerSources) {
+      if (source.id != id()) {
+        source.reset();
+        source.id = id();
+      }
+    }
+    return mSpatializerSources.data();
+  }
+
   /**
    * @brief Override this function to apply transformations after the internal
    * transformations of the voice has been applied
@@ -159,6 +200,8 @@ protected:
                                 // to determine the specific position of the
                                 // audio out
 
+  std::vector<SpatializerSource> mSpatializerSources;
+
   bool mUseDistAtten{true};
   bool mIsReplica{false}; // If voice is replica, it should not send its
                           // internal state but listen for changes.
@@ -226,6 +269,11 @@ public:
   std::shared_ptr<TSpatializer> setSpatializer(Speakers &sl) {
     mSpatializer = std::make_shared<TSpatializer>(sl);
     mSpatializer->compile();
+    // Thread accumulators depend on the spatializer. Reconfigure them here
+    // rather than leaving it to render() on the audio thread.
+    if (m_internalAudioConfigured) {
+      prepareAccumulators(mPreparedIO);
+    }
     return std::static_pointer_cast<TSpatializer>(mSpatializer);
   }
 
@@ -263,8 +311,29 @@ public:
   virtual void update(double dt = 0) final;
 
   void setUpdateThreaded(bool threaded) { mThreadedUpdate = threaded; }
+
+  /**
+   * @brief Render voices on the audio worker threads
+   *
+   * When enabled, the active voices are split into per-thread ranges that idle
+   * threads can steal from. Each thread spatializes into its own output
+   * buffers, which are summed into the device output at the end of the block.
+   * The bus routing callback will be called concurrently from the audio
+   * threads, so it must be thread safe.
+   */
   void setAudioThreaded(bool threaded) { mThreadedAudio = threaded; }
 
+  /**
+   * @brief Set the number of voices a thread claims at a time when audio is
+   * threaded
+   *
+   * Smaller chunks balance better when voice processing cost is uneven,
+   * larger chunks reduce contention on the shared work counters.
+   */
+  void setAudioThreadChunkSize(int numVoices) {
+    mAudioChunkSize = numVoices > 0 ? numVoices : 1;
+  }
+
   DistAtten<> &distanceAttenuation() { return mDistAtten; }
 
   void print(std::ostream &stream = std::cout);
@@ -284,7 +353,10 @@ public:
    * only have effect if threading is enabled for simulation or audio
    */
   void stopAudioThreads() {
-    mSynthRunning = false;
+    {
+      std::unique_lock<std::mutex> lk(mThreadTriggerLock);
+      mSynthRunning = false;
+    }
     mThreadTrigger.notify_all();
     for (auto &thr : mAudioThreads) {
       thr.join();
@@ -293,6 +365,11 @@ public:
   }
 
 protected:
+  /// Adds STEAL_FARTHEST, scoring positioned voices by their distance to the
+  /// listener
+  virtual double voiceStealScore(SynthVoice *voice,
+                                 VoiceStealPolicy policy) override;
+
 private:
   // A speaker layout and spatializer
   std::shared_ptr<Spatializer> mSpatializer;
@@ -308,19 +385,42 @@ private:
   // For threaded audio
   bool mThreadedAudio{false};
   std::vector<std::thread> mAudioThreads;
-  std::vector<AudioIOData> mThreadedAudioData;
-  std::map<int, std::vector<int>>
-      mThreadMap; // Defines which threads run which voices. Key is thread id,
-                  // value is voice ids.
+
+  // State for each thread taking part in threaded audio rendering. The last
+  // worker is the thread that calls render().
+  struct AudioWorker {
+    AudioIOData voiceIO;     // Buffers passed to the voices' onProcess()
+    AudioIOData accumulator; // Spatializer output for this thread
+    bool accumulatorUsed{false};
+    std::atomic<int> nextVoice{0}; // Next unclaimed index into mBlockVoices
+    int endVoice{0};
+  };
+  std::vector<std::unique_ptr<AudioWorker>> mAudioWorkers;
+  std::vector<SynthVoice *> mBlockVoices; // Active voices for current block
+  int mAudioChunkSize{4};
+
+  std::atomic<uint64_t> mAudioBlockCounter{0};
+  std::atomic<bool> mAudioBlockOpen{false};
+  std::atomic<int> mVoicesPending{0};
+  std::atomic<int> mAudioBusy{0};
+  std::atomic<int> mParkedAudioThreads{0};
+  // Preallocated in prepare() for the reduction at the end of each block
+  std::vector<AudioIOData *> mUsedAccumulators;
+  std::vector<const float *> mUsedBuses;
+  // Channel and buffer configuration of the io passed to prepare()
+  AudioIOData mPreparedIO;
+
+  // Only used to park idle audio threads
   std::condition_variable mThreadTrigger;
-  std::condition_variable mAudioThreadDone;
-  std::mutex mSpatializerLock;
-  AudioIOData
-      *externalAudioIO; // This is captured by the audio callback and passed to
-                        // the audio threads. Protected by mSpatializerLock
   std::mutex mThreadTriggerLock;
-  bool mSynthRunning{true};
-  unsigned int mAudioBusy = 0;
+  std::atomic<bool> mSynthRunning{true};
+
+  void prepareAccumulators(const AudioIOData &io);
+  void renderVoice(SynthVoice *voice, AudioIOData &voiceIO, AudioIOData &io,
+                   bool concurrent);
+  void renderThreaded(AudioIOData &io);
+  bool claimVoices(size_t workerIndex, int &begin, int &end);
+  void processVoiceChunks(size_t workerIndex);
 
   static void updateThreadFunc(UpdateThreadFuncData data);
 
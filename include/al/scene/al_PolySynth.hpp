@@ -41,8 +41,10 @@
     Andrés Cabrera mantaraya36@gmail.com
 */
 
+#include <atomic>
 #include <chrono>
 #include <cstring>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <typeindex>
@@ -51,7 +53,7 @@
 #include "al/graphics/al_Graphics.hpp"
 #include "al/io/al_AudioIOData.hpp"
 #include "al/io/al_File.hpp"
-#include "al/types/al_SingleRWRingBuffer.hpp"
+#include "al/types/al_MPSCQueue.hpp"
 #include "al/ui/al_Parameter.hpp"
 
 namespace al {
@@ -419,13 +421,30 @@ protected:
 
 private:
   int mId{-1};
+  int mTypeId{-1}; // Index of the PolySynth free voice pool for this class
   bool mActive{false};
+  // Voice stealing state, only accessed by the rendering thread
+  uint64_t mTriggerOrder{0};
+  int mStealFramesLeft{-1}; // Frames left in the fade out, -1 if not stolen
+  bool mTrackLevel{false};
+  float mLevel{0.0f}; // Peak output level of the last block
   int mOnOffsetFrames{0};
   int mOffOffsetFrames{0};
   void *mUserData;
   unsigned int mNumOutChannels{1};
 };
 
+/**
+ * @brief Voice to steal when a voice class is over its budget
+ * @ingroup Scene
+ */
+enum class VoiceStealPolicy {
+  STEAL_NONE,     ///< Don't steal. New voices over budget are dropped.
+  STEAL_OLDEST,   ///< Steal the voice triggered first
+  STEAL_QUIETEST, ///< Steal the voice with the lowest output peak
+  STEAL_FARTHEST  ///< Steal the voice farthest from the listener
+};
+
 /**
  * @brief A PolySynth manages polyphony and rendering of SynthVoice instances.
  * @ingroup Scene
@@ -447,18 +466,32 @@ public:
    * You can use the id to identify the note for later triggerOff() calls.
    * Always use a positive value for id, as negative ids have special treatment
    * in classes like this one and SynthGUIManager
+   *
+   * Can be called from any thread without blocking. The voice is queued and
+   * inserted into the rendering chain at the start of the next block.
    */
   int triggerOn(SynthVoice *voice, int offsetFrames = 0, int id = -1,
                 void *userData = nullptr);
 
-  /// trigger release of voice with id
+  /// trigger release of voice with id. Can be called from any thread.
   void triggerOff(int id);
 
   /**
    * @brief Turn off all notes immediately (without calling triggerOff() )
+   *
+   * Only voices triggered before this call are affected.
    */
   virtual void allNotesOff();
 
+  /**
+   * @brief Set the number of voice commands that can be queued between blocks
+   * @param size number of trigger on, trigger off and free commands
+   *
+   * Commands that don't fit are held in a locked overflow list until the
+   * queue drains, so none are lost. Only call while audio is not running.
+   */
+  void setVoiceCommandQueueSize(size_t size) { mVoiceCommands.resize(size); }
+
   /**
    * @brief Get a reference to a voice.
    * @param forceAlloc force allocation of voice even if maximum allowed
@@ -468,9 +501,25 @@ public:
    * Returns a free voice from the internal dynamic allocated pool.
    * You must call triggerVoice to put the voice back in the rendering
    * chain after setting its properties, otherwise it will be lost.
+   *
+   * Each voice class has its own pool, so this takes constant time. Returns
+   * nullptr if the pool is empty and allocation is disabled or the
+   * polyphony limit set with setMaxPolyphony() has been reached.
    */
   template <class TSynthVoice> TSynthVoice *getVoice(bool forceAlloc = false);
 
+  /**
+   * @brief Get a reference to a free voice by voice type id
+   * @param typeId id from voiceTypeId()
+   * @param forceAlloc force allocation of voice even if maximum allowed
+   * polyphony is reached
+   *
+   * Like getVoice(std::string) but without any string lookups. The voice
+   * class must have been registered with registerSynthClass() or used
+   * through the templated getVoice() for new voices to be allocated.
+   */
+  SynthVoice *getVoice(int typeId, bool forceAlloc = false);
+
   /**
    * @brief Get a reference to a free voice by voice type name
    * @param forceAlloc force allocation of voice even if maximum allowed
@@ -481,9 +530,33 @@ public:
    * If voice is not available. It will be allocated. Can return
    * nullptr if the class name and creator have not been registered
    * with registerSynthClass()
+   *
+   * Free voices of classes that were never registered, e.g. voices inserted
+   * with insertFreeVoice(), are found by their demangled or typeid class
+   * name.
    */
   SynthVoice *getVoice(std::string name, bool forceAlloc = false);
 
+  /**
+   * @brief Integer id for a voice class
+   *
+   * Ids are unique within the process and index the free voice pools. Look
+   * the id up once and pass it to getVoice(int) to acquire voices without
+   * string operations.
+   */
+  template <class TSynthVoice> static int voiceTypeId() {
+    static const int typeId =
+        registerVoiceType(std::type_index(typeid(TSynthVoice)));
+    return typeId;
+  }
+
+  /**
+   * @brief Integer id for a voice class name
+   * @return the id or -1 if the name has not been registered with
+   * registerSynthClass() or used through the templated getVoice()
+   */
+  int voiceTypeId(std::string name);
+
   /**
    * @brief Get the first available voice with minimal checks
    * @param forceAlloc
@@ -526,6 +599,50 @@ public:
    */
   void allocatePolyphony(std::string name, int number);
 
+  /**
+   * @brief Limit the number of voices allocated for a voice class
+   * @param maxVoices maximum number of voices, or -1 for no limit
+   *
+   * Once the limit is reached getVoice() only returns voices from the free
+   * pool, and returns nullptr when it is empty. Voices already allocated are
+   * not released.
+   */
+  template <class TSynthVoice> void setMaxPolyphony(int maxVoices);
+
+  void setMaxPolyphony(std::string name, int maxVoices);
+
+  /**
+   * @brief Limit the number of voices of a class sounding at once
+   * @param maxActiveVoices maximum number of active voices, or -1 for no limit
+   * @param policy voice to steal when a new voice goes over the budget
+   *
+   * The budget is enforced on the rendering thread when triggered voices are
+   * inserted. Stolen voices fade out over the time set with
+   * setVoiceStealFadeFrames() and then return to the free pool. The fade
+   * only applies when audio is the time master, in other modes stolen voices
+   * are removed at once. Preallocate a few more voices than the budget with
+   * allocatePolyphony() so new voices can start while stolen ones fade out.
+   *
+   * STEAL_FARTHEST is only meaningful in DynamicScene, PolySynth steals the
+   * oldest voice instead.
+   */
+  template <class TSynthVoice>
+  void setVoiceBudget(
+      int maxActiveVoices,
+      VoiceStealPolicy policy = VoiceStealPolicy::STEAL_OLDEST) {
+    setVoiceBudget(voiceTypeId<TSynthVoice>(), maxActiveVoices, policy);
+  }
+
+  void setVoiceBudget(int typeId, int maxActiveVoices,
+                      VoiceStealPolicy policy = VoiceStealPolicy::STEAL_OLDEST);
+
+  /**
+   * @brief Set the length of the fade out applied to stolen voices
+   *
+   * A length of 0 removes stolen voices at once.
+   */
+  void setVoiceStealFadeFrames(int frames) { mStealFadeFrames = frames; }
+
   /**
    * @brief Use this function to insert a voice allocated externally into the
    * free voice pool
@@ -708,13 +825,23 @@ public:
       TSynthVoice *voice = allocateVoice<TSynthVoice>();
       return voice;
     };
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    VoicePool &pool = voicePool<TSynthVoice>();
+    pool.name = name;
+    nameVoicePool(voiceTypeId<TSynthVoice>(), name);
   }
 
   SynthVoice *allocateVoice(std::string name);
 
   template <class TSynthVoice> TSynthVoice *allocateVoice() {
+    {
+      // Create the pool now so releasing the voice doesn't allocate
+      std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+      voicePool<TSynthVoice>();
+    }
     TSynthVoice *voice = new TSynthVoice;
     voice->next = nullptr;
+    voice->mTypeId = voiceTypeId<TSynthVoice>();
     if (mDefaultUserData) {
       voice->userData(mDefaultUserData);
     }
@@ -738,8 +865,14 @@ public:
    * This function is unsafe and should be used with extreme care. Ensure that
    * no allocation, voice insertion or removal takes place while working with
    * these voices.
+   *
+   * Returns the first non empty free voice pool. This holds all free voices
+   * only if the synth uses a single voice class.
    */
-  SynthVoice *getFreeVoices() { return mFreeVoices; }
+  SynthVoice *getFreeVoices();
+
+  /// Free voices for one voice class. Same caveats as getFreeVoices().
+  SynthVoice *getFreeVoices(int typeId);
 
   /**
    * @brief Determines the number of output channels allocated for the internal
@@ -800,49 +933,20 @@ public:
    *
    * You need to call this function only if you are in TIME_MASTER_FREE mode.
    * In other modes it is called in the render() function for the domain.
+   *
+   * Applies all queued trigger on, trigger off and free commands in the order
+   * they were issued.
    */
   inline void processVoices() {
-    if (mVoiceToInsertLock.try_lock()) {
-      if (mVoicesToInsert) {
-        // If lock acquired insert queued voices
-        if (mActiveVoices) {
-          auto voice = mVoicesToInsert;
-          while (voice->next) { // Find last voice to insert
-            voice = voice->next;
-          }
-          voice->next =
-              mActiveVoices; // Connect last inserted to previously active
-          mActiveVoices = mVoicesToInsert; // Put new voices in head
-        } else {
-          mActiveVoices = mVoicesToInsert;
-        }
-        if (verbose()) {
-          std::cout << "Voice on " << mVoicesToInsert->id() << std::endl;
-        }
-
-        mVoicesToInsert = nullptr;
-      }
-      mVoiceToInsertLock.unlock();
-    }
-    if (mAllNotesOff) {
-      if (mFreeVoiceLock.try_lock()) {
-        mAllNotesOff = false;
-        if (mActiveVoices) {
-          auto voice = mActiveVoices->next;
-          SynthVoice *previousVoice = mActiveVoices;
-          previousVoice->id(-1);
-          while (voice) {
-            voice->id(-1);
-            previousVoice = voice;
-            voice = voice->next;
-          }
-          previousVoice->next =
-              mFreeVoices; // Connect last active voice to first free voice
-          mFreeVoices = mActiveVoices; // Move all voices to free voices
-          mActiveVoices = nullptr;     // No active voices left
-        }
-        mFreeVoiceLock.unlock();
+    processVoiceCommands();
+    if (mVoicesToRelease && mFreeVoiceLock.try_lock()) {
+      // Voices removed by allNotesOff() go back to the free pools
+      while (mVoicesToRelease) {
+        auto *voice = mVoicesToRelease;
+        mVoicesToRelease = voice->next;
+        releaseVoice(voice);
       }
+      mFreeVoiceLock.unlock();
     }
   }
 
@@ -851,43 +955,11 @@ public:
    *
    * You need to call this function only if you are in TIME_MASTER_FREE mode.
    * In other modes it is called in the render() function for the domain.
+   *
+   * Trigger off commands share a queue with trigger on commands and are
+   * applied by processVoices(). This picks up any commands queued since.
    */
-  inline void processVoiceTurnOff() {
-    int voicesToTurnOff[16];
-    size_t numVoicesToTurnOff;
-    while ((numVoicesToTurnOff = mVoiceIdsToTurnOff.read(
-                (char *)voicesToTurnOff, 16 * sizeof(int)))) {
-      for (size_t i = 0; i < numVoicesToTurnOff / int(sizeof(int)); i++) {
-        auto *voice = mActiveVoices;
-        while (voice) {
-          if (voice->id() == voicesToTurnOff[i]) {
-            if (mVerbose) {
-              std::cout << "Voice trigger off " << voice->id() << std::endl;
-            }
-            voice->triggerOff(); // TODO use offset for turn off
-          }
-          voice = voice->next;
-        }
-      }
-    }
-    size_t numVoicesToFree;
-    int voicesToFree[16];
-    while ((numVoicesToFree =
-                mVoiceIdsToFree.read((char *)voicesToFree, 16 * sizeof(int)))) {
-      for (size_t i = 0; i < numVoicesToFree / int(sizeof(int)); i++) {
-        if (mVerbose) {
-          std::cout << "Voice free " << voicesToFree[i] << std::endl;
-        }
-        auto *voice = mActiveVoices;
-        while (voice) {
-          if (voice->id() == voicesToFree[i]) {
-            voice->mActive = false;
-          }
-          voice = voice->next;
-        }
-      }
-    }
-  }
+  inline void processVoiceTurnOff() { processVoiceCommands(); }
 
   /**
    * @brief Check for voices marked as free and move them to the free voice pool
@@ -899,36 +971,20 @@ public:
     // Move inactive voices to free queue
     if (mFreeVoiceLock.try_lock()) { // Attempt to remove inactive voices
       // without waiting.
-      auto *voice = mActiveVoices;
-      SynthVoice *previousVoice = nullptr;
-      while (voice) {
+      SynthVoice **link = &mActiveVoices;
+      while (*link) {
+        auto *voice = *link;
         if (!voice->active()) {
           int id = voice->id();
-          //          std::cout << " ****((((())))) **** Remove inactive voice:
-          //          " << voice << std::endl;
-          if (previousVoice) {
-            previousVoice->next = voice->next; // Remove from active list
-            voice->next = mFreeVoices;
-            mFreeVoices = voice; // Insert as head in free voices
-            voice->id(-1);       // Reset voice id
-            voice->onFree();
-            voice = previousVoice; // prepare next iteration
-          } else {                 // Inactive is head of the list
-            auto *nextVoice = voice->next;
-            mActiveVoices = nextVoice; // Remove voice from list
-            voice->next = mFreeVoices;
-            mFreeVoices = voice; // Insert as head in free voices
-            voice->id(-1);       // Reset voice id
-            voice->onFree();
-            voice = voice->next; // prepare next iteration
-          }
+          *link = voice->next; // Remove from active list
+          releaseVoice(voice); // Insert as head in its free pool
+          voice->id(-1);       // Reset voice id
+          voice->onFree();
           for (auto cbNode : mFreeCallbacks) {
             cbNode.first(id, cbNode.second);
           }
-        }
-        previousVoice = voice;
-        if (voice) {
-          voice = voice->next;
+        } else {
+          link = &voice->next;
         }
       }
       mFreeVoiceLock.unlock();
@@ -938,6 +994,102 @@ public:
 protected:
   void startCpuClockThread();
 
+  struct VoiceCommand {
+    enum Type { TRIGGER_ON, TRIGGER_OFF, FREE, ALL_OFF, SET_BUDGET };
+    Type type{TRIGGER_ON};
+    SynthVoice *voice{nullptr};
+    int id{-1}; // Voice id, or type id for SET_BUDGET
+    int maxActiveVoices{-1};
+    VoiceStealPolicy policy{VoiceStealPolicy::STEAL_OLDEST};
+  };
+
+  struct VoiceBudget {
+    int maxActiveVoices{-1};
+    VoiceStealPolicy policy{VoiceStealPolicy::STEAL_OLDEST};
+  };
+
+  /**
+   * @brief Score used to choose the voice to steal
+   *
+   * The active voice of the class with the highest score is stolen.
+   */
+  virtual double voiceStealScore(SynthVoice *voice, VoiceStealPolicy policy);
+
+  /// Steal voices to make room for a new voice if its class is over budget
+  void applyVoiceBudget(SynthVoice *newVoice);
+
+  /**
+   * @brief Apply the fade out of stolen voices and track output levels
+   * @param voice voice that has just rendered
+   * @param voiceIO the voice's own output buffers
+   *
+   * Call after the voice has rendered into its own buffers, before they are
+   * mixed or spatialized.
+   */
+  inline void processVoiceOutput(SynthVoice *voice, AudioIOData &voiceIO) {
+    if (voice->mStealFramesLeft >= 0 || voice->mTrackLevel) {
+      fadeAndMeasureVoice(voice, voiceIO);
+    }
+  }
+
+  void fadeAndMeasureVoice(SynthVoice *voice, AudioIOData &voiceIO);
+
+  /// Queue a command for the rendering thread. Does not block unless the
+  /// command queue is full.
+  void pushVoiceCommand(const VoiceCommand &command);
+
+  /// Apply queued voice commands. Only call from the rendering thread.
+  void processVoiceCommands();
+
+  /// Free voices and allocation state for one voice class
+  struct VoicePool {
+    SynthVoice *freeVoices{nullptr};
+    std::function<SynthVoice *()> creator;
+    std::string name;
+    const char *typeName{nullptr}; // typeid name of the voice class
+    int numAllocated{0};
+    int maxPolyphony{-1}; // -1 for no limit
+    bool allowAllocation{true};
+  };
+
+  static int registerVoiceType(std::type_index type);
+
+  // The following functions must be called with mFreeVoiceLock held
+
+  /// Get the pool for a type id, creating it if needed
+  VoicePool &voicePool(int typeId);
+
+  /// Get the pool for a voice class, setting its creator on first use
+  template <class TSynthVoice> VoicePool &voicePool() {
+    const int typeId = voiceTypeId<TSynthVoice>();
+    VoicePool &pool = voicePool(typeId);
+    if (!pool.creator) {
+      pool.creator = [this]() -> SynthVoice * {
+        return allocateVoice<TSynthVoice>();
+      };
+      pool.typeName = typeid(TSynthVoice).name();
+      nameVoicePool(typeId, demangle(pool.typeName));
+    }
+    return pool;
+  }
+
+  /// Create and name the pool for a voice that was not allocated by this
+  /// PolySynth. Called when the voice is triggered or inserted, so the pool
+  /// exists by the time the rendering thread releases the voice.
+  void registerVoicePool(SynthVoice *voice);
+
+  /// Map a name to a pool and apply disableAllocation() for that name
+  void nameVoicePool(int typeId, const std::string &name);
+
+  /// Pop a free voice, or reserve a new allocation. Returns nullptr and sets
+  /// mayAllocate if the caller should allocate a new voice.
+  SynthVoice *acquireVoice(VoicePool &pool, bool forceAlloc,
+                           bool &mayAllocate);
+
+  /// Push a voice to the head of its free pool. Doesn't allocate for voices
+  /// allocated, triggered or inserted through this PolySynth.
+  void releaseVoice(SynthVoice *voice);
+
   inline void processGain(AudioIOData &io) {
     io.frame(0);
     if (mAudioGain != 1.0f) {
@@ -953,15 +1105,28 @@ protected:
 
   virtual void prepare(AudioIOData &io);
 
-  /// Voices to be inserted in the realtime context. Internal voices are
-  /// allocated in PolySynth and shared with the outside.
-  SynthVoice *mVoicesToInsert{nullptr};
-  /// Allocated voices available for reuse
-  SynthVoice *mFreeVoices{nullptr};
+  /// Trigger on, trigger off and free commands for the rendering thread.
+  /// Voices passed to triggerOn() are allocated in PolySynth and shared with
+  /// the outside.
+  MPSCQueue<VoiceCommand> mVoiceCommands{1024};
+  /// Commands that did not fit in mVoiceCommands, in issue order
+  std::vector<VoiceCommand> mVoiceCommandOverflow;
+  std::mutex mVoiceCommandOverflowLock;
+  std::atomic<bool> mVoiceCommandsOverflowed{false};
+  /// Voices removed by allNotesOff() waiting to be returned to the free pool.
+  /// Only accessed from the rendering thread.
+  SynthVoice *mVoicesToRelease{nullptr};
+  /// Per class budgets indexed by type id. Sized by voicePool() when a pool
+  /// is created, otherwise only accessed from the rendering thread.
+  std::vector<VoiceBudget> mVoiceBudgets;
+  uint64_t mTriggerOrderCounter{0};
+  int mStealFadeFrames{256};
+  /// Allocated voices available for reuse, indexed by voice type id
+  std::vector<std::unique_ptr<VoicePool>> mVoicePools;
+  std::map<std::string, int> mVoiceTypeIds;
   /// Dynamic voices that are currently active. Only modified
   /// within the master domain (set by mMasterMode)
   SynthVoice *mActiveVoices{nullptr};
-  std::mutex mVoiceToInsertLock;
   std::mutex mFreeVoiceLock;
   std::mutex mGraphicsLock; // TODO: remove this lock?
 
@@ -974,9 +1139,6 @@ protected:
   std::shared_ptr<BusRoutingCallback> mBusRoutingCallback;
   AudioIOData internalAudioIO;
 
-  SingleRWRingBuffer mVoiceIdsToTurnOff{64 * sizeof(int)};
-  SingleRWRingBuffer mVoiceIdsToFree{64 * sizeof(int)};
-
   TimeMasterMode mMasterMode;
 
   std::vector<AudioCallback *> mPostProcessing;
@@ -1000,10 +1162,7 @@ protected:
 
   float mAudioGain{1.0f};
 
-  int mIdCounter{1000};
-
-  // Flag used to notify processing to turn off all voices
-  bool mAllNotesOff{false};
+  std::atomic<int> mIdCounter{1000};
 
   typedef std::function<SynthVoice *()> VoiceCreatorFunc;
   typedef std::map<std::string, VoiceCreatorFunc> Creators;
@@ -1028,65 +1187,45 @@ template <class TSynthVoice> void PolySynth::disableAllocation() {
 }
 
 template <class TSynthVoice> TSynthVoice *PolySynth::getVoice(bool forceAlloc) {
-  std::unique_lock<std::mutex> lk(
-      mFreeVoiceLock); // Only one getVoice() call at a time
-  SynthVoice *freeVoice = mFreeVoices;
-  SynthVoice *previousVoice = nullptr;
-  if (forceAlloc) {
-    freeVoice = nullptr;
-  } else {
-    while (freeVoice) {
-      if (std::type_index(typeid(*freeVoice)) ==
-          std::type_index(typeid(TSynthVoice))) {
-        if (previousVoice) {
-          previousVoice->next = freeVoice->next;
-        } else {
-          mFreeVoices = freeVoice->next;
-        }
-        break;
-      }
-      previousVoice = freeVoice;
-      freeVoice = freeVoice->next;
-    }
+  bool mayAllocate = false;
+  SynthVoice *freeVoice;
+  {
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    freeVoice = acquireVoice(voicePool<TSynthVoice>(), forceAlloc, mayAllocate);
   }
-  if (!freeVoice) { // No free voice in list, so we need to allocate it
-    // TODO report current polyphony for more informed allocation of polyphony
-    // TODO check if allocation allowed
-    //  But only allocate if allocation has not been disabled
-    std::string name = demangle(typeid(TSynthVoice).name());
-    if (std::find(mNoAllocationList.begin(), mNoAllocationList.end(), name) ==
-        mNoAllocationList.end()) {
-      // TODO report current polyphony for more informed allocation of polyphony
-      freeVoice = allocateVoice<TSynthVoice>();
-      if (mVerbose) {
-        std::cout << "Allocating voice of type " << typeid(TSynthVoice).name()
-                  << "." << std::endl;
-      }
-    } else {
-      std::cout << "Automatic allocation disabled for voice:" << name
-                << std::endl;
+  if (mayAllocate) { // No free voice in pool, so we need to allocate it
+    // Allocate outside the lock, the pool has already counted this voice
+    freeVoice = allocateVoice<TSynthVoice>();
+    if (mVerbose) {
+      std::cout << "Allocating voice of type " << typeid(TSynthVoice).name()
+                << "." << std::endl;
     }
   }
   return static_cast<TSynthVoice *>(freeVoice);
 }
 
 template <class TSynthVoice> void PolySynth::allocatePolyphony(int number) {
-  std::unique_lock<std::mutex> lk(mFreeVoiceLock);
-  SynthVoice *lastVoice = mFreeVoices;
-  if (lastVoice) {
-    while (lastVoice->next) {
-      lastVoice = lastVoice->next;
+  {
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    VoicePool &pool = voicePool<TSynthVoice>();
+    if (pool.maxPolyphony >= 0 &&
+        pool.numAllocated + number > pool.maxPolyphony) {
+      number = std::max(pool.maxPolyphony - pool.numAllocated, 0);
     }
-  } else {
-    lastVoice = mFreeVoices = allocateVoice<TSynthVoice>();
-    number--;
+    pool.numAllocated += number;
   }
   for (int i = 0; i < number; i++) {
-    lastVoice->next = allocateVoice<TSynthVoice>();
-    lastVoice = lastVoice->next;
+    auto *voice = allocateVoice<TSynthVoice>();
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    releaseVoice(voice);
   }
 }
 
+template <class TSynthVoice> void PolySynth::setMaxPolyphony(int maxVoices) {
+  std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+  voicePool<TSynthVoice>().maxPolyphony = maxVoices;
+}
+
 } // namespace al
 
 #endif // AL_POLYSYNTH_HPP
@@ -57,7 +57,9 @@
 #include "al/graphics/al_Graphics.hpp"
 #include "al/io/al_AudioIOData.hpp"
 #include "al/io/al_File.hpp"
+#include "al/scene/al_CompiledSequence.hpp"
 #include "al/scene/al_PolySynth.hpp"
+#include "al/types/al_MPSCQueue.hpp"
 #include "al/ui/al_Parameter.hpp"
 
 namespace al {
@@ -70,8 +72,6 @@ class SynthSequencerEvent {
 public:
   SynthSequencerEvent() {}
 
-  ~SynthSequencerEvent() {}
-
   typedef enum { EVENT_VOICE, EVENT_PFIELDS, EVENT_TEMPO } EventType;
 
   double startTime{0};
@@ -88,7 +88,7 @@ public:
   SynthVoice *voice{nullptr};
   ParamFields fields;
   float tempo;
-  int voiceId;
+  int voiceId{-1};
 };
 
 enum SynthEventType { TRIGGER_ON, TRIGGER_OFF, PARAMETER_CHANGE };
@@ -170,6 +170,10 @@ struct SynthEvent {
  * All events following will have this offset added to their start time.
  Negative numbers are allowed.
  *
+ * Long sequences can be compiled to a binary file with compileSequence() and
+ * played with playCompiledSequence(). The compiled file is memory mapped and
+ * events are dispatched directly from the mapping, avoiding parsing and per
+ * event allocation. See CompiledSequence.
  *
  */
 
@@ -179,9 +183,13 @@ public:
     mMasterMode = masterMode;
     mInternalSynth = std::make_unique<PolySynth>(masterMode);
     registerSynth(*mInternalSynth.get());
+    reserveEventStorage();
   }
 
-  SynthSequencer(PolySynth &synth) { registerSynth(synth); }
+  SynthSequencer(PolySynth &synth) {
+    registerSynth(synth);
+    reserveEventStorage();
+  }
 
   ~SynthSequencer() {
     stopSequence();
@@ -213,6 +221,8 @@ public:
    * insert events on the fly, use addVoice() or use triggerOn() directly on
    * the PolySynth
    *
+   * Events whose start time has already passed are skipped.
+   *
    * The TSynthVoice template must be a class inherited from SynthVoice.
    */
   template <class TSynthVoice>
@@ -220,6 +230,9 @@ public:
 
   /**
    * Insert configured voice into sequencer.
+   *
+   * Can be called from any thread while the sequencer is running. Events are
+   * passed through a lock free queue and sorted on the rendering thread.
    */
   template <class TSynthVoice>
   void addVoice(TSynthVoice *voice, double startTime, double duration = -1);
@@ -251,6 +264,10 @@ public:
   bool verbose() { return mVerbose; }
   void verbose(bool verbose) { mVerbose = verbose; }
 
+  /// Number of voices turned off early because the pending trigger offs
+  /// filled their reserved storage
+  uint64_t forcedTriggerOffs() const { return mForcedTriggerOffs; }
+
   void setTempo(float tempo) { mNormalizedTempo = tempo / 60.; }
 
   bool playSequence(std::string sequenceName = "", float startTime = 0.0f);
@@ -266,12 +283,49 @@ public:
                                               double timeOffset = 0,
                                               double timeScale = 1.0);
 
+  /**
+   * @brief Read a sequence file into a vector
+   * @return the events sorted by start time
+   *
+   * Same as loadSequence(), without building a list.
+   */
+  std::vector<SynthSequencerEvent>
+  loadSequenceEvents(std::string sequenceName, double timeOffset = 0,
+                     double timeScale = 1.0);
+
   /**
    * @brief play the event list provided all other events in list are discarded
    */
+  void playEvents(std::vector<SynthSequencerEvent> events,
+                  double timeOffset = 0.1);
+
   void playEvents(std::list<SynthSequencerEvent> events,
                   double timeOffset = 0.1);
 
+  /**
+   * @brief Compile a text sequence to the binary format
+   * @param sequenceName name of the sequence in the sequencer directory
+   * @return true if the compiled file was written
+   *
+   * The compiled file is written next to the text file, with the extension
+   * ".synthSequenceBin".
+   */
+  bool compileSequence(std::string sequenceName);
+
+  /**
+   * @brief Play a sequence compiled with compileSequence()
+   * @param sequenceName name of the sequence in the sequencer directory
+   * @param startTime
+   * @return false if the compiled sequence could not be opened
+   *
+   * Replaces any sequence currently playing. Voices for events are acquired
+   * as they are dispatched. Events with only numeric p-fields are dispatched
+   * without allocation, events with string p-fields allocate their fields.
+   */
+  bool playCompiledSequence(std::string sequenceName, float startTime = 0.0f);
+
+  std::string buildCompiledPath(std::string sequenceName);
+
   std::vector<std::string> getSequenceList();
 
   double getSequenceDuration(std::string sequenceName);
@@ -299,6 +353,11 @@ public:
 
   void operator<<(PolySynth &synth) { return registerSynth(synth); }
 
+protected:
+  // Guards the event stores below. processEvents() never waits for it: when
+  // it is taken the block's events are dispatched with the next block.
+  std::mutex mEventLock;
+
 private:
   PolySynth *mPolySynth;
   std::unique_ptr<PolySynth> mInternalSynth;
@@ -309,10 +368,40 @@ private:
 
   double mFps{0}; // graphics frames per second
 
-  unsigned int mNextEvent{0};
-  std::list<SynthSequencerEvent>
-      mEvents; // List of events sorted by start time.
-  std::mutex mEventLock;
+  // Voice added with addVoice(). Queued by value so inserting and draining
+  // the queue don't allocate.
+  struct ScheduledVoice {
+    double startTime;
+    double duration;
+    SynthVoice *voice;
+  };
+
+  // Events are dispatched from two stores. Sequences are stored in a sorted
+  // array read through a cursor. Events added with addVoice() come through a
+  // lock free queue and are kept in a heap ordered by start time. The heap
+  // is reserved up front and only grows outside of processEvents().
+  std::vector<SynthSequencerEvent> mEvents; // Sorted by start time
+  size_t mNextEvent{0};
+  std::vector<ScheduledVoice> mEventHeap; // Min heap on start time
+  MPSCQueue<ScheduledVoice> mIncomingEvents{4096};
+  // Start of the blocks skipped because the lock was taken, and end of the
+  // last one. Only used by the rendering thread.
+  bool mBlockDeferred{false};
+  double mDeferredStartTime{0.0};
+  double mDeferredEndTime{0.0};
+  // Compiled sequence read through its own cursor. Voice type ids are looked
+  // up once per voice name when the sequence is opened.
+  std::unique_ptr<CompiledSequence> mCompiledSequence;
+  size_t mNextCompiledEvent{0};
+  std::vector<int> mCompiledTypeIds;
+
+  struct PendingTriggerOff {
+    double time;
+    int voiceId;
+  };
+  std::vector<PendingTriggerOff> mPendingTriggerOffs; // Min heap on time
+  std::atomic<uint64_t> mForcedTriggerOffs{0};
+
   std::mutex mLoadingLock;
   bool mPlaying{false};
 
@@ -338,7 +427,31 @@ private:
   // CPU processing thread. Used when TIME_MASTER_CPU
   std::shared_ptr<std::thread> mCpuThread;
 
+  // fps is the number of rendering frames per second of sequence time, which
+  // runs faster than real time by the tempo
   void processEvents(double blockStartTime, double fps);
+
+  void reserveEventStorage();
+
+  // Queue a voice for the rendering thread. Falls back to locking when the
+  // queue is full.
+  void insertEvent(const ScheduledVoice &event);
+
+  // These must be called with mEventLock held
+  void pushHeapEvent(const ScheduledVoice &event);
+  void popHeapEvent();
+  void dispatchEvent(SynthSequencerEvent &event, double blockStartTime,
+                     double fps);
+  void dispatchVoice(const ScheduledVoice &event, double blockStartTime,
+                     double fps);
+  void dispatchCompiledEvent(const CompiledSequence::Event &event,
+                             double blockStartTime, double fps);
+  void scheduleTriggerOff(double time, int voiceId);
+  void releaseEventVoice(SynthSequencerEvent &event);
+  bool compiledEventsPending() {
+    return mCompiledSequence && mNextCompiledEvent < mCompiledSequence->size();
+  }
+  bool eventsPending();
 };
 
 //  Implementations -------------
@@ -355,17 +468,7 @@ TSynthVoice &SynthSequencer::add(double startTime, double duration) {
 template <class TSynthVoice>
 void SynthSequencer::addVoice(TSynthVoice *voice, double startTime,
                               double duration) {
-  std::list<SynthSequencerEvent>::iterator insertedEvent;
-  std::unique_lock<std::mutex> lk(mEventLock);
-  // Insert into event list, sorted.
-  auto position = mEvents.begin();
-  while (position != mEvents.end() && position->startTime < startTime) {
-    position++;
-  }
-  insertedEvent = mEvents.insert(position, SynthSequencerEvent());
-  insertedEvent->startTime = startTime;
-  insertedEvent->duration = duration;
-  insertedEvent->voice = voice;
+  insertEvent({startTime, duration, voice});
 }
 
 template <class TSynthVoice>
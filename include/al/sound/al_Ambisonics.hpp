@@ -52,6 +52,7 @@
 #include <stdio.h>
 
 #include <iostream>
+#include <vector>
 
 #include "al/math/al_Vec.hpp"
 #include "al/sound/al_Spatializer.hpp"
@@ -104,6 +105,11 @@
                  ambi_z =  gl_y;
 */
 
+// Highest supported order. Orders above 3 use ACN channel order and SN3D
+// normalization, as FuMa is only defined up to third order.
+#define AMBI_MAX_ORDER 15
+#define AMBI_MAX_CHANNELS ((AMBI_MAX_ORDER + 1) * (AMBI_MAX_ORDER + 1))
+
 namespace al {
 
 /// @defgroup Sound Sound
@@ -152,6 +158,20 @@ public:
   static void encodeWeightsFuMa(float *ws, int dim, int order, float x, float y,
                                 float z);
 
+  /// Compute spherical harmonic weights of any order up to AMBI_MAX_ORDER
+
+  /// Up to third order these are the FuMa weights from encodeWeightsFuMa().
+  /// Higher orders use ACN channel order and SN3D normalization in 3D, and
+  /// W followed by cos(mA)cos^m(E), sin(mA)cos^m(E) pairs in 2D. Harmonics
+  /// are computed with recurrences on the direction vector, without trig.
+  static void encodeWeights(float *ws, int dim, int order, float x, float y,
+                            float z);
+
+  /// Compute spherical harmonic weights of any order based on azimuth and
+  /// elevation in radians
+  static void encodeWeights(float *ws, int dim, int order, float azimuth,
+                            float elevation);
+
   /// Brute force 3rd order.  Weights must be of size 16.
   static void encodeWeightsFuMa16(float *weights, float azimuth,
                                   float elevation);
@@ -162,12 +182,18 @@ public:
   static int orderToChannelsH(int orderH);
   static int orderToChannelsV(int orderV);
 
+  /// Order for a number of channels in 2 or 3 dimensions, or -1 if no order
+  /// uses that many channels
+  static int channelsToOrder(int dim, int channels);
+
+  /// Order for the FuMa channel counts up to third order, or -1. Other counts
+  /// are ambiguous, e.g. 9 channels are 3D second order or 2D fourth order.
   static int channelsToOrder(int channels);
   static int channelsToDimensions(int channels);
 
 protected:
   int mDim;        // dimensions - 2d or 3d
-  int mOrder;      // order - 0th, 1st, 2nd, or 3rd
+  int mOrder;      // order - 0th up to AMBI_MAX_ORDER
   int mChannels;   // cached for efficiency
   float *mWeights; // weights for each ambi channel
 
@@ -192,6 +218,9 @@ public:
   /// @param[in ] enc				input Ambisonic domain buffers
   /// (non-interleaved)
   /// @param[in ] numDecFrames	number of frames in time domain buffers
+  ///
+  /// Runs as a matrix multiply blocked over speakers and frames, with SIMD
+  /// paths where available.
   virtual void decode(float *dec, const float *enc, int numDecFrames) const;
 
   float decodeWeight(int speaker, int channel) const {
@@ -239,13 +268,18 @@ protected:
   int mFlavor;          // decode flavor
   float *mDecodeMatrix; // deccoding matrix for each ambi channel & speaker
                         // cols are channels and rows are speakers
-  float mWOrder[5];     // weights for each order
+  float mWOrder[AMBI_MAX_ORDER + 1]; // weights for each order
+  // Decode matrix with channel weights applied, for speakers with non zero
+  // gain only. Rows are the speakers in mActiveSpeakers.
+  std::vector<float> mActiveMatrix;
+  std::vector<int> mActiveSpeakers;
   Speakers mSpeakers;
   // float * mPositions;		// speakers' azimuths + elevations
   // float * mFrame;			// an ambisonic channel frame used for
   // decode(int)
 
   void updateChanWeights();
+  void updateActiveMatrix();
   void resizeArrays(int numChannels, int numSpeakers);
 
   float decode(float *encFrame, int encNumChannels,
@@ -343,6 +377,24 @@ public:
                             const float &sample,
                             const unsigned int &frameIndex) override;
 
+  /// Accumulators hold B-format channels rather than speaker channels
+  virtual void prepareAccumulator(AudioIOData &accumulator,
+                                  const AudioIOData &io) override;
+
+  /// Encodes into the accumulator. The channel range is ignored, as encoding
+  /// does not depend on the speakers; only firstChannel == 0 renders.
+  virtual void renderToAccumulator(
+      AudioIOData &accumulator, const Pose &listeningPose,
+      const float *samples, const unsigned int &numFrames,
+      int firstChannel = 0, int lastChannel = -1,
+      SpatializerSource *source = nullptr) override;
+
+  /// Sums B-format channels [firstChannel, lastChannel) of the accumulators
+  /// into the ambisonic domain buffers to be decoded by finalize()
+  virtual void reduce(AudioIOData &io, AudioIOData *const *accumulators,
+                      size_t numAccumulators, int firstChannel = 0,
+                      int lastChannel = -1) override;
+
   virtual void finalize(AudioIOData &io) override;
 
   virtual void print(std::ostream &stream = std::cout) override;
@@ -365,6 +417,16 @@ inline int AmbiBase::orderToChannels(int dim, int order) {
 inline int AmbiBase::orderToChannelsH(int orderH) { return (orderH << 1) + 1; }
 inline int AmbiBase::orderToChannelsV(int orderV) { return orderV * orderV; }
 
+inline int AmbiBase::channelsToOrder(int dim, int channels) {
+  // 3D uses (order + 1)^2 channels, 2D uses 2 * order + 1
+  int order = dim == 2 ? (channels - 1) / 2 : channelsToUniformOrder(channels);
+  if (channels > 0 && order <= AMBI_MAX_ORDER &&
+      orderToChannels(dim, order) == channels) {
+    return order;
+  }
+  return -1;
+}
+
 inline int AmbiBase::channelsToOrder(int channels) {
   int order = -1;
   switch (channels) {
@@ -439,16 +501,16 @@ inline float AmbiDecode::decode(float *encFrame, int encNumChannels,
 //}
 
 inline void AmbiEncode::direction(float az, float el) {
-  AmbiBase::encodeWeightsFuMa(mWeights, mDim, mOrder, az, el);
+  AmbiBase::encodeWeights(mWeights, mDim, mOrder, az, el);
 }
 
 inline void AmbiEncode::direction(Vec3f vector) {
-  AmbiBase::encodeWeightsFuMa(mWeights, mDim, mOrder, vector.x, vector.y,
-                              vector.z);
+  AmbiBase::encodeWeights(mWeights, mDim, mOrder, vector.x, vector.y,
+                          vector.z);
 }
 
 inline void AmbiEncode::direction(float x, float y, float z) {
-  AmbiBase::encodeWeightsFuMa(mWeights, mDim, mOrder, x, y, z);
+  AmbiBase::encodeWeights(mWeights, mDim, mOrder, x, y, z);
 }
 
 inline void AmbiEncode::encode(float *ambiChans, int numFrames, int timeIndex,
@@ -460,6 +522,12 @@ inline void AmbiEncode::encode(float *ambiChans, int numFrames, int timeIndex,
     ambiChans[chanindex * numFrames + timeIndex] +=                            \
         weights()[chanindex] * timeSample;
   int ch = channels() - 1;
+  if (ch > 15) {
+    for (int c = 0; c <= ch; ++c) {
+      ambiChans[c * numFrames + timeIndex] += weights()[c] * timeSample;
+    }
+    return;
+  }
   switch (ch) {
     CS(15)
     CS(14)
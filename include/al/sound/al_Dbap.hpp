@@ -73,12 +73,31 @@ class Dbap : public Spatializer {
                             const float* samples,
                             const unsigned int& numFrames) override;
 
+  /// Speaker gains are cached in source and only recomputed when the
+  /// listening pose or the focus changes. When they change, the gains ramp
+  /// linearly from the previous block's gains across the block to avoid
+  /// zipper noise.
+  /// Partial speaker ranges passed to renderToAccumulator() use the cache
+  /// only after a full render has sized it.
+  virtual void renderSource(AudioIOData& io, const Pose& listeningPose,
+                            const float* samples, const unsigned int& numFrames,
+                            SpatializerSource& source) override;
+
   /// focus is an exponent determining the amplitude focus to nearby speakers.
 
   /// focus is (0, inf) with usable range typically [0.2, 5]. Default is 1.
   /// A denser speaker layout my benefit from a high focus > 1, and a sparse
   /// layout may benefit from focus < 1
-  void setFocus(float focus) { mFocus = focus; }
+  void setFocus(float focus) {
+    mFocus = focus;
+    mSettings++;  // Invalidates gains cached in sources
+  }
+
+  virtual void renderToAccumulator(
+      AudioIOData& accumulator, const Pose& listeningPose,
+      const float* samples, const unsigned int& numFrames,
+      int firstChannel = 0, int lastChannel = -1,
+      SpatializerSource* source = nullptr) override;
 
   void print(std::ostream& stream) override;
 
@@ -88,6 +107,19 @@ class Dbap : public Spatializer {
   unsigned int mDeviceChannels[DBAP_MAX_NUM_SPEAKERS];
   size_t mNumSpeakers;
   float mFocus;
+  unsigned int mSettings{0};
+
+  Vec3d relativePosition(const Pose& listeningPose);
+
+  float speakerGain(const Vec3d& relpos, unsigned int speaker) {
+    double dist = (relpos - mSpeakerVecs[speaker]).mag();
+    return powf(1.0f / (1.0f + float(dist)), mFocus);
+  }
+
+  void renderSpeakers(AudioIOData& io, const Pose& listeningPose,
+                      const float* samples, const unsigned int& numFrames,
+                      unsigned int firstChannel, unsigned int lastChannel,
+                      SpatializerSource* source);
 };
 
 }  // namespace al
@@ -103,6 +103,14 @@ class Lbap : public Spatializer {
                     const float *samples,
                     const unsigned int &numFrames) override;
 
+  /// Ring speaker indices do not map to a single contiguous range, so a
+  /// partial channel range renders all rings when firstChannel is 0.
+  /// The accumulator's temp buffer is used as scratch for the ring gains.
+  void renderToAccumulator(AudioIOData &accumulator, const Pose &listeningPose,
+                           const float *samples, const unsigned int &numFrames,
+                           int firstChannel = 0, int lastChannel = -1,
+                           SpatializerSource *source = nullptr) override;
+
   void print(std::ostream &stream = std::cout) override;
 
  private:
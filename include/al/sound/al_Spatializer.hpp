@@ -43,6 +43,7 @@
 */
 
 #include <iostream>
+#include <vector>
 
 #include "al/io/al_AudioIOData.hpp"
 #include "al/sound/al_Speaker.hpp"
@@ -50,6 +51,31 @@
 
 namespace al {
 
+/// State a spatializer can keep for a single source between blocks
+///
+/// The caller owns one of these for each source (e.g. each output channel of
+/// a voice) and passes it with every block, so it is only ever touched by the
+/// thread rendering that source. Spatializers use it to skip work when the
+/// source has not moved and to smooth changes across the block.
+///
+/// @ingroup Sound
+struct SpatializerSource {
+  /// Forget cached state, e.g. when the source is reused for a new sound, so
+  /// the next block is rendered without smoothing from the previous one.
+  void reset() {
+    valid = false;
+    gains.clear();
+    cachedIndex = -1;
+  }
+
+  int id{-1};               ///< Caller defined key, e.g. the voice id
+  bool valid{false};        ///< True once pose and gains hold a full block
+  Pose pose;                ///< Listening pose of the last block
+  std::vector<float> gains; ///< Speaker gains at the end of the last block
+  unsigned int settings{0}; ///< Spatializer settings version of the gains
+  int cachedIndex{-1};      ///< Spatializer specific, e.g. last VBAP triplet
+};
+
 /// Abstract class for all spatializers: Ambisonics, DBAP, VBAP, etc.
 ///
 /// @ingroup Sound
@@ -74,6 +100,15 @@ public:
                             const float *samples,
                             const unsigned int &numFrames) = 0;
 
+  /// Render audio buffer in position for a source that persists across
+  /// blocks
+
+  /// source lets the spatializer cache work between blocks and smooth changes
+  /// in position. The default ignores it and calls renderBuffer().
+  virtual void renderSource(AudioIOData &io, const Pose &listeningPose,
+                            const float *samples, const unsigned int &numFrames,
+                            SpatializerSource &source);
+
   /// Render audio sample in position
   virtual void renderSample(AudioIOData &io, const Pose &listeningPose,
                             const float &sample,
@@ -83,6 +118,52 @@ public:
   /// decode
   virtual void finalize(AudioIOData &io) {}
 
+  /// Configure a caller-owned accumulator for renderToAccumulator()
+
+  /// Sets the number of frames and output channels of the accumulator. By
+  /// default these match the device output channels in io. Bus and input
+  /// channels are left untouched. Must not be called from the audio thread.
+  virtual void prepareAccumulator(AudioIOData &accumulator,
+                                  const AudioIOData &io);
+
+  /// Render audio buffer in position into a caller-owned accumulator
+
+  /// Only the accumulator is written, so sources can be rendered from several
+  /// threads at once as long as each thread uses its own accumulator. The
+  /// accumulators are then summed into the output with reduce().
+  /// Rendering can be restricted to device channels in
+  /// [firstChannel, lastChannel), the same ranges reduce() sums, to split
+  /// very large speaker sets across threads. A negative lastChannel means
+  /// all channels. Spatializers that can't split their
+  /// speaker set render all speakers when firstChannel is 0 and nothing
+  /// otherwise.
+  /// If source is not null it is used as in renderSource().
+  virtual void renderToAccumulator(AudioIOData &accumulator,
+                                   const Pose &listeningPose,
+                                   const float *samples,
+                                   const unsigned int &numFrames,
+                                   int firstChannel = 0, int lastChannel = -1,
+                                   SpatializerSource *source = nullptr);
+
+  /// Sum accumulators into the output. Call before finalize()
+
+  /// Only accumulator channels in [firstChannel, lastChannel) are summed, so
+  /// the reduction can be split across threads too. A negative lastChannel
+  /// means all channels.
+  virtual void reduce(AudioIOData &io, AudioIOData *const *accumulators,
+                      size_t numAccumulators, int firstChannel = 0,
+                      int lastChannel = -1);
+
+  /// Add numSources buffers of numSamples each into dest
+  static void sumBuffers(float *dest, const float *const *sources,
+                         size_t numSources, size_t numSamples);
+
+  /// Add src into dest with a gain ramping linearly from startGain to
+  /// endGain. The gain reaches endGain on the last sample, so consecutive
+  /// blocks ramping between successive gains join without a step.
+  static void addRamped(float *dest, const float *src, size_t numSamples,
+                        float startGain, float endGain);
+
   /// Print out information about spatializer
   virtual void print(std::ostream &stream = std::cout) {}
 
@@ -37,6 +37,12 @@ class StereoPanner : public Spatializer {
                             const float* samples,
                             const unsigned int& numFrames) override;
 
+  virtual void renderToAccumulator(
+      AudioIOData& accumulator, const Pose& listeningPose,
+      const float* samples, const unsigned int& numFrames,
+      int firstChannel = 0, int lastChannel = -1,
+      SpatializerSource* source = nullptr) override;
+
  private:
   size_t numSpeakers;
 
@@ -44,6 +44,7 @@
         Ryan McGee, 2012, ryanmichaelmcgee@gmail.com
 */
 
+#include <array>
 #include <map>
 
 #include "al/math/al_Vec.hpp"
@@ -53,6 +54,8 @@
 #include "al/spatial/al_Pose.hpp"
 
 #define MAX_NUM_VBAP_TRIPLETS 512
+// Cells per cube face side in the direction to triplet lookup table
+#define VBAP_LOOKUP_RESOLUTION 16
 //#define MIN_VOLUME_TO_LENGTH_RATIO 0.01
 
 #define MIN_VOLUME_TO_LENGTH_RATIO 0.000001
@@ -108,6 +111,7 @@ class Vbap : public Spatializer {
   /// force triangulation in unusual situations (e.g. three rings on a
   /// sphere...) but it can also be used creatively to make an area in space
   /// be reassigned somewhere else, or to a wider number of speakers.
+  /// Must not be called while audio is being rendered.
   ///
   void makePhantomChannel(int channelIndex,
                           std::vector<unsigned int> assignedOutputs);
@@ -124,9 +128,22 @@ class Vbap : public Spatializer {
                             const float* samples,
                             const unsigned int& numFrames) override;
 
+  /// The triplet found for source is cached and tested first on the next
+  /// block, so a source that stays within a triplet needs no search
+  virtual void renderSource(AudioIOData& io, const Pose& listeningPose,
+                            const float* samples, const unsigned int& numFrames,
+                            SpatializerSource& source) override;
+
+  virtual void renderToAccumulator(
+      AudioIOData& accumulator, const Pose& listeningPose,
+      const float* samples, const unsigned int& numFrames,
+      int firstChannel = 0, int lastChannel = -1,
+      SpatializerSource* source = nullptr) override;
+
   virtual void print(std::ostream& stream = std::cout) override;
 
   /// Manually add a triple from indeces to speakers
+  /// Must not be called while audio is being rendered.
   void makeTriple(int s1, int s2, int s3 = -1);
 
   // Returns vector of triplets
@@ -139,7 +156,37 @@ class Vbap : public Spatializer {
   bool mIs3D;
   VbapOptions mOptions;
 
-  Vec3d computeGains(const Vec3d& vecA, const SpeakerTriple& speak);
+  // Direction to triplet lookup, built by compile(). Directions are mapped
+  // to a cell on a cube map (a square for 2D). Each cell lists every triplet
+  // that covers some part of it, packed into mLookupTriplets and indexed by
+  // mLookupOffsets, so only the triplets in one cell need to be tested.
+  std::vector<int> mLookupTriplets;
+  std::vector<size_t> mLookupOffsets;
+  // Phantom channel outputs for each triplet vertex, or nullptr
+  std::vector<std::array<const std::vector<unsigned int>*, 3>> mTripletPhantoms;
+
+  Vec3d computeGains(const Vec3d& vecA, const SpeakerTriple& speak) const;
+
+  bool gainsInTriplet(const Vec3d& gains, double tolerance = 0.0) const {
+    return gains[0] >= tolerance && gains[1] >= tolerance &&
+           (!mIs3D || gains[2] >= tolerance);
+  }
+
+  /// Cube map cell for a direction, or -1 for a zero vector
+  int lookupCell(const Vec3d& vec) const;
+  /// Build lookup table and phantom channel table
+  void buildLookup();
+
+  /// Find the triplet containing vec and its normalized gains. cachedIndex
+  /// is tested first if not negative. Returns -1 if no triplet was found.
+  int findTriplet(const Vec3d& vec, Vec3d& gains, int cachedIndex = -1) const;
+
+  /// Render only to output channels in [firstChannel, lastChannel), including
+  /// the outputs that phantom vertices are redistributed to
+  void renderSpeakers(AudioIOData& io, const Pose& listeningPose,
+                      const float* samples, const unsigned int& numFrames,
+                      int firstChannel, int lastChannel,
+                      SpatializerSource* source);
 
   /// 2D VBAP, Build internal list of speaker pairs
   void findSpeakerPairs(const Speakers& spkrs);
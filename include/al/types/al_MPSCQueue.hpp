@@ -0,0 +1,160 @@
+#ifndef INCLUDE_AL_MPSC_QUEUE_HPP
+#define INCLUDE_AL_MPSC_QUEUE_HPP
+
+/*	Allolib --
+    Multimedia / virtual environment application class library
+
+    Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012-2018. The Regents of the University of California.
+    All rights reserved.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are met:
+
+        Redistributions of source code must retain the above copyright notice,
+        this list of conditions and the following disclaimer.
+
+        Redistributions in binary form must reproduce the above copyright
+        notice, this list of conditions and the following disclaimer in the
+        documentation and/or other materials provided with the distribution.
+
+        Neither the name of the University of California nor the names of its
+        contributors may be used to endorse or promote products derived from
+        this software without specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+    AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+    IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+    ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+    LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+    CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+    SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+    INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+    CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+    ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+    POSSIBILITY OF SUCH DAMAGE.
+
+    File description:
+    Bounded lock free multiple producer single consumer queue
+*/
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace al {
+
+/**
+ * @brief Bounded lock free multiple-producer single-consumer queue.
+ *
+ * Any number of threads can push() concurrently while a single thread (e.g.
+ * the audio thread) calls pop(). Neither operation locks or allocates. Each
+ * slot carries a sequence number that tells producers and the consumer
+ * whether it is free or holds data for the current lap around the ring.
+ *
+ * The capacity is fixed at construction and rounded up to a power of two.
+ * push() returns false when the queue is full so the caller can decide what
+ * to do with the element.
+ *
+ * @ingroup Types
+ */
+template <class T> class MPSCQueue {
+public:
+  MPSCQueue(size_t capacity = 1024) { resize(capacity); }
+
+  MPSCQueue(const MPSCQueue &) = delete;
+  MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+  /**
+   * @brief Reallocate the queue, dropping its contents
+   *
+   * Not thread safe. Only call while no thread is pushing or popping.
+   */
+  void resize(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mSlots = std::vector<Slot>(size);
+    mMask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+      mSlots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    mHead.store(0, std::memory_order_relaxed);
+    mTail.store(0, std::memory_order_relaxed);
+  }
+
+  /// Number of elements the queue can hold
+  size_t capacity() const { return mMask + 1; }
+
+  /**
+   * @brief Add an element. Safe to call from any number of threads.
+   * @return false if the queue was full and the element was not added
+   */
+  bool push(const T &value) {
+    size_t pos = mHead.load(std::memory_order_relaxed);
+    while (true) {
+      Slot &slot = mSlots[pos & mMask];
+      size_t seq = slot.sequence.load(std::memory_order_acquire);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        // Slot is free on this lap. Claim it.
+        if (mHead.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          slot.value = value;
+          slot.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false; // Consumer has not released this slot yet
+      } else {
+        pos = mHead.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Remove the oldest element. Only call from the consumer thread.
+   * @return false if the queue was empty
+   *
+   * An element whose producer has claimed a slot but not finished writing it
+   * is treated as not yet available, so pop() never waits.
+   */
+  bool pop(T &value) {
+    size_t pos = mTail.load(std::memory_order_relaxed);
+    Slot &slot = mSlots[pos & mMask];
+    size_t seq = slot.sequence.load(std::memory_order_acquire);
+    if (intptr_t(seq) - intptr_t(pos + 1) < 0) {
+      return false;
+    }
+    value = slot.value;
+    slot.sequence.store(pos + mMask + 1, std::memory_order_release);
+    mTail.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// Approximate number of queued elements, for diagnostics
+  size_t size() const {
+    return mHead.load(std::memory_order_relaxed) -
+           mTail.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct Slot {
+    std::atomic<size_t> sequence{0};
+    T value;
+  };
+
+  std::vector<Slot> mSlots;
+  size_t mMask{0};
+  // Keep producer and consumer indices on separate cache lines
+  char mPad0[64];
+  std::atomic<size_t> mHead{0};
+  char mPad1[64];
+  std::atomic<size_t> mTail{0};
+};
+
+} // namespace al
+
+#endif // INCLUDE_AL_MPSC_QUEUE_HPP
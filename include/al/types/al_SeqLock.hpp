@@ -0,0 +1,142 @@
+#ifndef INCLUDE_AL_SEQLOCK_HPP
+#define INCLUDE_AL_SEQLOCK_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+        File description:
+        Wait-free reads of small values shared between threads
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace al {
+
+/**
+ * @brief Whether a type can be copied with memcpy
+ *
+ * Defaults to std::is_trivially_copyable. Specialize it to true for types
+ * that declare copy operations but hold no pointers or handles, so SeqLock
+ * can store them.
+ *
+ * @ingroup Types
+ */
+template <class T> struct IsBitwiseCopyable : std::is_trivially_copyable<T> {};
+
+/**
+ * @brief Single writer, many reader latch with wait-free reads
+ *
+ * The value is kept in two copies and a sequence number selects the copy
+ * readers use. store() bumps the sequence before updating each copy, so
+ * readers are always pointed at the copy not being written. load() only
+ * retries when a store() step finished while it was copying, so a reader
+ * never waits on a writer that was preempted half way through a store(),
+ * and never returns a torn value.
+ *
+ * Only one thread may call store() at a time. Serialize writers externally.
+ * T must satisfy IsBitwiseCopyable.
+ *
+ * @ingroup Types
+ */
+template <class T> class SeqLock {
+public:
+  SeqLock(const T &value = T()) {
+    static_assert(IsBitwiseCopyable<T>::value,
+                  "SeqLock requires a bitwise copyable type");
+    uint32_t words[kNumWords] = {0};
+    std::memcpy(words, &value, sizeof(T));
+    for (int copy = 0; copy < 2; copy++) {
+      for (size_t i = 0; i < kNumWords; i++) {
+        mCopies[copy][i].store(words[i], std::memory_order_relaxed);
+      }
+    }
+  }
+
+  SeqLock(const SeqLock &) = delete;
+  SeqLock &operator=(const SeqLock &) = delete;
+
+  /// Read the value. Safe to call from any thread, never blocks.
+  T load() const {
+    uint32_t words[kNumWords];
+    uint32_t sequence = mSequence.load(std::memory_order_acquire);
+    while (true) {
+      const std::atomic<uint32_t> *copy = mCopies[sequence & 1];
+      for (size_t i = 0; i < kNumWords; i++) {
+        words[i] = copy[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint32_t current = mSequence.load(std::memory_order_relaxed);
+      if (current == sequence) {
+        break;
+      }
+      sequence = current;
+      std::atomic_thread_fence(std::memory_order_acquire);
+    }
+    T value;
+    std::memcpy(static_cast<void *>(&value), words, sizeof(T));
+    return value;
+  }
+
+  /// Write the value. Only one thread may call this at a time.
+  void store(const T &value) {
+    uint32_t words[kNumWords] = {0};
+    std::memcpy(words, &value, sizeof(T));
+    uint32_t sequence = mSequence.load(std::memory_order_relaxed);
+    // An odd sequence points readers at copy 1 while copy 0 is written, an
+    // even one back at copy 0 while copy 1 is written
+    for (int copy = 0; copy < 2; copy++) {
+      sequence++;
+      mSequence.store(sequence, std::memory_order_release);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t i = 0; i < kNumWords; i++) {
+        mCopies[copy][i].store(words[i], std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  static const size_t kNumWords = (sizeof(T) + 3) / 4;
+
+  std::atomic<uint32_t> mSequence{0};
+  std::atomic<uint32_t> mCopies[2][kNumWords];
+};
+
+} // namespace al
+
+#endif // INCLUDE_AL_SEQLOCK_HPP
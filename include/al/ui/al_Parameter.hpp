@@ -54,16 +54,38 @@
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "al/math/al_Vec.hpp"
 #include "al/protocol/al_OSC.hpp"
 #include "al/spatial/al_Pose.hpp"
+#include "al/system/al_Time.hpp"
 #include "al/types/al_Color.hpp"
+#include "al/types/al_MPSCQueue.hpp"
+#include "al/types/al_SeqLock.hpp"
 #include "al/types/al_ValueSource.hpp"
 
 namespace al {
 
+// Vectors, quaternions and poses declare copy operations but only hold
+// numbers, so they can be stored in a SeqLock
+template <int N, class T>
+struct IsBitwiseCopyable<Vec<N, T>> : std::true_type {};
+template <class T> struct IsBitwiseCopyable<Quat<T>> : std::true_type {};
+template <> struct IsBitwiseCopyable<Pose> : std::true_type {};
+
+/**
+ * @brief Whether ParameterWrapper reads values of this type through a SeqLock
+ *
+ * Arithmetic types are excluded as Parameter, ParameterInt and ParameterBool
+ * access their value directly.
+ */
+template <class T>
+struct ParameterUsesSeqLock
+    : std::integral_constant<bool, IsBitwiseCopyable<T>::value &&
+                                       !std::is_arithmetic<T>::value> {};
+
 enum class TimeMasterMode {
   TIME_MASTER_AUDIO,
   TIME_MASTER_GRAPHICS,
@@ -175,9 +197,11 @@ public:
     std::swap(lhs.mType, rhs.mType);
   }
 
-  ParameterDataType type() { return mType; }
+  ParameterDataType type() const { return mType; }
 
-  template <typename type> type get() { return *static_cast<type *>(mData); }
+  template <typename type> type get() const {
+    return *static_cast<const type *>(mData);
+  }
 
   template <typename type> void set(type value) {
     if (std::is_same<type, float>::value) {
@@ -352,6 +376,12 @@ public:
 
   void set(ParameterMeta *p);
 
+  /**
+   * @brief Run change callbacks for a change queued in a
+   * ParameterCallbackQueue
+   */
+  virtual void runDeferredCallbacks() {}
+
 protected:
   std::string mFullAddress;
   std::string mParameterName;
@@ -361,6 +391,66 @@ protected:
   std::map<std::string, float> mHints; // Provide hints for behavior
 };
 
+/**
+ * @brief Runs parameter change callbacks in batches on a chosen thread
+ * @ingroup UI
+ *
+ * Parameters attached with ParameterWrapper::setCallbackQueue() do not call
+ * their change callbacks from set(). Instead set() stores the value and
+ * pushes the parameter on this lock free queue. process() then runs the
+ * callbacks of all queued parameters with their latest values, so several
+ * changes to a parameter between two calls to process() result in a single
+ * callback with the final value.
+ *
+ * Call process() from the thread that should run the callbacks, e.g. from
+ * onAnimate() to run them in the graphics domain, or call start() to run them
+ * on a worker thread.
+ *
+ * A parameter is in the queue at most once, so the capacity should be at
+ * least the number of parameters attached. Parameters must outlive the queue
+ * or its last call to process().
+ */
+class ParameterCallbackQueue {
+public:
+  ParameterCallbackQueue(size_t capacity = 1024) : mQueue(capacity) {}
+
+  ~ParameterCallbackQueue() { stop(); }
+
+  /// Queue a parameter that has changed. Lock free, safe from any thread.
+  bool push(ParameterMeta *param) {
+    if (!mQueue.push(param)) {
+      mOverflows.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Run callbacks of all parameters that changed since the last call
+   * @return number of parameters whose callbacks were run
+   *
+   * Only call from one thread at a time.
+   */
+  int process();
+
+  /// Call process() from a worker thread every period seconds
+  void start(al_sec period = 0.01);
+
+  void stop();
+
+  /// Number of changes dropped because the queue was full
+  uint64_t overflows() const {
+    return mOverflows.load(std::memory_order_relaxed);
+  }
+
+private:
+  MPSCQueue<ParameterMeta *> mQueue;
+  std::atomic<uint64_t> mOverflows{0};
+
+  std::atomic<bool> mRunning{false};
+  std::thread mThread;
+};
+
 /**
  * @brief The ParameterWrapper class provides a generic thread safe Parameter
  * class from the ParameterType template parameter
@@ -383,6 +473,10 @@ public:
    * function and doing try_lock() on the mutex to update a cached value in the
    * get() function. In the worst case this might incur some jitter when reading
    * the value.
+   *
+   * Types for which ParameterUsesSeqLock is true, like al::Vec3f, al::Pose
+   * and al::Color, are read through a SeqLock instead. get() never blocks and
+   * always returns the latest complete value.
    */
   ParameterWrapper(std::string parameterName, std::string group = "",
                    ParameterType defaultValue = ParameterType());
@@ -412,6 +506,7 @@ public:
 
     runChangeCallbacksSynchronous(value, src);
     setLocking(value);
+    queueDeferredCallbacks();
   }
 
   /**
@@ -438,11 +533,12 @@ public:
       value = (*mProcessCallback)(value); //, mProcessUdata);
     }
     if (blockReceiver) {
-      for (auto cb : mCallbacks) {
-        (*cb)(value);
-      }
+      runChangeCallbacksSynchronous(value, nullptr);
     }
     setLocking(value);
+    if (blockReceiver) {
+      queueDeferredCallbacks();
+    }
   }
 
   /**
@@ -453,6 +549,7 @@ public:
   inline void setLocking(ParameterType value) {
     mMutex->lock();
     mValue = value;
+    storeValue(value, UsesSeqLock());
     mMutex->unlock();
   }
 
@@ -577,6 +674,27 @@ public:
     }
   }
 
+  /**
+   * @brief Run change callbacks from a ParameterCallbackQueue
+   * @param queue the queue, or nullptr to call callbacks from set() again
+   *
+   * set() then only stores the value and queues the parameter, and the
+   * callbacks are called when the queue is processed, with the value the
+   * parameter has at that time. The ValueSource passed to set() is copied and
+   * given to callbacks registered with a source. Set the queue before the
+   * parameter is shared between threads.
+   */
+  void setCallbackQueue(ParameterCallbackQueue *queue) {
+    if (queue) {
+      mDeferred = std::make_unique<DeferredChange>();
+      mDeferred->queue = queue;
+    } else {
+      mDeferred.reset();
+    }
+  }
+
+  virtual void runDeferredCallbacks() override;
+
   bool hasChange() { return mChanged; }
 
   /**
@@ -631,16 +749,50 @@ protected:
 
   void runChangeCallbacksSynchronous(ParameterType &value, ValueSource *src);
 
+  /// Queue the parameter on its ParameterCallbackQueue, if it has one. Call
+  /// after storing the new value.
+  void queueDeferredCallbacks() {
+    if (mDeferred &&
+        !mDeferred->queued.exchange(true, std::memory_order_acq_rel)) {
+      if (!mDeferred->queue->push(this)) {
+        mDeferred->queued.store(false, std::memory_order_release);
+      }
+    }
+  }
+
   std::shared_ptr<ParameterProcessCallback> mProcessCallback;
   // void * mProcessUdata;
   // std::vector<void *> mCallbackUdata;
 
 private:
+  typedef ParameterUsesSeqLock<ParameterType> UsesSeqLock;
+  struct NoSeqLock {};
+
+  ParameterType getValue(std::true_type) { return mLatch.load(); }
+  ParameterType getValue(std::false_type);
+  void storeValue(const ParameterType &value, std::true_type) {
+    mLatch.store(value);
+  }
+  void storeValue(const ParameterType &value, std::false_type) {}
+
   // pointer to avoid having to explicitly declare copy/move
   std::unique_ptr<std::mutex> mMutex;
+  // Written under mMutex
+  typename std::conditional<UsesSeqLock::value, SeqLock<ParameterType>,
+                            NoSeqLock>::type mLatch;
 
   bool mChanged{false};
 
+  struct DeferredChange {
+    ParameterCallbackQueue *queue{nullptr};
+    std::atomic<bool> queued{false};
+    // The source is copied under a lock, only when set() is given one
+    std::atomic<bool> hasSource{false};
+    std::mutex sourceLock;
+    ValueSource source;
+  };
+  std::unique_ptr<DeferredChange> mDeferred;
+
 private:
   std::vector<std::shared_ptr<ParameterChangeCallback>> mCallbacks;
   std::vector<std::shared_ptr<ParameterChangeCallbackSrc>> mCallbacksSrc;
@@ -649,6 +801,14 @@ private:
       mMetaCallbacksSrc;
 };
 
+/// Shape of the ramp ParameterSmoother follows to a new Parameter value
+/// @ingroup UI
+enum class SmoothingMode {
+  NONE,       // Jump to the new value
+  LINEAR,     // Constant rate of change over the smoothing time
+  EXPONENTIAL // One pole decay, 60 dB closer to the target after the time
+};
+
 /**
  * @brief The Parameter class
  * @ingroup UI
@@ -708,6 +868,8 @@ public:
 
   Parameter(const al::Parameter &param) : ParameterWrapper<float>(param) {
     mValue = param.mValue;
+    mSmoothingMode = param.mSmoothingMode;
+    mSmoothingTime = param.mSmoothingTime;
     setDefault(param.getDefault());
   }
 
@@ -780,9 +942,137 @@ public:
     }
   }
 
+  /**
+   * @brief Set how ParameterSmoother objects ramp to new values
+   * @param mode shape of the ramp
+   * @param time duration of the ramp in seconds
+   *
+   * Smoothing only affects values read through a ParameterSmoother. get()
+   * always returns the last value set.
+   */
+  void smoothing(SmoothingMode mode, float time) {
+    mSmoothingMode = mode;
+    mSmoothingTime = time;
+  }
+
+  SmoothingMode smoothingMode() const { return mSmoothingMode; }
+  float smoothingTime() const { return mSmoothingTime; }
+
+private:
+  SmoothingMode mSmoothingMode{SmoothingMode::NONE};
+  float mSmoothingTime{0.0f};
+};
+
+/**
+ * @brief Reads a Parameter at audio rate, ramping to new values
+ * @ingroup UI
+ *
+ * Each reader of a Parameter, e.g. each SynthVoice, owns a ParameterSmoother.
+ * process() is called once per audio block. When the parameter has not
+ * changed and no ramp is in progress it returns false without writing to the
+ * buffer and value() holds the value for the whole block. Otherwise it fills
+ * the buffer with one value per sample following the ramp configured with
+ * Parameter::smoothing().
+ *
+ * @code
+  void onProcess(AudioIOData &io) override {
+    float gains[512];
+    bool ramping = mGainSmoother.process(gains, io.framesPerBuffer());
+    int frame = 0;
+    while (io()) {
+      float gain = ramping ? gains[frame++] : mGainSmoother.value();
+      io.out(0) += mOsc() * gain;
+    }
+  }
+ * @endcode
+ *
+ * Not thread safe. Only call process() from the thread reading the parameter.
+ */
+class ParameterSmoother {
+public:
+  ParameterSmoother() {}
+
+  ParameterSmoother(Parameter &param, double sampleRate = 44100.0) {
+    attach(param, sampleRate);
+  }
+
+  /// Read values from param and jump to its current value
+  void attach(Parameter &param, double sampleRate = 44100.0);
+
+  void sampleRate(double sampleRate) { mSampleRate = sampleRate; }
+  double sampleRate() const { return mSampleRate; }
+
+  /// Jump to the parameter's current value, e.g. when a voice is triggered
+  void reset();
+
+  /**
+   * @brief Advance by a block of samples
+   * @param buffer receives numFrames values if the value changes in the block
+   * @param numFrames number of samples in the block
+   * @return false if the value is constant over the block, if the block is
+   * empty or if no parameter is attached. The buffer is not written to and
+   * value() holds the value.
+   */
+  bool process(float *buffer, int numFrames);
+
+  /// Value at the end of the last block processed
+  float value() const { return mValue; }
+
+  /// Target value of the ramp in progress or the current value
+  float target() const { return mTarget; }
+
+  bool ramping() const { return mRemaining > 0; }
+
 private:
+  void startRamp(float target);
+
+  Parameter *mParameter{nullptr};
+  double mSampleRate{44100.0};
+  SmoothingMode mMode{SmoothingMode::NONE};
+  float mValue{0.0f};
+  float mTarget{0.0f};
+  float mIncrement{0.0f};   // Per sample for linear ramps
+  float mCoefficient{0.0f}; // Per sample for exponential ramps
+  int mRemaining{0};        // Samples left in the ramp
 };
 
+inline bool ParameterSmoother::process(float *buffer, int numFrames) {
+  if (!mParameter || numFrames <= 0) {
+    return false;
+  }
+  float target = mParameter->get();
+  if (target != mTarget) {
+    startRamp(target);
+  }
+  if (mRemaining == 0) {
+    return false;
+  }
+  int rampFrames = std::min(numFrames, mRemaining);
+  if (mMode == SmoothingMode::LINEAR) {
+    // No dependency between iterations, so this loop is vectorized
+    float start = mValue;
+    float increment = mIncrement;
+    for (int i = 0; i < rampFrames; i++) {
+      buffer[i] = start + increment * float(i + 1);
+    }
+  } else {
+    float end = mTarget;
+    float distance = mValue - end;
+    float coefficient = mCoefficient;
+    for (int i = 0; i < rampFrames; i++) {
+      distance *= coefficient;
+      buffer[i] = end + distance;
+    }
+  }
+  mRemaining -= rampFrames;
+  if (mRemaining == 0) {
+    buffer[rampFrames - 1] = mTarget;
+  }
+  mValue = buffer[rampFrames - 1];
+  std::fill(buffer + rampFrames, buffer + numFrames, mTarget);
+  return true;
+}
+
 /// ParamaterInt
 /// @ingroup UI
 class ParameterInt : public ParameterWrapper<int32_t> {
@@ -1450,6 +1740,7 @@ ParameterWrapper<ParameterType>::ParameterWrapper(std::string parameterName,
   mValue = defaultValue;
   mValueCache = defaultValue;
   mMutex = std::make_unique<std::mutex>();
+  storeValue(defaultValue, UsesSeqLock());
   setDefault(defaultValue);
   std::shared_ptr<ParameterChangeCallback> mAsyncCallback =
       std::make_shared<ParameterChangeCallback>(
@@ -1486,6 +1777,11 @@ ParameterWrapper<ParameterType>::ParameterWrapper(
 
 template <class ParameterType>
 ParameterType ParameterWrapper<ParameterType>::get() {
+  return getValue(UsesSeqLock());
+}
+
+template <class ParameterType>
+ParameterType ParameterWrapper<ParameterType>::getValue(std::false_type) {
   ParameterType current = mValueCache;
   if (mMutex->try_lock()) {
     current = mValue;
@@ -1527,9 +1823,44 @@ void ParameterWrapper<ParameterType>::registerMetaChangeCallback(
       std::make_shared<ParameterMetaChangeCallbackSrc>(cb));
 }
 
+template <class ParameterType>
+void ParameterWrapper<ParameterType>::runDeferredCallbacks() {
+  if (!mDeferred) {
+    return;
+  }
+  // Clear the flag before reading the value, so later changes queue again
+  mDeferred->queued.exchange(false, std::memory_order_acq_rel);
+  ValueSource source;
+  bool hasSource = mDeferred->hasSource.load(std::memory_order_acquire);
+  if (hasSource) {
+    std::lock_guard<std::mutex> lk(mDeferred->sourceLock);
+    source = mDeferred->source;
+  }
+  ParameterType value = get();
+  for (auto cb : mCallbacks) {
+    if (cb) {
+      (*cb)(value);
+    }
+  }
+  for (auto cb : mCallbacksSrc) {
+    (*cb)(value, hasSource ? &source : nullptr);
+  }
+}
+
 template <class ParameterType>
 void ParameterWrapper<ParameterType>::runChangeCallbacksSynchronous(
     ParameterType &value, ValueSource *src) {
+  if (mDeferred) {
+    // Callbacks run from the queue after the caller stores the value
+    if (src) {
+      std::lock_guard<std::mutex> lk(mDeferred->sourceLock);
+      mDeferred->source = *src;
+      mDeferred->hasSource.store(true, std::memory_order_release);
+    } else {
+      mDeferred->hasSource.store(false, std::memory_order_release);
+    }
+    return;
+  }
   for (auto cb : mCallbacks) {
     if (cb == nullptr) {
       // If first callback if nullptr, callbacks must be processed async
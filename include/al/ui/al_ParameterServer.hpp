@@ -42,9 +42,16 @@
         Andrés Cabrera mantaraya36@gmail.com
 */
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #include "al/protocol/al_OSC.hpp"
+#include "al/protocol/al_ReliableOSC.hpp"
 #include "al/ui/al_Parameter.hpp"
 #include "al/ui/al_ParameterBundle.hpp"
 
@@ -108,6 +115,66 @@ public:
     }
   }
 
+  /**
+   * @brief Notify all members of a multicast group with a single send
+   * @param group Multicast group address, e.g. "239.0.0.1"
+   * @param oscPort The network port so send the value changes on
+   * @param ttl Number of router hops packets can travel
+   * @param loopback Whether listeners on this machine receive the packets
+   * @param interfaceAddress Address of network interface to send from. If
+   * empty, the system chooses the interface.
+   *
+   * Receivers must join the group, e.g. with ParameterServer::listenMulticast()
+   */
+  void addMulticastListener(std::string group, uint16_t oscPort, int ttl = 1,
+                            bool loopback = true,
+                            std::string interfaceAddress = "") {
+    auto newListenerSocket = new osc::Send;
+
+    if (newListenerSocket->open(oscPort, group.c_str()) &&
+        newListenerSocket->multicastTTL(ttl) &&
+        newListenerSocket->multicastLoopback(loopback) &&
+        (interfaceAddress.size() == 0 ||
+         newListenerSocket->multicastInterface(interfaceAddress.c_str()))) {
+      mListenerLock.lock();
+      mOSCSenders.push_back(newListenerSocket);
+      mListenerLock.unlock();
+    } else {
+      delete newListenerSocket;
+      std::cerr << "ERROR: Could not register multicast listener " << group
+                << ":" << oscPort << std::endl;
+    }
+  }
+
+  /**
+   * @brief Notify a listener through a reliable ordered channel
+   * @param IPaddress The IP address of the listener
+   * @param oscPort The network port so send the value changes on
+   * @param nackPort Port where requests for lost packets are received. It is
+   * shared by all reliable listeners and set by the first call.
+   *
+   * Packets lost by the network are retransmitted when the listener asks for
+   * them. The listener must unwrap packets with osc::ReliableReceiver, which
+   * ParameterServer does. Value changes that came from the network are not
+   * forwarded to reliable listeners.
+   */
+  void addReliableListener(std::string IPaddress, uint16_t oscPort,
+                           uint16_t nackPort);
+
+  /**
+   * @brief Coalesce value change notifications
+   * @param window Time during which changes are collected. Only the last value
+   * for each address is sent. Pass 0 to send every change immediately, which
+   * is the default.
+   * @param maxPacketSize Largest OSC bundle sent to a listener
+   *
+   * Collected changes are packed into OSC bundles for each listener and sent
+   * from a background thread, so setting parameters never waits on a socket.
+   * Packets passed to send() are not coalesced.
+   */
+  void coalesceNotifications(al_sec window = 1.0 / 60.0,
+                             int maxPacketSize = 1400);
+
   /**
    * @brief Notify the listeners of value changes
    * @param OSCaddress The OSC path to send the value on
@@ -146,6 +213,9 @@ public:
       //      sender->port()
       //                << std::endl;
     }
+    if (mReliableSender) {
+      mReliableSender->send(p);
+    }
     mListenerLock.unlock();
   }
   void startHandshakeServer(std::string address = "0.0.0.0");
@@ -157,6 +227,7 @@ public:
 protected:
   std::mutex mListenerLock;
   std::vector<osc::Send *> mOSCSenders;
+  std::unique_ptr<osc::ReliableSender> mReliableSender;
   std::vector<std::pair<std::string, int>> mConnectedNodes;
 
   class HandshakeHandler : public osc::PacketHandler {
@@ -168,10 +239,58 @@ protected:
 
   osc::Recv mHandshakeServer;
 
+  // Must be called with mListenerLock held
+  template <class... Args>
+  void notifyReliable(ValueSource *src, const std::string &OSCaddress,
+                      const Args &... args) {
+    if (mReliableSender && !src) {
+      osc::Packet p;
+      p.addMessage(OSCaddress, args...);
+      mReliableSender->send(p);
+    }
+  }
+
   std::vector<std::pair<std::string, uint16_t>> mNodes;
   std::mutex mNodeLock;
 
 private:
+  struct PendingNotification {
+    std::string address;
+    std::string typeTags;
+    float floats[7];
+    int32_t intValue;
+    std::string stringValue;
+    bool hasSource;
+    ValueSource source;
+  };
+
+  // Returns false if notifications are not being coalesced
+  bool queueNotification(const std::string &address, const char *typeTags,
+                         const float *floats, int32_t intValue,
+                         const std::string &stringValue, ValueSource *src);
+  void flushNotifications();
+  void stopCoalescing();
+  void sendBundles(size_t count,
+                   const std::function<bool(const PendingNotification &)> &use,
+                   const std::function<void(osc::Packet &)> &send);
+
+  std::atomic<bool> mCoalescing{false};
+  al_sec mCoalesceWindow{0};
+  int mMaxPacketSize{1400};
+  // Protects mPending, mPendingCount and mPendingIndex
+  std::mutex mPendingLock;
+  // Entries are reused, only the first mPendingCount are valid
+  std::vector<PendingNotification> mPending;
+  size_t mPendingCount{0};
+  std::unordered_map<std::string, size_t> mPendingIndex;
+  // Only accessed by the thread flushing notifications
+  std::vector<PendingNotification> mSending;
+  std::unique_ptr<osc::Packet> mBundle;
+
+  std::mutex mCoalesceLock;
+  std::condition_variable mCoalesceCondition;
+  bool mCoalesceRunning{false};
+  std::thread mCoalesceThread;
 };
 
 /**
@@ -221,13 +340,27 @@ public:
    */
   bool listen(int oscPort = -1, std::string oscAddress = "");
 
+  /**
+   * Open and start receiving osc sent to a multicast group. Returns true on
+   * successful start.
+   */
+  bool listenMulticast(int oscPort, std::string group,
+                       std::string interfaceAddress = "");
+
   /**
    * Register a parameter with the server.
+   *
+   * The parameter's address is indexed on registration. Incoming messages
+   * are matched against the index, and OSC address patterns such as
+   * "/voice?/amp" or "/{amp,freq}" set every matching parameter.
    */
   ParameterServer &registerParameter(ParameterMeta &param);
 
   /**
    * Remove a parameter from the server.
+   *
+   * Waits for messages being dispatched, so the parameter is not set by the
+   * server once this returns and it can be destroyed.
    */
   void unregisterParameter(ParameterMeta &param);
 
@@ -339,6 +472,20 @@ protected:
                                std::vector<ParameterBundle *> bundleGroup,
                                std::string rootAddress);
 
+  // Setters for the addresses of registered parameters, and the handlers that
+  // get every message. A new index is built when registrations change and
+  // swapped in atomically, so onMessage() doesn't take mParameterLock.
+  struct AddressIndex {
+    typedef std::function<bool(osc::Message &m, ValueSource *src)> Setter;
+    std::unordered_map<std::string, std::vector<Setter>> setters;
+    std::vector<osc::PacketHandler *> handlers;
+    std::vector<std::pair<osc::MessageConsumer *, std::string>> consumers;
+  };
+
+  // Must be called with mParameterLock held
+  void rebuildAddressIndex();
+  static void addSetters(AddressIndex &index, ParameterMeta *param);
+
   std::vector<std::pair<std::string, uint16_t>>
       mNotifiers; // List of primary nodes
 
@@ -346,11 +493,14 @@ protected:
   std::vector<std::pair<osc::MessageConsumer *, std::string>> mMessageConsumers;
   osc::Recv *mServer;
   std::mutex mServerLock;
+  // Unwraps packets sent to addReliableListener() of a remote notifier
+  osc::ReliableReceiver mReliableReceiver{*this, 0};
 
   std::vector<ParameterMeta *> mParameters;
   std::map<std::string, std::vector<ParameterBundle *>> mParameterBundles;
   std::map<std::string, int> mCurrentActiveBundle;
   std::mutex mParameterLock;
+  std::shared_ptr<const AddressIndex> mAddressIndex;
 
   std::string mOscAddress;
   int mOscPort;
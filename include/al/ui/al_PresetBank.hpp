@@ -0,0 +1,207 @@
+#ifndef INCLUDE_AL_PRESETBANK_HPP
+#define INCLUDE_AL_PRESETBANK_HPP
+
+/*	Allocore --
+        Multimedia / virtual environment application class library
+
+        Copyright (C) 2009. AlloSphere Research Group, Media Arts & Technology,
+   UCSB. Copyright (C) 2012. The Regents of the University of California. All
+   rights reserved.
+
+        Redistribution and use in source and binary forms, with or without
+        modification, are permitted provided that the following conditions are
+   met:
+
+                Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+
+                Redistributions in binary form must reproduce the above
+   copyright notice, this list of conditions and the following disclaimer in the
+                documentation and/or other materials provided with the
+   distribution.
+
+                Neither the name of the University of California nor the names
+   of its contributors may be used to endorse or promote products derived from
+                this software without specific prior written permission.
+
+        THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+   IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+        IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+   PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+   CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+   EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+   PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+   OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+   WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+   OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+   ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+        File description:
+        Single file binary storage for presets and their preset map
+*/
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "al/io/al_File.hpp"
+#include "al/ui/al_Parameter.hpp"
+
+namespace al {
+
+/**
+ * @brief Stores many presets and their preset map in one binary file
+ * @ingroup UI
+ *
+ * The file starts with a schema listing each parameter address and its field
+ * types, and an index of preset names and preset map indices. Each preset is
+ * a fixed size record holding a bit per schema entry that marks the
+ * parameters it contains, followed by 4 bytes per field in schema order.
+ * Strings are stored once in a table at the end of the file.
+ *
+ * The file is memory mapped, so opening a bank only reads the schema and the
+ * index, and loading a preset only touches its record. Changes rewrite the
+ * whole file to a temporary file that is then renamed over the bank, so the
+ * bank on disk is always complete. Store several presets with a single call
+ * to store() when possible.
+ *
+ * Values are stored in the byte order of the machine that wrote the bank.
+ * Use exportPresets() and importPresets() to convert from and to the text
+ * format used by PresetHandler, e.g. to move a bank to a different machine.
+ *
+ * All functions are thread safe.
+ */
+class PresetBank {
+public:
+  typedef std::map<std::string, std::vector<ParameterField>> ParameterStates;
+
+  struct Preset {
+    std::string name;
+    int index; // Index in the preset map, -1 to keep the current one
+    ParameterStates values;
+  };
+
+  PresetBank() {}
+
+  PresetBank(std::string fileName) { open(fileName); }
+
+  PresetBank(const PresetBank &) = delete;
+  PresetBank &operator=(const PresetBank &) = delete;
+
+  /**
+   * @brief Open a bank file
+   * @return false if the file exists but is not a valid bank
+   *
+   * If the file doesn't exist the bank is empty and the file is created when
+   * the first preset is stored.
+   */
+  bool open(std::string fileName);
+
+  void close();
+
+  std::string fileName();
+
+  /// Number of presets in the bank
+  size_t size();
+
+  bool has(std::string name);
+
+  /// Names of all presets in the bank
+  std::vector<std::string> presetNames();
+
+  /**
+   * @brief Read the values of a preset
+   * @return false if there is no preset with this name
+   */
+  bool load(std::string name, ParameterStates &values);
+
+  /**
+   * @brief Add or replace a preset
+   * @param index index in the preset map. -1 keeps the current index of an
+   * existing preset.
+   *
+   * The fields of parameters already in the bank must have the same count
+   * and types as before, except that floats and integers are converted.
+   */
+  bool store(std::string name, const ParameterStates &values, int index = -1);
+
+  /// Add or replace several presets, writing the file once
+  bool store(const std::vector<Preset> &presets);
+
+  bool remove(std::string name);
+
+  /// Preset names by preset map index
+  std::map<int, std::string> presetMap();
+
+  /**
+   * @brief Replace the preset map
+   *
+   * Presets not in the map are kept without an index. Names in the map that
+   * are not in the bank are added as empty presets.
+   */
+  bool setPresetMap(const std::map<int, std::string> &presetsMap);
+
+  /// Incremented every time the bank is opened or changed
+  uint64_t generation();
+
+  /**
+   * @brief Add the text presets and preset map in a directory
+   * @param directory directory containing ".preset" files
+   * @param mapName name of the preset map file, without ".presetMap"
+   */
+  bool importPresets(std::string directory, std::string mapName = "default");
+
+  /// Write all presets and the preset map to a directory in the text format
+  bool exportPresets(std::string directory, std::string mapName = "default");
+
+private:
+  struct SchemaEntry {
+    std::string address;
+    std::string types; // 'f', 'i' or 's' per field
+    uint32_t firstField;
+  };
+
+  struct Record {
+    std::string name;
+    int index;
+  };
+
+  // These must be called with mLock held
+  void clear();
+  bool readIndex();
+  std::string readString(uint32_t offset);
+  const char *recordData(uint32_t record) {
+    return mRecordsData + size_t(record) * mRecordSize;
+  }
+  void loadRecord(uint32_t record, ParameterStates &values);
+  bool rewrite(const std::vector<Preset> &presets,
+               const std::set<std::string> &removed,
+               const std::map<int, std::string> *presetsMap);
+
+  std::mutex mLock;
+  std::string mFileName;
+  MappedFile mFile;
+  uint64_t mGeneration{0};
+
+  std::vector<SchemaEntry> mSchema;
+  std::unordered_map<std::string, uint32_t> mSchemaIndex;
+  uint32_t mFieldCount{0};
+  uint32_t mBitmapWords{0};
+  uint32_t mRecordSize{0};
+
+  std::vector<Record> mRecords;
+  std::unordered_map<std::string, uint32_t> mRecordIndex;
+
+  const char *mRecordsData{nullptr};
+  const char *mStrings{nullptr};
+  size_t mStringsSize{0};
+};
+
+} // namespace al
+
+#endif // INCLUDE_AL_PRESETBANK_HPP
@@ -45,15 +45,18 @@
 #include <condition_variable>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include "al/io/al_File.hpp"
 #include "al/protocol/al_OSC.hpp"
 #include "al/system/al_Time.hpp"
 #include "al/ui/al_Parameter.hpp"
 #include "al/ui/al_ParameterServer.hpp"
+#include "al/ui/al_PresetBank.hpp"
 
 namespace al {
 
@@ -158,6 +161,10 @@ public:
    *
    * A factor of 0 uses preset 1 and a factor of 1 uses preset 2. Values
    * in between result in linear interpolation of the values.
+   *
+   * The presets are read from the preset cache and the parameters they
+   * contain are resolved once per pair of presets, so this can be called at
+   * controller rate.
    */
   void setInterpolatedPreset(int index1, int index2, double factor);
 
@@ -283,6 +290,21 @@ public:
   void storeCurrentPresetMap(std::string mapName = "",
                              bool useSubDirectory = false);
 
+  /**
+   * @brief Store presets and the preset map in a single binary file
+   * @param fileName bank file, created when the first preset is stored. An
+   * empty string goes back to preset files in getCurrentPath().
+   * @return false if the file exists but is not a valid bank
+   *
+   * Use PresetBank::importPresets() to move existing preset files into a
+   * bank. The bank holds a single preset map, so the map name is ignored
+   * while a bank is used.
+   */
+  bool usePresetBank(std::string fileName);
+
+  /// The bank in use or nullptr when presets are stored as text files
+  PresetBank *presetBank() { return mBank.get(); }
+
   /**
    * @brief useCallbacks determines whether to call the internal callbacks
    * @param use
@@ -316,9 +338,16 @@ public:
    * values
    * @param name name of the preset to load
    * @return the state of the parameters in the loaded prese
+   *
+   * Preset files are parsed once and kept in memory. A file is read again
+   * when its modification time changes or when it is written through this
+   * class.
    */
   ParameterStates loadPresetValues(std::string name);
 
+  /// Drop all presets kept in memory, forcing them to be read again
+  void clearPresetCache();
+
   /**
    * @brief save list of parameter states into text preset file
    * @param values the values of parameters to store
@@ -329,6 +358,22 @@ public:
   bool savePresetValues(const ParameterStates &values, std::string presetName,
                         bool overwrite = true);
 
+  /// Parse a text preset file
+  static ParameterStates readPresetFile(std::string fileName,
+                                        bool verbose = false);
+
+  /// Write a text preset file through a temporary file that replaces it
+  static bool writePresetFile(std::string fileName, std::string presetName,
+                              const ParameterStates &values);
+
+  /// Parse a text preset map file
+  static std::map<int, std::string> readPresetMapFile(std::string fileName,
+                                                      bool verbose = false);
+
+  /// Write a text preset map file through a temporary file that replaces it
+  static bool writePresetMapFile(std::string fileName,
+                                 const std::map<int, std::string> &presetsMap);
+
   void setTimeMaster(TimeMasterMode masterMode);
 
   void startCpuThread();
@@ -343,6 +388,37 @@ private:
 
   ParameterStates getBundleStates(ParameterBundle *bundle, std::string id);
 
+  // Parameter values of two states resolved to registered parameters and
+  // packed into contiguous arrays, so each interpolation step is a single
+  // loop over floats followed by one set per parameter.
+  struct MorphPlan {
+    struct Target {
+      ParameterMeta *param;
+      Parameter *floatParameter; // Set directly when it has a single field
+      size_t offset;             // Index of the first field in the arrays
+      size_t count;
+      std::vector<ParameterField> fields; // Reused for setFields()
+    };
+    std::vector<Target> targets;
+    std::vector<float> startValues;
+    std::vector<float> endValues;
+    std::vector<float> values;
+
+    void apply(double factor);
+  };
+
+  void compileMorphPlan(const ParameterStates &startValues,
+                        const ParameterStates &endValues, MorphPlan &plan,
+                        bool useSkipList);
+
+  // Registered parameters by the address they have in preset files
+  std::map<std::string, ParameterMeta *> parameterAddresses();
+
+  std::shared_ptr<const ParameterStates> cachedPresetValues(std::string name);
+  static ParameterStates parsePreset(std::istream &f, bool verbose);
+
+  void invalidateInterpolationPlan();
+
   bool mVerbose{false};
   bool mUseCallbacks{true};
   std::string mRootDir;
@@ -360,10 +436,30 @@ private:
   // Protects file writing from this class. Only one file may be written at
   // a time.
   std::mutex mFileLock;
+  std::unique_ptr<PresetBank> mBank; // Presets are files when null
 
   std::mutex mTargetLock;
   ParameterStates mTargetValues;
   ParameterStates mStartValues;
+  MorphPlan mMorphPlan;
+
+  struct CachedPreset {
+    File::Stamp stamp;
+    bool settled{false}; // Modified long enough ago to trust the stamp
+    std::string text;    // Contents of files that are not settled
+    uint64_t generation{0}; // Of the bank for presets read from a bank
+    std::shared_ptr<const ParameterStates> values;
+  };
+  std::mutex mPresetCacheLock;
+  // By file path, or by "bank:" and name
+  std::map<std::string, CachedPreset> mPresetCache;
+
+  // Plan for setInterpolatedPreset(), valid while the cached presets it was
+  // compiled from are current
+  std::mutex mInterpolationLock;
+  std::shared_ptr<const ParameterStates> mInterpolationStart;
+  std::shared_ptr<const ParameterStates> mInterpolationEnd;
+  MorphPlan mInterpolationPlan;
 
   TimeMasterMode mTimeMasterMode{TimeMasterMode::TIME_MASTER_CPU};
 
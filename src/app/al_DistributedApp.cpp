@@ -80,6 +80,9 @@ void DistributedApp::prepare() {
         if (name() == host) { // Set configuration for this node when found
           rank = *table->get_as<int>("rank");
         }
+        if (*table->get_as<int>("rank") == 0) {
+          mPrimaryHost = host;
+        }
       } else {
         std::cout << "WARNING: node " << host.c_str() << " not given rank"
                   << std::endl;
@@ -132,6 +135,33 @@ void DistributedApp::prepare() {
   } else {
     additionalConfig["broadcastAddress"] = "127.0.0.1";
   }
+  // Optional multicast transport for state
+  if (appConfig.hasKey<std::string>("multicastGroup")) {
+    additionalConfig["multicastGroup"] = appConfig.gets("multicastGroup");
+  }
+  if (appConfig.hasKey<std::string>("multicastInterface")) {
+    additionalConfig["multicastInterface"] =
+        appConfig.gets("multicastInterface");
+  }
+  if (appConfig.hasKey<int64_t>("multicastTTL")) {
+    additionalConfig["multicastTTL"] =
+        std::to_string(appConfig.geti("multicastTTL"));
+  }
+  if (appConfig.hasKey<bool>("multicastLoopback")) {
+    additionalConfig["multicastLoopback"] =
+        appConfig.getb("multicastLoopback") ? "1" : "0";
+  }
+  if (appConfig.hasKey<bool>("frameSync")) {
+    additionalConfig["frameSync"] = appConfig.getb("frameSync") ? "1" : "0";
+  }
+  if (appConfig.hasKey<int64_t>("frameSyncPort")) {
+    additionalConfig["frameSyncPort"] =
+        std::to_string(appConfig.geti("frameSyncPort"));
+  }
+  if (appConfig.hasKey<double>("frameSyncTimeout")) {
+    additionalConfig["frameSyncTimeout"] =
+        std::to_string(appConfig.getd("frameSyncTimeout"));
+  }
 
   osc::Recv testServer;
   // probe to check if first port available, this will determine if this
@@ -238,6 +268,10 @@ void DistributedApp::start() {
     parameterServer().notifyAll();
   }
 
+  if (additionalConfig["frameSync"] == "1") {
+    startFrameSync();
+  }
+
   onInit();
 
   for (auto &domain : mDomainList) {
@@ -255,6 +289,9 @@ void DistributedApp::start() {
     mRunningDomains.pop();
   }
 
+  mFrameSyncServer.stop();
+  mFrameSyncClient.stop();
+
   onExit();
   mDefaultWindowDomain = nullptr;
   for (auto &domain : mDomainList) {
@@ -264,6 +301,52 @@ void DistributedApp::start() {
   }
 }
 
+void DistributedApp::startFrameSync() {
+  uint16_t port = additionalConfig.count("frameSyncPort") > 0
+                      ? std::stoi(additionalConfig["frameSyncPort"])
+                      : 34460;
+  al_sec timeout = additionalConfig.count("frameSyncTimeout") > 0
+                       ? std::stod(additionalConfig["frameSyncTimeout"])
+                       : 0.1;
+
+  std::function<void()> barrier;
+  if (isPrimary()) {
+    if (!mFrameSyncServer.start(port, "0.0.0.0")) {
+      std::cerr << "ERROR starting frame sync server. Frames not synchronized."
+                << std::endl;
+      return;
+    }
+    barrier = [this, timeout]() { mFrameSyncServer.frameBarrier(timeout); };
+  } else {
+    // Replicas on the primary's machine have rank 99
+    std::string host = rank == 99 ? "localhost" : mPrimaryHost;
+    if (!mFrameSyncClient.start(port, host.c_str())) {
+      std::cerr << "ERROR connecting frame sync to " << host << ":" << port
+                << ". Frames not synchronized." << std::endl;
+      return;
+    }
+    barrier = [this, timeout]() {
+      if (mFrameSyncClient.isConnected()) {
+        mFrameSyncClient.frameBarrier(timeout);
+      }
+    };
+  }
+
+  // Wait after drawing and before the buffers are swapped
+  auto addBarrier = [barrier](std::function<void()> &postOnDraw) {
+    auto previous = postOnDraw;
+    postOnDraw = [previous, barrier]() {
+      previous();
+      barrier();
+    };
+  };
+  if (omniRendering) {
+    addBarrier(omniRendering->postOnDraw);
+  } else if (mDefaultWindowDomain) {
+    addBarrier(mDefaultWindowDomain->postOnDraw);
+  }
+}
+
 std::string DistributedApp::name() { return al_get_hostname(); }
 
 void al::DistributedApp::registerDynamicScene(DynamicScene &scene) {
@@ -9,6 +9,7 @@
 #define VC_EXTRALEAN
 #define NOMINMAX
 #include <direct.h>  // _getcwd
+#include <io.h>      // _commit
 #include <windows.h> // TCHAR, LPCTSTR
 #define platform_getcwd _getcwd
 #ifndef PATH_MAX
@@ -16,6 +17,8 @@
 #endif
 #undef NOMINMAX
 #else
+#include <fcntl.h>    // open (POSIX)
+#include <sys/mman.h> // mmap (POSIX)
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h> // getcwd (POSIX)
@@ -31,6 +34,7 @@
 #include <fileapi.h>
 #endif
 
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <memory>
@@ -404,6 +408,60 @@ al_sec al::File::modificationTime(const char *path) {
   return 0.;
 }
 
+File::Stamp File::stamp(const std::string &path) {
+  Stamp stamp;
+#ifdef AL_WINDOWS
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data)) {
+    // 100 ns intervals since 1601
+    int64_t ticks = (int64_t(data.ftLastWriteTime.dwHighDateTime) << 32) |
+                    data.ftLastWriteTime.dwLowDateTime;
+    stamp.modified = (ticks - 116444736000000000LL) * 100;
+    stamp.size = (int64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+  }
+#else
+  struct stat s;
+  if (::stat(path.c_str(), &s) == 0) {
+#ifdef AL_OSX
+    const struct timespec &t = s.st_mtimespec;
+#else
+    const struct timespec &t = s.st_mtim;
+#endif
+    stamp.modified = int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+    stamp.size = int64_t(s.st_size);
+  }
+#endif
+  return stamp;
+}
+
+bool File::writeAtomic(const std::string &path, const char *data,
+                       size_t size) {
+  std::string tempPath = path + ".tmp";
+  FILE *f = fopen(tempPath.c_str(), "wb");
+  if (!f) {
+    return false;
+  }
+  bool ok = fwrite(data, 1, size, f) == size && fflush(f) == 0;
+#ifdef AL_WINDOWS
+  ok = ok && _commit(_fileno(f)) == 0;
+#else
+  ok = ok && fsync(fileno(f)) == 0;
+#endif
+  ok = fclose(f) == 0 && ok;
+  if (ok) {
+#ifdef AL_WINDOWS
+    ok = MoveFileExA(tempPath.c_str(), path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    ok = ::rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+  }
+  if (!ok) {
+    ::remove(tempPath.c_str());
+  }
+  return ok;
+}
+
 FilePath::FilePath(const std::string &file, const std::string &path)
     : mPath(path), mFile(file) {
   mPath = File::conformPathToOS(mPath);
@@ -449,6 +507,76 @@ PushDirectory::~PushDirectory() {
   mDirectoryLock.unlock();
 }
 
+bool MappedFile::open(const std::string &path) {
+  close();
+#ifdef AL_WINDOWS
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) {
+    CloseHandle(file);
+    return false;
+  }
+  void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data == nullptr) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  mFileHandle = file;
+  mMappingHandle = mapping;
+  mSize = size_t(fileSize.QuadPart);
+  mData = static_cast<const char *>(data);
+#else
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void *data =
+      mmap(nullptr, size_t(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  mSize = size_t(fileStat.st_size);
+  mData = static_cast<const char *>(data);
+#endif
+  return true;
+}
+
+void MappedFile::close() {
+  if (!mData) {
+    return;
+  }
+#ifdef AL_WINDOWS
+  UnmapViewOfFile(mData);
+  CloseHandle(mMappingHandle);
+  CloseHandle(mFileHandle);
+  mMappingHandle = nullptr;
+  mFileHandle = nullptr;
+#else
+  munmap(const_cast<char *>(mData), mSize);
+#endif
+  mData = nullptr;
+  mSize = 0;
+}
+
 // bool Dir::make(const std::string& path, bool recursive)
 bool Dir::make(const std::string &path) {
   // return Impl().make(path, -1, recursive);
@@ -67,6 +67,7 @@ public:
   bool listen() { return false; }
   bool accept(Socket::Impl *newSock) { return false; }
   bool opened() const { return false; }
+  intptr_t handle() const { return -1; }
   int recv(char *buffer, int maxlen, char *from) { return 0; }
   int send(const char *buffer, int len) { return 0; }
 };
@@ -513,6 +514,8 @@ public:
 
   bool opened() const { return INVALID_SOCKET != mSocketHandle; }
 
+  intptr_t handle() const { return (intptr_t)mSocketHandle; }
+
   size_t recv(char *buffer, size_t maxlen, char *from) {
     return ::recv(mSocketHandle, buffer, maxlen, 0);
   }
@@ -586,6 +589,8 @@ const std::string &Socket::address() const { return mImpl->address(); }
 
 bool Socket::opened() const { return mImpl->opened(); }
 
+intptr_t Socket::handle() const { return mImpl->handle(); }
+
 uint16_t Socket::port() const { return mImpl->port(); }
 
 al_sec Socket::timeout() const { return mImpl->timeout(); }
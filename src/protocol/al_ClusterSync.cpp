@@ -0,0 +1,327 @@
+#include "al/protocol/al_ClusterSync.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+using namespace al;
+
+namespace {
+
+// Pings sent quickly to nodes with fewer samples than this
+const size_t initialSamples = 8;
+const al_sec initialSyncInterval = 0.02;
+
+template <typename T> void append(std::vector<uint8_t> &message, T value) {
+  auto bytes = reinterpret_cast<const uint8_t *>(&value);
+  message.insert(message.end(), bytes, bytes + sizeof(T));
+}
+
+} // namespace
+
+void ClockEstimator::addSample(al_sec localSend, al_sec remote,
+                               al_sec localReceive) {
+  Sample sample;
+  sample.time = (localSend + localReceive) / 2.0;
+  sample.offset = remote - sample.time;
+  sample.roundTrip = localReceive - localSend;
+  if (sample.roundTrip < 0) {
+    return;
+  }
+  if (mSamples.size() >= mWindowSize) {
+    mSamples.erase(mSamples.begin());
+  }
+  mSamples.push_back(sample);
+
+  // Round trips longer than the median include queueing delays that make
+  // the offset asymmetric, so only the faster half is fitted
+  std::vector<Sample> best = mSamples;
+  std::sort(best.begin(), best.end(), [](const Sample &a, const Sample &b) {
+    return a.roundTrip < b.roundTrip;
+  });
+  best.resize((best.size() + 1) / 2);
+  mRoundTrip = best.front().roundTrip;
+
+  mReferenceTime = mSamples.back().time;
+  double meanTime = 0, meanOffset = 0;
+  for (auto &s : best) {
+    meanTime += s.time - mReferenceTime;
+    meanOffset += s.offset;
+  }
+  meanTime /= best.size();
+  meanOffset /= best.size();
+  double covariance = 0, variance = 0;
+  for (auto &s : best) {
+    double t = s.time - mReferenceTime - meanTime;
+    covariance += t * (s.offset - meanOffset);
+    variance += t * t;
+  }
+  auto span = std::minmax_element(
+      best.begin(), best.end(),
+      [](const Sample &a, const Sample &b) { return a.time < b.time; });
+  if (span.second->time - span.first->time > 1.0 && variance > 0) {
+    mDrift = covariance / variance;
+  } else {
+    mDrift = 0;
+  }
+  mOffset = meanOffset - mDrift * meanTime;
+}
+
+// -----------------------------------------------------------------------
+
+ClusterSyncServer::~ClusterSyncServer() { stop(); }
+
+bool ClusterSyncServer::start(uint16_t serverPort, const char *serverAddr) {
+  if (!CommandServer::start(serverPort, serverAddr)) {
+    return false;
+  }
+  mSyncRunning = true;
+  mSyncThread = std::thread(&ClusterSyncServer::syncLoop, this);
+  return true;
+}
+
+void ClusterSyncServer::stop() {
+  {
+    std::unique_lock<std::mutex> lk(mSyncLock);
+    mSyncRunning = false;
+  }
+  mSyncCondition.notify_all();
+  if (mSyncThread.joinable()) {
+    mSyncThread.join();
+  }
+  CommandServer::stop();
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  mNodes.clear();
+}
+
+void ClusterSyncServer::onConnection(Socket *newConnection) {
+  {
+    std::unique_lock<std::mutex> lk(mSyncLock);
+    mNodes[newConnection] = Node();
+  }
+  // Start sampling the new node right away
+  mSyncCondition.notify_all();
+}
+
+void ClusterSyncServer::onPong(Socket *src, al_sec sendTime, al_sec remoteTime,
+                               al_sec receiveTime) {
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  auto node = mNodes.find(src);
+  if (node != mNodes.end()) {
+    node->second.clock.addSample(sendTime, remoteTime, receiveTime);
+  }
+}
+
+void ClusterSyncServer::syncLoop() {
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  while (mSyncRunning) {
+    lk.unlock();
+    ping(mSyncInterval);
+    sendEstimates();
+    lk.lock();
+    bool initializing = std::any_of(
+        mNodes.begin(), mNodes.end(), [](const std::pair<Socket *const, Node> &n) {
+          return n.second.clock.samples() < initialSamples;
+        });
+    mSyncCondition.wait_for(
+        lk,
+        std::chrono::duration<double>(initializing ? initialSyncInterval
+                                                   : mSyncInterval),
+        [this]() { return !mSyncRunning; });
+  }
+}
+
+void ClusterSyncServer::sendEstimates() {
+  std::vector<std::shared_ptr<Socket>> nodes;
+  {
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    nodes = mServerConnections;
+  }
+  std::vector<uint8_t> message;
+  for (auto &socket : nodes) {
+    message.clear();
+    message.push_back(CLOCK_ESTIMATE);
+    {
+      std::unique_lock<std::mutex> lk(mSyncLock);
+      auto node = mNodes.find(socket.get());
+      if (node == mNodes.end() || node->second.clock.samples() == 0) {
+        continue;
+      }
+      append(message, node->second.clock.offset());
+      append(message, node->second.clock.drift());
+      append(message, node->second.clock.referenceTime());
+    }
+    sendMessage(message.data(), message.size(), socket.get());
+  }
+}
+
+bool ClusterSyncServer::frameBarrier(al_sec timeout) {
+  mFrame++;
+  bool allReady;
+  al_sec longestRoundTrip = 0;
+  {
+    std::unique_lock<std::mutex> lk(mSyncLock);
+    allReady = mSyncCondition.wait_for(
+        lk, std::chrono::duration<double>(timeout), [this]() {
+          std::unique_lock<std::mutex> connectionsLock(mConnectionsLock);
+          for (auto &socket : mServerConnections) {
+            auto node = mNodes.find(socket.get());
+            // Nodes that haven't seen a frame yet report frame 0, which is
+            // ready for whatever frame the server is at
+            if (node != mNodes.end() &&
+                (!node->second.ready || (node->second.readyFrame != 0 &&
+                                         node->second.readyFrame < mFrame))) {
+              return false;
+            }
+          }
+          return true;
+        });
+    for (auto &node : mNodes) {
+      if (node.second.ready && node.second.readyFrame == 0) {
+        // Used up by this frame, the node reports this frame + 1 next
+        node.second.readyFrame = mFrame;
+      }
+      longestRoundTrip =
+          std::max(longestRoundTrip, node.second.clock.roundTrip());
+    }
+  }
+  if (!allReady) {
+    mBarrierTimeouts++;
+  }
+
+  al_sec delay = mPresentDelay >= 0 ? mPresentDelay : longestRoundTrip + 0.001;
+  al_sec presentTime = localTime() + delay;
+  std::vector<uint8_t> message;
+  message.push_back(FRAME_GO);
+  append(message, mFrame);
+  append(message, presentTime);
+  sendMessage(message.data(), message.size());
+
+  al_sleep(presentTime - localTime());
+  return allReady;
+}
+
+std::vector<NodeSyncStats> ClusterSyncServer::stats() {
+  std::vector<std::shared_ptr<Socket>> nodes;
+  {
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    nodes = mServerConnections;
+  }
+  std::vector<NodeSyncStats> stats;
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  for (auto &socket : nodes) {
+    auto node = mNodes.find(socket.get());
+    if (node == mNodes.end()) {
+      continue;
+    }
+    auto &clock = node->second.clock;
+    stats.push_back({socket->address(), socket->port(),
+                     clock.offset(localTime()), clock.drift(),
+                     clock.roundTrip(), clock.samples(),
+                     node->second.readyFrame});
+  }
+  return stats;
+}
+
+bool ClusterSyncServer::processIncomingMessage(Message &message,
+                                               Socket *src) {
+  if (message.remainingBytes() >= 9 && message.data()[0] == FRAME_READY) {
+    message.getByte();
+    uint64_t frame = message.get<uint64_t>();
+    {
+      std::unique_lock<std::mutex> lk(mSyncLock);
+      auto node = mNodes.find(src);
+      if (node != mNodes.end()) {
+        node->second.readyFrame = frame;
+        node->second.ready = true;
+      }
+    }
+    mSyncCondition.notify_all();
+    return true;
+  }
+  return CommandServer::processIncomingMessage(message, src);
+}
+
+// -----------------------------------------------------------------------
+
+ClusterSyncClient::~ClusterSyncClient() { stop(); }
+
+bool ClusterSyncClient::start(uint16_t serverPort, const char *serverAddr) {
+  return CommandClient::start(serverPort, serverAddr);
+}
+
+bool ClusterSyncClient::frameBarrier(al_sec timeout) {
+  uint64_t frame;
+  {
+    std::unique_lock<std::mutex> lk(mSyncLock);
+    // Follow the server's frame numbers. Until the first frame arrives, any
+    // frame releases the barrier.
+    frame = mHaveFrame ? mFrame + 1 : 0;
+  }
+  std::vector<uint8_t> message;
+  message.push_back(FRAME_READY);
+  append(message, frame);
+  sendMessage(message.data(), message.size());
+
+  al_sec target;
+  {
+    std::unique_lock<std::mutex> lk(mSyncLock);
+    if (!mSyncCondition.wait_for(lk, std::chrono::duration<double>(timeout),
+                                 [&]() {
+                                   return mHaveFrame && mFrame >= frame;
+                                 })) {
+      return false;
+    }
+    // Local time is server time plus the offset estimated by the server
+    target = mPresentTime + mOffset + mDrift * (mPresentTime - mReferenceTime);
+  }
+  al_sleep(target - localTime());
+  mLastLateness = localTime() - target;
+  return true;
+}
+
+uint64_t ClusterSyncClient::frame() {
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  return mFrame;
+}
+
+al_sec ClusterSyncClient::serverTime() {
+  al_sec now = localTime();
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  return (now - mOffset + mDrift * mReferenceTime) / (1.0 + mDrift);
+}
+
+al_sec ClusterSyncClient::offset() {
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  return mOffset;
+}
+
+double ClusterSyncClient::drift() {
+  std::unique_lock<std::mutex> lk(mSyncLock);
+  return mDrift;
+}
+
+bool ClusterSyncClient::processIncomingMessage(Message &message,
+                                               Socket *src) {
+  if (message.remainingBytes() >= 25 &&
+      message.data()[0] == CLOCK_ESTIMATE) {
+    message.getByte();
+    std::unique_lock<std::mutex> lk(mSyncLock);
+    mOffset = message.get<al_sec>();
+    mDrift = message.get<double>();
+    mReferenceTime = message.get<al_sec>();
+    return true;
+  } else if (message.remainingBytes() >= 17 &&
+             message.data()[0] == FRAME_GO) {
+    message.getByte();
+    {
+      std::unique_lock<std::mutex> lk(mSyncLock);
+      mFrame = message.get<uint64_t>();
+      mPresentTime = message.get<al_sec>();
+      mHaveFrame = true;
+    }
+    mSyncCondition.notify_all();
+    return true;
+  }
+  return CommandClient::processIncomingMessage(message, src);
+}
@@ -2,7 +2,28 @@
 
 #include <algorithm>
 #include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <limits>
+
+#ifdef AL_WINDOWS
+#include <winsock2.h>
+#else
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifdef AL_LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 namespace Convert {
 auto to_bytes(std::uint16_t x) {
@@ -37,435 +58,796 @@ void from_bytes(const uint8_t *bytes, uint16_t &dest) {
 }
 
 void from_bytes(const uint8_t *bytes, uint32_t &dest) {
-  dest = (uint16_t(bytes[3]) << 8 * 3) | (uint16_t(bytes[4]) << 8 * 2) |
-         (uint16_t(bytes[1]) << 8 * 1) | (uint16_t(bytes[0]) << 8 * 0);
+  dest = (uint32_t(bytes[3]) << 8 * 3) | (uint32_t(bytes[2]) << 8 * 2) |
+         (uint32_t(bytes[1]) << 8 * 1) | (uint32_t(bytes[0]) << 8 * 0);
 }
 
 } // namespace Convert
 
 using namespace al;
 
-void CommandConnection::stop() {
-  mRunning = false;
-  mSocket.close();
-  for (auto &connection : mConnectionThreads) {
-    connection->join();
-  }
-  mState = BarrierState::NONE;
-}
+namespace {
 
-/// =====================================
-///
-std::vector<float> CommandServer::ping(double timeoutSecs) {
-  std::vector<float> pingTimes;
+#ifdef AL_WINDOWS
+typedef SOCKET SocketHandle;
+const SocketHandle invalidSocket = INVALID_SOCKET;
+bool wouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+std::string lastError() {
+  return "socket error " + std::to_string(WSAGetLastError());
+}
+void setNonBlocking(SocketHandle s) {
+  u_long on = 1;
+  ioctlsocket(s, FIONBIO, &on);
+}
+void setNoDelay(SocketHandle s) {
+  BOOL on = TRUE;
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char *)&on, sizeof(on));
+}
+#else
+typedef int SocketHandle;
+const SocketHandle invalidSocket = -1;
+bool wouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+std::string lastError() { return strerror(errno); }
+void setNonBlocking(SocketHandle s) {
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#ifdef AL_OSX
+  int on = 1;
+  setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+}
+// Commands are small and latency sensitive, so don't wait to coalesce them
+void setNoDelay(SocketHandle s) {
+  int on = 1;
+  setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+#endif
+
+#ifdef AL_LINUX
+const int sendFlags = MSG_NOSIGNAL;
+#else
+const int sendFlags = 0;
+#endif
+
+// Size of the length that precedes each message
+const uint32_t headerSize = 4;
+// Reads from one connection before other connections get a turn
+const int maxReadsPerWake = 16;
+
+std::shared_ptr<std::vector<uint8_t>> makeFrame(const uint8_t *message,
+                                                size_t length) {
+  auto frame = std::make_shared<std::vector<uint8_t>>(headerSize + length);
+  auto b = Convert::to_bytes(uint32_t(length));
+  std::copy(b.begin(), b.end(), frame->begin());
+  std::memcpy(frame->data() + headerSize, message, length);
+  return frame;
+}
 
-  std::unique_lock<std::mutex> lk(mConnectionsLock);
-  for (auto listener : mServerConnections) {
-    if (mVerbose) {
-      std::cout << "pinging " << listener->address() << ":" << listener->port()
+} // namespace
+
+struct CommandConnection::Connection {
+  std::shared_ptr<Socket> socket;
+  SocketHandle handle{invalidSocket};
+  bool handshaked{false};
+  // Set with mConnectionsLock held, read by the loop thread without it
+  std::atomic<bool> closed{false};
+  uint16_t version{0};
+  uint16_t revision{0};
+
+  // Received bytes. Bytes of consumed messages are reclaimed by moving the
+  // unread bytes to the front when the end of the buffer is reached.
+  std::vector<uint8_t> input = std::vector<uint8_t>(8192);
+  size_t inputStart{0};
+  size_t inputEnd{0};
+
+  // Frames waiting to be written, shared with other connections
+  std::deque<std::shared_ptr<std::vector<uint8_t>>> output;
+  size_t outputOffset{0}; // Bytes of output.front() already written
+  size_t queuedBytes{0};
+  bool writeRegistered{false};
+
+  al_sec pingTime{0};
+  al_sec pongTime{-1};
+};
+
+struct CommandConnection::Loop {
+  // Only changed by the loop thread, with mConnectionsLock held
+  std::vector<std::shared_ptr<Connection>> connections;
+  SocketHandle listener{invalidSocket};
+  std::thread thread;
+#ifdef AL_LINUX
+  int epoll{-1};
+  int wakeup{-1};
+#endif
+
+  bool open(SocketHandle listenerHandle) {
+    listener = listenerHandle;
+#ifdef AL_LINUX
+    epoll = epoll_create1(0);
+    wakeup = eventfd(0, EFD_NONBLOCK);
+    if (epoll < 0 || wakeup < 0) {
+      std::cerr << "ERROR creating epoll instance: " << lastError()
                 << std::endl;
+      close();
+      return false;
+    }
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epoll, EPOLL_CTL_ADD, wakeup, &event);
+    if (listener != invalidSocket) {
+      event.data.ptr = this;
+      epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event);
     }
-    auto startTime = al_steady_time();
-    unsigned char message[2] = {0, 0};
+#endif
+    return true;
+  }
 
-    message[0] = PING;
-    listener->send((const char *)message, 2);
-    size_t bytes = 0;
-    // FIXME need to check responses
+  void close() {
+#ifdef AL_LINUX
+    if (epoll >= 0) {
+      ::close(epoll);
+      epoll = -1;
+    }
+    if (wakeup >= 0) {
+      ::close(wakeup);
+      wakeup = -1;
+    }
+#endif
+    listener = invalidSocket;
+  }
 
-    //    auto endTime = al_steady_time();
-    //    if (bytes == 2 && message[0] == COMMAND_PONG) {
-    //      std::cout << "Pong from " << listener->address() << ":"
-    //                << listener->port() << " in " << (endTime - startTime) *
-    //                1000.0
-    //                << " ms" << std::endl;
-    //    } else {
-    //      std::cout << "No response from: " << listener->address() << ":"
-    //                << listener->port() << std::endl;
-    //      allResponded = false;
-    //    }
+  void add(const std::shared_ptr<Connection> &c) {
+    connections.push_back(c);
+#ifdef AL_LINUX
+    epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = c.get();
+    epoll_ctl(epoll, EPOLL_CTL_ADD, c->handle, &event);
+#endif
   }
 
-  return pingTimes;
-}
+  void remove(Connection &c) {
+#ifdef AL_LINUX
+    epoll_ctl(epoll, EPOLL_CTL_DEL, c.handle, nullptr);
+#endif
+  }
 
-size_t CommandServer::connectionCount() {
-  std::unique_lock<std::mutex> lk(mConnectionsLock);
-  size_t numConnections = mServerConnections.size();
-  return numConnections;
-}
+  void watchWrite(Connection &c, bool write) {
+    c.writeRegistered = write;
+#ifdef AL_LINUX
+    epoll_event event;
+    event.events = write ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    event.data.ptr = &c;
+    epoll_ctl(epoll, EPOLL_CTL_MOD, c.handle, &event);
+#endif
+  }
 
-std::vector<std::pair<std::string, uint16_t>> CommandServer::connections() {
-  std::vector<std::pair<std::string, uint16_t>> cs;
-  std::unique_lock<std::mutex> lk(mConnectionsLock);
-  for (auto conn : mServerConnections) {
-    cs.push_back({conn->address(), conn->port()});
+  // Interrupt the wait for socket events. The select() fallback wakes up
+  // periodically instead.
+  void wake() {
+#ifdef AL_LINUX
+    uint64_t value = 1;
+    if (wakeup >= 0 && write(wakeup, &value, sizeof(value)) < 0) {
+      // Counter is already non-zero
+    }
+#endif
   }
-  return cs;
-}
+};
 
-bool CommandServer::start(uint16_t serverPort, const char *serverAddr) {
-  al_sec timeout = 0.5;
-  if (!mSocket.open(serverPort, serverAddr, timeout, al::Socket::TCP)) {
-    std::cerr << "ERROR opening port" << std::endl;
+CommandConnection::CommandConnection() : mLoop(std::make_unique<Loop>()) {}
+
+// Derived classes stop the loop before their part of the object is gone.
+// This only releases what is left, e.g. after a failed start().
+CommandConnection::~CommandConnection() { stop(); }
+
+bool CommandConnection::startLoop() {
+  if (mLoop->thread.joinable()) {
+    std::cerr << "ERROR: Connection already started" << std::endl;
     return false;
   }
-  if (!mSocket.bind()) {
-    std::cerr << "ERROR on bind" << std::endl;
+  auto handle = (SocketHandle)mSocket.handle();
+  setNonBlocking(handle);
+  if (!mLoop->open(mState == SERVER ? handle : invalidSocket)) {
     return false;
   }
-
-  if (!mSocket.listen()) {
-    std::cerr << "ERROR on listen" << std::endl;
-    return false;
+  if (mState == CLIENT) {
+    // The server connection is mSocket itself
+    auto c = std::make_shared<Connection>();
+    c->socket = std::shared_ptr<Socket>(&mSocket, [](Socket *) {});
+    c->handle = handle;
+    setNoDelay(handle);
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    mLoop->add(c);
   }
-
   mRunning = true;
-  mBootstrapServerThread = std::make_unique<std::thread>([&]() {
-    // Receive data
-    if (mVerbose) {
-      std::cout << "Server started" << std::endl;
+  mLoop->thread = std::thread(&CommandConnection::runLoop, this);
+  return true;
+}
+
+void CommandConnection::stop() {
+  mRunning = false;
+  if (mLoop->thread.joinable()) {
+    mLoop->wake();
+    mLoop->thread.join();
+  }
+  {
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    for (auto &c : mLoop->connections) {
+      c->closed = true;
+      c->socket->close();
     }
+    mLoop->connections.clear();
+    mServerConnections.clear();
+    mConnectionVersions.clear();
+  }
+  mConnectionsChanged.notify_all();
+  mSocket.close();
+  mLoop->close();
+  mState = BarrierState::NONE;
+}
 
-    while (mRunning) {
-      std::shared_ptr<Socket> incomingConnectionSocket =
-          std::make_shared<Socket>();
-      if (mSocket.accept(*incomingConnectionSocket)) {
-        if (mVerbose) {
-          std::cout << "Got Connection Request "
-                    << incomingConnectionSocket->address() << ":"
-                    << incomingConnectionSocket->port() << std::endl;
+void CommandConnection::runLoop() {
+  auto accept = [this]() {
+    while (true) {
+      auto socket = std::make_shared<Socket>();
+      if (!mSocket.accept(*socket)) {
+        break;
+      }
+      if (mVerbose) {
+        std::cout << "Got Connection Request " << socket->address() << ":"
+                  << socket->port() << std::endl;
+      }
+      auto c = std::make_shared<Connection>();
+      c->socket = socket;
+      c->handle = (SocketHandle)socket->handle();
+      setNonBlocking(c->handle);
+      setNoDelay(c->handle);
+      std::unique_lock<std::mutex> lk(mConnectionsLock);
+      mLoop->add(c);
+    }
+  };
+
+  while (mRunning) {
+#ifdef AL_LINUX
+    epoll_event events[64];
+    int count = epoll_wait(mLoop->epoll, events, 64, -1);
+    if (count < 0 && errno != EINTR) {
+      std::cerr << "ERROR waiting for connections: " << lastError()
+                << std::endl;
+      break;
+    }
+    for (int i = 0; i < count; i++) {
+      void *ptr = events[i].data.ptr;
+      if (!ptr) {
+        uint64_t value;
+        if (read(mLoop->wakeup, &value, sizeof(value)) < 0) {
+          // Already reset
         }
-        uint8_t message[8192];
-
-        int bytesRecv = incomingConnectionSocket->recv((char *)message, 8192);
-        if (bytesRecv > 0 && bytesRecv <= 8192) {
-          if (message[0] == HANDSHAKE) {
-            uint16_t version = 0;
-            uint16_t revision = 0;
-            if (bytesRecv >= 4) {
-              Convert::from_bytes((const uint8_t *)&message[1], version);
-              Convert::from_bytes((const uint8_t *)&message[3], revision);
-            }
+        continue;
+      }
+      if (ptr == mLoop.get()) {
+        accept();
+        continue;
+      }
+      Connection &c = *static_cast<Connection *>(ptr);
+      if (events[i].events & EPOLLOUT) {
+        std::unique_lock<std::mutex> lk(mConnectionsLock);
+        writeConnection(c);
+      }
+      if (!c.closed && events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        readConnection(c);
+      }
+    }
+#else
+    fd_set readable, writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    SocketHandle maxSocket = 0;
+    std::vector<std::shared_ptr<Connection>> connections;
+    {
+      std::unique_lock<std::mutex> lk(mConnectionsLock);
+      connections = mLoop->connections;
+      for (auto &c : connections) {
+        FD_SET(c->handle, &readable);
+        if (!c->output.empty()) {
+          FD_SET(c->handle, &writable);
+        }
+        maxSocket = std::max(maxSocket, c->handle);
+      }
+    }
+    if (mLoop->listener != invalidSocket) {
+      FD_SET(mLoop->listener, &readable);
+      maxSocket = std::max(maxSocket, mLoop->listener);
+    }
+    timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = 50000;
+    if (select(int(maxSocket) + 1, &readable, &writable, nullptr, &timeout) <=
+        0) {
+      continue;
+    }
+    if (mLoop->listener != invalidSocket &&
+        FD_ISSET(mLoop->listener, &readable)) {
+      accept();
+    }
+    for (auto &c : connections) {
+      if (FD_ISSET(c->handle, &writable)) {
+        std::unique_lock<std::mutex> lk(mConnectionsLock);
+        writeConnection(*c);
+      }
+      if (!c->closed && FD_ISSET(c->handle, &readable)) {
+        readConnection(*c);
+      }
+    }
+#endif
 
-            if (mVerbose) {
-              std::cout << "Handshake for "
-                        << incomingConnectionSocket->address() << ":"
-                        << incomingConnectionSocket->port() << std::endl;
-              std::cout << "Client reports protocol version " << version
-                        << " revision " << revision << std::endl;
+    // Drop closed connections and wait for writability only while data is
+    // queued
+    bool changed = false;
+    {
+      std::unique_lock<std::mutex> lk(mConnectionsLock);
+      auto &connections = mLoop->connections;
+      for (auto it = connections.begin(); it != connections.end();) {
+        Connection &c = **it;
+        if (c.closed) {
+          mLoop->remove(c);
+          for (size_t i = 0; i < mServerConnections.size(); i++) {
+            if (mServerConnections[i] == c.socket) {
+              mServerConnections.erase(mServerConnections.begin() + i);
+              mConnectionVersions.erase(mConnectionVersions.begin() + i);
+              break;
             }
+          }
+          c.socket->close();
+          c.output.clear();
+          c.queuedBytes = 0;
+          it = connections.erase(it);
+          changed = true;
+          continue;
+        }
+        if (c.output.empty() == c.writeRegistered) {
+          mLoop->watchWrite(c, !c.output.empty());
+        }
+        ++it;
+      }
+      if (changed && mState == CLIENT && connections.empty()) {
+        mRunning = false;
+      }
+    }
+    if (changed) {
+      mConnectionsChanged.notify_all();
+    }
+  }
 
-            message[0] = HANDSHAKE_ACK;
-            memcpy(message + 1, &mVersion, sizeof(uint16_t));
-            memcpy(message + 1 + sizeof(uint16_t), &mRevision,
-                   sizeof(uint16_t));
+  if (mVerbose) {
+    std::cout << (mState == SERVER ? "Server" : "Client") << " stopped"
+              << std::endl;
+  }
+}
 
-            auto bytesSent =
-                incomingConnectionSocket->send((const char *)message, 5);
-            if (bytesSent != 5) {
-              std::cerr << "ERROR sending handshake ack" << std::endl;
-            }
-            {
-              std::unique_lock<std::mutex> lk(mConnectionsLock);
-              mServerConnections.emplace_back(incomingConnectionSocket);
-              mConnectionVersions.emplace_back(
-                  std::pair<uint16_t, uint16_t>{version, revision});
-            }
+void CommandConnection::readConnection(Connection &c) {
+  for (int i = 0; i < maxReadsPerWake && !c.closed; i++) {
+    if (c.inputEnd == c.input.size()) {
+      if (c.inputStart > 0) {
+        std::memmove(c.input.data(), c.input.data() + c.inputStart,
+                     c.inputEnd - c.inputStart);
+        c.inputEnd -= c.inputStart;
+        c.inputStart = 0;
+      } else {
+        // A single message is larger than the buffer
+        c.input.resize(c.input.size() * 2);
+      }
+    }
+    auto bytes = ::recv(c.handle, (char *)c.input.data() + c.inputEnd,
+                        int(c.input.size() - c.inputEnd), 0);
+    if (bytes == 0) {
+      if (mVerbose) {
+        std::cout << "Connection closed by " << c.socket->address() << ":"
+                  << c.socket->port() << std::endl;
+      }
+      closeConnection(c);
+      break;
+    } else if (bytes < 0) {
+      if (!wouldBlock()) {
+        std::cerr << "ERROR receiving from " << c.socket->address() << ":"
+                  << c.socket->port() << ": " << lastError() << std::endl;
+        closeConnection(c);
+      }
+      break;
+    }
+    c.inputEnd += bytes;
+
+    while (c.inputEnd - c.inputStart >= headerSize && !c.closed) {
+      uint32_t length;
+      Convert::from_bytes(&c.input[c.inputStart], length);
+      if (length > mMaxMessageSize) {
+        std::cerr << __FILE__ << " : Message of " << length
+                  << " bytes exceeds maximum size. Closing connection to "
+                  << c.socket->address() << ":" << c.socket->port()
+                  << std::endl;
+        closeConnection(c);
+        break;
+      }
+      if (c.inputEnd - c.inputStart < headerSize + length) {
+        break;
+      }
+      uint8_t *data = &c.input[c.inputStart + headerSize];
+      c.inputStart += headerSize + length;
+      handleFrame(c, data, length);
+    }
+    if (c.inputStart == c.inputEnd) {
+      c.inputStart = c.inputEnd = 0;
+    }
+  }
+}
 
-            onConnection(incomingConnectionSocket.get());
-
-            mConnectionThreads.emplace_back(std::make_unique<std::thread>(
-                [&](std::shared_ptr<Socket> client) {
-                  uint8_t commandMessage[8192];
-                  size_t bufferSize = 0;
-                  while (mRunning) {
-                    size_t bytes = client->recv(
-                        (char *)(commandMessage + bufferSize), 4096);
-
-                    while (bytes > 0 && bytes < 4097) {
-                      Message message(commandMessage, bytes);
-                      if (mVerbose) {
-                        std::cout << "Server received message from "
-                                  << client->address() << ":" << client->port()
-                                  << std::endl;
-                      }
-                      if (!processIncomingMessage(message, client.get())) {
-                        std::cerr << __FILE__
-                                  << " : Server unable to process message("
-                                  << (int)commandMessage[0] << ") from client "
-                                  << client->address() << ":" << client->port()
-                                  << std::endl;
-                      } else {
-                        if (message.remainingBytes() > 0) {
-                          memcpy(commandMessage, message.data(),
-                                 message.remainingBytes());
-                          bufferSize = message.remainingBytes();
-                        } else {
-                          bufferSize = 0;
-                        }
-                      }
-                      bytes = client->recv(
-                          (char *)(commandMessage + bufferSize), 4096);
-                    }
-                    if (bytes != SIZE_MAX && bytes != 0) {
-                      std::cerr
-                          << __FILE__
-                          << " : Unexpected command size. Flushing buffer."
-                          << bytes << std::endl;
-                    }
-                  }
-
-                  if (mVerbose) {
-                    std::cout << "Client stopped" << std::endl;
-                  }
-                },
-                incomingConnectionSocket));
-          } else {
-            std::cerr << __FILE__ << ": Server unable to recognize message "
-                      << (int)message[0] << std::endl;
-          }
-        }
+void CommandConnection::handleFrame(Connection &c, uint8_t *data,
+                                    uint32_t length) {
+  if (length == 0) {
+    return;
+  }
+  if (!c.handshaked) {
+    if (mState == SERVER && data[0] == HANDSHAKE) {
+      if (length >= 5) {
+        Convert::from_bytes(&data[1], c.version);
+        Convert::from_bytes(&data[3], c.revision);
       }
+      if (mVerbose) {
+        std::cout << "Handshake for " << c.socket->address() << ":"
+                  << c.socket->port() << std::endl;
+        std::cout << "Client reports protocol version " << c.version
+                  << " revision " << c.revision << std::endl;
+      }
+      uint8_t ack[5] = {HANDSHAKE_ACK, 0, 0, 0, 0};
+      auto version = Convert::to_bytes(mVersion);
+      auto revision = Convert::to_bytes(mRevision);
+      std::copy(version.begin(), version.end(), ack + 1);
+      std::copy(revision.begin(), revision.end(), ack + 3);
+      {
+        std::unique_lock<std::mutex> lk(mConnectionsLock);
+        queueFrame(c, makeFrame(ack, 5), lk);
+        c.handshaked = true;
+        mServerConnections.emplace_back(c.socket);
+        mConnectionVersions.emplace_back(
+            std::pair<uint16_t, uint16_t>{c.version, c.revision});
+      }
+      mConnectionsChanged.notify_all();
+      onConnection(c.socket.get());
+    } else if (mState == CLIENT && data[0] == HANDSHAKE_ACK) {
+      if (length >= 5) {
+        Convert::from_bytes(&data[1], c.version);
+        Convert::from_bytes(&data[3], c.revision);
+      }
+      if (mVerbose) {
+        std::cout << "Client got handshake ack from " << c.socket->address()
+                  << ":" << c.socket->port() << std::endl;
+        std::cout << "Server reports protocol version " << c.version
+                  << " revision " << c.revision << std::endl;
+      }
+      {
+        std::unique_lock<std::mutex> lk(mConnectionsLock);
+        c.handshaked = true;
+      }
+      mConnectionsChanged.notify_all();
+      onConnection(c.socket.get());
+    } else {
+      std::cerr << __FILE__ << ": Unable to recognize handshake "
+                << (int)data[0] << " from " << c.socket->address() << ":"
+                << c.socket->port() << std::endl;
+      closeConnection(c);
     }
-    //    incomingConnectionSocket->close();
+    return;
+  }
 
+  if (mState == CLIENT && data[0] == PING) {
+    if (mVerbose) {
+      std::cout << "Client got ping request" << std::endl;
+    }
+    // Echo the server's send time and add the local time
+    uint8_t pong[17] = {PONG};
+    if (length >= 9) {
+      std::memcpy(pong + 1, data + 1, sizeof(al_sec));
+    }
+    al_sec now = localTime();
+    std::memcpy(pong + 9, &now, sizeof(al_sec));
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    queueFrame(c, makeFrame(pong, 17), lk);
+    return;
+  } else if (mState == SERVER && data[0] == PONG) {
     if (mVerbose) {
-      std::cout << "Server stopped" << std::endl;
+      std::cout << "Got pong for " << c.socket->address() << ":"
+                << c.socket->port() << std::endl;
     }
-  });
+    al_sec receiveTime = localTime();
+    {
+      std::unique_lock<std::mutex> lk(mConnectionsLock);
+      c.pongTime = al_steady_time();
+    }
+    mConnectionsChanged.notify_all();
+    if (length >= 17) {
+      al_sec sendTime, remoteTime;
+      std::memcpy(&sendTime, data + 1, sizeof(al_sec));
+      std::memcpy(&remoteTime, data + 9, sizeof(al_sec));
+      onPong(c.socket.get(), sendTime, remoteTime, receiveTime);
+    }
+    return;
+  }
 
-  mState = CommandConnection::SERVER;
-  return true;
+  Message message(data, length);
+  if (mVerbose) {
+    std::cout << (mState == SERVER ? "Server" : "Client")
+              << " received message from " << c.socket->address() << ":"
+              << c.socket->port() << std::endl;
+  }
+  if (!processIncomingMessage(message, c.socket.get())) {
+    std::cerr << __FILE__ << " : " << (mState == SERVER ? "Server" : "Client")
+              << " unable to process message(" << (int)data[0] << ") from "
+              << c.socket->address() << ":" << c.socket->port() << std::endl;
+  }
 }
 
-void CommandServer::stop() {
+void CommandConnection::closeConnection(Connection &c) {
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  c.closed = true;
+}
 
-  mRunning = false;
-  mSocket.close();
-  if (mBootstrapServerThread) {
-    mBootstrapServerThread->join();
+bool CommandConnection::queueFrame(
+    Connection &c, const std::shared_ptr<std::vector<uint8_t>> &frame,
+    std::unique_lock<std::mutex> &lk) {
+  if (c.closed) {
+    return false;
   }
-  {
-    std::unique_lock<std::mutex> lk(mConnectionsLock);
-    for (auto connectionSocket : mServerConnections) {
-      connectionSocket->close();
+  if (c.queuedBytes >= mSendQueueLimit) {
+    // Waiting on the loop thread would never finish
+    if (std::this_thread::get_id() != mLoop->thread.get_id()) {
+      mConnectionsChanged.wait_for(
+          lk, std::chrono::duration<double>(mSendTimeout), [&]() {
+            return c.closed || c.queuedBytes < mSendQueueLimit || !mRunning;
+          });
+    }
+    if (c.closed || c.queuedBytes >= mSendQueueLimit) {
+      std::cerr << "ERROR: Send queue full for " << c.socket->address() << ":"
+                << c.socket->port() << ". Message dropped." << std::endl;
+      return false;
     }
   }
-
-  for (auto &connection : mConnectionThreads) {
-    connection->join();
+  bool wasEmpty = c.output.empty();
+  c.output.push_back(frame);
+  c.queuedBytes += frame->size();
+  if (wasEmpty) {
+    writeConnection(c);
   }
-  mState = BarrierState::NONE;
+  if (!c.output.empty()) {
+    mLoop->wake();
+  }
+  return !c.closed;
 }
 
-uint16_t CommandServer::waitForConnections(uint16_t connectionCount,
-                                           double timeout) {
-  if (mState == BarrierState::SERVER) {
-    double targetTime = al_steady_time() + timeout;
-    double currentTime = al_steady_time();
-
-    //    size_t existingConnections = mServerConnections.size();
-    size_t existingConnections = 0;
-    mConnectionsLock.lock();
-    size_t totalConnections = mServerConnections.size();
-    mConnectionsLock.unlock();
-    while (targetTime >= currentTime) {
-      // TODO what should happen if there are disconnections instead of
-      // connections while this runs?
-      {
-        std::unique_lock<std::mutex> lk(mConnectionsLock);
-        totalConnections = mServerConnections.size();
+void CommandConnection::writeConnection(Connection &c) {
+  while (!c.output.empty() && !c.closed) {
+    auto &frame = *c.output.front();
+    auto bytes = ::send(c.handle, (const char *)frame.data() + c.outputOffset,
+                        int(frame.size() - c.outputOffset), sendFlags);
+    if (bytes < 0) {
+      if (!wouldBlock()) {
+        std::cerr << "ERROR sending to " << c.socket->address() << ":"
+                  << c.socket->port() << ": " << lastError()
+                  << std::endl;
+        c.closed = true;
+        mLoop->wake();
       }
-      // FIXME this could allow more connections through than requested.
-      // Should
-      // the number be treated as a maximum?
-      if (totalConnections - existingConnections < connectionCount) {
-        al_sleep(0.3);
-      } else {
-        return totalConnections - existingConnections;
-      }
-      currentTime = al_steady_time();
+      break;
+    }
+    c.outputOffset += bytes;
+    c.queuedBytes -= bytes;
+    if (c.outputOffset == frame.size()) {
+      c.output.pop_front();
+      c.outputOffset = 0;
     }
-    return totalConnections - existingConnections;
-  } else {
-    // TODO make sure clients connect
   }
-  return 0;
+  if (c.queuedBytes < mSendQueueLimit) {
+    mConnectionsChanged.notify_all();
+  }
 }
 
-bool CommandServer::sendMessage(uint8_t *message, size_t length,
-                                al::Socket *dst, al::ValueSource *src) {
-  bool ret = true;
+bool CommandConnection::sendMessage(uint8_t *message, size_t length,
+                                    Socket *dst, ValueSource *src) {
   if (length == 0) {
     return false;
   }
-
-  if (!dst) {
-
-    std::unique_lock<std::mutex> lk(mConnectionsLock);
-    for (auto connection : mServerConnections) {
-      if (!src || connection->address() != src->ipAddr ||
-          connection->port() != src->port) {
-        if (mVerbose) {
-          std::cout << "Sending message to " << connection->address() << ":"
-                    << connection->port() << std::endl;
-        }
-        ret &= connection->send((const char *)message, length) == length;
+  auto frame = makeFrame(message, length);
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  // Queueing can wait and release the lock, so keep the connections alive
+  std::vector<std::shared_ptr<Connection>> destinations;
+  for (auto &c : mLoop->connections) {
+    if (!c->handshaked || c->closed) {
+      continue;
+    }
+    if (dst) {
+      if (c->socket.get() != dst) {
+        continue;
       }
+    } else if (src && c->socket->address() == src->ipAddr &&
+               c->socket->port() == src->port) {
+      continue;
     }
+    destinations.push_back(c);
+  }
+  if (dst && destinations.empty()) {
+    std::cerr << "ERROR: Not connected to " << dst->address() << ":"
+              << dst->port() << std::endl;
+    return false;
+  }
 
-  } else {
+  bool ret = true;
+  for (auto &c : destinations) {
     if (mVerbose) {
-      std::cout << "Sending message to " << dst->address() << ":" << dst->port()
-                << std::endl;
+      std::cout << "Sending message to " << c->socket->address() << ":"
+                << c->socket->port() << std::endl;
     }
-    ret = dst->send((const char *)message, length) == length;
+    ret &= queueFrame(*c, frame, lk);
   }
   return ret;
 }
 
-// -----------------------------------------------------------------------
+/// =====================================
+///
+CommandServer::~CommandServer() { stop(); }
 
-bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
-  if (!mSocket.open(serverPort, serverAddr, 1.0, al::Socket::TCP)) {
-    std::cerr << "Error opening bootstrap socket" << std::endl;
-    return false;
-  }
-  std::condition_variable cv;
-  std::mutex mutex;
-  std::unique_lock<std::mutex> lk(mutex);
-  mConnectionThreads.push_back(std::make_unique<std::thread>([&]() {
-    // For a client connection, mSocket is connected to a server socket on
-    // the other end.
-
-    if (!mSocket.connect()) {
-      std::cerr << "Error connecting bootstrap socket" << std::endl;
-      return;
-    }
-
-    mState = CommandConnection::CLIENT;
-    mRunning = true;
-    unsigned char message[8] = {0, 0, 0, 0, 0, 0, 0, 0};
-    message[0] = HANDSHAKE;
-    auto b = Convert::to_bytes(mSocket.port());
-
-    memcpy(message + 1, &mVersion, sizeof(uint16_t));
-    memcpy(message + 1 + sizeof(uint16_t), &mRevision, sizeof(uint16_t));
-
-    // TODO provide functionality to validat connection versions
-    auto bytesSent = mSocket.send((const char *)message, 5);
-    if (bytesSent != 5) {
-      std::cerr << "ERROR sending handshake" << std::endl;
-    }
-    size_t bytesRecv = mSocket.recv((char *)message, 5);
-    if (bytesRecv == 5 && message[0] == HANDSHAKE_ACK) {
-      uint16_t version = 0;
-      uint16_t revision = 0;
-      if (bytesRecv >= 4) {
-        Convert::from_bytes((const uint8_t *)&message[1], version);
-        Convert::from_bytes((const uint8_t *)&message[3], revision);
-      }
-      if (mVerbose) {
-        std::cout << "Client got handshake ack from " << mSocket.address()
-                  << ":" << mSocket.port() << std::endl;
-        std::cout << "Server reports protocol version " << version
-                  << " revision " << revision << std::endl;
-      }
-      mRunning = true;
-    } else {
-      return;
+std::vector<float> CommandServer::ping(double timeoutSecs) {
+  uint8_t message[9] = {PING};
+  al_sec now = localTime();
+  std::memcpy(message + 1, &now, sizeof(al_sec));
+  auto frame = makeFrame(message, 9);
+
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  std::vector<std::shared_ptr<Connection>> pinged;
+  for (auto &c : mLoop->connections) {
+    if (c->handshaked && !c->closed) {
+      c->pingTime = al_steady_time();
+      c->pongTime = -1;
+      pinged.push_back(c);
     }
-    {
-      std::unique_lock<std::mutex> lk(mutex);
-      cv.notify_one();
+  }
+  for (auto &c : pinged) {
+    if (mVerbose) {
+      std::cout << "pinging " << c->socket->address() << ":"
+                << c->socket->port() << std::endl;
     }
-    uint8_t commandMessage[2048];
-    size_t bufferSize = 0;
+    queueFrame(*c, frame, lk);
+  }
 
-    onConnection(&mSocket);
-    while (mRunning) {
-      if (!mSocket.opened()) {
-        std::cerr << "ERROR: Socket not open" << std::endl;
-      }
+  auto allReplied = [&]() {
+    return std::all_of(pinged.begin(), pinged.end(),
+                       [](const std::shared_ptr<Connection> &c) {
+                         return c->pongTime >= 0 || c->closed;
+                       });
+  };
+  if (timeoutSecs > 0) {
+    mConnectionsChanged.wait_for(
+        lk, std::chrono::duration<double>(timeoutSecs), allReplied);
+  } else {
+    mConnectionsChanged.wait(lk, allReplied);
+  }
 
-      size_t bytes = mSocket.recv((char *)(commandMessage + bufferSize), 1024);
-      if (bytes > 0 && bytes < 1025) {
-        bufferSize += bytes;
-        if (commandMessage[0] == PING) {
-          clientHandlePing(mSocket);
-        } else {
-          Message message(commandMessage, bytes);
-          if (mVerbose) {
-            std::cout << "Client received message from " << mSocket.address()
-                      << ":" << mSocket.port() << std::endl;
-          }
-          if (!processIncomingMessage(message, &mSocket)) {
-            std::cerr << __FILE__ << " : Client unable to process message("
-                      << (int)commandMessage[0] << ") from "
-                      << mSocket.address() << ":" << mSocket.port()
-                      << std::endl;
-
-          } else {
-            if (message.remainingBytes() > 0) {
-              memcpy(commandMessage, message.data(), message.remainingBytes());
-              bufferSize = message.remainingBytes();
-            } else {
-              bufferSize = 0;
-            }
-          }
-        }
-      } else if (bytes != SIZE_MAX && bytes != 0) {
-        std::cerr << "ERROR: Network buffer overrun. " << bytes << std::endl;
-      }
-    }
-    //        connectionSocket.close();
-    if (mVerbose) {
-      std::cout << "Client stopped " << std::endl;
+  std::vector<float> pingTimes;
+  for (auto &c : pinged) {
+    if (c->pongTime >= 0) {
+      pingTimes.push_back(float(c->pongTime - c->pingTime));
+    } else {
+      pingTimes.push_back(std::numeric_limits<float>::infinity());
     }
-  }));
+  }
+  return pingTimes;
+}
 
-  cv.wait(lk);
-  return true;
+size_t CommandServer::connectionCount() {
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  size_t numConnections = mServerConnections.size();
+  return numConnections;
 }
 
-void CommandClient::clientHandlePing(Socket &client) {
+std::vector<std::pair<std::string, uint16_t>> CommandServer::connections() {
+  std::vector<std::pair<std::string, uint16_t>> cs;
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  for (auto conn : mServerConnections) {
+    cs.push_back({conn->address(), conn->port()});
+  }
+  return cs;
+}
+
+bool CommandServer::start(uint16_t serverPort, const char *serverAddr) {
+  al_sec timeout = 0.5;
+  if (!mSocket.open(serverPort, serverAddr, timeout, al::Socket::TCP)) {
+    std::cerr << "ERROR opening port" << std::endl;
+    return false;
+  }
+  if (!mSocket.bind()) {
+    std::cerr << "ERROR on bind" << std::endl;
+    return false;
+  }
+
+  if (!mSocket.listen()) {
+    std::cerr << "ERROR on listen" << std::endl;
+    return false;
+  }
+
+  mState = CommandConnection::SERVER;
+  if (!startLoop()) {
+    mSocket.close();
+    mState = BarrierState::NONE;
+    return false;
+  }
   if (mVerbose) {
-    std::cout << "Client got ping request" << std::endl;
+    std::cout << "Server started" << std::endl;
   }
-  char buffer[2] = {0, 0};
-  buffer[0] = PONG;
-  //  std::cout << "sending pong" << std::endl;
-  int bytesSent = client.send((const char *)buffer, 2);
-  if (bytesSent != 2) {
-    std::cerr << "ERROR: sent bytes mismatch for pong" << std::endl;
+  return true;
+}
+
+uint16_t CommandServer::waitForConnections(uint16_t connectionCount,
+                                           double timeout) {
+  if (mState != BarrierState::SERVER) {
+    return 0;
   }
+  // FIXME this could allow more connections through than requested. Should
+  // the number be treated as a maximum?
+  std::unique_lock<std::mutex> lk(mConnectionsLock);
+  mConnectionsChanged.wait_for(
+      lk, std::chrono::duration<double>(timeout),
+      [&]() { return mServerConnections.size() >= connectionCount; });
+  return uint16_t(mServerConnections.size());
 }
 
-bool CommandClient::sendMessage(uint8_t *message, size_t length, Socket *dst,
-                                al::ValueSource *src) {
-  bool ret = true;
-  if (length == 0) {
+// -----------------------------------------------------------------------
+
+CommandClient::~CommandClient() { stop(); }
+
+bool CommandClient::start(uint16_t serverPort, const char *serverAddr) {
+  if (!mSocket.open(serverPort, serverAddr, 1.0, al::Socket::TCP)) {
+    std::cerr << "Error opening bootstrap socket" << std::endl;
+    return false;
+  }
+  // For a client connection, mSocket is connected to a server socket on
+  // the other end.
+  if (!mSocket.connect()) {
+    std::cerr << "Error connecting bootstrap socket" << std::endl;
     return false;
   }
 
-  if (!dst) {
-    if (!src || mSocket.address() != src->ipAddr ||
-        mSocket.port() != src->port) {
-      if (mVerbose) {
-        std::cout << "Sending message to " << mSocket.address() << ":"
-                  << mSocket.port() << std::endl;
-      }
-      ret = mSocket.send((const char *)message, length) == length;
-    }
-  } else {
-    if (mSocket.address() != dst->address() || mSocket.port() != dst->port()) {
-      if (mVerbose) {
-        std::cout << "Sending message to " << dst->address() << ":"
-                  << dst->port() << std::endl;
-      }
-      ret = dst->send((const char *)message, length) == length;
+  mState = CommandConnection::CLIENT;
+  if (!startLoop()) {
+    mSocket.close();
+    mState = BarrierState::NONE;
+    return false;
+  }
+
+  // TODO provide functionality to validat connection versions
+  uint8_t message[5] = {HANDSHAKE, 0, 0, 0, 0};
+  auto version = Convert::to_bytes(mVersion);
+  auto revision = Convert::to_bytes(mRevision);
+  std::copy(version.begin(), version.end(), message + 1);
+  std::copy(revision.begin(), revision.end(), message + 3);
+
+  bool acknowledged = false;
+  {
+    std::unique_lock<std::mutex> lk(mConnectionsLock);
+    // The loop thread drops the connection if the server has already closed it
+    if (!mLoop->connections.empty()) {
+      auto server = mLoop->connections.front();
+      queueFrame(*server, makeFrame(message, 5), lk);
+      mConnectionsChanged.wait_for(lk, std::chrono::seconds(5), [&]() {
+        return server->handshaked || server->closed;
+      });
+      acknowledged = server->handshaked && !server->closed;
     }
   }
-  return ret;
+  if (!acknowledged) {
+    std::cerr << "ERROR: No handshake ack from " << serverAddr << ":"
+              << serverPort << std::endl;
+    stop();
+    return false;
+  }
+  return true;
 }
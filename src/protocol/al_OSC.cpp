@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include <iostream>
+#include <new>
 
 #include "al/system/al_Printing.hpp"
 #include "ip/UdpSocket.h"
@@ -167,6 +168,88 @@ void Packet::printRaw() const {
 
 size_t Packet::size() const { return mImpl->Size(); }
 
+bool patternMatches(const char *pattern, const char *address) {
+  while (*pattern) {
+    switch (*pattern) {
+    case '?':
+      if (*address == '\0' || *address == '/') {
+        return false;
+      }
+      pattern++;
+      address++;
+      break;
+    case '*':
+      // Try every split of the remaining part of this address segment
+      while (*pattern == '*') {
+        pattern++;
+      }
+      do {
+        if (patternMatches(pattern, address)) {
+          return true;
+        }
+      } while (*address != '\0' && *address++ != '/');
+      return false;
+    case '[': {
+      if (*address == '\0' || *address == '/') {
+        return false;
+      }
+      pattern++;
+      bool negate = *pattern == '!';
+      if (negate) {
+        pattern++;
+      }
+      bool found = false;
+      while (*pattern && *pattern != ']') {
+        if (pattern[1] == '-' && pattern[2] && pattern[2] != ']') {
+          found |= *address >= pattern[0] && *address <= pattern[2];
+          pattern += 3;
+        } else {
+          found |= *address == *pattern;
+          pattern++;
+        }
+      }
+      if (*pattern != ']' || found == negate) {
+        return false;
+      }
+      pattern++;
+      address++;
+      break;
+    }
+    case '{': {
+      const char *end = strchr(pattern, '}');
+      if (!end) {
+        return false;
+      }
+      const char *option = pattern + 1;
+      while (option <= end) {
+        const char *optionEnd = option;
+        while (*optionEnd != ',' && optionEnd != end) {
+          optionEnd++;
+        }
+        size_t length = optionEnd - option;
+        if (strncmp(option, address, length) == 0 &&
+            patternMatches(end + 1, address + length)) {
+          return true;
+        }
+        option = optionEnd + 1;
+      }
+      return false;
+    }
+    default:
+      if (*pattern != *address) {
+        return false;
+      }
+      pattern++;
+      address++;
+    }
+  }
+  return *address == '\0';
+}
+
+bool isPattern(const std::string &address) {
+  return address.find_first_of("?*[{") != std::string::npos;
+}
+
 class Message::Impl : public ::osc::ReceivedMessage {
 public:
   Impl(const char *message, int size)
@@ -181,11 +264,32 @@ public:
   ::osc::ReceivedMessageArgumentStream args;
 };
 
+Message::Message() : mTimeTag(1) { mSenderAddr[0] = '\0'; }
+
 Message::Message(const char *message, int size, const TimeTag &timeTag,
-                 const char *senderAddr)
-    : mImpl(new Impl(message, size)), mTimeTag(timeTag) {
-  OSCTRY("Message()", mAddressPattern = mImpl->AddressPattern();
-         mTypeTags = mImpl->ArgumentCount() ? mImpl->TypeTags() : "";
+                 const char *senderAddr) {
+  set(message, size, timeTag, senderAddr);
+}
+
+Message::~Message() {
+  if (mImpl) {
+    mImpl->~Impl();
+  }
+}
+
+void Message::set(const char *message, int size, const TimeTag &timeTag,
+                  const char *senderAddr) {
+  static_assert(sizeof(Impl) <= sizeof(mImplStorage),
+                "Message::mImplStorage too small");
+  static_assert(alignof(Impl) <= 8, "Message::mImplStorage misaligned");
+  if (mImpl) {
+    mImpl->~Impl();
+    mImpl = nullptr;
+  }
+  mImpl = new (mImplStorage) Impl(message, size);
+  mTimeTag = timeTag;
+  OSCTRY("Message()", mAddressPattern.assign(mImpl->AddressPattern());
+         mTypeTags.assign(mImpl->ArgumentCount() ? mImpl->TypeTags() : "");
          resetStream();)
   if (senderAddr != nullptr) {
     strncpy(mSenderAddr, senderAddr, 32);
@@ -194,8 +298,6 @@ Message::Message(const char *message, int size, const TimeTag &timeTag,
   }
 }
 
-Message::~Message() { OSCTRY("~Message()", delete mImpl;) }
-
 void Message::print() const {
   OSCTRY(
       "Message::print",
@@ -319,6 +421,37 @@ bool Send::open(uint16_t port, const char *address) {
   return true;
 }
 
+bool Send::multicastTTL(int ttl) {
+  if (!socketSender) {
+    return false;
+  }
+  socketSender->transmitSocket.SetMulticastTTL(ttl);
+  return true;
+}
+
+bool Send::multicastLoopback(bool loopback) {
+  if (!socketSender) {
+    return false;
+  }
+  socketSender->transmitSocket.SetMulticastLoopback(loopback);
+  return true;
+}
+
+bool Send::multicastInterface(const char *interfaceAddress) {
+  if (!socketSender) {
+    return false;
+  }
+  try {
+    socketSender->transmitSocket.SetMulticastInterface(
+        IpEndpointName{interfaceAddress}.address);
+  } catch (const std::runtime_error &e) {
+    std::cout << "run time exception at Send::multicastInterface: "
+              << e.what() << std::endl;
+    return false;
+  }
+  return true;
+}
+
 size_t Send::send() {
   size_t r = send(*this);
   OSCTRY("Packet::endMessage", Packet::clear();)
@@ -352,6 +485,21 @@ public:
         receiveSocket{IpEndpointName{IpEndpointName{address, port}}, this},
         recv{r} {}
 
+  // Multicast receivers bind to all interfaces and share the port
+  SocketReceiver(uint16_t port, const char *group, const char *interfaceAddress,
+                 Recv *r)
+      : ::osc::OscPacketListener{},
+        receiveSocket{IpEndpointName{IpEndpointName::ANY_ADDRESS, port}, this,
+                      true},
+        recv{r} {
+    unsigned long interfaceIp =
+        *interfaceAddress == '\0'
+            ? 0 // INADDR_ANY
+            : IpEndpointName{interfaceAddress}.address;
+    receiveSocket.JoinMulticastGroup(IpEndpointName{group}.address,
+                                     interfaceIp);
+  }
+
   virtual void ProcessMessage(const ::osc::ReceivedMessage &m,
                               const IpEndpointName &remoteEndpoint) override {}
 
@@ -369,10 +517,10 @@ public:
   void stop() { receiveSocket.AsynchronousBreak(); }
 };
 
-Recv::Recv() : mBuffer(1024), mBackground(false) {}
+Recv::Recv() : mBackground(false) {}
 
 Recv::Recv(uint16_t port, const char *address, al_sec timeout)
-    : mBuffer(1024), mBackground(false) {
+    : mBackground(false) {
   open(port, address, timeout);
 }
 
@@ -388,6 +536,7 @@ bool Recv::open(uint16_t port, const char *address, al_sec timeout) {
     } else {
       socketReceiver = std::make_unique<SocketReceiver>(port, address, this);
     }
+    socketReceiver->receiveSocket.SetMaxPacketSize(mMaxPacketSize);
 
     mAddress = address;
     mPort = port;
@@ -400,6 +549,48 @@ bool Recv::open(uint16_t port, const char *address, al_sec timeout) {
   return true;
 }
 
+bool Recv::openMulticast(uint16_t port, const char *group,
+                         const char *interfaceAddress) {
+  mOpen = false;
+  try {
+    if (!IpEndpointName{group}.IsMulticastAddress()) {
+      std::cout << "Recv::openMulticast: not a multicast address " << group
+                << std::endl;
+      return false;
+    }
+    socketReceiver =
+        std::make_unique<SocketReceiver>(port, group, interfaceAddress, this);
+    socketReceiver->receiveSocket.SetMaxPacketSize(mMaxPacketSize);
+    mAddress = group;
+    mPort = port;
+  } catch (const std::runtime_error &e) {
+    std::cout << "run time exception at Recv::openMulticast: " << e.what()
+              << " " << group << ":" << port << std::endl;
+    return false;
+  }
+  mOpen = true;
+  return true;
+}
+
+bool Recv::socketBufferSize(int bytes) {
+  if (!socketReceiver) {
+    return false;
+  }
+  socketReceiver->receiveSocket.SetReceiveBufferSize(bytes);
+  return true;
+}
+
+bool Recv::maxPacketSize(int bytes) {
+  if (bytes <= 0 || mBackground) {
+    return false;
+  }
+  mMaxPacketSize = bytes;
+  if (socketReceiver) {
+    socketReceiver->receiveSocket.SetMaxPacketSize(bytes);
+  }
+  return true;
+}
+
 int Recv::recv() { return 0; }
 
 bool Recv::start() {
@@ -418,13 +609,9 @@ void Recv::stop() {
 }
 
 void Recv::parse(const char *packet, int size, const char *senderAddr) {
-  std::memcpy(&mBuffer[0], packet, size);
-  auto messages = parse(&mBuffer[0], size, 1, senderAddr);
-  for (auto *handler : mHandlers) {
-    for (auto m : messages) {
-      handler->onMessage(*m);
-    }
-  }
+  mPacket = packet;
+  dispatch(packet, size, 1, senderAddr, mHandlers.data(), mHandlers.size());
+  mPacket = nullptr;
 }
 
 void Recv::loop() { socketReceiver->loop(); }
@@ -448,6 +635,58 @@ bool Recv::portAvailable(uint16_t port, const char *address) {
   return true;
 }
 
+namespace {
+
+// Messages reused by Recv::dispatch(). Handlers can parse packets from within
+// onMessage(), so each nesting level has its own message.
+struct MessagePool {
+  std::vector<std::unique_ptr<Message>> messages;
+  size_t depth{0};
+};
+
+thread_local MessagePool messagePool;
+
+struct MessagePoolLevel {
+  MessagePoolLevel() { messagePool.depth++; }
+  ~MessagePoolLevel() { messagePool.depth--; }
+};
+
+} // namespace
+
+void Recv::parse(const char *packet, int size, PacketHandler &handler,
+                 const char *senderAddr, TimeTag timeTag) {
+  PacketHandler *handlers[] = {&handler};
+  dispatch(packet, size, timeTag, senderAddr, handlers, 1);
+}
+
+void Recv::dispatch(const char *packet, int size, const TimeTag &timeTag,
+                    const char *senderAddr, PacketHandler *const *handlers,
+                    size_t numHandlers) {
+  try {
+    ::osc::ReceivedPacket p(packet, size);
+    if (p.IsBundle()) {
+      ::osc::ReceivedBundle b(p);
+      for (auto it = b.ElementsBegin(); it != b.ElementsEnd(); ++it) {
+        dispatch(it->Contents(), it->Size(), b.TimeTag(), senderAddr, handlers,
+                 numHandlers);
+      }
+    } else if (p.IsMessage()) {
+      if (messagePool.depth == messagePool.messages.size()) {
+        messagePool.messages.emplace_back(new Message());
+      }
+      Message &m = *messagePool.messages[messagePool.depth];
+      MessagePoolLevel level;
+      m.set(packet, size, timeTag, senderAddr);
+      for (size_t i = 0; i < numHandlers; i++) {
+        m.resetStream();
+        handlers[i]->onMessage(m);
+      }
+    }
+  } catch (::osc::Exception &e) {
+    AL_WARN("OSC error: %s", e.what());
+  }
+}
+
 std::vector<std::shared_ptr<Message>> Recv::parse(const char *packet, int size,
                                                   TimeTag timeTag,
                                                   const char *senderAddr) {
@@ -0,0 +1,408 @@
+#include "al/protocol/al_OSCRecvLoop.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef AL_WINDOWS
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifdef AL_LINUX
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+using namespace al;
+using namespace al::osc;
+
+namespace {
+
+#ifdef AL_WINDOWS
+typedef SOCKET SocketHandle;
+const SocketHandle invalidSocket = INVALID_SOCKET;
+void closeSocket(SocketHandle s) { closesocket(s); }
+#else
+typedef int SocketHandle;
+const SocketHandle invalidSocket = -1;
+void closeSocket(SocketHandle s) { ::close(s); }
+#endif
+
+// Batches read from one socket before other sockets get a turn
+const int maxBatchesPerWake = 4;
+
+bool resolveAddress(const char *address, in_addr &out) {
+  if (*address == '\0') {
+    out.s_addr = htonl(INADDR_ANY);
+    return true;
+  }
+  if (inet_pton(AF_INET, address, &out) == 1) {
+    return true;
+  }
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo *result = nullptr;
+  if (getaddrinfo(address, nullptr, &hints, &result) != 0 || !result) {
+    return false;
+  }
+  out = reinterpret_cast<sockaddr_in *>(result->ai_addr)->sin_addr;
+  freeaddrinfo(result);
+  return true;
+}
+
+SocketHandle openSocket(uint16_t port, in_addr address, bool allowReuse) {
+  SocketHandle s = socket(AF_INET, SOCK_DGRAM, 0);
+  if (s == invalidSocket) {
+    return invalidSocket;
+  }
+  if (allowReuse) {
+    int on = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on));
+#ifdef AL_OSX
+    setsockopt(s, SOL_SOCKET, SO_REUSEPORT, (const char *)&on, sizeof(on));
+#endif
+  }
+  sockaddr_in local;
+  std::memset(&local, 0, sizeof(local));
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr = address;
+  if (bind(s, (const sockaddr *)&local, sizeof(local)) != 0) {
+    closeSocket(s);
+    return invalidSocket;
+  }
+#ifdef AL_WINDOWS
+  u_long nonBlocking = 1;
+  ioctlsocket(s, FIONBIO, &nonBlocking);
+#else
+  fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+  return s;
+}
+
+} // namespace
+
+struct RecvLoopPort {
+  uint16_t port;
+  SocketHandle socket;
+  std::vector<PacketHandler *> handlers;
+};
+
+class RecvLoop::Impl {
+public:
+  Impl(int maxPacketSize_, int batchSize_)
+      : maxPacketSize(std::max(maxPacketSize_, 1)),
+        batchSize(std::max(batchSize_, 1)),
+        buffers(size_t(maxPacketSize) * batchSize) {
+#ifdef AL_WINDOWS
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+#ifdef AL_LINUX
+    epollFd = epoll_create1(0);
+    wakeFd = eventfd(0, EFD_NONBLOCK);
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = nullptr;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+    headers.resize(batchSize);
+    iovecs.resize(batchSize);
+    addresses.resize(batchSize);
+    for (int i = 0; i < batchSize; i++) {
+      iovecs[i].iov_base = &buffers[size_t(i) * maxPacketSize];
+      iovecs[i].iov_len = maxPacketSize;
+      std::memset(&headers[i], 0, sizeof(mmsghdr));
+      headers[i].msg_hdr.msg_iov = &iovecs[i];
+      headers[i].msg_hdr.msg_iovlen = 1;
+      headers[i].msg_hdr.msg_name = &addresses[i];
+    }
+#endif
+  }
+
+  ~Impl() {
+    stop();
+    for (auto &port : ports) {
+      closeSocket(port->socket);
+    }
+#ifdef AL_LINUX
+    ::close(wakeFd);
+    ::close(epollFd);
+#endif
+#ifdef AL_WINDOWS
+    WSACleanup();
+#endif
+  }
+
+  bool addPort(uint16_t port, SocketHandle s) {
+    std::unique_lock<std::mutex> lk(lock);
+    ports.emplace_back(new RecvLoopPort{port, s, {}});
+#ifdef AL_LINUX
+    epoll_event event;
+    std::memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = ports.back().get();
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, s, &event) != 0) {
+      closeSocket(s);
+      ports.pop_back();
+      return false;
+    }
+#endif
+    return true;
+  }
+
+  RecvLoopPort *findPort(uint16_t port) {
+    for (auto &p : ports) {
+      if (p->port == port) {
+        return p.get();
+      }
+    }
+    return nullptr;
+  }
+
+  bool start() {
+    if (running) {
+      return true;
+    }
+    running = true;
+    thread = std::thread([this]() { loop(); });
+    return true;
+  }
+
+  void stop() {
+    if (!running) {
+      return;
+    }
+    running = false;
+#ifdef AL_LINUX
+    uint64_t one = 1;
+    if (write(wakeFd, &one, sizeof(one)) != sizeof(one)) {
+      std::cerr << "RecvLoop: could not wake loop thread" << std::endl;
+    }
+#endif
+    thread.join();
+  }
+
+#ifdef AL_LINUX
+  void loop() {
+    const int maxEvents = 16;
+    epoll_event events[maxEvents];
+    while (running) {
+      int count = epoll_wait(epollFd, events, maxEvents, -1);
+      if (count < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cerr << "RecvLoop: epoll_wait failed" << std::endl;
+        break;
+      }
+      std::unique_lock<std::mutex> lk(lock);
+      for (int i = 0; i < count && running; i++) {
+        if (events[i].data.ptr == nullptr) {
+          uint64_t value;
+          if (read(wakeFd, &value, sizeof(value)) < 0) {
+            // Nothing to clear
+          }
+          continue;
+        }
+        receive(*static_cast<RecvLoopPort *>(events[i].data.ptr));
+      }
+    }
+  }
+
+  void receive(RecvLoopPort &port) {
+    for (int batch = 0; batch < maxBatchesPerWake; batch++) {
+      for (auto &header : headers) {
+        header.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      }
+      int count = recvmmsg(port.socket, headers.data(), batchSize, MSG_DONTWAIT,
+                           nullptr);
+      if (count <= 0) {
+        return;
+      }
+      reads++;
+      packets += count;
+      for (int i = 0; i < count; i++) {
+        if (headers[i].msg_hdr.msg_flags & MSG_TRUNC) {
+          continue;
+        }
+        dispatch(port, &buffers[size_t(i) * maxPacketSize],
+                 int(headers[i].msg_len), addresses[i]);
+      }
+      if (count < batchSize) {
+        return;
+      }
+    }
+  }
+#else
+  void loop() {
+    while (running) {
+      fd_set readable;
+      FD_ZERO(&readable);
+      SocketHandle maxSocket = 0;
+      {
+        std::unique_lock<std::mutex> lk(lock);
+        for (auto &port : ports) {
+          FD_SET(port->socket, &readable);
+          if (port->socket > maxSocket) {
+            maxSocket = port->socket;
+          }
+        }
+      }
+      // Wake up regularly to notice new ports and stop()
+      timeval timeout{0, 50000};
+      if (maxSocket == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        continue;
+      }
+      if (select(int(maxSocket) + 1, &readable, nullptr, nullptr, &timeout) <=
+          0) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lk(lock);
+      for (auto &port : ports) {
+        if (FD_ISSET(port->socket, &readable)) {
+          receive(*port);
+        }
+      }
+    }
+  }
+
+  void receive(RecvLoopPort &port) {
+    for (int i = 0; i < maxBatchesPerWake * batchSize; i++) {
+      sockaddr_in from;
+      socklen_t fromSize = sizeof(from);
+      int size = recvfrom(port.socket, buffers.data(), maxPacketSize, 0,
+                          (sockaddr *)&from, &fromSize);
+      if (size <= 0) {
+        return;
+      }
+      reads++;
+      packets++;
+      dispatch(port, buffers.data(), size, from);
+    }
+  }
+#endif
+
+  void dispatch(RecvLoopPort &port, const char *data, int size,
+                const sockaddr_in &from) {
+    char sender[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, (void *)&from.sin_addr, sender, sizeof(sender));
+    Recv::dispatch(data, size, 1, sender, port.handlers.data(),
+                   port.handlers.size());
+  }
+
+  int maxPacketSize;
+  int batchSize;
+  std::vector<char> buffers;
+  std::vector<std::unique_ptr<RecvLoopPort>> ports;
+  std::mutex lock; // Protects ports and their handlers
+  std::thread thread;
+  std::atomic<bool> running{false};
+  std::atomic<uint64_t> packets{0};
+  std::atomic<uint64_t> reads{0};
+
+#ifdef AL_LINUX
+  int epollFd;
+  int wakeFd;
+  std::vector<mmsghdr> headers;
+  std::vector<iovec> iovecs;
+  std::vector<sockaddr_in> addresses;
+#endif
+};
+
+RecvLoop::RecvLoop(int maxPacketSize, int batchSize)
+    : mImpl(new Impl(maxPacketSize, batchSize)) {}
+
+RecvLoop::~RecvLoop() {}
+
+bool RecvLoop::open(uint16_t port, const char *address) {
+  in_addr localAddress;
+  if (!resolveAddress(address, localAddress)) {
+    std::cout << "RecvLoop: unknown address " << address << std::endl;
+    return false;
+  }
+  SocketHandle s = openSocket(port, localAddress, false);
+  if (s == invalidSocket) {
+    std::cout << "RecvLoop: could not open " << address << ":" << port
+              << std::endl;
+    return false;
+  }
+  return mImpl->addPort(port, s);
+}
+
+bool RecvLoop::openMulticast(uint16_t port, const char *group,
+                             const char *interfaceAddress) {
+  ip_mreq request;
+  if (!resolveAddress(group, request.imr_multiaddr) ||
+      !IN_MULTICAST(ntohl(request.imr_multiaddr.s_addr))) {
+    std::cout << "RecvLoop: not a multicast address " << group << std::endl;
+    return false;
+  }
+  if (!resolveAddress(interfaceAddress, request.imr_interface)) {
+    std::cout << "RecvLoop: unknown interface " << interfaceAddress
+              << std::endl;
+    return false;
+  }
+  in_addr any;
+  any.s_addr = htonl(INADDR_ANY);
+  SocketHandle s = openSocket(port, any, true);
+  if (s == invalidSocket) {
+    std::cout << "RecvLoop: could not open port " << port << std::endl;
+    return false;
+  }
+  if (setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&request,
+                 sizeof(request)) != 0) {
+    std::cout << "RecvLoop: could not join multicast group " << group
+              << std::endl;
+    closeSocket(s);
+    return false;
+  }
+  return mImpl->addPort(port, s);
+}
+
+bool RecvLoop::appendHandler(uint16_t port, PacketHandler &handler) {
+  std::unique_lock<std::mutex> lk(mImpl->lock);
+  RecvLoopPort *p = mImpl->findPort(port);
+  if (!p) {
+    std::cout << "RecvLoop: port " << port << " is not open" << std::endl;
+    return false;
+  }
+  p->handlers.push_back(&handler);
+  return true;
+}
+
+bool RecvLoop::socketBufferSize(uint16_t port, int bytes) {
+  std::unique_lock<std::mutex> lk(mImpl->lock);
+  RecvLoopPort *p = mImpl->findPort(port);
+  return p && setsockopt(p->socket, SOL_SOCKET, SO_RCVBUF,
+                         (const char *)&bytes, sizeof(bytes)) == 0;
+}
+
+bool RecvLoop::start() { return mImpl->start(); }
+
+void RecvLoop::stop() { mImpl->stop(); }
+
+bool RecvLoop::running() const { return mImpl->running; }
+
+uint64_t RecvLoop::packets() const { return mImpl->packets; }
+
+uint64_t RecvLoop::reads() const { return mImpl->reads; }
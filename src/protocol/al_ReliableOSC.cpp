@@ -0,0 +1,435 @@
+#include "al/protocol/al_ReliableOSC.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+using namespace al;
+using namespace al::osc;
+
+namespace {
+
+// Largest number of packets a receiver buffers ahead of a gap
+const uint32_t maxPending = 4096;
+// Largest number of ranges requested by one round of NACKs
+const int maxNackRanges = 32;
+// Time before missing packets are requested again
+const al_sec nackRetryInterval = 0.05;
+// A sequence this far behind the expected one means the sender restarted
+const int32_t restartDistance = 1 << 20;
+
+int32_t sequenceDistance(uint32_t from, uint32_t to) {
+  return int32_t(to - from);
+}
+
+// First sequence of a stream that starts with the sender's oldest packet and
+// has seen sequence. Keeps the gap within what the receiver can buffer.
+uint32_t streamStart(uint32_t oldest, uint32_t sequence) {
+  int32_t distance = sequenceDistance(oldest, sequence);
+  if (distance < 0) {
+    return sequence;
+  }
+  if (distance >= int32_t(maxPending)) {
+    return sequence - maxPending + 1;
+  }
+  return oldest;
+}
+
+} // namespace
+
+// ReliableSender --------------------------------------------------------------
+
+ReliableSender::ReliableSender(unsigned int windowSize)
+    : mWindowSize(std::max(windowSize, 1u)),
+      mRandom(std::random_device{}()) {
+  mNackHandler.sender = this;
+}
+
+ReliableSender::~ReliableSender() { close(); }
+
+bool ReliableSender::open(uint16_t nackPort, const char *nackAddress) {
+  close();
+  mNackRecv = std::make_unique<Recv>();
+  if (!mNackRecv->open(nackPort, nackAddress)) {
+    mNackRecv = nullptr;
+    return false;
+  }
+  mNackRecv->handler(mNackHandler);
+  mNackRecv->start();
+  mNackPort = nackPort;
+
+  mRunning = true;
+  mHeartbeatThread = std::thread([this]() {
+    std::unique_lock<std::mutex> lk(mLock);
+    while (mRunning) {
+      mHeartbeatCondition.wait_for(
+          lk, std::chrono::duration<double>(mHeartbeatInterval));
+      if (mRunning) {
+        sendHeartbeats();
+      }
+    }
+  });
+  return true;
+}
+
+void ReliableSender::close() {
+  {
+    std::unique_lock<std::mutex> lk(mLock);
+    mRunning = false;
+  }
+  mHeartbeatCondition.notify_all();
+  if (mHeartbeatThread.joinable()) {
+    mHeartbeatThread.join();
+  }
+  if (mNackRecv) {
+    mNackRecv->stop();
+    mNackRecv = nullptr;
+  }
+}
+
+bool ReliableSender::addDestination(uint16_t port, const char *address) {
+  auto destination = std::make_unique<Send>();
+  if (!destination->open(port, address)) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lk(mLock);
+  mDestinations.push_back(std::move(destination));
+  return true;
+}
+
+void ReliableSender::send(const Packet &p, int channel) {
+  std::unique_lock<std::mutex> lk(mLock);
+  Channel &c = mChannels[channel];
+  if (c.window.size() == 0) {
+    c.window.resize(mWindowSize);
+  }
+  SentPacket &packet = c.window[c.nextSequence % c.window.size()];
+  packet.sequence = c.nextSequence;
+  packet.data.assign(p.data(), p.data() + p.size());
+  c.nextSequence++;
+  if (c.nextSequence - c.oldestSequence > c.window.size()) {
+    c.oldestSequence = c.nextSequence - uint32_t(c.window.size());
+  }
+  c.lastSendTime = al_steady_time();
+  for (auto &destination : mDestinations) {
+    if (!dropPacket()) {
+      sendEnvelope(*destination, channel, c, packet);
+    }
+  }
+}
+
+bool ReliableSender::dropPacket() {
+  return mLossProbability > 0.0f &&
+         std::uniform_real_distribution<float>(0.0f, 1.0f)(mRandom) <
+             mLossProbability;
+}
+
+void ReliableSender::sendEnvelope(Send &socket, int channel, const Channel &c,
+                                  const SentPacket &packet) {
+  mEnvelope.clear();
+  mEnvelope.beginMessage("/_rel");
+  mEnvelope << int(mNackPort) << channel << int(c.oldestSequence)
+            << int(packet.sequence)
+            << Blob(packet.data.data(), packet.data.size());
+  mEnvelope.endMessage();
+  socket.send(mEnvelope);
+}
+
+void ReliableSender::retransmit(const std::string &address, uint16_t port,
+                                int channel, uint32_t first, uint32_t count) {
+  auto channelIt = mChannels.find(channel);
+  if (channelIt == mChannels.end()) {
+    return;
+  }
+  Channel &c = channelIt->second;
+  std::string key = address + ":" + std::to_string(port);
+  auto &socket = mRetransmitSockets[key];
+  if (!socket) {
+    socket = std::make_unique<Send>();
+    if (!socket->open(port, address.c_str())) {
+      mRetransmitSockets.erase(key);
+      return;
+    }
+  }
+  count = std::min(count, uint32_t(c.window.size()));
+  uint32_t goneCount = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t sequence = first + i;
+    int32_t age = sequenceDistance(sequence, c.nextSequence);
+    if (age <= 0) {
+      break; // Not sent yet
+    }
+    const SentPacket &packet = c.window[sequence % c.window.size()];
+    if (uint32_t(age) > c.window.size() || packet.sequence != sequence) {
+      goneCount++;
+      continue;
+    }
+    if (!dropPacket()) {
+      sendEnvelope(*socket, channel, c, packet);
+    }
+    mRetransmitted++;
+  }
+  if (goneCount > 0) {
+    // Packets leave the window oldest first, so missing ones start at first
+    mEnvelope.clear();
+    mEnvelope.beginMessage("/_relGone");
+    mEnvelope << int(mNackPort) << channel << int(first) << int(goneCount);
+    mEnvelope.endMessage();
+    socket->send(mEnvelope);
+  }
+}
+
+void ReliableSender::sendHeartbeats() {
+  al_sec now = al_steady_time();
+  for (auto &channel : mChannels) {
+    Channel &c = channel.second;
+    if (c.nextSequence == 0 || now - c.lastSendTime < mHeartbeatInterval) {
+      continue;
+    }
+    for (auto &destination : mDestinations) {
+      if (dropPacket()) {
+        continue;
+      }
+      mEnvelope.clear();
+      mEnvelope.beginMessage("/_relHB");
+      mEnvelope << int(mNackPort) << channel.first << int(c.oldestSequence)
+                << int(c.nextSequence - 1);
+      mEnvelope.endMessage();
+      destination->send(mEnvelope);
+    }
+  }
+}
+
+void ReliableSender::NackHandler::onMessage(Message &m) {
+  if (m.addressPattern() == "/_nack" && m.typeTags() == "iiii") {
+    int port, channel, first, count;
+    m >> port >> channel >> first >> count;
+    if (count > 0 && port > 0 && port < 65536) {
+      std::unique_lock<std::mutex> lk(sender->mLock);
+      sender->retransmit(m.senderAddress(), uint16_t(port), channel,
+                         uint32_t(first), uint32_t(count));
+    }
+  }
+}
+
+// ReliableReceiver ------------------------------------------------------------
+
+ReliableReceiver::ReliableReceiver(PacketHandler &handler, uint16_t port,
+                                   bool inOrder)
+    : mHandler(handler), mPort(port), mInOrder(inOrder),
+      mRandom(std::random_device{}()) {}
+
+void ReliableReceiver::onMessage(Message &m) {
+  if (!handleMessage(m)) {
+    mHandler.onMessage(m);
+  }
+}
+
+bool ReliableReceiver::handleMessage(Message &m) {
+  const std::string &address = m.addressPattern();
+  if (address.size() < 5 || address.compare(0, 5, "/_rel") != 0) {
+    return false;
+  }
+  bool drop = mLossProbability > 0.0f &&
+              std::uniform_real_distribution<float>(0.0f, 1.0f)(mRandom) <
+                  mLossProbability;
+  if (address == "/_rel" && m.typeTags() == "iiiib") {
+    int nackPort, channel, oldest, sequence;
+    Blob packet;
+    m >> nackPort >> channel >> oldest >> sequence >> packet;
+    if (!drop) {
+      receivePacket(m, nackPort, channel, uint32_t(oldest), uint32_t(sequence),
+                    packet);
+    }
+  } else if (address == "/_relHB" && m.typeTags() == "iiii") {
+    int nackPort, channel, oldest, lastSequence;
+    m >> nackPort >> channel >> oldest >> lastSequence;
+    if (!drop) {
+      uint32_t next = uint32_t(lastSequence) + 1;
+      Stream *s = stream(m, nackPort, channel, streamStart(oldest, next));
+      int32_t behind = sequenceDistance(s->nextSequence, uint32_t(oldest));
+      if (behind > 0 && behind <= int32_t(maxPending) &&
+          sequenceDistance(uint32_t(oldest), next) >= 0) {
+        // Missing packets that have left the window can't be requested
+        skipTo(*s, uint32_t(oldest), m.senderAddress());
+      }
+      if (sequenceDistance(s->nextSequence, uint32_t(lastSequence)) >= 0) {
+        if (sequenceDistance(s->highestSequence, uint32_t(lastSequence)) > 0) {
+          s->highestSequence = uint32_t(lastSequence);
+        }
+        sendNacks(*s, m.senderAddress(), nackPort, channel,
+                  uint32_t(lastSequence));
+      }
+    }
+  } else if (address == "/_relGone" && m.typeTags() == "iiii") {
+    int nackPort, channel, first, count;
+    m >> nackPort >> channel >> first >> count;
+    std::string key = m.senderAddress() + ":" + std::to_string(nackPort) +
+                      ":" + std::to_string(channel);
+    auto it = mStreams.find(key);
+    if (it != mStreams.end() && count > 0) {
+      uint32_t end = uint32_t(first) + uint32_t(count);
+      Stream &s = it->second;
+      if (sequenceDistance(s.nextSequence, end) > 0 &&
+          sequenceDistance(s.nextSequence, end) <= int32_t(maxPending)) {
+        skipTo(s, end, m.senderAddress());
+      }
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+ReliableReceiver::Stream *ReliableReceiver::stream(Message &m, int nackPort,
+                                                   int channel,
+                                                   uint32_t first) {
+  std::string key = m.senderAddress() + ":" + std::to_string(nackPort) + ":" +
+                    std::to_string(channel);
+  auto it = mStreams.find(key);
+  if (it == mStreams.end()) {
+    // Packets from first on are requested if they have not arrived
+    Stream &s = mStreams[key];
+    s.nextSequence = first;
+    s.highestSequence = first - 1;
+    return &s;
+  }
+  return &it->second;
+}
+
+void ReliableReceiver::receivePacket(Message &m, int nackPort, int channel,
+                                     uint32_t oldest, uint32_t sequence,
+                                     const Blob &packet) {
+  std::string sender = m.senderAddress();
+  Stream &s = *stream(m, nackPort, channel, streamStart(oldest, sequence));
+  int32_t distance = sequenceDistance(s.nextSequence, sequence);
+  if (distance < -restartDistance) {
+    s.pending.clear();
+    s.nextSequence = streamStart(oldest, sequence);
+    s.highestSequence = s.nextSequence - 1;
+  }
+  int32_t behind = sequenceDistance(s.nextSequence, oldest);
+  if (behind > 0 && behind <= int32_t(maxPending) &&
+      sequenceDistance(oldest, sequence) >= 0) {
+    // Missing packets that have left the window can't be requested
+    skipTo(s, oldest, sender);
+  }
+  distance = sequenceDistance(s.nextSequence, sequence);
+  if (distance < 0 || s.pending.find(sequence) != s.pending.end()) {
+    return; // Duplicate
+  }
+  const char *data = static_cast<const char *>(packet.data);
+  if (distance == 0) {
+    deliver(data, packet.size, sender);
+    s.nextSequence++;
+    deliverPending(s, sender);
+  } else {
+    if (distance >= int32_t(maxPending)) {
+      skipTo(s, sequence - maxPending + 1, sender);
+    }
+    if (mInOrder) {
+      s.pending[sequence].assign(data, data + packet.size);
+    } else {
+      deliver(data, packet.size, sender);
+      s.pending[sequence].clear();
+    }
+  }
+  if (sequenceDistance(s.highestSequence, sequence) > 0) {
+    // Request packets newly found missing right away
+    uint32_t firstMissing = s.highestSequence + 1;
+    s.highestSequence = sequence;
+    if (sequenceDistance(firstMissing, sequence) > 0 &&
+        sequenceDistance(s.nextSequence, firstMissing) >= 0 &&
+        !(mLossProbability > 0.0f &&
+          std::uniform_real_distribution<float>(0.0f, 1.0f)(mRandom) <
+              mLossProbability)) {
+      if (Send *socket = nackSocket(sender, nackPort)) {
+        socket->send("/_nack", int(mPort), channel, int(firstMissing),
+                     int(sequence - firstMissing));
+      }
+    }
+  }
+  if (s.pending.size() > 0 &&
+      al_steady_time() - s.lastNackTime > nackRetryInterval) {
+    sendNacks(s, sender, nackPort, channel, s.highestSequence);
+  }
+}
+
+void ReliableReceiver::deliver(const char *data, size_t size,
+                               const std::string &sender) {
+  Recv::parse(data, int(size), mHandler, sender.c_str());
+}
+
+void ReliableReceiver::deliverPending(Stream &s, const std::string &sender) {
+  auto it = s.pending.find(s.nextSequence);
+  while (it != s.pending.end()) {
+    if (mInOrder) {
+      deliver(it->second.data(), it->second.size(), sender);
+    }
+    s.pending.erase(it);
+    s.nextSequence++;
+    it = s.pending.find(s.nextSequence);
+  }
+}
+
+void ReliableReceiver::skipTo(Stream &s, uint32_t sequence,
+                              const std::string &sender) {
+  while (sequenceDistance(s.nextSequence, sequence) > 0) {
+    auto it = s.pending.find(s.nextSequence);
+    if (it != s.pending.end()) {
+      if (mInOrder) {
+        deliver(it->second.data(), it->second.size(), sender);
+      }
+      s.pending.erase(it);
+    } else {
+      mLost++;
+    }
+    s.nextSequence++;
+  }
+  deliverPending(s, sender);
+}
+
+void ReliableReceiver::sendNacks(Stream &s, const std::string &sender,
+                                 int nackPort, int channel,
+                                 uint32_t lastSequence) {
+  s.lastNackTime = al_steady_time();
+  Send *socket = nackSocket(sender, nackPort);
+  if (!socket) {
+    return;
+  }
+  int ranges = 0;
+  uint32_t sequence = s.nextSequence;
+  while (sequenceDistance(sequence, lastSequence) >= 0 &&
+         ranges < maxNackRanges) {
+    if (s.pending.find(sequence) != s.pending.end()) {
+      sequence++;
+      continue;
+    }
+    uint32_t first = sequence;
+    while (sequenceDistance(sequence, lastSequence) >= 0 &&
+           s.pending.find(sequence) == s.pending.end()) {
+      sequence++;
+    }
+    bool drop = mLossProbability > 0.0f &&
+                std::uniform_real_distribution<float>(0.0f, 1.0f)(mRandom) <
+                    mLossProbability;
+    if (!drop) {
+      socket->send("/_nack", int(mPort), channel, int(first),
+                   int(sequence - first));
+    }
+    ranges++;
+  }
+}
+
+Send *ReliableReceiver::nackSocket(const std::string &sender, int nackPort) {
+  std::string key = sender + ":" + std::to_string(nackPort);
+  auto &socket = mNackSockets[key];
+  if (!socket) {
+    socket = std::make_unique<Send>();
+    if (!socket->open(uint16_t(nackPort), sender.c_str())) {
+      mNackSockets.erase(key);
+      return nullptr;
+    }
+  }
+  return socket.get();
+}
@@ -0,0 +1,448 @@
+#include "al/scene/al_CompiledSequence.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+using namespace al;
+
+namespace {
+
+const char sequenceMagic[8] = {'a', 'l', 'S', 'e', 'q', 'B', 'i', 'n'};
+const uint32_t byteOrderMark = 0x01020304;
+
+uint64_t alignTo8(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+
+// Accumulates events while parsing text sequences
+struct SequenceCompiler {
+  std::vector<CompiledSequence::Event> events;
+  std::vector<float> values;
+  std::vector<uint8_t> types;
+  std::vector<std::string> names;
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint32_t> nameIndices;
+  std::unordered_map<std::string, uint32_t> stringIndices;
+
+  uint32_t internName(const std::string &name) {
+    auto it = nameIndices.find(name);
+    if (it != nameIndices.end()) {
+      return it->second;
+    }
+    uint32_t index = uint32_t(names.size());
+    names.push_back(name);
+    nameIndices[name] = index;
+    return index;
+  }
+
+  // String fields are stored after the names, so indices are offset on write
+  uint32_t internString(const std::string &value) {
+    auto it = stringIndices.find(value);
+    if (it != stringIndices.end()) {
+      return it->second;
+    }
+    uint32_t index = uint32_t(strings.size());
+    strings.push_back(value);
+    stringIndices[value] = index;
+    return index;
+  }
+
+  void addFloat(float value) {
+    values.push_back(value);
+    types.push_back(CompiledSequence::FIELD_FLOAT);
+  }
+
+  void addString(const std::string &value) {
+    uint32_t index = internString(value);
+    float slot;
+    std::memcpy(&slot, &index, sizeof(slot));
+    values.push_back(slot);
+    types.push_back(CompiledSequence::FIELD_STRING);
+  }
+
+  bool parse(std::string path, double timeOffset, double timeScale,
+             int depth);
+  bool write(std::string outputPath);
+};
+
+bool isFloat(const std::string &text) {
+  std::istringstream iss(text);
+  float f;
+  iss >> std::noskipws >> f; // noskipws considers leading whitespace invalid
+  return iss.eof() && !iss.fail();
+}
+
+std::string includePath(const std::string &directory, std::string name) {
+  if (name.size() < 14 || name.substr(name.size() - 14) != ".synthSequence") {
+    name += ".synthSequence";
+  }
+  return directory + name;
+}
+
+// Follows the parsing rules of SynthSequencer::loadSequence()
+bool SequenceCompiler::parse(std::string path, double timeOffset,
+                             double timeScale, int depth) {
+  if (depth > 32) {
+    std::cerr << "CompiledSequence: Includes nested too deeply in " << path
+              << std::endl;
+    return false;
+  }
+  std::ifstream f(path);
+  if (!f.is_open()) {
+    std::cerr << "CompiledSequence: Could not open:" << path << std::endl;
+    return false;
+  }
+  std::string directory = File::directory(path);
+  // Note on events waiting for their note off, by id
+  std::map<int, size_t> openNotes;
+
+  std::string line;
+  double tempoFactor = 1.0;
+  while (getline(f, line)) {
+    if (line.substr(0, 2) == "::") {
+      break;
+    }
+    std::stringstream ss(line);
+    int command = ss.get();
+    if (command == '@' && ss.get() == ' ') {
+      std::string name, start, durationText;
+      while (start.size() == 0 && ss.good()) {
+        std::getline(ss, start, ' ');
+      }
+      while (durationText.size() == 0 && ss.good()) {
+        std::getline(ss, durationText, ' ');
+      }
+      while (name.size() == 0 && ss.good()) {
+        std::getline(ss, name, ' ');
+      }
+      if (name.size() == 0) {
+        continue;
+      }
+      CompiledSequence::Event event;
+      event.startTime =
+          timeOffset + std::stod(start) * timeScale * tempoFactor;
+      event.duration = std::stod(durationText) * timeScale * tempoFactor;
+      event.nameIndex = internName(name);
+      event.firstValue = values.size();
+      event.flags = 0;
+
+      std::string fieldsString;
+      std::getline(ss, fieldsString);
+      bool processingString = false;
+      std::string accum;
+      auto addAccumulated = [&]() {
+        if (isFloat(accum)) {
+          addFloat(std::stof(accum));
+        } else {
+          addString(accum);
+          event.flags |= CompiledSequence::HAS_STRING_FIELDS;
+        }
+        accum.clear();
+      };
+      for (char c : fieldsString) {
+        if (c == '"') {
+          if (processingString) { // String end
+            addString(accum);
+            event.flags |= CompiledSequence::HAS_STRING_FIELDS;
+            accum.clear();
+          }
+          processingString = !processingString;
+        } else if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+          if (processingString) {
+            accum += c;
+          } else if (accum.size() > 0) {
+            addAccumulated();
+          }
+        } else {
+          accum += c;
+        }
+      }
+      if (accum.size() > 0) {
+        addAccumulated();
+      }
+      event.numFields = uint16_t(values.size() - event.firstValue);
+      events.push_back(event);
+    } else if (command == '+' && ss.get() == ' ') {
+      std::string name, idText, start;
+      std::getline(ss, start, ' ');
+      std::getline(ss, idText, ' ');
+      std::getline(ss, name, ' ');
+
+      CompiledSequence::Event event;
+      event.startTime =
+          timeOffset + std::stod(start) * timeScale * tempoFactor;
+      // Turn on events have undetermined duration until a turn off is found
+      event.duration = -1;
+      event.nameIndex = internName(name);
+      event.firstValue = values.size();
+      event.flags = 0;
+      std::string field;
+      // Stop on a failed read, which leaves the previous field in place
+      while (values.size() - event.firstValue < 64 &&
+             std::getline(ss, field, ' ') && field != "") {
+        addFloat(std::stof(field));
+      }
+      event.numFields = uint16_t(values.size() - event.firstValue);
+      openNotes[std::stoi(idText)] = events.size();
+      events.push_back(event);
+    } else if (command == '-' && ss.get() == ' ') {
+      std::string time, idText;
+      std::getline(ss, time, ' ');
+      std::getline(ss, idText);
+      auto note = openNotes.find(std::stoi(idText));
+      if (note != openNotes.end()) {
+        auto &event = events[note->second];
+        double eventTime =
+            timeOffset + std::stod(time) * timeScale * tempoFactor;
+        event.duration = std::max(0.0, eventTime - event.startTime);
+        openNotes.erase(note);
+      }
+    } else if (command == '=' && ss.get() == ' ') {
+      std::string time, sequenceName, timeScaleInFile;
+      std::getline(ss, time, ' ');
+      while (sequenceName.size() == 0 && ss.good()) {
+        std::getline(ss, sequenceName, ' ');
+      }
+      while (timeScaleInFile.size() == 0 && ss.good()) {
+        std::getline(ss, timeScaleInFile);
+      }
+      if (sequenceName.size() > 0 && sequenceName.front() == '"') {
+        sequenceName = sequenceName.substr(1);
+      }
+      if (sequenceName.size() > 0 && sequenceName.back() == '"') {
+        sequenceName = sequenceName.substr(0, sequenceName.size() - 1);
+      }
+      if (!parse(includePath(directory, sequenceName),
+                 std::stod(time) + timeOffset,
+                 std::stod(timeScaleInFile) * tempoFactor, depth + 1)) {
+        return false;
+      }
+    } else if (command == '>' && ss.get() == ' ') {
+      std::string time;
+      std::getline(ss, time);
+      timeOffset += std::stod(time);
+    } else if (command == 't' && ss.get() == ' ') {
+      std::string tempo;
+      std::getline(ss, tempo);
+      tempoFactor = 60.0 / std::stod(tempo);
+    }
+  }
+  return !f.bad();
+}
+
+bool SequenceCompiler::write(std::string outputPath) {
+  std::stable_sort(events.begin(), events.end(),
+                   [](const CompiledSequence::Event &a,
+                      const CompiledSequence::Event &b) {
+                     return a.startTime < b.startTime;
+                   });
+  // String field indices follow the names in the string table
+  uint32_t numNames = uint32_t(names.size());
+  for (size_t i = 0; i < values.size(); i++) {
+    if (types[i] == CompiledSequence::FIELD_STRING) {
+      uint32_t index;
+      std::memcpy(&index, &values[i], sizeof(index));
+      index += numNames;
+      std::memcpy(&values[i], &index, sizeof(index));
+    }
+  }
+  std::vector<uint32_t> stringOffsets;
+  std::string stringData;
+  for (auto *table : {&names, &strings}) {
+    for (auto &s : *table) {
+      stringOffsets.push_back(uint32_t(stringData.size()));
+      stringData.append(s);
+      stringData.push_back('\0');
+    }
+  }
+
+  CompiledSequence::Header header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, sequenceMagic, sizeof(header.magic));
+  header.version = CompiledSequence::currentVersion;
+  header.byteOrder = byteOrderMark;
+  header.numEvents = events.size();
+  header.numValues = values.size();
+  header.numNames = numNames;
+  header.numStrings = uint32_t(stringOffsets.size());
+  header.eventsOffset = alignTo8(sizeof(header));
+  header.valuesOffset = alignTo8(header.eventsOffset +
+                                 events.size() * sizeof(events[0]));
+  header.typesOffset =
+      alignTo8(header.valuesOffset + values.size() * sizeof(float));
+  header.stringOffsetsOffset = alignTo8(header.typesOffset + types.size());
+  header.stringDataOffset = alignTo8(
+      header.stringOffsetsOffset + stringOffsets.size() * sizeof(uint32_t));
+  header.stringDataSize = stringData.size();
+
+  std::ofstream f(outputPath, std::ios::binary | std::ios::trunc);
+  if (!f.is_open()) {
+    std::cerr << "CompiledSequence: Could not write:" << outputPath
+              << std::endl;
+    return false;
+  }
+  auto writeSection = [&f](uint64_t offset, const void *data, size_t size) {
+    static const char padding[8] = {0};
+    uint64_t position = uint64_t(f.tellp());
+    f.write(padding, std::streamsize(offset - position));
+    if (size > 0) {
+      f.write(static_cast<const char *>(data), std::streamsize(size));
+    }
+  };
+  f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  writeSection(header.eventsOffset, events.data(),
+               events.size() * sizeof(events[0]));
+  writeSection(header.valuesOffset, values.data(),
+               values.size() * sizeof(float));
+  writeSection(header.typesOffset, types.data(), types.size());
+  writeSection(header.stringOffsetsOffset, stringOffsets.data(),
+               stringOffsets.size() * sizeof(uint32_t));
+  writeSection(header.stringDataOffset, stringData.data(),
+               stringData.size());
+  return f.good();
+}
+
+} // namespace
+
+bool CompiledSequence::compile(std::string textPath, std::string outputPath) {
+  SequenceCompiler compiler;
+  try {
+    if (!compiler.parse(textPath, 0.0, 1.0, 0)) {
+      return false;
+    }
+  } catch (std::exception &e) {
+    std::cerr << "CompiledSequence: Error parsing " << textPath << ": "
+              << e.what() << std::endl;
+    return false;
+  }
+  return compiler.write(outputPath);
+}
+
+bool CompiledSequence::open(std::string path) {
+  mEvents = nullptr;
+  mEventCount = 0;
+  if (!mFile.open(path)) {
+    std::cerr << "CompiledSequence: Could not open:" << path << std::endl;
+    return false;
+  }
+  const char *data = mFile.data();
+  uint64_t size = mFile.size();
+  Header header;
+  if (size < sizeof(header)) {
+    mFile.close();
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, sequenceMagic, sizeof(header.magic)) != 0 ||
+      header.version != currentVersion || header.byteOrder != byteOrderMark) {
+    std::cerr << "CompiledSequence: Not a compatible compiled sequence:"
+              << path << std::endl;
+    mFile.close();
+    return false;
+  }
+  // Check every section lies within the file. Counts are checked against
+  // the file size first so the products below can't overflow.
+  auto sectionValid = [size](uint64_t offset, uint64_t count,
+                             uint64_t elementSize) {
+    return offset % 8 == 0 && offset <= size && count <= size &&
+           count * elementSize <= size - offset;
+  };
+  if (!sectionValid(header.eventsOffset, header.numEvents, sizeof(Event)) ||
+      !sectionValid(header.valuesOffset, header.numValues, sizeof(float)) ||
+      !sectionValid(header.typesOffset, header.numValues, 1) ||
+      !sectionValid(header.stringOffsetsOffset, header.numStrings,
+                    sizeof(uint32_t)) ||
+      !sectionValid(header.stringDataOffset, header.stringDataSize, 1) ||
+      header.numNames > header.numStrings ||
+      (header.stringDataSize > 0 &&
+       data[header.stringDataOffset + header.stringDataSize - 1] != '\0')) {
+    std::cerr << "CompiledSequence: Corrupt compiled sequence:" << path
+              << std::endl;
+    mFile.close();
+    return false;
+  }
+  // Strings must start within the string data, so name() is valid for every
+  // name index
+  const uint32_t *stringOffsets =
+      reinterpret_cast<const uint32_t *>(data + header.stringOffsetsOffset);
+  for (uint32_t i = 0; i < header.numStrings; i++) {
+    if (stringOffsets[i] >= header.stringDataSize) {
+      std::cerr << "CompiledSequence: Corrupt compiled sequence:" << path
+                << std::endl;
+      mFile.close();
+      return false;
+    }
+  }
+  mEvents = reinterpret_cast<const Event *>(data + header.eventsOffset);
+  mEventCount = size_t(header.numEvents);
+  mValues = reinterpret_cast<const float *>(data + header.valuesOffset);
+  mValueCount = header.numValues;
+  mTypes = reinterpret_cast<const uint8_t *>(data + header.typesOffset);
+  mStringOffsets = stringOffsets;
+  mStringCount = header.numStrings;
+  mNameCount = header.numNames;
+  mStringData = data + header.stringDataOffset;
+  mStringDataSize = header.stringDataSize;
+  return true;
+}
+
+const char *CompiledSequence::name(uint32_t index) const {
+  if (index >= mNameCount || mStringOffsets[index] >= mStringDataSize) {
+    return nullptr;
+  }
+  return mStringData + mStringOffsets[index];
+}
+
+const float *CompiledSequence::values(const Event &event) const {
+  if (event.firstValue > mValueCount ||
+      event.numFields > mValueCount - event.firstValue) {
+    return nullptr;
+  }
+  return mValues + event.firstValue;
+}
+
+CompiledSequence::FieldType
+CompiledSequence::fieldType(const Event &event, uint16_t field) const {
+  return FieldType(mTypes[event.firstValue + field]);
+}
+
+const char *CompiledSequence::stringField(const Event &event,
+                                          uint16_t field) const {
+  uint32_t index;
+  std::memcpy(&index, mValues + event.firstValue + field, sizeof(index));
+  if (index >= mStringCount || mStringOffsets[index] >= mStringDataSize) {
+    return "";
+  }
+  return mStringData + mStringOffsets[index];
+}
+
+std::vector<ParameterField>
+CompiledSequence::fields(const Event &event) const {
+  std::vector<ParameterField> pFields;
+  const float *eventValues = values(event);
+  if (!eventValues) {
+    return pFields;
+  }
+  pFields.reserve(event.numFields);
+  for (uint16_t i = 0; i < event.numFields; i++) {
+    if (fieldType(event, i) == FIELD_STRING) {
+      pFields.push_back(std::string(stringField(event, i)));
+    } else {
+      pFields.push_back(eventValues[i]);
+    }
+  }
+  return pFields;
+}
+
+double CompiledSequence::duration() const {
+  double dur = 0.0;
+  for (size_t i = 0; i < mEventCount; i++) {
+    if (mEvents[i].startTime + mEvents[i].duration > dur) {
+      dur = mEvents[i].startTime + mEvents[i].duration;
+    }
+  }
+  return dur;
+}
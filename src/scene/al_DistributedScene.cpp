@@ -224,7 +224,10 @@ bool al::DistributedScene::consumeMessage(osc::Message &m,
     if (m.typeTags() == "i") {
       int id;
       m >> id;
-      mVoiceIdsToFree.write((const char *)&id, sizeof(int));
+      VoiceCommand command;
+      command.type = VoiceCommand::FREE;
+      command.id = id;
+      pushVoiceCommand(command);
       if (verbose()) {
         std::cout << "FREE received " << id << std::endl;
       }
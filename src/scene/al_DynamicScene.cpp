@@ -67,12 +67,24 @@ DynamicScene::DynamicScene(int threadPoolSize, TimeMasterMode masterMode)
   if (threadPoolSize > 0) {
     mWorkerThreads = std::make_unique<ThreadPool>(threadPoolSize);
   }
+  // One worker per audio thread plus one for the thread calling render()
+  for (int i = 0; i < threadPoolSize + 1; i++) {
+    mAudioWorkers.emplace_back(std::make_unique<AudioWorker>());
+  }
   for (int i = 0; i < threadPoolSize; i++) {
     mAudioThreads.push_back(
         std::thread(DynamicScene::audioThreadFunc, this, i));
-    mThreadMap[i] = std::vector<int>();
-    mThreadMap[i].reserve(16);
   }
+  // Size the spatializer state before the voice reaches the audio thread
+  registerTriggerOnCallback(
+      [this](SynthVoice *voice, int offsetFrames, int id, void *userData) {
+        auto *posVoice = dynamic_cast<PositionedVoice *>(voice);
+        if (posVoice) {
+          posVoice->prepareSpatializerSources(voice->numOutChannels(),
+                                              mSpatializer->numSpeakers());
+        }
+        return true;
+      });
 
   addSphere(mWorldMarker);
   mWorldMarker.primitive(Mesh::LINES);
@@ -109,16 +121,34 @@ void DynamicScene::prepare(AudioIOData &io) {
                  "is likely to crash."
               << std::endl;
   }
-  mThreadedAudioData.resize(mAudioThreads.size());
-  for (auto &threadio : mThreadedAudioData) {
-    threadio.framesPerBuffer(io.framesPerBuffer());
-    threadio.channelsIn(mVoiceMaxInputChannels);
-    threadio.channelsOut(mVoiceMaxOutputChannels);
-    threadio.channelsBus(mVoiceBusChannels);
+  for (auto &worker : mAudioWorkers) {
+    worker->voiceIO.framesPerBuffer(io.framesPerBuffer());
+    worker->voiceIO.channelsIn(mVoiceMaxInputChannels);
+    worker->voiceIO.channelsOut(mVoiceMaxOutputChannels);
+    worker->voiceIO.channelsBus(mVoiceBusChannels);
   }
+  mPreparedIO.framesPerBuffer(io.framesPerBuffer());
+  mPreparedIO.framesPerSecond(io.framesPerSecond());
+  mPreparedIO.channelsIn(0);
+  mPreparedIO.channelsOut(io.channelsOut());
+  mPreparedIO.channelsBus(io.channelsBus());
+  prepareAccumulators(mPreparedIO);
+  mBlockVoices.reserve(1024);
+  mUsedAccumulators.reserve(mAudioWorkers.size());
+  mUsedBuses.reserve(mAudioWorkers.size());
   m_internalAudioConfigured = true;
 }
 
+void DynamicScene::prepareAccumulators(const AudioIOData &io) {
+  for (auto &worker : mAudioWorkers) {
+    worker->accumulator.channelsIn(0);
+    worker->accumulator.channelsBus(io.channelsBus());
+    if (mSpatializer) {
+      mSpatializer->prepareAccumulator(worker->accumulator, io);
+    }
+  }
+}
+
 void DynamicScene::render(Graphics &g) {
   if (mDrawWorldMarker) {
     g.color(0.7);
@@ -185,99 +215,24 @@ void DynamicScene::render(AudioIOData &io) {
   io.zeroBus();
 
   auto *voice = mActiveVoices;
-  int fpb = internalAudioIO.framesPerBuffer();
   if (mAudioThreads.size() == 0 ||
       !mThreadedAudio) { // Not using worker threads
     // Render active voices
     while (voice) {
       if (voice->active()) {
-        int offset = voice->getStartOffsetFrames(fpb);
-        if (offset < fpb) {
-          // io.frame(offset);
-          int endOffsetFrames = voice->getEndOffsetFrames(fpb);
-          if (endOffsetFrames > 0 && endOffsetFrames <= fpb) {
-            voice->triggerOff(endOffsetFrames);
-          }
-          internalAudioIO.zeroOut();
-          internalAudioIO.zeroBus();
-          internalAudioIO.frame(offset);
-          voice->onProcess(internalAudioIO);
-          Vec3d listeningDir;
-          vector<Vec3f> posOffsets;
-          if (dynamic_cast<PositionedVoice *>(voice)) {
-            PositionedVoice *posVoice = static_cast<PositionedVoice *>(voice);
-            Vec3d direction = posVoice->pose().vec() - mListenerPose.vec();
-
-            // Rotate vector according to listener-rotation
-            Quatd srcRot = mListenerPose.quat();
-            listeningDir = srcRot.rotate(direction);
-            posOffsets = posVoice->audioOutOffsets();
-            assert(posOffsets.size() == 0 ||
-                   posOffsets.size() == posVoice->numOutChannels());
-            if (posVoice->useDistanceAttenuation()) {
-              float distance = listeningDir.mag();
-              float atten = mDistAtten.attenuation(distance);
-              internalAudioIO.frame(0);
-              float *buf = internalAudioIO.outBuffer(0);
-
-              while (internalAudioIO()) {
-                *buf = *buf * atten;
-                buf++;
-              }
-            }
-          } else {
-            listeningDir = mListenerPose;
-          }
-          if (mBusRoutingCallback) {
-            // First call callback to route signals to internal buses
-            internalAudioIO.frame(offset);
-            Pose listeningPose = listeningDir;
-            (*mBusRoutingCallback)(internalAudioIO, listeningPose);
-            io.frame(offset);
-            internalAudioIO.frame(offset);
-            // Then gather all the internal buses into the master AudioIO buses
-            while (io() && internalAudioIO()) {
-              for (int i = 0; i < mVoiceBusChannels; i++) {
-                io.bus(i) += internalAudioIO.bus(i);
-              }
-            }
-          }
-          for (unsigned int i = 0; i < voice->numOutChannels(); i++) {
-            io.frame(offset);
-            internalAudioIO.frame(offset);
-            Pose offsetPose = listeningDir;
-            if (posOffsets.size() > 0) {
-              // Is there need to rotate the position according to the quat()?
-              // It would only really be useful if the source has a direction
-              // dependent dispersion model...
-              offsetPose.vec() += posOffsets[i];
-            }
-            mSpatializer->renderBuffer(io, offsetPose,
-                                       internalAudioIO.outBuffer(i), fpb);
-          }
-        }
+        renderVoice(voice, internalAudioIO, io, false);
       }
       voice = voice->next;
     }
   } else { // Process Audio Threaded
-    mAudioBusy = 0;
-    for (auto &tmap : mThreadMap) {
-      tmap.second.resize(0);
-    }
-    unsigned int counter = 0;
+    mBlockVoices.clear();
     while (voice) {
       if (voice->active()) {
-        mThreadMap[counter++].push_back(voice->id());
-        if (counter > mThreadMap.size()) {
-          counter = 0;
-        }
+        mBlockVoices.push_back(voice);
       }
       voice = voice->next;
     }
-    externalAudioIO = &io;
-    mThreadTrigger.notify_all();
-    std::unique_lock<std::mutex> lk(mThreadTriggerLock);
-    mAudioThreadDone.wait(lk, [this]() { return mAudioBusy == 0; });
+    renderThreaded(io);
   }
   mSpatializer->finalize(io);
   processGain(io);
@@ -361,93 +316,220 @@ void DynamicScene::updateThreadFunc(UpdateThreadFuncData data) {
   voice->update(dt);
 }
 
+void DynamicScene::renderVoice(SynthVoice *voice, AudioIOData &voiceIO,
+                               AudioIOData &io, bool concurrent) {
+  int fpb = voiceIO.framesPerBuffer();
+  int offset = voice->getStartOffsetFrames(fpb);
+  if (offset >= fpb) {
+    return;
+  }
+  int endOffsetFrames = voice->getEndOffsetFrames(fpb);
+  if (endOffsetFrames > 0 && endOffsetFrames <= fpb) {
+    voice->triggerOff(endOffsetFrames);
+  }
+  voiceIO.zeroOut();
+  voiceIO.zeroBus();
+  voiceIO.frame(offset);
+  voice->onProcess(voiceIO);
+  Vec3d listeningDir;
+  vector<Vec3f> posOffsets;
+  SpatializerSource *sources = nullptr;
+  if (dynamic_cast<PositionedVoice *>(voice)) {
+    PositionedVoice *posVoice = static_cast<PositionedVoice *>(voice);
+    sources = posVoice->spatializerSources(voice->numOutChannels());
+    Vec3d direction = posVoice->pose().vec() - mListenerPose.vec();
+
+    // Rotate vector according to listener-rotation
+    Quatd srcRot = mListenerPose.quat();
+    listeningDir = srcRot.rotate(direction);
+    posOffsets = posVoice->audioOutOffsets();
+    assert(posOffsets.size() == 0 ||
+           posOffsets.size() == posVoice->numOutChannels());
+    if (posVoice->useDistanceAttenuation()) {
+      float distance = listeningDir.mag();
+      float atten = mDistAtten.attenuation(distance);
+      voiceIO.frame(0);
+      float *buf = voiceIO.outBuffer(0);
+
+      while (voiceIO()) {
+        *buf = *buf * atten;
+        buf++;
+      }
+    }
+  } else {
+    listeningDir = mListenerPose;
+  }
+  // Measured after distance attenuation so quiet means quiet to the listener
+  processVoiceOutput(voice, voiceIO);
+  if (mBusRoutingCallback) {
+    // First call callback to route signals to internal buses
+    voiceIO.frame(offset);
+    Pose listeningPose = listeningDir;
+    (*mBusRoutingCallback)(voiceIO, listeningPose);
+    io.frame(offset);
+    voiceIO.frame(offset);
+    // Then gather all the internal buses into the master AudioIO buses
+    while (io() && voiceIO()) {
+      for (int i = 0; i < mVoiceBusChannels; i++) {
+        io.bus(i) += voiceIO.bus(i);
+      }
+    }
+  }
+  for (unsigned int i = 0; i < voice->numOutChannels(); i++) {
+    io.frame(offset);
+    voiceIO.frame(offset);
+    Pose offsetPose = listeningDir;
+    if (posOffsets.size() > 0) {
+      // Is there need to rotate the position according to the quat()?
+      // It would only really be useful if the source has a direction
+      // dependent dispersion model...
+      offsetPose.vec() += posOffsets[i];
+    }
+    SpatializerSource *source = sources ? sources + i : nullptr;
+    if (concurrent) {
+      // io is this thread's accumulator
+      mSpatializer->renderToAccumulator(io, offsetPose, voiceIO.outBuffer(i),
+                                        fpb, 0, -1, source);
+    } else if (source) {
+      mSpatializer->renderSource(io, offsetPose, voiceIO.outBuffer(i), fpb,
+                                 *source);
+    } else {
+      mSpatializer->renderBuffer(io, offsetPose, voiceIO.outBuffer(i), fpb);
+    }
+  }
+}
+
+double DynamicScene::voiceStealScore(SynthVoice *voice,
+                                     VoiceStealPolicy policy) {
+  if (policy == VoiceStealPolicy::STEAL_FARTHEST) {
+    if (auto *posVoice = dynamic_cast<PositionedVoice *>(voice)) {
+      return (posVoice->pose().pos() - mListenerPose.pos()).mag();
+    }
+    policy = VoiceStealPolicy::STEAL_OLDEST;
+  }
+  return PolySynth::voiceStealScore(voice, policy);
+}
+
+void DynamicScene::renderThreaded(AudioIOData &io) {
+  const size_t numWorkers = mAudioWorkers.size();
+  const int numVoices = int(mBlockVoices.size());
+  if (numVoices == 0) {
+    return;
+  }
+  // Split voices into contiguous ranges, one per worker. Workers that run out
+  // of voices in their range steal chunks from the others.
+  const int voicesPerWorker = int((numVoices + numWorkers - 1) / numWorkers);
+  int start = 0;
+  for (auto &worker : mAudioWorkers) {
+    int end = std::min(start + voicesPerWorker, numVoices);
+    worker->nextVoice.store(start, std::memory_order_relaxed);
+    worker->endVoice = end;
+    worker->accumulatorUsed = false;
+    start = end;
+  }
+  mVoicesPending.store(numVoices);
+  mAudioBlockOpen.store(true);
+  mAudioBlockCounter.fetch_add(1);
+  // Only wake threads that have gone to sleep. Threads that are still
+  // spinning will pick up the new block on their own.
+  if (mParkedAudioThreads.load() > 0) {
+    { std::unique_lock<std::mutex> lk(mThreadTriggerLock); }
+    mThreadTrigger.notify_all();
+  }
+
+  // This thread renders too
+  processVoiceChunks(numWorkers - 1);
+
+  while (mVoicesPending.load(std::memory_order_acquire) > 0) {
+    std::this_thread::yield();
+  }
+  mAudioBlockOpen.store(false);
+  // Wait for threads that are still checking for work in this block
+  while (mAudioBusy.load() > 0) {
+    std::this_thread::yield();
+  }
+
+  // Sum the output of each thread into the device buffers
+  mUsedAccumulators.clear();
+  for (auto &worker : mAudioWorkers) {
+    if (worker->accumulatorUsed) {
+      mUsedAccumulators.push_back(&worker->accumulator);
+    }
+  }
+  mSpatializer->reduce(io, mUsedAccumulators.data(), mUsedAccumulators.size());
+  if (mUsedAccumulators.empty()) {
+    return;
+  }
+  for (unsigned int c = 0; c < io.channelsBus(); c++) {
+    mUsedBuses.clear();
+    for (auto *accumulator : mUsedAccumulators) {
+      mUsedBuses.push_back(accumulator->busBuffer(c));
+    }
+    Spatializer::sumBuffers(io.busBuffer(c), mUsedBuses.data(),
+                            mUsedBuses.size(), io.framesPerBuffer());
+  }
+}
+
+bool DynamicScene::claimVoices(size_t workerIndex, int &begin, int &end) {
+  const size_t numWorkers = mAudioWorkers.size();
+  // Own range first, then steal from the others
+  for (size_t i = 0; i < numWorkers; i++) {
+    AudioWorker &worker = *mAudioWorkers[(workerIndex + i) % numWorkers];
+    if (worker.nextVoice.load(std::memory_order_relaxed) >= worker.endVoice) {
+      continue;
+    }
+    begin = worker.nextVoice.fetch_add(mAudioChunkSize,
+                                       std::memory_order_relaxed);
+    if (begin < worker.endVoice) {
+      end = std::min(begin + mAudioChunkSize, worker.endVoice);
+      return true;
+    }
+  }
+  return false;
+}
+
+void DynamicScene::processVoiceChunks(size_t workerIndex) {
+  AudioWorker &worker = *mAudioWorkers[workerIndex];
+  int begin, end;
+  while (claimVoices(workerIndex, begin, end)) {
+    if (!worker.accumulatorUsed) {
+      worker.accumulator.zeroOut();
+      worker.accumulator.zeroBus();
+      worker.accumulatorUsed = true;
+    }
+    for (int i = begin; i < end; i++) {
+      renderVoice(mBlockVoices[i], worker.voiceIO, worker.accumulator, true);
+    }
+    mVoicesPending.fetch_sub(end - begin, std::memory_order_release);
+  }
+}
+
 void DynamicScene::audioThreadFunc(DynamicScene *scene, int id) {
+  // Number of times to check for a new block before going to sleep
+  const int spinCount = 2000;
+  uint64_t lastBlock = scene->mAudioBlockCounter.load();
   while (scene->mSynthRunning) {
-    std::unique_lock<std::mutex> lk(scene->mThreadTriggerLock);
-    scene->mThreadTrigger.wait(lk);
-    scene->mAudioBusy++;
-
-    vector<int> &idsToProcess = scene->mThreadMap[id];
-    AudioIOData &internalAudioIO = scene->mThreadedAudioData[id];
-    AudioIOData &io = *scene->externalAudioIO;
-    unsigned int fpb = internalAudioIO.framesPerBuffer();
-    SynthVoice *voice = scene->mActiveVoices;
-    while (voice) {
-      //                if (voice->active()) { // No need to check as only
-      //                active voices are put in mThreadMap
-      if (find(idsToProcess.begin(), idsToProcess.end(), voice->id()) !=
-          idsToProcess.end()) { // voice has been assigned to this thread
-        unsigned int offset = voice->getStartOffsetFrames(fpb);
-        if (offset < fpb) {
-          io.frame(offset);
-          unsigned int endOffsetFrames = voice->getEndOffsetFrames(fpb);
-          if (endOffsetFrames > 0 && endOffsetFrames <= fpb) {
-            voice->triggerOff(endOffsetFrames);
-          }
-          internalAudioIO.zeroOut();
-          internalAudioIO.zeroBus();
-          internalAudioIO.frame(offset);
-          voice->onProcess(internalAudioIO);
-          Vec3d listeningDir;
-          vector<Vec3f> posOffsets;
-          if (dynamic_cast<PositionedVoice *>(voice)) {
-            PositionedVoice *posVoice = static_cast<PositionedVoice *>(voice);
-            Vec3d direction =
-                posVoice->pose().vec() - scene->mListenerPose.vec();
-
-            // Rotate vector according to listener-rotation
-            Quatd srcRot = scene->mListenerPose.quat();
-            listeningDir = srcRot.rotate(direction);
-            posOffsets = posVoice->audioOutOffsets();
-            assert(posOffsets.size() == 0 ||
-                   posOffsets.size() == posVoice->numOutChannels());
-            if (posVoice->useDistanceAttenuation()) {
-              float distance = scene->mListenerPose.vec().mag();
-              float atten = scene->mDistAtten.attenuation(distance);
-              internalAudioIO.frame(0);
-              float *buf = internalAudioIO.outBuffer(0);
-
-              while (internalAudioIO()) {
-                *buf = *buf * atten;
-                buf++;
-              }
-            }
-          } else {
-            listeningDir = scene->mListenerPose;
-            // FIXME what should we do here if voice not a PositionedVoice?
-          }
-          scene->mSpatializerLock.lock();
-          if (scene->mBusRoutingCallback) {
-            // First call callback to route signals to internal buses
-            internalAudioIO.frame(offset);
-            (*scene->mBusRoutingCallback)(internalAudioIO,
-                                          scene->mListenerPose);
-            io.frame(offset);
-            internalAudioIO.frame(offset);
-            // Then gather all the internal buses into the master AudioIO buses
-            while (io() && internalAudioIO()) {
-              for (int i = 0; i < scene->mVoiceBusChannels; i++) {
-                io.bus(i) += internalAudioIO.bus(i);
-              }
-            }
-          }
-          for (unsigned int i = 0; i < voice->numOutChannels(); i++) {
-            io.frame(offset);
-            internalAudioIO.frame(offset);
-            Pose offsetPose = scene->mListenerPose;
-            if (posOffsets.size() > 0) {
-              offsetPose.vec() += posOffsets[i];
-            }
-            scene->mSpatializer->renderBuffer(
-                io, offsetPose, internalAudioIO.outBuffer(i), fpb);
-          }
-          scene->mSpatializerLock.unlock();
-        }
+    int spins = 0;
+    while (scene->mAudioBlockCounter.load() == lastBlock &&
+           scene->mSynthRunning) {
+      if (spins++ < spinCount) {
+        std::this_thread::yield();
+        continue;
       }
-      voice = voice->next;
+      std::unique_lock<std::mutex> lk(scene->mThreadTriggerLock);
+      scene->mParkedAudioThreads++;
+      scene->mThreadTrigger.wait(lk, [&]() {
+        return scene->mAudioBlockCounter.load() != lastBlock ||
+               !scene->mSynthRunning;
+      });
+      scene->mParkedAudioThreads--;
+    }
+    lastBlock = scene->mAudioBlockCounter.load();
+    scene->mAudioBusy++;
+    if (scene->mAudioBlockOpen.load()) {
+      scene->processVoiceChunks(id);
     }
     scene->mAudioBusy--;
-    scene->mAudioThreadDone.notify_one();
   }
   //  std::cout << "Audio thread " << id << " done" << std::endl;
 }
@@ -1,5 +1,8 @@
 #include "al/scene/al_PolySynth.hpp"
 
+#include <cmath>
+#include <cstring>
+#include <limits>
 #include <memory>
 
 using namespace al;
@@ -415,6 +418,11 @@ int PolySynth::triggerOn(SynthVoice *voice, int offsetFrames, int id,
     }
   }
   voice->id(thisId);
+  if (voice->mTypeId < 0) {
+    // Voice was not allocated by a PolySynth
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    registerVoicePool(voice);
+  }
   if (userData) {
     voice->userData(userData);
   }
@@ -424,15 +432,15 @@ int PolySynth::triggerOn(SynthVoice *voice, int offsetFrames, int id,
   }
   if (allCallbacksOk) {
     voice->triggerOn(offsetFrames);
-    {
-      std::unique_lock<std::mutex> lk(mVoiceToInsertLock);
-      voice->next = mVoicesToInsert;
-      voice->mActive =
-          true; // We need to mark this here to avoid race conditions if
-                // active() is checked on separate thread, and the voice
-                // removed before it has been triggered.
-      mVoicesToInsert = voice;
-    }
+    voice->mActive = true; // We need to mark this here to avoid race
+                           // conditions if active() is checked on separate
+                           // thread, and the voice removed before it has been
+                           // triggered.
+    VoiceCommand command;
+    command.type = VoiceCommand::TRIGGER_ON;
+    command.voice = voice;
+    command.id = thisId;
+    pushVoiceCommand(command);
     return thisId;
   } else {
     return -1;
@@ -445,56 +453,400 @@ void PolySynth::triggerOff(int id) {
     allCallbacksOk &= cbNode.first(id, cbNode.second);
   }
   if (allCallbacksOk) {
-    mVoiceIdsToTurnOff.write((const char *)&id, sizeof(int));
+    VoiceCommand command;
+    command.type = VoiceCommand::TRIGGER_OFF;
+    command.id = id;
+    pushVoiceCommand(command);
   }
 }
 
-void PolySynth::allNotesOff() { mAllNotesOff = true; }
+void PolySynth::allNotesOff() {
+  VoiceCommand command;
+  command.type = VoiceCommand::ALL_OFF;
+  pushVoiceCommand(command);
+}
 
-SynthVoice *PolySynth::getVoice(std::string name, bool forceAlloc) {
-  std::unique_lock<std::mutex> lk(
-      mFreeVoiceLock); // Only one getVoice() call at a time
-  SynthVoice *freeVoice = mFreeVoices;
-  SynthVoice *previousVoice = nullptr;
-  while (freeVoice) {
-    if (verbose()) {
-      std::cout << "Comparing  voice '" << demangle(typeid(*freeVoice).name())
-                << "' to '" << name << "'" << std::endl;
-    }
-    if (demangle(typeid(*freeVoice).name()) == name ||
-        strncmp(typeid(*freeVoice).name(), name.c_str(), name.size()) == 0) {
-      if (previousVoice) {
-        previousVoice->next = freeVoice->next;
-      } else {
-        mFreeVoices = freeVoice->next;
+void PolySynth::setVoiceBudget(int typeId, int maxActiveVoices,
+                               VoiceStealPolicy policy) {
+  if (typeId < 0) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    voicePool(typeId); // Makes room for the budget
+  }
+  VoiceCommand command;
+  command.type = VoiceCommand::SET_BUDGET;
+  command.id = typeId;
+  command.maxActiveVoices = maxActiveVoices;
+  command.policy = policy;
+  pushVoiceCommand(command);
+}
+
+double PolySynth::voiceStealScore(SynthVoice *voice, VoiceStealPolicy policy) {
+  if (policy == VoiceStealPolicy::STEAL_QUIETEST) {
+    return -voice->mLevel;
+  }
+  return -double(voice->mTriggerOrder); // Oldest
+}
+
+void PolySynth::applyVoiceBudget(SynthVoice *newVoice) {
+  const int typeId = newVoice->mTypeId;
+  if (typeId < 0 || typeId >= int(mVoiceBudgets.size()) ||
+      mVoiceBudgets[typeId].maxActiveVoices < 0) {
+    return;
+  }
+  const VoiceBudget &budget = mVoiceBudgets[typeId];
+  if (budget.policy == VoiceStealPolicy::STEAL_QUIETEST) {
+    newVoice->mTrackLevel = true;
+  }
+  while (true) {
+    // Count voices of this class that are sounding and not being stolen
+    int numActive = 0;
+    SynthVoice *victim = nullptr;
+    double victimScore = -std::numeric_limits<double>::infinity();
+    for (auto *voice = mActiveVoices; voice; voice = voice->next) {
+      if (voice->mTypeId == typeId && voice->active() &&
+          voice->mStealFramesLeft < 0) {
+        numActive++;
+        double score = voiceStealScore(voice, budget.policy);
+        if (!victim || score > victimScore) {
+          victim = voice;
+          victimScore = score;
+        }
+      }
+    }
+    if (numActive < budget.maxActiveVoices) {
+      return;
+    }
+    if (budget.policy == VoiceStealPolicy::STEAL_NONE || !victim) {
+      newVoice->mActive = false; // Drop the new voice
+      return;
+    }
+    if (mVerbose) {
+      std::cout << "Stealing voice " << victim->id() << std::endl;
+    }
+    // The fade advances as audio renders, so when audio isn't the time
+    // master nothing would finish it
+    if (mStealFadeFrames > 0 &&
+        mMasterMode == TimeMasterMode::TIME_MASTER_AUDIO) {
+      victim->mStealFramesLeft = mStealFadeFrames;
+    } else {
+      victim->mActive = false;
+    }
+  }
+}
+
+void PolySynth::fadeAndMeasureVoice(SynthVoice *voice, AudioIOData &voiceIO) {
+  const int fpb = voiceIO.framesPerBuffer();
+  const int channels =
+      std::min(int(voice->numOutChannels()), int(voiceIO.channelsOut()));
+  if (voice->mTrackLevel) {
+    float peak = 0.0f;
+    for (int c = 0; c < channels; c++) {
+      const float *buf = voiceIO.outBuffer(c);
+      for (int i = 0; i < fpb; i++) {
+        peak = std::max(peak, std::fabs(buf[i]));
+      }
+    }
+    voice->mLevel = peak;
+  }
+  if (voice->mStealFramesLeft >= 0) {
+    const float step = 1.0f / std::max(mStealFadeFrames, 1);
+    for (int c = 0; c < channels; c++) {
+      float *buf = voiceIO.outBuffer(c);
+      float gain = voice->mStealFramesLeft * step;
+      for (int i = 0; i < fpb; i++) {
+        buf[i] *= gain > 0.0f ? gain : 0.0f;
+        gain -= step;
+      }
+    }
+    voice->mStealFramesLeft -= fpb;
+    if (voice->mStealFramesLeft <= 0) {
+      voice->mStealFramesLeft = -1;
+      voice->mActive = false; // Fade done, return voice to the free pool
+    }
+  }
+}
+
+void PolySynth::pushVoiceCommand(const VoiceCommand &command) {
+  // Once a command has overflowed, later commands must follow it through the
+  // overflow list to keep their order
+  if (!mVoiceCommandsOverflowed.load(std::memory_order_acquire) &&
+      mVoiceCommands.push(command)) {
+    return;
+  }
+  std::unique_lock<std::mutex> lk(mVoiceCommandOverflowLock);
+  // The overflow list may have been applied while waiting for the lock
+  if (!mVoiceCommandsOverflowed.load(std::memory_order_relaxed) &&
+      mVoiceCommands.push(command)) {
+    return;
+  }
+  // Raise the flag before appending so commands pushed from now on queue up
+  // behind this one
+  mVoiceCommandsOverflowed.store(true, std::memory_order_release);
+  mVoiceCommandOverflow.push_back(command);
+}
+
+void PolySynth::processVoiceCommands() {
+  auto apply = [this](const VoiceCommand &command) {
+    switch (command.type) {
+    case VoiceCommand::TRIGGER_ON: {
+      auto *voice = command.voice;
+      voice->mTriggerOrder = mTriggerOrderCounter++;
+      voice->mStealFramesLeft = -1;
+      voice->mTrackLevel = false;
+      // Don't let voices that haven't rendered yet count as quiet
+      voice->mLevel = std::numeric_limits<float>::max();
+      applyVoiceBudget(voice);
+      voice->next = mActiveVoices; // Put new voice in head
+      mActiveVoices = voice;
+      if (verbose()) {
+        std::cout << "Voice on " << command.id << std::endl;
       }
       break;
     }
-    previousVoice = freeVoice;
-    freeVoice = freeVoice->next;
+    case VoiceCommand::TRIGGER_OFF:
+      for (auto *voice = mActiveVoices; voice; voice = voice->next) {
+        if (voice->id() == command.id) {
+          if (mVerbose) {
+            std::cout << "Voice trigger off " << voice->id() << std::endl;
+          }
+          voice->triggerOff(); // TODO use offset for turn off
+        }
+      }
+      break;
+    case VoiceCommand::FREE:
+      if (mVerbose) {
+        std::cout << "Voice free " << command.id << std::endl;
+      }
+      for (auto *voice = mActiveVoices; voice; voice = voice->next) {
+        if (voice->id() == command.id) {
+          voice->mActive = false;
+        }
+      }
+      break;
+    case VoiceCommand::ALL_OFF:
+      if (mActiveVoices) {
+        auto *voice = mActiveVoices;
+        while (true) {
+          voice->id(-1);
+          if (!voice->next) {
+            break;
+          }
+          voice = voice->next;
+        }
+        // Connect last active voice to voices waiting for release
+        voice->next = mVoicesToRelease;
+        mVoicesToRelease = mActiveVoices;
+        mActiveVoices = nullptr; // No active voices left
+      }
+      break;
+    case VoiceCommand::SET_BUDGET:
+      mVoiceBudgets[command.id].maxActiveVoices = command.maxActiveVoices;
+      mVoiceBudgets[command.id].policy = command.policy;
+      for (auto *voice = mActiveVoices; voice; voice = voice->next) {
+        if (voice->mTypeId == command.id) {
+          voice->mTrackLevel =
+              command.maxActiveVoices >= 0 &&
+              command.policy == VoiceStealPolicy::STEAL_QUIETEST;
+        }
+      }
+      break;
+    }
+  };
+
+  VoiceCommand command;
+  while (mVoiceCommands.pop(command)) {
+    apply(command);
+  }
+  if (mVoiceCommandsOverflowed.load(std::memory_order_acquire) &&
+      mVoiceCommandOverflowLock.try_lock()) {
+    for (auto &overflowCommand : mVoiceCommandOverflow) {
+      apply(overflowCommand);
+    }
+    mVoiceCommandOverflow.clear();
+    mVoiceCommandsOverflowed.store(false, std::memory_order_release);
+    mVoiceCommandOverflowLock.unlock();
+  }
+}
+
+SynthVoice *PolySynth::getVoice(std::string name, bool forceAlloc) {
+  int typeId = voiceTypeId(name);
+  if (typeId < 0 && name.size() > 0) {
+    // Classes that were never registered can still have free voices
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    for (size_t i = 0; i < mVoicePools.size(); i++) {
+      const char *typeName =
+          mVoicePools[i] ? mVoicePools[i]->typeName : nullptr;
+      if (typeName && strncmp(typeName, name.c_str(), name.size()) == 0) {
+        typeId = int(i);
+        break;
+      }
+    }
   }
-  if (!freeVoice) { // No free voice in list, so we need to allocate it
-                    //  But only allocate if allocation has not been disabled
-    if (std::find(mNoAllocationList.begin(), mNoAllocationList.end(), name) ==
+  if (typeId < 0) {
+    if (std::find(mNoAllocationList.begin(), mNoAllocationList.end(), name) !=
         mNoAllocationList.end()) {
-      // TODO report current polyphony for more informed allocation of polyphony
-      freeVoice = allocateVoice(name);
-    } else {
       std::cout << "Automatic allocation disabled for voice:" << name
                 << std::endl;
+    } else if (mVerbose) {
+      std::cout << "Can't allocate voice of type " << name
+                << ". Voice not registered and no polyphony." << std::endl;
+    }
+    return nullptr;
+  }
+  return getVoice(typeId, forceAlloc);
+}
+
+SynthVoice *PolySynth::getVoice(int typeId, bool forceAlloc) {
+  if (typeId < 0) {
+    return nullptr;
+  }
+  bool mayAllocate = false;
+  SynthVoice *freeVoice;
+  VoicePool *pool;
+  {
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    pool = &voicePool(typeId);
+    freeVoice = acquireVoice(*pool, forceAlloc, mayAllocate);
+  }
+  if (mayAllocate) { // No free voice in pool, so we need to allocate it
+    // Pools are never deleted, so the pool is valid outside the lock
+    if (pool->creator) {
+      freeVoice = pool->creator();
+    } else {
+      std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+      pool->numAllocated--;
+      if (mVerbose) {
+        std::cout << "Can't allocate voice of type " << pool->name
+                  << ". Voice not registered." << std::endl;
+      }
     }
   }
   return freeVoice;
 }
 
+int PolySynth::voiceTypeId(std::string name) {
+  std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+  auto it = mVoiceTypeIds.find(name);
+  return it != mVoiceTypeIds.end() ? it->second : -1;
+}
+
+int PolySynth::registerVoiceType(std::type_index type) {
+  // Ids are shared by all PolySynth instances
+  static std::mutex registryLock;
+  static std::map<std::type_index, int> typeIds;
+  std::unique_lock<std::mutex> lk(registryLock);
+  auto it = typeIds.find(type);
+  if (it != typeIds.end()) {
+    return it->second;
+  }
+  int typeId = int(typeIds.size());
+  typeIds[type] = typeId;
+  return typeId;
+}
+
+PolySynth::VoicePool &PolySynth::voicePool(int typeId) {
+  if (typeId >= int(mVoicePools.size())) {
+    mVoicePools.resize(typeId + 1);
+    // Sized here so the rendering thread never resizes it
+    mVoiceBudgets.resize(typeId + 1);
+  }
+  if (!mVoicePools[typeId]) {
+    mVoicePools[typeId] = std::unique_ptr<VoicePool>(new VoicePool);
+  }
+  return *mVoicePools[typeId];
+}
+
+void PolySynth::nameVoicePool(int typeId, const std::string &name) {
+  VoicePool &pool = voicePool(typeId);
+  if (pool.name.size() == 0) {
+    pool.name = name;
+  }
+  mVoiceTypeIds[name] = typeId;
+  if (std::find(mNoAllocationList.begin(), mNoAllocationList.end(), name) !=
+      mNoAllocationList.end()) {
+    pool.allowAllocation = false;
+  }
+}
+
+SynthVoice *PolySynth::acquireVoice(VoicePool &pool, bool forceAlloc,
+                                    bool &mayAllocate) {
+  mayAllocate = false;
+  SynthVoice *freeVoice = pool.freeVoices;
+  if (freeVoice) {
+    pool.freeVoices = freeVoice->next;
+    freeVoice->next = nullptr;
+    return freeVoice;
+  }
+  if (!pool.allowAllocation) {
+    std::cout << "Automatic allocation disabled for voice:" << pool.name
+              << std::endl;
+  } else if (!forceAlloc && pool.maxPolyphony >= 0 &&
+             pool.numAllocated >= pool.maxPolyphony) {
+    if (mVerbose) {
+      std::cout << "Polyphony limit reached for voice:" << pool.name
+                << std::endl;
+    }
+  } else {
+    pool.numAllocated++;
+    mayAllocate = true;
+  }
+  return nullptr;
+}
+
+void PolySynth::registerVoicePool(SynthVoice *voice) {
+  if (voice->mTypeId < 0) {
+    voice->mTypeId = registerVoiceType(std::type_index(typeid(*voice)));
+  }
+  VoicePool &pool = voicePool(voice->mTypeId);
+  if (!pool.typeName) {
+    pool.typeName = typeid(*voice).name();
+    nameVoicePool(voice->mTypeId, demangle(pool.typeName));
+  }
+}
+
+void PolySynth::releaseVoice(SynthVoice *voice) {
+  if (voice->mTypeId < 0 || voice->mTypeId >= int(mVoicePools.size()) ||
+      !mVoicePools[voice->mTypeId]) {
+    // Only voices allocated by another PolySynth get here
+    registerVoicePool(voice);
+  }
+  VoicePool &pool = *mVoicePools[voice->mTypeId];
+  voice->next = pool.freeVoices;
+  pool.freeVoices = voice;
+}
+
 SynthVoice *PolySynth::getFreeVoice() {
   std::unique_lock<std::mutex> lk(
       mFreeVoiceLock); // Only one getVoice() call at a time
-  SynthVoice *freeVoice = mFreeVoices;
-  if (freeVoice) {
-    mFreeVoices = freeVoice->next;
+  for (auto &pool : mVoicePools) {
+    if (pool && pool->freeVoices) {
+      SynthVoice *freeVoice = pool->freeVoices;
+      pool->freeVoices = freeVoice->next;
+      freeVoice->next = nullptr;
+      return freeVoice;
+    }
   }
-  return freeVoice;
+  return nullptr;
+}
+
+SynthVoice *PolySynth::getFreeVoices() {
+  for (auto &pool : mVoicePools) {
+    if (pool && pool->freeVoices) {
+      return pool->freeVoices;
+    }
+  }
+  return nullptr;
+}
+
+SynthVoice *PolySynth::getFreeVoices(int typeId) {
+  if (typeId < 0 || typeId >= int(mVoicePools.size()) ||
+      !mVoicePools[typeId]) {
+    return nullptr;
+  }
+  return mVoicePools[typeId]->freeVoices;
 }
 
 void PolySynth::render(AudioIOData &io) {
@@ -523,6 +875,7 @@ void PolySynth::render(AudioIOData &io) {
           internalAudioIO.zeroBus();
           internalAudioIO.frame(offset);
           voice->onProcess(internalAudioIO);
+          processVoiceOutput(voice, internalAudioIO);
 
           if (mBusRoutingCallback) {
             // First call callback to route signals to internal buses
@@ -608,48 +961,77 @@ void PolySynth::disableAllocation(std::string name) {
       mNoAllocationList.end()) {
     mNoAllocationList.push_back(name);
   }
+  std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+  auto it = mVoiceTypeIds.find(name);
+  if (it != mVoiceTypeIds.end()) {
+    voicePool(it->second).allowAllocation = false;
+  }
 }
 
 void PolySynth::allocatePolyphony(std::string name, int number) {
-  std::unique_lock<std::mutex> lk(mFreeVoiceLock);
-  // Find last voice and add polyphony there
-  SynthVoice *lastVoice = mFreeVoices;
-  if (lastVoice) {
-    while (lastVoice->next) {
-      lastVoice = lastVoice->next;
+  int typeId = voiceTypeId(name);
+  if (typeId < 0) {
+    std::cout << "Can't allocate polyphony for voice " << name
+              << ". Voice not registered." << std::endl;
+    return;
+  }
+  std::function<SynthVoice *()> creator;
+  {
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    VoicePool &pool = voicePool(typeId);
+    if (!pool.creator) {
+      // Pools named by insertFreeVoice() can't create voices
+      std::cerr << "Can't allocate polyphony for voice " << name
+                << ". Voice not registered." << std::endl;
+      return;
     }
-  } else {
-    lastVoice = mFreeVoices = allocateVoice(name);
-    number--;
+    if (pool.maxPolyphony >= 0 &&
+        pool.numAllocated + number > pool.maxPolyphony) {
+      number = std::max(pool.maxPolyphony - pool.numAllocated, 0);
+    }
+    pool.numAllocated += number;
+    creator = pool.creator;
   }
   for (int i = 0; i < number; i++) {
-    lastVoice->next = allocateVoice(name);
-    lastVoice = lastVoice->next;
+    auto *voice = creator();
+    std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+    releaseVoice(voice);
+  }
+}
+
+void PolySynth::setMaxPolyphony(std::string name, int maxVoices) {
+  std::unique_lock<std::mutex> lk(mFreeVoiceLock);
+  auto it = mVoiceTypeIds.find(name);
+  if (it != mVoiceTypeIds.end()) {
+    voicePool(it->second).maxPolyphony = maxVoices;
+  } else {
+    std::cout << "Can't set polyphony for voice " << name
+              << ". Voice not registered." << std::endl;
   }
 }
 
 void PolySynth::insertFreeVoice(SynthVoice *voice) {
   std::unique_lock<std::mutex> lk(mFreeVoiceLock);
-  voice->next = mFreeVoices;
-  mFreeVoices = voice;
+  if (voice->mTypeId < 0) {
+    registerVoicePool(voice);
+  }
+  releaseVoice(voice);
 }
 
 bool PolySynth::popFreeVoice(SynthVoice *voice) {
   std::unique_lock<std::mutex> lk(mFreeVoiceLock);
-  SynthVoice *lastVoice = mFreeVoices;
-  SynthVoice *previousVoice = nullptr;
-  while (lastVoice) {
-    if (lastVoice == voice) {
-      if (previousVoice) {
-        previousVoice->next = lastVoice->next;
-        voice->next = nullptr;
-      } else {
-        mFreeVoices = lastVoice->next;
-        voice->next = nullptr;
-      }
+  if (voice->mTypeId < 0 || voice->mTypeId >= int(mVoicePools.size()) ||
+      !mVoicePools[voice->mTypeId]) {
+    return false;
+  }
+  SynthVoice **link = &mVoicePools[voice->mTypeId]->freeVoices;
+  while (*link) {
+    if (*link == voice) {
+      *link = voice->next;
+      voice->next = nullptr;
       return true;
     }
-    lastVoice = lastVoice->next;
+    link = &(*link)->next;
   }
   return false;
 }
@@ -712,13 +1094,20 @@ PolySynth &PolySynth::remove(AudioCallback &v) {
 void PolySynth::print(std::ostream &stream) {
   {
     std::unique_lock<std::mutex> lk(mFreeVoiceLock);
-    auto voice = mFreeVoices;
-    int counter = 0;
     stream << " ---- Free Voices ----" << std::endl;
-    while (voice) {
-      stream << "Voice " << counter++ << " " << voice->id() << " : "
-             << typeid(voice).name() << " " << voice << std::endl;
-      voice = voice->next;
+    for (auto &pool : mVoicePools) {
+      if (!pool) {
+        continue;
+      }
+      stream << pool->name << " (" << pool->numAllocated << " allocated)"
+             << std::endl;
+      auto voice = pool->freeVoices;
+      int counter = 0;
+      while (voice) {
+        stream << "Voice " << counter++ << " " << voice->id() << " : "
+               << typeid(voice).name() << " " << voice << std::endl;
+        voice = voice->next;
+      }
     }
   }
   //
@@ -734,15 +1123,10 @@ void PolySynth::print(std::ostream &stream) {
   }
   //
   {
-    std::unique_lock<std::mutex> lk(mVoiceToInsertLock);
-    auto voice = mVoicesToInsert;
-    int counter = 0;
-    stream << " ---- Queued Voices ----" << std::endl;
-    while (voice) {
-      stream << "Voice " << counter++ << " " << voice->id() << " : "
-             << typeid(voice).name() << " " << voice << std::endl;
-      voice = voice->next;
-    }
+    std::unique_lock<std::mutex> lk(mVoiceCommandOverflowLock);
+    stream << " ---- Queued Voice Commands ----" << std::endl;
+    stream << mVoiceCommands.size() + mVoiceCommandOverflow.size()
+           << std::endl;
   }
 }
 
@@ -17,7 +17,8 @@ void SynthSequencer::render(AudioIOData &io) {
         mNormalizedTempo * io.framesPerBuffer() / (double)io.framesPerSecond();
     double blockStartTime = mMasterTime;
     mMasterTime += timeIncrement;
-    processEvents(blockStartTime, mNormalizedTempo * io.framesPerSecond());
+    // Sequence time runs mNormalizedTempo times faster than the audio
+    processEvents(blockStartTime, io.framesPerSecond() / mNormalizedTempo);
   }
   mPolySynth->render(io);
 }
@@ -27,7 +28,7 @@ void SynthSequencer::render(Graphics &g) {
     assert(mFps > 0);
     double blockStartTime = mMasterTime;
     mMasterTime += (1.0 / mFps);
-    processEvents(blockStartTime, mNormalizedTempo);
+    processEvents(blockStartTime, mFps);
   }
   mPolySynth->render(g);
 }
@@ -36,7 +37,7 @@ void SynthSequencer::update(double dt) {
   if (mMasterMode == TimeMasterMode::TIME_MASTER_UPDATE) {
     double blockStartTime = mMasterTime;
     mMasterTime += dt;
-    processEvents(blockStartTime, mNormalizedTempo);
+    processEvents(blockStartTime, dt > 0 ? 1.0 / dt : 0.0);
   }
   mPolySynth->update(dt);
 }
@@ -54,13 +55,17 @@ bool SynthSequencer::playSequence(std::string sequenceName, float startTime) {
   double currentMasterTime = mMasterTime;
   const double startPad = 0.0;
   if (sequenceName.size() > 0) {
-    std::list<SynthSequencerEvent> events =
-        loadSequence(sequenceName, currentMasterTime - startTime + startPad);
+    std::vector<SynthSequencerEvent> events =
+        loadSequenceEvents(sequenceName,
+                           currentMasterTime - startTime + startPad);
+    std::unique_ptr<CompiledSequence> compiled;
     std::unique_lock<std::mutex> lk(mEventLock);
     mLastSequencePlayed = sequenceName;
-    mEvents = events;
+    mEvents.swap(events);
     mNextEvent = 0;
+    compiled.swap(mCompiledSequence);
     lk.unlock();
+    // Previous events are released here, outside the lock
   }
   mPlaybackStartTime = currentMasterTime + startPad;
   mPlaying = true;
@@ -75,7 +80,7 @@ bool SynthSequencer::playSequence(std::string sequenceName, float startTime) {
           double timeIncrement = granularityns * 1.0e-9;
           while (running) {
             std::unique_lock<std::mutex> lk(mEventLock);
-            if (mEvents.size() == 0 || mPlaying == false) {
+            if (!eventsPending() || mPlaying == false) {
               running = false;
               if (verbose()) {
                 std::cout << "CPU play thread done." << std::endl;
@@ -94,22 +99,66 @@ bool SynthSequencer::playSequence(std::string sequenceName, float startTime) {
   return true;
 }
 
-void SynthSequencer::stopSequence() {
-  std::unique_lock<std::mutex> lk(mEventLock);
-  for (auto &event : mEvents) {
-    if (event.type == SynthSequencerEvent::EVENT_VOICE) {
-      // Give back allocated voice to synth
-      if (event.voice) {
-        mPolySynth->insertFreeVoice(event.voice);
-      }
+bool SynthSequencer::compileSequence(std::string sequenceName) {
+  return CompiledSequence::compile(buildFullPath(sequenceName),
+                                   buildCompiledPath(sequenceName));
+}
+
+bool SynthSequencer::playCompiledSequence(std::string sequenceName,
+                                          float startTime) {
+  std::unique_ptr<CompiledSequence> compiled =
+      std::make_unique<CompiledSequence>();
+  if (!compiled->open(buildCompiledPath(sequenceName))) {
+    return false;
+  }
+  std::vector<int> typeIds(compiled->numNames());
+  for (uint32_t i = 0; i < compiled->numNames(); i++) {
+    typeIds[i] = mPolySynth->voiceTypeId(compiled->name(i));
+    if (typeIds[i] < 0) {
+      std::cerr << "SynthSequencer: Voice '" << compiled->name(i)
+                << "' in compiled sequence is not registered" << std::endl;
     }
   }
+  std::vector<SynthSequencerEvent> events;
+  std::unique_lock<std::mutex> lk(mEventLock);
+  mLastSequencePlayed = sequenceName;
+  mEvents.swap(events);
+  mNextEvent = 0;
+  mCompiledSequence.swap(compiled);
+  mCompiledTypeIds.swap(typeIds);
+  mNextCompiledEvent = 0;
+  lk.unlock();
+  // Previous events and mapping are released here, outside the lock
+  return playSequence("", startTime);
+}
 
-  mEvents.clear();
+void SynthSequencer::stopSequence() {
+  std::vector<SynthSequencerEvent> events;
+  std::unique_ptr<CompiledSequence> compiled;
+  std::vector<ScheduledVoice> voices;
+  std::unique_lock<std::mutex> lk(mEventLock);
+  ScheduledVoice incoming;
+  while (mIncomingEvents.pop(incoming)) {
+    pushHeapEvent(incoming);
+  }
+  events.swap(mEvents);
+  // Copied so the heap keeps its reserved storage
+  voices = mEventHeap;
+  mEventHeap.clear();
+  mPendingTriggerOffs.clear();
   mNextEvent = 0;
+  compiled.swap(mCompiledSequence);
+  mNextCompiledEvent = 0;
   mPlaying = false;
+  lk.unlock();
+
+  for (auto &event : events) {
+    releaseEventVoice(event);
+  }
+  for (auto &voice : voices) {
+    mPolySynth->insertFreeVoice(voice.voice);
+  }
   if (mCpuThread) {
-    lk.unlock();
     mCpuThread->join();
     mCpuThread = nullptr;
   }
@@ -117,9 +166,24 @@ void SynthSequencer::stopSequence() {
 
 void SynthSequencer::setTime(float newTime) {
   synth().allNotesOff();
+  std::unique_lock<std::mutex> lk(mEventLock);
   //  mPlaybackStartTime = newTime;
   mMasterTime = newTime;
+  // Events before the new time are skipped in processEvents()
   mNextEvent = 0;
+  if (mCompiledSequence) {
+    // Compiled events have no voices to release, so jump straight to the
+    // first event at the new time
+    const CompiledSequence::Event *first = mCompiledSequence->events();
+    const CompiledSequence::Event *last = first + mCompiledSequence->size();
+    mNextCompiledEvent =
+        std::lower_bound(first, last, double(newTime),
+                         [](const CompiledSequence::Event &event, double t) {
+                           return event.startTime < t;
+                         }) -
+        first;
+  }
+  mPendingTriggerOffs.clear();
 
   //  std::cout << "Setting time not implemented" <<std::endl;
 }
@@ -174,11 +238,25 @@ std::string SynthSequencer::buildFullPath(std::string sequenceName) {
   return fullName;
 }
 
+std::string SynthSequencer::buildCompiledPath(std::string sequenceName) {
+  return buildFullPath(sequenceName) + "Bin";
+}
+
 std::list<SynthSequencerEvent>
 SynthSequencer::loadSequence(std::string sequenceName, double timeOffset,
                              double timeScale) {
+  auto events = loadSequenceEvents(sequenceName, timeOffset, timeScale);
+  return std::list<SynthSequencerEvent>(
+      std::make_move_iterator(events.begin()),
+      std::make_move_iterator(events.end()));
+}
+
+std::vector<SynthSequencerEvent>
+SynthSequencer::loadSequenceEvents(std::string sequenceName, double timeOffset,
+                                   double timeScale) {
   std::unique_lock<std::mutex> lk(mLoadingLock);
-  std::list<SynthSequencerEvent> events;
+  // Events are appended in file order and sorted at the end
+  std::vector<SynthSequencerEvent> events;
   std::string fullName = buildFullPath(sequenceName);
   std::ifstream f(fullName);
   if (!f.is_open()) {
@@ -281,13 +359,8 @@ SynthSequencer::loadSequence(std::string sequenceName, double timeOffset,
             mPolySynth->insertFreeVoice(newVoice); // Return voice to sequencer.
           } else {
             double absoluteTime = timeOffset + startTime;
-            // Insert into event list, sorted.
-            auto position = events.begin();
-            while (position != events.end() &&
-                   position->startTime < absoluteTime) {
-              position++;
-            }
-            auto insertedEvent = events.insert(position, SynthSequencerEvent());
+            events.emplace_back();
+            auto insertedEvent = &events.back();
             // Add 0.1 padding to ensure all events play.
             insertedEvent->type = SynthSequencerEvent::EVENT_VOICE;
             insertedEvent->startTime = absoluteTime;
@@ -300,20 +373,15 @@ SynthSequencer::loadSequence(std::string sequenceName, double timeOffset,
         }
       } else {
         double absoluteTime = timeOffset + startTime;
-        // Insert into event list, sorted.
-        auto position = events.begin();
-        while (position != events.end() && position->startTime < absoluteTime) {
-          position++;
-        }
-        auto insertedEvent = events.insert(position, SynthSequencerEvent());
+        events.emplace_back();
+        auto insertedEvent = &events.back();
         // Add 0.1 padding to ensure all events play.
         insertedEvent->type = SynthSequencerEvent::EVENT_PFIELDS;
         insertedEvent->startTime = absoluteTime;
         insertedEvent->duration = duration;
         insertedEvent->fields.name = name;
         insertedEvent->voice = nullptr;
-        insertedEvent->fields.pFields =
-            pFields; // TODO it would be nice not to have to copy here...
+        insertedEvent->fields.pFields = std::move(pFields);
       }
 
       //                std::cout << "Done reading sequence" << std::endl;
@@ -353,17 +421,9 @@ SynthSequencer::loadSequence(std::string sequenceName, double timeOffset,
           }
           std::cerr << std::endl;
         } else {
-          std::list<SynthSequencerEvent>::iterator insertedEvent;
           double absoluteTime = timeOffset + startTime;
-          {
-            //                            // Insert into event list, sorted.
-            auto position = events.begin();
-            while (position != events.end() &&
-                   position->startTime < absoluteTime) {
-              position++;
-            }
-            insertedEvent = events.insert(position, SynthSequencerEvent());
-          }
+          events.emplace_back();
+          auto insertedEvent = &events.back();
           // Add 0.1 padding to ensure all events play.
           insertedEvent->type = SynthSequencerEvent::EVENT_VOICE;
           insertedEvent->startTime = absoluteTime;
@@ -387,8 +447,8 @@ SynthSequencer::loadSequence(std::string sequenceName, double timeOffset,
       int id = std::stoi(idText);
       double eventTime = std::stod(time) * timeScale * tempoFactor;
       for (SynthSequencerEvent &event : events) {
-        if (event.voice->id() == id && event.duration < 0 &&
-            event.type == SynthSequencerEvent::EVENT_VOICE) {
+        if (event.type == SynthSequencerEvent::EVENT_VOICE && event.voice &&
+            event.voice->id() == id && event.duration < 0) {
           double duration = eventTime - event.startTime + timeOffset;
           if (duration < 0) {
             duration = 0;
@@ -415,18 +475,16 @@ SynthSequencer::loadSequence(std::string sequenceName, double timeOffset,
         sequenceName = sequenceName.substr(0, sequenceName.size() - 1);
       }
       lk.unlock();
-      auto newEvents = loadSequence(sequenceName, stod(time) + timeOffset,
-                                    stod(timeScaleInFile) * tempoFactor);
+      auto newEvents =
+          loadSequenceEvents(sequenceName, stod(time) + timeOffset,
+                             stod(timeScaleInFile) * tempoFactor);
       lk.lock();
-      events.insert(events.end(), newEvents.begin(), newEvents.end());
-      // FIXME: This sorting only works if both the existing sequence and
+      // FIXME: Sorting only works if both the existing sequence and
       // the incoming sequence use absolute event times. Sorting
       // anything else results in chaos... This should be detected
       // and acted on
-      events.sort(
-          [](const SynthSequencerEvent &a, const SynthSequencerEvent &b) {
-            return a.startTime < b.startTime;
-          });
+      events.insert(events.end(), std::make_move_iterator(newEvents.begin()),
+                    std::make_move_iterator(newEvents.end()));
     } else if (command == '>' && ss.get() == ' ') {
       std::string time;
       std::getline(ss, time);
@@ -447,19 +505,40 @@ SynthSequencer::loadSequence(std::string sequenceName, double timeOffset,
   if (f.bad()) {
     std::cout << "Error reading:" << fullName << std::endl;
   }
+  std::stable_sort(
+      events.begin(), events.end(),
+      [](const SynthSequencerEvent &a, const SynthSequencerEvent &b) {
+        return a.startTime < b.startTime;
+      });
   return events;
 }
 
-void SynthSequencer::playEvents(std::list<SynthSequencerEvent> events,
+void SynthSequencer::playEvents(std::vector<SynthSequencerEvent> events,
                                 double timeOffset) {
 
   double currentMasterTime = mMasterTime;
   for (auto &event : events) {
     event.startTime += currentMasterTime + timeOffset;
   }
+  std::stable_sort(
+      events.begin(), events.end(),
+      [](const SynthSequencerEvent &a, const SynthSequencerEvent &b) {
+        return a.startTime < b.startTime;
+      });
 
+  std::unique_ptr<CompiledSequence> compiled;
   std::unique_lock<std::mutex> lk(mEventLock);
-  mEvents = events;
+  mEvents.swap(events);
+  mNextEvent = 0;
+  compiled.swap(mCompiledSequence);
+  lk.unlock();
+  // Previous events are released here, outside the lock
+}
+
+void SynthSequencer::playEvents(std::list<SynthSequencerEvent> events,
+                                double timeOffset) {
+  playEvents(std::vector<SynthSequencerEvent>(events.begin(), events.end()),
+             timeOffset);
 }
 
 std::vector<std::string> SynthSequencer::getSequenceList() {
@@ -502,7 +581,8 @@ std::vector<std::string> SynthSequencer::getSequenceList() {
 }
 
 double SynthSequencer::getSequenceDuration(std::string sequenceName) {
-  std::list<SynthSequencerEvent> events = loadSequence(sequenceName, 0.0);
+  std::vector<SynthSequencerEvent> events =
+      loadSequenceEvents(sequenceName, 0.0);
   double dur = 0.0;
   for (auto const &event : events) {
     if (event.startTime + event.duration > dur) {
@@ -513,94 +593,253 @@ double SynthSequencer::getSequenceDuration(std::string sequenceName) {
 }
 
 void SynthSequencer::processEvents(double blockStartTime, double fpsAdjusted) {
-  if (mEventLock.try_lock()) {
-    if (mNextEvent < mEvents.size()) {
-      int i = 0;
-      for (auto cb : mTimeChangeCallbacks) {
-        mTimeAccumCallbackNs[i] += (mMasterTime - blockStartTime) * 1.0e9;
-        //        std::cout << mTimeAccumCallbackNs[i] << std::endl;
-        if (mTimeAccumCallbackNs[i] * 1.0e-9 > cb.second) {
-          cb.first(float(blockStartTime - mPlaybackStartTime));
-          mTimeAccumCallbackNs[i] -= cb.second * 1.0e9;
-        }
-        i++;
-      }
-      auto iter = mEvents.begin();
-      std::advance(iter, mNextEvent);
-      auto event = iter;
-      while (event != mEvents.end() && event->startTime < blockStartTime) {
-        event++;
-        mNextEvent++;
-      }
-      while (event->startTime <= mMasterTime) {
-        event->offsetCounter =
-            (event->startTime - blockStartTime) * fpsAdjusted;
-        if (event->type == SynthSequencerEvent::EVENT_VOICE && event->voice) {
-          mPolySynth->triggerOn(event->voice, event->offsetCounter);
-          event->voiceId = event->voice->id();
-          event->voice = nullptr; // Voice has been consumed, all voices
-                                  // reamining in the event list are put back
-                                  // in the synth's free voice pool
-        } else if (event->type == SynthSequencerEvent::EVENT_PFIELDS) {
-          auto *voice = mPolySynth->getVoice(event->fields.name);
-          if (voice) {
-            voice->setTriggerParams(event->fields.pFields);
-
-            event->voiceId = mPolySynth->triggerOn(voice, event->offsetCounter);
-
-            //            std::cout << " ++ trigger ON " << voice->id() << " "
-            //            << mMasterTime
-            //                      << "   " <<
-            //                      event->fields.pFields[0].get<float>()
-            //                      << std::endl;
-            //            event->voice = voice;
-          } else {
-            std::cerr
-                << "SynthSequencer::processEvents: Could not get free voice '"
-                << event->fields.name << "' for sequencer!" << std::endl;
-          }
-        } else if (event->type == SynthSequencerEvent::EVENT_TEMPO) {
-          // TODO support tempo events
-        }
-        //                std::cout << "Event " << mNextEvent << " " <<
-        //                event->startTime << " " <<
-        //                typeid(*event->voice).name() << std::endl;
-        mNextEvent++;
-        iter++;
-        if (iter == mEvents.end()) {
-          break;
-        }
-        event = iter;
-      }
+  std::unique_lock<std::mutex> lk(mEventLock, std::try_to_lock);
+  if (!lk.owns_lock()) {
+    // Dispatch this block's events with the next block instead of waiting
+    if (!mBlockDeferred) {
+      mDeferredStartTime = blockStartTime;
+      mBlockDeferred = true;
     }
-    bool allEventsDone = true;
-    bool triggerOffThisBlock = false;
-    for (auto &event : mEvents) {
-      //            if (event.startTime*mNormalizedTempo > mMasterTime) {
-      //                break;
-      //            }
-      double eventTermination = event.startTime + event.duration;
-      if (event.voiceId >= 0 && eventTermination <= mMasterTime) {
-        mPolySynth->triggerOff(event.voiceId);
-        //        std::cout << "trigger off " << event.voiceId << " " <<
-        //        eventTermination
-        //                  << " " << mMasterTime << std::endl;
-        event.voiceId = -1;
-        event.voice = nullptr; // When an event gives up a voice, it
-        //        is done.
-        triggerOffThisBlock = true;
-      }
-      if (eventTermination > mMasterTime) {
-        allEventsDone = false;
-      }
+    mDeferredEndTime = mMasterTime;
+    return;
+  }
+  if (mBlockDeferred) {
+    // Unless the time was changed in between
+    if (mDeferredEndTime == blockStartTime) {
+      blockStartTime = mDeferredStartTime;
     }
-    if (allEventsDone &&
-        triggerOffThisBlock) { // This block marks the end of the sequence
-      mPlaying = false;
-      for (auto cb : mSequenceEndCallbacks) {
-        cb(mLastSequencePlayed);
+    mBlockDeferred = false;
+  }
+  // Queued voices that don't fit in the heap wait for it to be drained, as
+  // growing it would allocate
+  ScheduledVoice incoming;
+  while (mEventHeap.size() < mEventHeap.capacity() &&
+         mIncomingEvents.pop(incoming)) {
+    pushHeapEvent(incoming);
+  }
+  if (mNextEvent < mEvents.size() || mEventHeap.size() > 0 ||
+      compiledEventsPending()) {
+    int i = 0;
+    for (auto cb : mTimeChangeCallbacks) {
+      mTimeAccumCallbackNs[i] += (mMasterTime - blockStartTime) * 1.0e9;
+      //        std::cout << mTimeAccumCallbackNs[i] << std::endl;
+      if (mTimeAccumCallbackNs[i] * 1.0e-9 > cb.second) {
+        cb.first(float(blockStartTime - mPlaybackStartTime));
+        mTimeAccumCallbackNs[i] -= cb.second * 1.0e9;
       }
+      i++;
     }
-    mEventLock.unlock();
   }
+  // Skip events that are already past, e.g. after setTime()
+  while (mNextEvent < mEvents.size() &&
+         mEvents[mNextEvent].startTime < blockStartTime) {
+    releaseEventVoice(mEvents[mNextEvent]);
+    mNextEvent++;
+  }
+  while (mEventHeap.size() > 0 &&
+         mEventHeap.front().startTime < blockStartTime) {
+    mPolySynth->insertFreeVoice(mEventHeap.front().voice);
+    popHeapEvent();
+  }
+  while (compiledEventsPending() &&
+         mCompiledSequence->event(mNextCompiledEvent).startTime <
+             blockStartTime) {
+    mNextCompiledEvent++;
+  }
+  // Dispatch events starting within this block from all stores in time
+  // order. Events on the block end belong to the next block.
+  enum { NONE, SEQUENCE, HEAP, COMPILED };
+  bool eventDoneThisBlock = false;
+  while (true) {
+    int source = NONE;
+    double nextTime = mMasterTime;
+    if (mNextEvent < mEvents.size() &&
+        mEvents[mNextEvent].startTime < nextTime) {
+      source = SEQUENCE;
+      nextTime = mEvents[mNextEvent].startTime;
+    }
+    if (mEventHeap.size() > 0 && mEventHeap.front().startTime < nextTime) {
+      source = HEAP;
+      nextTime = mEventHeap.front().startTime;
+    }
+    if (compiledEventsPending() &&
+        mCompiledSequence->event(mNextCompiledEvent).startTime < nextTime) {
+      source = COMPILED;
+    }
+    if (source == SEQUENCE) {
+      dispatchEvent(mEvents[mNextEvent], blockStartTime, fpsAdjusted);
+      mNextEvent++;
+    } else if (source == HEAP) {
+      dispatchVoice(mEventHeap.front(), blockStartTime, fpsAdjusted);
+      popHeapEvent();
+    } else if (source == COMPILED) {
+      dispatchCompiledEvent(mCompiledSequence->event(mNextCompiledEvent),
+                            blockStartTime, fpsAdjusted);
+      mNextCompiledEvent++;
+    } else {
+      break;
+    }
+    eventDoneThisBlock = true;
+  }
+  auto laterOff = [](const PendingTriggerOff &a, const PendingTriggerOff &b) {
+    return a.time > b.time;
+  };
+  while (mPendingTriggerOffs.size() > 0 &&
+         mPendingTriggerOffs.front().time <= mMasterTime) {
+    mPolySynth->triggerOff(mPendingTriggerOffs.front().voiceId);
+    std::pop_heap(mPendingTriggerOffs.begin(), mPendingTriggerOffs.end(),
+                  laterOff);
+    mPendingTriggerOffs.pop_back();
+    eventDoneThisBlock = true;
+  }
+  if (!eventsPending() &&
+      eventDoneThisBlock) { // This block marks the end of the sequence
+    mPlaying = false;
+    for (auto cb : mSequenceEndCallbacks) {
+      cb(mLastSequencePlayed);
+    }
+  }
+}
+
+void SynthSequencer::reserveEventStorage() {
+  mEventHeap.reserve(mIncomingEvents.capacity());
+  mPendingTriggerOffs.reserve(mIncomingEvents.capacity());
+}
+
+void SynthSequencer::insertEvent(const ScheduledVoice &event) {
+  if (!mIncomingEvents.push(event)) {
+    // Queue is full, e.g. when many events are added before rendering starts.
+    // The heap can grow here as this is not the rendering thread.
+    std::unique_lock<std::mutex> lk(mEventLock);
+    pushHeapEvent(event);
+  }
+}
+
+void SynthSequencer::pushHeapEvent(const ScheduledVoice &event) {
+  mEventHeap.push_back(event);
+  std::push_heap(mEventHeap.begin(), mEventHeap.end(),
+                 [](const ScheduledVoice &a, const ScheduledVoice &b) {
+                   return a.startTime > b.startTime;
+                 });
+}
+
+void SynthSequencer::popHeapEvent() {
+  std::pop_heap(mEventHeap.begin(), mEventHeap.end(),
+                [](const ScheduledVoice &a, const ScheduledVoice &b) {
+                  return a.startTime > b.startTime;
+                });
+  mEventHeap.pop_back();
+}
+
+namespace {
+
+// Round to the nearest frame. Offsets past the end of the block are carried
+// over to the next block by the voice.
+int frameOffset(double startTime, double blockStartTime, double fps) {
+  int offset = int(std::floor((startTime - blockStartTime) * fps + 0.5));
+  return offset < 0 ? 0 : offset;
+}
+
+} // namespace
+
+void SynthSequencer::dispatchEvent(SynthSequencerEvent &event,
+                                   double blockStartTime, double fps) {
+  event.offsetCounter = frameOffset(event.startTime, blockStartTime, fps);
+  if (event.type == SynthSequencerEvent::EVENT_VOICE && event.voice) {
+    mPolySynth->triggerOn(event.voice, event.offsetCounter);
+    event.voiceId = event.voice->id();
+    event.voice = nullptr; // Voice has been consumed, all voices
+                           // reamining in the event list are put back
+                           // in the synth's free voice pool
+  } else if (event.type == SynthSequencerEvent::EVENT_PFIELDS) {
+    auto *voice = mPolySynth->getVoice(event.fields.name);
+    if (voice) {
+      voice->setTriggerParams(event.fields.pFields);
+
+      event.voiceId = mPolySynth->triggerOn(voice, event.offsetCounter);
+    } else {
+      std::cerr << "SynthSequencer::processEvents: Could not get free voice '"
+                << event.fields.name << "' for sequencer!" << std::endl;
+    }
+  } else if (event.type == SynthSequencerEvent::EVENT_TEMPO) {
+    // TODO support tempo events
+  }
+  // Voices with negative duration end themselves
+  if (event.voiceId >= 0 && event.duration >= 0) {
+    scheduleTriggerOff(event.startTime + event.duration, event.voiceId);
+    event.voiceId = -1;
+  }
+}
+
+void SynthSequencer::dispatchVoice(const ScheduledVoice &event,
+                                   double blockStartTime, double fps) {
+  int voiceId = mPolySynth->triggerOn(
+      event.voice, frameOffset(event.startTime, blockStartTime, fps));
+  // Voices with negative duration end themselves
+  if (voiceId >= 0 && event.duration >= 0) {
+    scheduleTriggerOff(event.startTime + event.duration, voiceId);
+  }
+}
+
+void SynthSequencer::dispatchCompiledEvent(const CompiledSequence::Event &event,
+                                           double blockStartTime, double fps) {
+  int offsetCounter = frameOffset(event.startTime, blockStartTime, fps);
+  const float *values = mCompiledSequence->values(event);
+  if (!values || event.nameIndex >= mCompiledTypeIds.size()) {
+    return;
+  }
+  auto *voice = mPolySynth->getVoice(mCompiledTypeIds[event.nameIndex]);
+  if (!voice) {
+    std::cerr << "SynthSequencer::processEvents: Could not get free voice '"
+              << mCompiledSequence->name(event.nameIndex)
+              << "' for sequencer!" << std::endl;
+    return;
+  }
+  if (event.flags & CompiledSequence::HAS_STRING_FIELDS) {
+    voice->setTriggerParams(mCompiledSequence->fields(event));
+  } else {
+    voice->setTriggerParams(const_cast<float *>(values), event.numFields);
+  }
+  int voiceId = mPolySynth->triggerOn(voice, offsetCounter);
+  // Voices with negative duration end themselves
+  if (voiceId >= 0 && event.duration >= 0) {
+    scheduleTriggerOff(event.startTime + event.duration, voiceId);
+  }
+}
+
+void SynthSequencer::scheduleTriggerOff(double time, int voiceId) {
+  auto laterOff = [](const PendingTriggerOff &a, const PendingTriggerOff &b) {
+    return a.time > b.time;
+  };
+  if (mPendingTriggerOffs.size() == mPendingTriggerOffs.capacity()) {
+    // Growing the heap would allocate. Turn off the voice due first instead
+    // of leaving a voice on forever.
+    mForcedTriggerOffs++;
+    if (mPendingTriggerOffs.empty() ||
+        mPendingTriggerOffs.front().time > time) {
+      mPolySynth->triggerOff(voiceId);
+      return;
+    }
+    mPolySynth->triggerOff(mPendingTriggerOffs.front().voiceId);
+    std::pop_heap(mPendingTriggerOffs.begin(), mPendingTriggerOffs.end(),
+                  laterOff);
+    mPendingTriggerOffs.pop_back();
+  }
+  mPendingTriggerOffs.push_back({time, voiceId});
+  std::push_heap(mPendingTriggerOffs.begin(), mPendingTriggerOffs.end(),
+                 laterOff);
+}
+
+void SynthSequencer::releaseEventVoice(SynthSequencerEvent &event) {
+  if (event.type == SynthSequencerEvent::EVENT_VOICE && event.voice) {
+    // Give back allocated voice to synth
+    mPolySynth->insertFreeVoice(event.voice);
+    event.voice = nullptr;
+  }
+}
+
+bool SynthSequencer::eventsPending() {
+  return mNextEvent < mEvents.size() || mEventHeap.size() > 0 ||
+         compiledEventsPending() || mPendingTriggerOffs.size() > 0 ||
+         mIncomingEvents.size() > 0;
 }
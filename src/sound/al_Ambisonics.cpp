@@ -2,6 +2,20 @@
 
 #include <string.h>
 
+#include <algorithm>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define AL_AMBI_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AL_AMBI_NEON
+#endif
+
 #ifdef USE_GAMMA
 #include "scl.h"
 #define COS gam::scl::cosT8
@@ -56,6 +70,7 @@ void AmbiBase::dim(int dim) {
 }
 
 void AmbiBase::order(int o) {
+  assert(o >= 0 && o <= AMBI_MAX_ORDER);
   if (o != mOrder) {
     mOrder = o;
     mChannels = orderToChannels(mDim, mOrder);
@@ -131,6 +146,101 @@ void AmbiBase::encodeWeightsFuMa(float* ws, int dim, int order, float az,
   encodeWeightsFuMa(ws, dim, order, x, y, z);
 }
 
+// SN3D normalization factors sqrt((2 - delta_m) (l - m)! / (l + m)!) times
+// (2m - 1)!!, the starting value of the Legendre recurrence for each m.
+// Indexed by l * (AMBI_MAX_ORDER + 1) + m.
+static const double *sn3dFactors() {
+  static const std::vector<double> factors = [] {
+    const int n = AMBI_MAX_ORDER + 1;
+    std::vector<double> f(n * n, 0.0);
+    for (int l = 0; l < n; l++) {
+      for (int m = 0; m <= l; m++) {
+        double ratio = 1.0;  // (l - m)! / (l + m)!
+        for (int k = l - m + 1; k <= l + m; k++) {
+          ratio /= k;
+        }
+        double doubleFactorial = 1.0;  // (2m - 1)!!
+        for (int k = 2 * m - 1; k > 1; k -= 2) {
+          doubleFactorial *= k;
+        }
+        f[l * n + m] = sqrt((m == 0 ? 1.0 : 2.0) * ratio) * doubleFactorial;
+      }
+    }
+    return f;
+  }();
+  return factors.data();
+}
+
+void AmbiBase::encodeWeights(float* ws, int dim, int order, float x, float y,
+                             float z) {
+  if (order <= 3) {
+    encodeWeightsFuMa(ws, dim, order, x, y, z);
+    return;
+  }
+  // cos(mA)cos^m(E) and sin(mA)cos^m(E) are the real and imaginary parts of
+  // (x + iy)^m
+  double cosm[AMBI_MAX_ORDER + 1];
+  double sinm[AMBI_MAX_ORDER + 1];
+  cosm[0] = 1.0;
+  sinm[0] = 0.0;
+  for (int m = 1; m <= order; m++) {
+    cosm[m] = cosm[m - 1] * x - sinm[m - 1] * y;
+    sinm[m] = sinm[m - 1] * x + cosm[m - 1] * y;
+  }
+
+  if (dim == 2) {
+    ws[0] = 1.f;
+    for (int m = 1; m <= order; m++) {
+      ws[2 * m - 1] = cosm[m];
+      ws[2 * m] = sinm[m];
+    }
+    return;
+  }
+
+  // Associated Legendre functions divided by cos^m(E), which is already in
+  // cosm and sinm, computed along l for each m:
+  //   Q(m, m) = 1 (the (2m - 1)!! is in the normalization factor)
+  //   Q(m + 1, m) = (2m + 1) z Q(m, m)
+  //   Q(l, m) = ((2l - 1) z Q(l - 1, m) - (l + m - 1) Q(l - 2, m)) / (l - m)
+  const double* norms = sn3dFactors();
+  const int n = AMBI_MAX_ORDER + 1;
+  for (int m = 0; m <= order; m++) {
+    double q2 = 0.0;
+    double q1 = 1.0;
+    for (int l = m; l <= order; l++) {
+      double q;
+      if (l == m) {
+        q = 1.0;
+      } else if (l == m + 1) {
+        q = (2 * m + 1) * z;
+      } else {
+        q = ((2 * l - 1) * z * q1 - (l + m - 1) * q2) / (l - m);
+      }
+      q2 = q1;
+      q1 = q;
+      double value = norms[l * n + m] * q;
+      int acn = l * l + l;
+      if (m == 0) {
+        ws[acn] = value;
+      } else {
+        ws[acn + m] = value * cosm[m];
+        ws[acn - m] = value * sinm[m];
+      }
+    }
+  }
+}
+
+void AmbiBase::encodeWeights(float* ws, int dim, int order, float az,
+                             float el) {
+  WRAP(az);
+  WRAP(el);
+  float cosel = COS(el);
+  float x = COS(az) * cosel;
+  float y = SIN(az) * cosel;
+  float z = dim >= 3 ? SIN(el) : 0;
+  encodeWeights(ws, dim, order, x, y, z);
+}
+
 // [x, y, z] is the direction unit vector
 void AmbiBase::encodeWeightsFuMa16(float* ws, float x, float y, float z) {
   float x2 = x * x;
@@ -213,18 +323,122 @@ AmbiDecode::~AmbiDecode() {
   // delete[] mSpeakers; // listener now owns speakers and will delete them
 }
 
+namespace {
+
+#if defined(__FMA__)
+#define AL_AMBI_FMADD256(a, b, c) _mm256_fmadd_ps(a, b, c)
+#else
+#define AL_AMBI_FMADD256(a, b, c) _mm256_add_ps(_mm256_mul_ps(a, b), c)
+#endif
+
+// Decode K speakers at once. Each block of input frames is loaded once per
+// channel and used for all K speakers, whose outputs stay in registers
+// until all channels have been added.
+template <int K>
+void decodeSpeakers(float* const* outs, const float* const* rows,
+                    const float* ambi, int numChannels, int numFrames) {
+  int i = 0;
+#if defined(__AVX__)
+  for (; i + 8 <= numFrames; i += 8) {
+    __m256 acc[K];
+    for (int k = 0; k < K; k++) {
+      acc[k] = _mm256_loadu_ps(outs[k] + i);
+    }
+    const float* in = ambi + i;
+    for (int c = 0; c < numChannels; c++, in += numFrames) {
+      __m256 x = _mm256_loadu_ps(in);
+      for (int k = 0; k < K; k++) {
+        acc[k] = AL_AMBI_FMADD256(_mm256_broadcast_ss(rows[k] + c), x, acc[k]);
+      }
+    }
+    for (int k = 0; k < K; k++) {
+      _mm256_storeu_ps(outs[k] + i, acc[k]);
+    }
+  }
+#endif
+#if defined(AL_AMBI_SSE)
+  for (; i + 4 <= numFrames; i += 4) {
+    __m128 acc[K];
+    for (int k = 0; k < K; k++) {
+      acc[k] = _mm_loadu_ps(outs[k] + i);
+    }
+    const float* in = ambi + i;
+    for (int c = 0; c < numChannels; c++, in += numFrames) {
+      __m128 x = _mm_loadu_ps(in);
+      for (int k = 0; k < K; k++) {
+        acc[k] = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(rows[k][c]), x), acc[k]);
+      }
+    }
+    for (int k = 0; k < K; k++) {
+      _mm_storeu_ps(outs[k] + i, acc[k]);
+    }
+  }
+#elif defined(AL_AMBI_NEON)
+  for (; i + 4 <= numFrames; i += 4) {
+    float32x4_t acc[K];
+    for (int k = 0; k < K; k++) {
+      acc[k] = vld1q_f32(outs[k] + i);
+    }
+    const float* in = ambi + i;
+    for (int c = 0; c < numChannels; c++, in += numFrames) {
+      float32x4_t x = vld1q_f32(in);
+      for (int k = 0; k < K; k++) {
+        acc[k] = vmlaq_n_f32(acc[k], x, rows[k][c]);
+      }
+    }
+    for (int k = 0; k < K; k++) {
+      vst1q_f32(outs[k] + i, acc[k]);
+    }
+  }
+#endif
+  for (; i < numFrames; i++) {
+    for (int k = 0; k < K; k++) {
+      float sum = outs[k][i];
+      for (int c = 0; c < numChannels; c++) {
+        sum += rows[k][c] * ambi[c * numFrames + i];
+      }
+      outs[k][i] = sum;
+    }
+  }
+}
+
+#undef AL_AMBI_FMADD256
+
+}  // namespace
+
 void AmbiDecode::decode(float* dec, const float* ambi, int numDecFrames) const {
-  // iterate speakers
-  for (int s = 0; s < numSpeakers(); ++s) {
-    // skip zero-amp speakers:
-    if (mSpeakers[s].gain != 0.) {
-      float* out = dec + mSpeakers[s].deviceChannel * numDecFrames;
+  const int numChannels = channels();
+  const int numActive = int(mActiveSpeakers.size());
+  float* outs[4];
+  const float* rows[4];
+  int s = 0;
+  for (; s + 4 <= numActive; s += 4) {
+    for (int k = 0; k < 4; k++) {
+      int speaker = mActiveSpeakers[s + k];
+      outs[k] = dec + mSpeakers[speaker].deviceChannel * numDecFrames;
+      rows[k] = mActiveMatrix.data() + (s + k) * numChannels;
+    }
+    decodeSpeakers<4>(outs, rows, ambi, numChannels, numDecFrames);
+  }
+  for (; s < numActive; s++) {
+    outs[0] = dec + mSpeakers[mActiveSpeakers[s]].deviceChannel * numDecFrames;
+    rows[0] = mActiveMatrix.data() + s * numChannels;
+    decodeSpeakers<1>(outs, rows, ambi, numChannels, numDecFrames);
+  }
+}
 
-      // iterate ambi channels
+void AmbiDecode::updateActiveMatrix() {
+  // skip zero-amp speakers
+  mActiveSpeakers.clear();
+  mActiveMatrix.clear();
+  if (int(mSpeakers.size()) < mNumSpeakers) {
+    return;
+  }
+  for (int s = 0; s < mNumSpeakers; ++s) {
+    if (mSpeakers[s].gain != 0.) {
+      mActiveSpeakers.push_back(s);
       for (int c = 0; c < channels(); ++c) {
-        const float* in = ambi + c * numDecFrames;
-        float w = decodeWeight(s, c);
-        for (int i = 0; i < numDecFrames; ++i) out[i] += in[i] * w;
+        mActiveMatrix.push_back(decodeWeight(s, c));
       }
     }
   }
@@ -234,8 +448,46 @@ void AmbiDecode::flavor(int type) {
   if (type < 4) {
     mFlavor = type;
     const int No = sizeof(mWOrder) / sizeof(mWOrder[0]);
-    for (int i = 0; i < No; ++i)
-      mWOrder[i] = flavorWeights[flavor()][i][order()];
+    if (order() <= 4) {
+      for (int i = 0; i < No; ++i)
+        mWOrder[i] = i <= 4 ? flavorWeights[flavor()][i][order()] : 0.f;
+    } else {
+      // Past the table, use the closed forms of the in-phase and max-rE
+      // weights. The default flavor uses max-rE.
+      const int M = order();
+      for (int l = 0; l < No; ++l) {
+        double w = 0.0;
+        if (l <= M) {
+          if (type == 0) {
+            w = 1.0;
+          } else if (type == 2) {
+            // M!^2 / ((M + l)! (M - l)!) in 2D,
+            // M! (M + 1)! / ((M + l + 1)! (M - l)!) in 3D
+            w = 1.0;
+            for (int k = M - l + 1; k <= M; k++) {
+              w *= k;
+            }
+            for (int k = M + (mDim == 3 ? 2 : 1); k <= M + l + (mDim == 3);
+                 k++) {
+              w /= k;
+            }
+          } else if (mDim == 3) {
+            // Legendre polynomial P_l at cos(137.9 deg / (M + 1.51))
+            double x = cos(137.9 * M_PI / 180.0 / (M + 1.51));
+            double p0 = 1.0, p1 = x;
+            w = l == 0 ? p0 : p1;
+            for (int k = 2; k <= l; k++) {
+              w = ((2 * k - 1) * x * p1 - (k - 1) * p0) / k;
+              p0 = p1;
+              p1 = w;
+            }
+          } else {
+            w = cos(l * M_PI / (2 * M + 2));
+          }
+        }
+        mWOrder[l] = w;
+      }
+    }
     updateChanWeights();
   }
 }
@@ -258,10 +510,11 @@ void AmbiDecode::setSpeakerRadians(int index, int deviceChannel, float az,
   mSpeakers[index].gain = amp;
 
   // update encoding weights
-  encodeWeightsFuMa(mDecodeMatrix + index * channels(), mDim, mOrder, az, el);
+  encodeWeights(mDecodeMatrix + index * channels(), mDim, mOrder, az, el);
   for (int i = 0; i < channels(); i++) {
     mDecodeMatrix[index * channels() + i] *= amp;
   }
+  updateActiveMatrix();
 }
 
 void AmbiDecode::setSpeaker(int index, int deviceChannel, float az, float el,
@@ -280,9 +533,33 @@ void AmbiDecode::setSpeakers(Speakers* spkrs) {
   setSpeakers(*spkrs);
 }
 
-void AmbiDecode::setSpeakers(Speakers& spkrs) { mSpeakers = spkrs; }
+void AmbiDecode::setSpeakers(Speakers& spkrs) {
+  mSpeakers = spkrs;
+  updateActiveMatrix();
+}
 
 void AmbiDecode::updateChanWeights() {
+  if (mOrder > 3) {
+    // Sampling decoder for SN3D. Each order is scaled by its number of
+    // harmonics (2l + 1, or 2 per order in 2D) and by the number of speakers,
+    // so the gains for a uniform layout reconstruct the W component.
+    float scale = mNumSpeakers > 0 ? 1.f / mNumSpeakers : 1.f;
+    if (mDim == 2) {
+      mWeights[0] = mWOrder[0] * scale;
+      for (int m = 1; m <= mOrder; m++) {
+        mWeights[2 * m - 1] = mWeights[2 * m] = 2.f * mWOrder[m] * scale;
+      }
+    } else {
+      for (int l = 0; l <= mOrder; l++) {
+        for (int c = l * l; c < (l + 1) * (l + 1); c++) {
+          mWeights[c] = (2 * l + 1) * mWOrder[l] * scale;
+        }
+      }
+    }
+    updateActiveMatrix();
+    return;
+  }
+
   float* wc = mWeights;
   *wc++ = mWOrder[0];
 
@@ -314,32 +591,17 @@ void AmbiDecode::updateChanWeights() {
       }
     }
   }
+  updateActiveMatrix();
 }
 
 void AmbiDecode::resizeArrays(int numChannels, int numSpeakers) {
-  int oldSize = channels() * mNumSpeakers;
-  int newSize = numChannels * numSpeakers;
-
-  if (oldSize != newSize) {
-    resize(mDecodeMatrix, newSize);
-    // resize(mFrame, newSize);
-
-    // resize number of speakers (?)
-    if (numSpeakers != mNumSpeakers) {
-      mNumSpeakers = numSpeakers;
-
-      // resize(mSpeakers, numSpeakers);
-    }
-
-    //		// recompute decode matrix weights
-    //		for(int i=0; i<numSpeakers; i++){
-    //			setSpeaker(i, azimuths()[i], elevations()[i]);
-    //		}
-
-    updateChanWeights();
-  }
-
+  // channels() may already hold the new channel count when called from
+  // onChannelsChange(), so the matrix is always reallocated
+  resize(mDecodeMatrix, numChannels * numSpeakers);
+  mSpeakers.resize(numSpeakers);
+  mNumSpeakers = numSpeakers;
   mChannels = numChannels;
+  updateChanWeights();
 }
 
 void AmbiDecode::onChannelsChange() { resizeArrays(channels(), mNumSpeakers); }
@@ -513,6 +775,66 @@ void AmbisonicsSpatializer::renderSample(AudioIOData& io,
   mEncoder.encode(ambiChans(), io.framesPerBuffer(), frameIndex, sample);
 }
 
+void AmbisonicsSpatializer::prepareAccumulator(AudioIOData& accumulator,
+                                               const AudioIOData& io) {
+  accumulator.framesPerBuffer(io.framesPerBuffer());
+  accumulator.channelsOut(mDecoder.channels());
+}
+
+void AmbisonicsSpatializer::renderToAccumulator(AudioIOData& accumulator,
+                                                const Pose& listeningPose,
+                                                const float* samples,
+                                                const unsigned int& numFrames,
+                                                int firstChannel,
+                                                int lastChannel,
+                                                SpatializerSource* source) {
+  if (firstChannel != 0) {
+    return;
+  }
+  Vec3d direction = listeningPose.vec();
+
+  Quatd srcRot = listeningPose.quat();
+  direction = srcRot.rotate(direction);
+  direction = Vec4d(-direction.z, -direction.x, direction.y).normalize();
+  // Weights are computed locally so mEncoder is not shared between threads
+  float weights[AMBI_MAX_CHANNELS];
+  AmbiBase::encodeWeights(weights, mEncoder.dim(), mEncoder.order(),
+                          direction.x, direction.y, direction.z);
+  int numChannels =
+      std::min(mEncoder.channels(), (int)accumulator.channelsOut());
+  for (int c = 0; c < numChannels; ++c) {
+    float* out = accumulator.outBuffer(c);
+    float weight = weights[c];
+    for (unsigned int i = 0; i < numFrames; ++i) {
+      out[i] += weight * samples[i];
+    }
+  }
+}
+
+void AmbisonicsSpatializer::reduce(AudioIOData& io,
+                                   AudioIOData* const* accumulators,
+                                   size_t numAccumulators, int firstChannel,
+                                   int lastChannel) {
+  if (lastChannel < 0 || lastChannel > mDecoder.channels()) {
+    lastChannel = mDecoder.channels();
+  }
+  if (firstChannel >= lastChannel || numAccumulators == 0) {
+    return;
+  }
+  // B-format channels are contiguous in both the accumulators and
+  // mAmbiDomainChannels, so the range is summed as a single buffer
+  const size_t numSamples = (lastChannel - firstChannel) * mNumFrames;
+  const float* sources[8];
+  size_t i = 0;
+  while (i < numAccumulators) {
+    size_t count = 0;
+    while (count < 8 && i < numAccumulators) {
+      sources[count++] = accumulators[i++]->outBuffer(firstChannel);
+    }
+    sumBuffers(ambiChans(firstChannel), sources, count, numSamples);
+  }
+}
+
 void AmbisonicsSpatializer::finalize(AudioIOData& io) {
   // previously done in render method of audioscene
 
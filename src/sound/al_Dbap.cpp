@@ -14,46 +14,112 @@ Dbap::Dbap(const Speakers &sl, float focus)
   }
 }
 
-void Dbap::renderSample(AudioIOData &io, const Pose &listeningPose,
-                        const float &sample, const unsigned int &frameIndex) {
+Vec3d Dbap::relativePosition(const Pose &listeningPose) {
   Vec3d relpos = listeningPose.vec();
 
   // Rotate vector according to listener-rotation
   Quatd srcRot = listeningPose.quat();
   relpos = srcRot.rotate(relpos);
-  relpos = Vec4d(relpos.x, relpos.z, relpos.y);
-  for (unsigned int i = 0; i < mNumSpeakers; ++i) {
-    float gain = 1.f;
-    Vec3d vec = relpos - mSpeakerVecs[i];
-    double dist = vec.mag();
-    gain = 1.f / (1.f + float(dist));
-    gain = powf(gain, mFocus);
+  return Vec4d(relpos.x, relpos.z, relpos.y);
+}
 
-    io.out(mDeviceChannels[i], frameIndex) += gain * sample;
+void Dbap::renderSample(AudioIOData &io, const Pose &listeningPose,
+                        const float &sample, const unsigned int &frameIndex) {
+  Vec3d relpos = relativePosition(listeningPose);
+  for (unsigned int i = 0; i < mNumSpeakers; ++i) {
+    io.out(mDeviceChannels[i], frameIndex) += speakerGain(relpos, i) * sample;
   }
 }
 
 void Dbap::renderBuffer(AudioIOData &io, const Pose &listeningPose,
                         const float *samples, const unsigned int &numFrames) {
-  Vec3d relpos = listeningPose.vec();
+  renderSpeakers(io, listeningPose, samples, numFrames, 0, io.channelsOut(),
+                 nullptr);
+}
 
-  // Rotate vector according to listener-rotation
-  Quatd srcRot = listeningPose.quat();
-  relpos = srcRot.rotate(relpos);
-  relpos = Vec4d(relpos.x, relpos.z, relpos.y);
+void Dbap::renderSource(AudioIOData &io, const Pose &listeningPose,
+                        const float *samples, const unsigned int &numFrames,
+                        SpatializerSource &source) {
+  renderSpeakers(io, listeningPose, samples, numFrames, 0, io.channelsOut(),
+                 &source);
+}
 
-  for (unsigned int k = 0; k < mNumSpeakers; ++k) {
-    float gain = 1.f;
+void Dbap::renderToAccumulator(AudioIOData &accumulator,
+                               const Pose &listeningPose, const float *samples,
+                               const unsigned int &numFrames, int firstChannel,
+                               int lastChannel, SpatializerSource *source) {
+  if (lastChannel < 0 || lastChannel > int(accumulator.channelsOut())) {
+    lastChannel = int(accumulator.channelsOut());
+  }
+  if (firstChannel < lastChannel) {
+    renderSpeakers(accumulator, listeningPose, samples, numFrames,
+                   firstChannel, lastChannel, source);
+  }
+}
 
-    Vec3d vec = relpos - mSpeakerVecs[k];
-    double dist = vec.mag();
-    gain = 1.0f / (1.0f + float(dist));
-    gain = powf(gain, mFocus);
+void Dbap::renderSpeakers(AudioIOData &io, const Pose &listeningPose,
+                          const float *samples, const unsigned int &numFrames,
+                          unsigned int firstChannel, unsigned int lastChannel,
+                          SpatializerSource *source) {
+  const bool allSpeakers = firstChannel == 0 && lastChannel == io.channelsOut();
+  auto inRange = [&](unsigned int k) {
+    return mDeviceChannels[k] >= firstChannel &&
+           mDeviceChannels[k] < lastChannel;
+  };
+  if (source && source->gains.size() != mNumSpeakers) {
+    if (allSpeakers) {
+      // Negative gain marks a speaker with no previous block to ramp from
+      source->gains.assign(mNumSpeakers, -1.0f);
+      source->valid = false;
+    } else {
+      // Partial renders may run concurrently for the same source, so they
+      // can't resize its state
+      source = nullptr;
+    }
+  }
+  if (!source) {
+    Vec3d relpos = relativePosition(listeningPose);
+    for (unsigned int k = 0; k < mNumSpeakers; ++k) {
+      if (!inRange(k)) {
+        continue;
+      }
+      float gain = speakerGain(relpos, k);
+      addRamped(io.outBuffer(mDeviceChannels[k]), samples, numFrames, gain,
+                gain);
+    }
+    return;
+  }
+
+  // Only full renders use and update the cached pose. Partial renders only
+  // touch the gains for their own speakers.
+  if (allSpeakers && source->valid && source->settings == mSettings &&
+      source->pose.pos() == listeningPose.pos() &&
+      source->pose.quat() == listeningPose.quat()) {
+    for (unsigned int k = 0; k < mNumSpeakers; ++k) {
+      if (!inRange(k)) {
+        continue;
+      }
+      addRamped(io.outBuffer(mDeviceChannels[k]), samples, numFrames,
+                source->gains[k], source->gains[k]);
+    }
+    return;
+  }
 
-    float *out = io.outBuffer(mDeviceChannels[k]);
-    for (size_t i = 0; i < numFrames; ++i) {
-      out[i] += gain * samples[i];
+  Vec3d relpos = relativePosition(listeningPose);
+  for (unsigned int k = 0; k < mNumSpeakers; ++k) {
+    if (!inRange(k)) {
+      continue;
     }
+    float gain = speakerGain(relpos, k);
+    float previousGain = source->gains[k] < 0.0f ? gain : source->gains[k];
+    addRamped(io.outBuffer(mDeviceChannels[k]), samples, numFrames,
+              previousGain, gain);
+    source->gains[k] = gain;
+  }
+  if (allSpeakers) {
+    source->pose = listeningPose;
+    source->settings = mSettings;
+    source->valid = true;
   }
 }
 
@@ -72,6 +72,54 @@ void Lbap::renderBuffer(AudioIOData &io, const Pose &listeningPose,
   }
 }
 
+void Lbap::renderToAccumulator(AudioIOData &accumulator,
+                               const Pose &listeningPose, const float *samples,
+                               const unsigned int &numFrames, int firstChannel,
+                               int lastChannel, SpatializerSource *source) {
+  if (firstChannel != 0) {
+    return;
+  }
+  Vec3d vec = listeningPose.vec();
+
+  Quatd srcRot = listeningPose.quat();
+  vec = srcRot.rotate(vec);
+  vec = Vec4d(-vec.z, -vec.x, vec.y);
+
+  float elev =
+      RAD_2_DEG_SCALE * atan(vec.z / sqrt(vec.x * vec.x + vec.y * vec.y));
+
+  auto it = mRings.begin();
+  while (it != mRings.end() && it->elevation > elev) {
+    it++;
+  }
+  if (it == mRings.begin()) {  // Top ring
+    it->vbap->renderToAccumulator(accumulator, listeningPose, samples,
+                                  numFrames);
+  } else if (it == mRings.end()) {  // Bottom ring
+    mRings.back().vbap->renderToAccumulator(accumulator, listeningPose,
+                                            samples, numFrames);
+  } else {  // Between inner rings
+    auto topRingIt = it - 1;
+    float fraction =
+        (elev - it->elevation) / (topRingIt->elevation - it->elevation);
+    float gainTop = sin(M_PI_2 * fraction);
+    float gainBottom = cos(M_PI_2 * fraction);
+    // The shared member buffer can't be used from several threads, so the
+    // accumulator's own temp buffer holds each ring's signal in turn.
+    float *scratch = accumulator.tempBuffer();
+    for (unsigned int i = 0; i < numFrames; i++) {
+      scratch[i] = samples[i] * gainTop;
+    }
+    topRingIt->vbap->renderToAccumulator(accumulator, listeningPose, scratch,
+                                         numFrames);
+    for (unsigned int i = 0; i < numFrames; i++) {
+      scratch[i] = samples[i] * gainBottom;
+    }
+    it->vbap->renderToAccumulator(accumulator, listeningPose, scratch,
+                                  numFrames);
+  }
+}
+
 void Lbap::print(std::ostream &stream) {
   for (auto ring : mRings) {
     stream << " ---- Ring at elevation:" << ring.elevation << std::endl;
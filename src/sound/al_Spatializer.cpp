@@ -1,5 +1,180 @@
 #include "al/sound/al_Spatializer.hpp"
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define AL_SPATIALIZER_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define AL_SPATIALIZER_NEON
+#endif
+
 using namespace al;
 
 Spatializer::Spatializer(const Speakers &sl) { mSpeakers = sl; }
+
+void Spatializer::prepareAccumulator(AudioIOData &accumulator,
+                                     const AudioIOData &io) {
+  accumulator.framesPerBuffer(io.framesPerBuffer());
+  accumulator.channelsOut(io.channelsOut());
+}
+
+void Spatializer::renderSource(AudioIOData &io, const Pose &listeningPose,
+                               const float *samples,
+                               const unsigned int &numFrames,
+                               SpatializerSource &source) {
+  renderBuffer(io, listeningPose, samples, numFrames);
+}
+
+void Spatializer::renderToAccumulator(AudioIOData &accumulator,
+                                      const Pose &listeningPose,
+                                      const float *samples,
+                                      const unsigned int &numFrames,
+                                      int firstChannel, int lastChannel,
+                                      SpatializerSource *source) {
+  if (firstChannel == 0) {
+    if (source) {
+      renderSource(accumulator, listeningPose, samples, numFrames, *source);
+    } else {
+      renderBuffer(accumulator, listeningPose, samples, numFrames);
+    }
+  }
+}
+
+void Spatializer::reduce(AudioIOData &io, AudioIOData *const *accumulators,
+                         size_t numAccumulators, int firstChannel,
+                         int lastChannel) {
+  if (lastChannel < 0) {
+    lastChannel = io.channelsOut();
+  }
+  if (firstChannel >= lastChannel) {
+    return;
+  }
+  // Output channels are contiguous, so the channel range can be summed as a
+  // single buffer
+  const size_t numSamples = (lastChannel - firstChannel) * io.framesPerBuffer();
+  const float *sources[8];
+  size_t i = 0;
+  while (i < numAccumulators) {
+    size_t count = 0;
+    while (count < 8 && i < numAccumulators) {
+      sources[count++] = accumulators[i++]->outBuffer(firstChannel);
+    }
+    sumBuffers(io.outBuffer(firstChannel), sources, count, numSamples);
+  }
+}
+
+void Spatializer::sumBuffers(float *dest, const float *const *sources,
+                             size_t numSources, size_t numSamples) {
+  size_t i = 0;
+  // Each output sample is loaded and stored once, however many sources
+#if defined(__AVX__)
+  for (; i + 8 <= numSamples; i += 8) {
+    __m256 sum = _mm256_loadu_ps(dest + i);
+    for (size_t s = 0; s < numSources; s++) {
+      sum = _mm256_add_ps(sum, _mm256_loadu_ps(sources[s] + i));
+    }
+    _mm256_storeu_ps(dest + i, sum);
+  }
+#endif
+#if defined(AL_SPATIALIZER_SSE)
+  for (; i + 4 <= numSamples; i += 4) {
+    __m128 sum = _mm_loadu_ps(dest + i);
+    for (size_t s = 0; s < numSources; s++) {
+      sum = _mm_add_ps(sum, _mm_loadu_ps(sources[s] + i));
+    }
+    _mm_storeu_ps(dest + i, sum);
+  }
+#elif defined(AL_SPATIALIZER_NEON)
+  for (; i + 4 <= numSamples; i += 4) {
+    float32x4_t sum = vld1q_f32(dest + i);
+    for (size_t s = 0; s < numSources; s++) {
+      sum = vaddq_f32(sum, vld1q_f32(sources[s] + i));
+    }
+    vst1q_f32(dest + i, sum);
+  }
+#endif
+  for (; i < numSamples; i++) {
+    float sum = dest[i];
+    for (size_t s = 0; s < numSources; s++) {
+      sum += sources[s][i];
+    }
+    dest[i] = sum;
+  }
+}
+
+void Spatializer::addRamped(float *dest, const float *src, size_t numSamples,
+                            float startGain, float endGain) {
+  if (numSamples == 0) {
+    return;
+  }
+  size_t i = 0;
+  const float inc = (endGain - startGain) / numSamples;
+  // Gain is computed from the sample index rather than accumulated, so
+  // lanes are independent and the ramp doesn't drift
+  if (inc == 0.0f) {
+#if defined(__AVX__)
+    const __m256 gain8 = _mm256_set1_ps(startGain);
+    for (; i + 8 <= numSamples; i += 8) {
+      __m256 out = _mm256_loadu_ps(dest + i);
+      out = _mm256_add_ps(out, _mm256_mul_ps(gain8, _mm256_loadu_ps(src + i)));
+      _mm256_storeu_ps(dest + i, out);
+    }
+#endif
+#if defined(AL_SPATIALIZER_SSE)
+    const __m128 gain4 = _mm_set1_ps(startGain);
+    for (; i + 4 <= numSamples; i += 4) {
+      __m128 out = _mm_loadu_ps(dest + i);
+      out = _mm_add_ps(out, _mm_mul_ps(gain4, _mm_loadu_ps(src + i)));
+      _mm_storeu_ps(dest + i, out);
+    }
+#elif defined(AL_SPATIALIZER_NEON)
+    const float32x4_t gain4 = vdupq_n_f32(startGain);
+    for (; i + 4 <= numSamples; i += 4) {
+      vst1q_f32(dest + i, vmlaq_f32(vld1q_f32(dest + i), gain4,
+                                    vld1q_f32(src + i)));
+    }
+#endif
+    for (; i < numSamples; i++) {
+      dest[i] += startGain * src[i];
+    }
+    return;
+  }
+#if defined(__AVX__)
+  const __m256 ramp8 =
+      _mm256_mul_ps(_mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f,
+                                   7.0f),
+                    _mm256_set1_ps(inc));
+  for (; i + 8 <= numSamples; i += 8) {
+    __m256 gain8 =
+        _mm256_add_ps(_mm256_set1_ps(startGain + inc * (i + 1)), ramp8);
+    __m256 out = _mm256_loadu_ps(dest + i);
+    out = _mm256_add_ps(out, _mm256_mul_ps(gain8, _mm256_loadu_ps(src + i)));
+    _mm256_storeu_ps(dest + i, out);
+  }
+#endif
+#if defined(AL_SPATIALIZER_SSE)
+  for (; i + 4 <= numSamples; i += 4) {
+    const float base = startGain + inc * (i + 1);
+    __m128 gain4 = _mm_setr_ps(base, base + inc, base + 2.0f * inc,
+                               base + 3.0f * inc);
+    __m128 out = _mm_loadu_ps(dest + i);
+    out = _mm_add_ps(out, _mm_mul_ps(gain4, _mm_loadu_ps(src + i)));
+    _mm_storeu_ps(dest + i, out);
+  }
+#elif defined(AL_SPATIALIZER_NEON)
+  for (; i + 4 <= numSamples; i += 4) {
+    const float base = startGain + inc * (i + 1);
+    const float gains[4] = {base, base + inc, base + 2.0f * inc,
+                            base + 3.0f * inc};
+    vst1q_f32(dest + i, vmlaq_f32(vld1q_f32(dest + i), vld1q_f32(gains),
+                                  vld1q_f32(src + i)));
+  }
+#endif
+  for (; i < numSamples; i++) {
+    dest[i] += (startGain + inc * (i + 1)) * src[i];
+  }
+}
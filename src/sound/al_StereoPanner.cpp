@@ -46,6 +46,35 @@ void al::StereoPanner::renderBuffer(al::AudioIOData &io,
   }
 }
 
+void al::StereoPanner::renderToAccumulator(al::AudioIOData &accumulator,
+                                           const al::Pose &listeningPose,
+                                           const float *samples,
+                                           const unsigned int &numFrames,
+                                           int firstChannel, int lastChannel,
+                                           SpatializerSource *source) {
+  if (lastChannel < 0 || lastChannel > int(numSpeakers)) {
+    lastChannel = int(numSpeakers);
+  }
+  if (firstChannel == 0 && lastChannel == int(numSpeakers)) {
+    renderBuffer(accumulator, listeningPose, samples, numFrames);
+    return;
+  }
+  if (numSpeakers < 2) {
+    return;
+  }
+  Vec3d vec = listeningPose.vec();
+  Quatd srcRot = listeningPose.quat();
+  vec = srcRot.rotate(vec);
+  float gains[2];
+  equalPowerPan(vec, gains[0], gains[1]);
+  for (int chan = firstChannel; chan < lastChannel && chan < 2; chan++) {
+    float *buf = accumulator.outBuffer(chan);
+    for (unsigned int i = 0; i < numFrames; i++) {
+      buf[i] += gains[chan] * samples[i];
+    }
+  }
+}
+
 void al::StereoPanner::equalPowerPan(const al::Vec3d &relPos, float &gainL,
                                      float &gainR) {
   double panVal = 0.5;
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <list>
 #include <utility> // move
 #include <vector>
@@ -51,7 +53,8 @@ Vbap::Vbap(const Speakers &sl, bool is3D) : Spatializer(sl), mIs3D(is3D) {}
 
 void Vbap::addTriple(const SpeakerTriple &st) { mTriplets.push_back(st); }
 
-Vec3d Vbap::computeGains(const Vec3d &vecA, const SpeakerTriple &speak) {
+Vec3d Vbap::computeGains(const Vec3d &vecA,
+                         const SpeakerTriple &speak) const {
   const Mat3d &mat = speak.mat;
   unsigned dimensions = mIs3D ? 3 : 2;
   Vec3d vec(0., 0., 0.);
@@ -380,6 +383,214 @@ void Vbap::makePhantomChannel(int channelIndex,
                               std::vector<unsigned int> assignedOutputs) {
   mPhantomChannels[channelIndex] = std::move(assignedOutputs);
   // mPhantomChannels[channelIndex] = assignedOutputs;
+  buildLookup();
+}
+
+int Vbap::lookupCell(const Vec3d &vec) const {
+  const int n = VBAP_LOOKUP_RESOLUTION;
+  double ax = std::abs(vec.x);
+  double ay = std::abs(vec.y);
+  double az = mIs3D ? std::abs(vec.z) : 0.0;
+  int face;
+  double u, v;
+  if (ax >= ay && ax >= az) {
+    if (ax == 0.0) {
+      return -1;
+    }
+    face = vec.x > 0 ? 0 : 1;
+    u = vec.y / ax;
+    v = vec.z / ax;
+  } else if (ay >= az) {
+    face = vec.y > 0 ? 2 : 3;
+    u = vec.x / ay;
+    v = vec.z / ay;
+  } else {
+    face = vec.z > 0 ? 4 : 5;
+    u = vec.x / az;
+    v = vec.y / az;
+  }
+  int cellU = std::min(n - 1, int((u + 1.0) * 0.5 * n));
+  if (!mIs3D) {
+    return face * n + cellU;
+  }
+  int cellV = std::min(n - 1, int((v + 1.0) * 0.5 * n));
+  return (face * n + cellU) * n + cellV;
+}
+
+namespace {
+
+// Clip a convex polygon against the half space p[axis] * sign >= epsilon
+std::vector<Vec3d> clipToFace(const std::vector<Vec3d> &polygon, int axis,
+                              double sign) {
+  const double epsilon = 1e-9;
+  std::vector<Vec3d> clipped;
+  for (size_t i = 0; i < polygon.size(); i++) {
+    const Vec3d &p0 = polygon[i];
+    const Vec3d &p1 = polygon[(i + 1) % polygon.size()];
+    double d0 = p0[axis] * sign - epsilon;
+    double d1 = p1[axis] * sign - epsilon;
+    if (d0 >= 0) {
+      clipped.push_back(p0);
+    }
+    if ((d0 >= 0) != (d1 >= 0)) {
+      clipped.push_back(p0 + (p1 - p0) * (d0 / (d0 - d1)));
+    }
+    if (polygon.size() == 2 && i == 0) {
+      // A segment has a single edge
+      if (d1 >= 0) {
+        clipped.push_back(p1);
+      }
+      break;
+    }
+  }
+  return clipped;
+}
+
+// Separating axis test between a convex polygon and an axis aligned box
+bool polygonOverlapsBox(const std::vector<Vec2d> &polygon, double u0,
+                        double u1, double v0, double v1) {
+  const double epsilon = 1e-9;
+  u0 -= epsilon;
+  v0 -= epsilon;
+  u1 += epsilon;
+  v1 += epsilon;
+  double minU = polygon[0].x, maxU = polygon[0].x;
+  double minV = polygon[0].y, maxV = polygon[0].y;
+  for (auto &p : polygon) {
+    minU = std::min(minU, p.x);
+    maxU = std::max(maxU, p.x);
+    minV = std::min(minV, p.y);
+    maxV = std::max(maxV, p.y);
+  }
+  if (maxU < u0 || minU > u1 || maxV < v0 || minV > v1) {
+    return false;
+  }
+  const Vec2d corners[4] = {Vec2d(u0, v0), Vec2d(u1, v0), Vec2d(u0, v1),
+                            Vec2d(u1, v1)};
+  for (size_t i = 0; i < polygon.size(); i++) {
+    Vec2d edge = polygon[(i + 1) % polygon.size()] - polygon[i];
+    Vec2d normal(-edge.y, edge.x);
+    double minPoly = normal.dot(polygon[0]), maxPoly = minPoly;
+    for (auto &p : polygon) {
+      minPoly = std::min(minPoly, normal.dot(p));
+      maxPoly = std::max(maxPoly, normal.dot(p));
+    }
+    double minBox = normal.dot(corners[0]), maxBox = minBox;
+    for (auto &c : corners) {
+      minBox = std::min(minBox, normal.dot(c));
+      maxBox = std::max(maxBox, normal.dot(c));
+    }
+    if (maxPoly < minBox - epsilon || minPoly > maxBox + epsilon) {
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+void Vbap::buildLookup() {
+  const int n = VBAP_LOOKUP_RESOLUTION;
+  const int numFaces = mIs3D ? 6 : 4;
+  const int numCellsV = mIs3D ? n : 1;
+  // Axis of each cube face, and the axes mapped to u and v on the face
+  const int faceAxes[6][3] = {{0, 1, 2}, {0, 1, 2}, {1, 0, 2},
+                              {1, 0, 2}, {2, 0, 1}, {2, 0, 1}};
+
+  // Triplets cover the cone spanned by their speaker vectors. Projected onto
+  // a cube face through the center (a gnomonic projection) the cone becomes
+  // a convex polygon, so the cells it covers can be found exactly.
+  std::vector<std::vector<int>> cells(numFaces * n * numCellsV);
+  for (size_t t = 0; t < mTriplets.size(); t++) {
+    std::vector<Vec3d> triangle;
+    if (mIs3D) {
+      triangle = {mTriplets[t].s1Vec, mTriplets[t].s2Vec, mTriplets[t].s3Vec};
+    } else {
+      triangle = {Vec3d(mTriplets[t].s1Vec.x, mTriplets[t].s1Vec.y, 0.0),
+                  Vec3d(mTriplets[t].s2Vec.x, mTriplets[t].s2Vec.y, 0.0)};
+    }
+    for (int face = 0; face < numFaces; face++) {
+      const int *axes = faceAxes[face];
+      double sign = face % 2 == 0 ? 1.0 : -1.0;
+      std::vector<Vec3d> clipped = clipToFace(triangle, axes[0], sign);
+      if (clipped.empty()) {
+        continue;
+      }
+      std::vector<Vec2d> projected;
+      for (auto &p : clipped) {
+        double major = p[axes[0]] * sign;
+        projected.push_back(
+            Vec2d(p[axes[1]] / major, mIs3D ? p[axes[2]] / major : 0.0));
+      }
+      for (int cellU = 0; cellU < n; cellU++) {
+        double u0 = -1.0 + 2.0 * cellU / n;
+        double u1 = -1.0 + 2.0 * (cellU + 1) / n;
+        for (int cellV = 0; cellV < numCellsV; cellV++) {
+          double v0 = mIs3D ? -1.0 + 2.0 * cellV / n : -1.0;
+          double v1 = mIs3D ? -1.0 + 2.0 * (cellV + 1) / n : 1.0;
+          if (polygonOverlapsBox(projected, u0, u1, v0, v1)) {
+            cells[(face * n + cellU) * numCellsV + cellV].push_back(int(t));
+          }
+        }
+      }
+    }
+  }
+
+  // Pack cell lists, keeping triplets in index order so overlapping triplets
+  // resolve the same way as a linear search
+  mLookupTriplets.clear();
+  mLookupOffsets.clear();
+  mLookupOffsets.reserve(cells.size() + 1);
+  for (auto &cell : cells) {
+    mLookupOffsets.push_back(mLookupTriplets.size());
+    mLookupTriplets.insert(mLookupTriplets.end(), cell.begin(), cell.end());
+  }
+  mLookupOffsets.push_back(mLookupTriplets.size());
+
+  mTripletPhantoms.resize(mTriplets.size());
+  for (size_t t = 0; t < mTriplets.size(); t++) {
+    const unsigned int chans[3] = {mTriplets[t].s1Chan, mTriplets[t].s2Chan,
+                                   mTriplets[t].s3Chan};
+    for (int vertex = 0; vertex < 3; vertex++) {
+      auto it = mPhantomChannels.find(chans[vertex]);
+      mTripletPhantoms[t][vertex] =
+          it != mPhantomChannels.end() ? &it->second : nullptr;
+    }
+  }
+}
+
+int Vbap::findTriplet(const Vec3d &vec, Vec3d &gains, int cachedIndex) const {
+  if (cachedIndex >= 0 && cachedIndex < int(mTriplets.size())) {
+    gains = computeGains(vec, mTriplets[cachedIndex]);
+    if (gainsInTriplet(gains)) {
+      gains.normalize();
+      return cachedIndex;
+    }
+  }
+  if (mLookupOffsets.empty()) {
+    // Lookup not built yet, search all triplets
+    for (size_t index = 0; index < mTriplets.size(); ++index) {
+      gains = computeGains(vec, mTriplets[index]);
+      if (gainsInTriplet(gains)) {
+        gains.normalize();
+        return int(index);
+      }
+    }
+    return -1;
+  }
+  int cell = lookupCell(vec);
+  if (cell < 0) {
+    return -1;
+  }
+  for (size_t i = mLookupOffsets[cell]; i < mLookupOffsets[cell + 1]; i++) {
+    int index = mLookupTriplets[i];
+    gains = computeGains(vec, mTriplets[index]);
+    if (gainsInTriplet(gains)) {
+      gains.normalize();
+      return index;
+    }
+  }
+  return -1;
 }
 
 // void Vbap::compile(Listener& listener){
@@ -388,12 +599,38 @@ void Vbap::makePhantomChannel(int channelIndex,
 
 void Vbap::renderBuffer(AudioIOData &io, const Pose &listeningPose,
                         const float *samples, const unsigned int &numFrames) {
-  // FIMXE AC use cached index
-  //	unsigned currentTripletIndex = src.cachedIndex();
-  unsigned currentTripletIndex = 0;
-  // unsigned currentTripletIndex = mCachedTripletIndex; // Cached source
-  // placement, so it starts searching from there.
+  renderSpeakers(io, listeningPose, samples, numFrames, 0,
+                 int(io.channelsOut()), nullptr);
+}
 
+void Vbap::renderSource(AudioIOData &io, const Pose &listeningPose,
+                        const float *samples, const unsigned int &numFrames,
+                        SpatializerSource &source) {
+  renderSpeakers(io, listeningPose, samples, numFrames, 0,
+                 int(io.channelsOut()), &source);
+}
+
+void Vbap::renderToAccumulator(AudioIOData &accumulator,
+                               const Pose &listeningPose, const float *samples,
+                               const unsigned int &numFrames, int firstChannel,
+                               int lastChannel, SpatializerSource *source) {
+  if (lastChannel < 0 || lastChannel > int(accumulator.channelsOut())) {
+    lastChannel = int(accumulator.channelsOut());
+  }
+  if (firstChannel != 0 || lastChannel < int(accumulator.channelsOut())) {
+    // Partial renders may run concurrently for the same source
+    source = nullptr;
+  }
+  if (firstChannel < lastChannel) {
+    renderSpeakers(accumulator, listeningPose, samples, numFrames,
+                   firstChannel, lastChannel, source);
+  }
+}
+
+void Vbap::renderSpeakers(AudioIOData &io, const Pose &listeningPose,
+                          const float *samples, const unsigned int &numFrames,
+                          int firstChannel, int lastChannel,
+                          SpatializerSource *source) {
   Vec3d vec = listeningPose.vec();
 
   // Rotate vector according to listener-rotation
@@ -401,84 +638,43 @@ void Vbap::renderBuffer(AudioIOData &io, const Pose &listeningPose,
   vec = srcRot.rotate(vec);
   vec = Vec4d(-vec.z, vec.x, vec.y);
 
-  // Silent by default
   Vec3d gains;
+  int tripletIndex = findTriplet(vec, gains, source ? source->cachedIndex : -1);
+  if (source) {
+    source->cachedIndex = tripletIndex;
+  }
+  if (tripletIndex < 0) {
+    return; // Silent
+  }
 
-  // Search thru the triplets array in search of a match for the source
-  // position.
-  for (unsigned count = 0; count < mTriplets.size(); ++count) {
-    gains = computeGains(vec, mTriplets[currentTripletIndex]);
-    if ((gains[0] >= 0) && (gains[1] >= 0) && (!mIs3D || (gains[2] >= 0))) {
-      gains.normalize();
-
-      SpeakerTriple triple = mTriplets[currentTripletIndex];
-
-      float *outBuff1 = io.outBuffer(triple.s1Chan);
-      float *outBuff2 = io.outBuffer(triple.s2Chan);
-      float *outBuff3 = nullptr;
-      if (mIs3D) {
-        outBuff3 = io.outBuffer(triple.s3Chan);
-      }
-
-      // Check if any of the triplets are phantom channels and
-      // reassign signal
-      auto it1 = mPhantomChannels.find(triple.s1Chan);
-      auto it2 = mPhantomChannels.find(triple.s2Chan);
-      auto it3 = mPhantomChannels.find(triple.s3Chan);
-
-      for (size_t i = 0; i < numFrames; ++i) {
-        float sample = samples[i];
-        if (it1 != mPhantomChannels.end()) { // vertex 1 is phantom
-          float splitGain = gains[0] / mPhantomChannels.size();
-          float splitGainSQ = splitGain * splitGain;
-          for (auto const &element :
-               it1->second) { // iterate across all assigned speakers
-            io.out(element, i) += sample * splitGainSQ;
-          }
-        } else {
-          outBuff1[i] += sample * gains[0];
-        }
-        if (it2 != mPhantomChannels.end()) { // vertex 2 is phantom
-          float splitGain = gains[1] / mPhantomChannels.size();
-          float splitGainSQ = splitGain * splitGain;
-          for (auto const &element : it2->second) {
-            io.out(element, i) += sample * splitGainSQ;
-          }
-        } else {
-          outBuff2[i] += sample * gains[1];
-        }
-        if (mIs3D) {
-          if (it3 != mPhantomChannels.end()) {
-            float splitGain = gains[2] / mPhantomChannels.size();
-            float splitGainSQ = splitGain * splitGain;
-            for (auto const &element : it3->second) {
-              io.out(element, i) += sample * splitGainSQ;
-            }
-          } else {
-            outBuff3[i] += sample * gains[2];
-          }
+  const SpeakerTriple &triple = mTriplets[tripletIndex];
+  // Phantom channels reassign their signal to other outputs
+  const auto &phantoms = mTripletPhantoms[tripletIndex];
+  const unsigned int chans[3] = {triple.s1Chan, triple.s2Chan, triple.s3Chan};
+  const int numVertices = mIs3D ? 3 : 2;
+  auto inRange = [&](unsigned int chan) {
+    return int(chan) >= firstChannel && int(chan) < lastChannel;
+  };
+
+  for (int vertex = 0; vertex < numVertices; vertex++) {
+    if (phantoms[vertex]) {
+      float splitGain = gains[vertex] / mPhantomChannels.size();
+      float splitGainSQ = splitGain * splitGain;
+      for (auto const &element : *phantoms[vertex]) {
+        if (inRange(element)) {
+          addRamped(io.outBuffer(element), samples, numFrames, splitGainSQ,
+                    splitGainSQ);
         }
       }
-      break;
-    }
-
-    ++currentTripletIndex;
-    if (currentTripletIndex >= mTriplets.size()) {
-      currentTripletIndex = 0;
+    } else if (inRange(chans[vertex])) {
+      addRamped(io.outBuffer(chans[vertex]), samples, numFrames,
+                float(gains[vertex]), float(gains[vertex]));
     }
   }
-  // FIXME AC store cached index
-  //	src.cachedIndex(currentTripletIndex);
-  // mCachedTripletIndex = currentTripletIndex; // Store the new index
 }
 
 void Vbap::renderSample(AudioIOData &io, const Pose &listeningPose,
                         const float &sample, const unsigned int &frameIndex) {
-  // FIXME AC use cached index
-  //	unsigned currentTripletIndex = src.cachedIndex();
-  // unsigned currentTripletIndex = mCachedTripletIndex; // Cached source
-  // placement, so it starts searching from there.
-  unsigned currentTripletIndex = 0;
   Vec3d vec = listeningPose.vec();
 
   // Rotate vector according to listener-rotation
@@ -487,38 +683,19 @@ void Vbap::renderSample(AudioIOData &io, const Pose &listeningPose,
 
   // now transform to audio positions
   vec = Vec4d(vec.x, vec.z, vec.y);
-  // Silent by default
-  Vec3d gains;
-  //	Vec3d gainsTemp;
-
-  // Search thru the triplets array in search of a match for the source
-  // position.
-  for (size_t count = 0; count < mTriplets.size(); ++count) {
-    gains = computeGains(vec, mTriplets[currentTripletIndex]);
-    if ((gains[0] >= 0) && (gains[1] >= 0) && (!mIs3D || (gains[2] >= 0))) {
-      gains.normalize();
-      break;
-    }
 
-    ++currentTripletIndex;
-    if (currentTripletIndex >= mTriplets.size()) {
-      currentTripletIndex = 0;
-    }
+  Vec3d gains;
+  int tripletIndex = findTriplet(vec, gains);
+  if (tripletIndex < 0) {
+    return; // Silent
   }
-
-  SpeakerTriple triple = mTriplets[currentTripletIndex];
-
-  // mCachedTripletIndex = currentTripletIndex; // Store the new index
-  // FIXME stored cached index
-  //	src.cachedIndex(currentTripletIndex);
+  const SpeakerTriple &triple = mTriplets[tripletIndex];
 
   // Check if any of the triplets are phantom channels and
   // reassign signal
-  auto it1 = mPhantomChannels.find(triple.s1Chan);
-  auto it2 = mPhantomChannels.find(triple.s2Chan);
-  // auto it3 = mPhantomChannels.find(triple.s3Chan);
+  const auto &phantoms = mTripletPhantoms[tripletIndex];
 
-  if (it1 != mPhantomChannels.end()) { // vertex 1 is phantom
+  if (phantoms[0]) { // vertex 1 is phantom
     float splitGain = gains[0] * gains[0] / 2.0;
     io.out(triple.s1Chan, frameIndex) = 0.0;
     io.out(triple.s2Chan, frameIndex) += sample * splitGain;
@@ -526,7 +703,7 @@ void Vbap::renderSample(AudioIOData &io, const Pose &listeningPose,
   } else {
     io.out(triple.s1Chan, frameIndex) += sample * gains[0];
   }
-  if (it2 != mPhantomChannels.end()) { // vertex 2 is phantom
+  if (phantoms[1]) { // vertex 2 is phantom
     float splitGain = gains[1] * gains[1] / 2.0;
     io.out(triple.s1Chan, frameIndex) += sample * splitGain;
     io.out(triple.s2Chan, frameIndex) = 0.0;
@@ -535,7 +712,7 @@ void Vbap::renderSample(AudioIOData &io, const Pose &listeningPose,
     io.out(triple.s2Chan, frameIndex) += sample * gains[1];
   }
   if (mIs3D) {
-    if (it2 != mPhantomChannels.end()) {
+    if (phantoms[1]) {
       float splitGain = gains[2] * gains[2] / 2.0;
       io.out(triple.s1Chan, frameIndex) += sample * splitGain;
       io.out(triple.s2Chan, frameIndex) += sample * splitGain;
@@ -566,6 +743,7 @@ void Vbap::makeTriple(int s1, int s2, int s3) {
   triple.s3 = s3;
   triple.loadVectors(mSpeakers);
   addTriple(triple);
+  buildLookup();
 }
 
 void Vbap::compile() {
@@ -582,6 +760,7 @@ void Vbap::compile() {
     printf("No SpeakerSets found. Check mode setting or speaker layout.\n");
     throw - 1;
   }
+  buildLookup();
 }
 
 std::vector<SpeakerTriple> Vbap::triplets() const { return mTriplets; }
@@ -1,6 +1,7 @@
 
 #include "al/ui/al_Parameter.hpp"
 
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <regex>
@@ -48,6 +49,9 @@ void Parameter::setNoCalls(float value, void *blockReceiver) {
   }
 
   mValue = value;
+  if (blockReceiver) {
+    queueDeferredCallbacks();
+  }
 }
 
 void Parameter::set(float value, ValueSource *src) {
@@ -61,6 +65,69 @@ void Parameter::set(float value, ValueSource *src) {
 
   runChangeCallbacksSynchronous(value, src);
   mValue = value;
+  queueDeferredCallbacks();
+}
+
+// ParameterCallbackQueue -----------------------------------------------------
+int ParameterCallbackQueue::process() {
+  int count = 0;
+  ParameterMeta *param;
+  while (mQueue.pop(param)) {
+    param->runDeferredCallbacks();
+    count++;
+  }
+  return count;
+}
+
+void ParameterCallbackQueue::start(al_sec period) {
+  if (mRunning.exchange(true)) {
+    return;
+  }
+  mThread = std::thread([this, period]() {
+    while (mRunning.load()) {
+      process();
+      al_sleep(period);
+    }
+    process();
+  });
+}
+
+void ParameterCallbackQueue::stop() {
+  if (mRunning.exchange(false)) {
+    mThread.join();
+  }
+}
+
+// ParameterSmoother ----------------------------------------------------------
+void ParameterSmoother::attach(Parameter &param, double sampleRate) {
+  mParameter = &param;
+  mSampleRate = sampleRate;
+  reset();
+}
+
+void ParameterSmoother::reset() {
+  if (mParameter) {
+    mValue = mTarget = mParameter->get();
+  }
+  mRemaining = 0;
+}
+
+void ParameterSmoother::startRamp(float target) {
+  mTarget = target;
+  mMode = mParameter->smoothingMode();
+  int frames = int(mParameter->smoothingTime() * mSampleRate);
+  if (mMode == SmoothingMode::NONE || frames < 1) {
+    mValue = target;
+    mRemaining = 0;
+    return;
+  }
+  // Ramps restart from the current value when the target changes mid ramp
+  mRemaining = frames;
+  if (mMode == SmoothingMode::LINEAR) {
+    mIncrement = (target - mValue) / frames;
+  } else {
+    mCoefficient = float(std::pow(0.001, 1.0 / frames));
+  }
 }
 
 // ParameterInt
@@ -95,6 +162,9 @@ void ParameterInt::setNoCalls(int32_t value, void *blockReceiver) {
   }
 
   mValue = value;
+  if (blockReceiver) {
+    queueDeferredCallbacks();
+  }
 }
 
 void ParameterInt::set(int32_t value, ValueSource *src) {
@@ -108,6 +178,7 @@ void ParameterInt::set(int32_t value, ValueSource *src) {
 
   runChangeCallbacksSynchronous(value, src);
   mValue = value;
+  queueDeferredCallbacks();
 }
 
 // ParameterBool
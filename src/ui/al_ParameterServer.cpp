@@ -13,13 +13,190 @@ using namespace al;
 OSCNotifier::OSCNotifier() { mHandshakeHandler.notifier = this; }
 
 OSCNotifier::~OSCNotifier() {
+  stopCoalescing();
   for (osc::Send *sender : mOSCSenders) {
     delete sender;
   }
 }
 
+void OSCNotifier::addReliableListener(std::string IPaddress, uint16_t oscPort,
+                                      uint16_t nackPort) {
+  std::unique_lock<std::mutex> lk(mListenerLock);
+  if (!mReliableSender) {
+    auto sender = std::make_unique<osc::ReliableSender>();
+    if (!sender->open(nackPort)) {
+      std::cerr << "ERROR: Could not open NACK port " << nackPort << std::endl;
+      return;
+    }
+    mReliableSender = std::move(sender);
+  }
+  if (!mReliableSender->addDestination(oscPort, IPaddress.c_str())) {
+    std::cerr << "ERROR: Could not register reliable listener " << IPaddress
+              << ":" << oscPort << std::endl;
+  }
+}
+
+void OSCNotifier::coalesceNotifications(al_sec window, int maxPacketSize) {
+  stopCoalescing();
+  if (window <= 0) {
+    return;
+  }
+  mCoalesceWindow = window;
+  mMaxPacketSize = maxPacketSize;
+  // Also fits single messages larger than maxPacketSize
+  mBundle = std::make_unique<osc::Packet>(65536);
+  {
+    std::unique_lock<std::mutex> lk(mPendingLock);
+    mCoalescing = true;
+  }
+  mCoalesceRunning = true;
+  mCoalesceThread = std::thread([this]() {
+    std::unique_lock<std::mutex> lk(mCoalesceLock);
+    while (mCoalesceRunning) {
+      mCoalesceCondition.wait_for(
+          lk, std::chrono::duration<double>(mCoalesceWindow));
+      lk.unlock();
+      flushNotifications();
+      lk.lock();
+    }
+  });
+}
+
+void OSCNotifier::stopCoalescing() {
+  {
+    // Notifications queued before this are flushed below
+    std::unique_lock<std::mutex> lk(mPendingLock);
+    mCoalescing = false;
+  }
+  {
+    std::unique_lock<std::mutex> lk(mCoalesceLock);
+    mCoalesceRunning = false;
+  }
+  mCoalesceCondition.notify_all();
+  if (mCoalesceThread.joinable()) {
+    mCoalesceThread.join();
+    flushNotifications();
+  }
+}
+
+bool OSCNotifier::queueNotification(const std::string &address,
+                                    const char *typeTags, const float *floats,
+                                    int32_t intValue,
+                                    const std::string &stringValue,
+                                    ValueSource *src) {
+  if (!mCoalescing) {
+    return false;
+  }
+  std::unique_lock<std::mutex> lk(mPendingLock);
+  if (!mCoalescing) {
+    return false;
+  }
+  size_t index;
+  auto existing = mPendingIndex.find(address);
+  if (existing != mPendingIndex.end()) {
+    index = existing->second;
+  } else {
+    index = mPendingCount++;
+    if (mPending.size() < mPendingCount) {
+      mPending.resize(mPendingCount);
+    }
+    mPendingIndex[address] = index;
+  }
+  PendingNotification &n = mPending[index];
+  n.address = address;
+  n.typeTags = typeTags;
+  if (floats) {
+    std::copy(floats, floats + n.typeTags.size(), n.floats);
+  }
+  n.intValue = intValue;
+  n.stringValue = stringValue;
+  n.hasSource = src != nullptr;
+  if (src) {
+    n.source = *src;
+  }
+  return true;
+}
+
+void OSCNotifier::flushNotifications() {
+  size_t count;
+  {
+    std::unique_lock<std::mutex> lk(mPendingLock);
+    std::swap(mPending, mSending);
+    count = mPendingCount;
+    mPendingCount = 0;
+    mPendingIndex.clear();
+  }
+  if (count == 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lk(mListenerLock);
+  for (osc::Send *sender : mOSCSenders) {
+    auto ip = Socket::nameToIp(sender->address());
+    sendBundles(
+        count,
+        [&](const PendingNotification &n) {
+          return !n.hasSource ||
+                 (n.source.port == 0 && n.source.ipAddr != ip) ||
+                 (n.source.port != sender->port() && n.source.ipAddr != ip);
+        },
+        [sender](osc::Packet &p) { sender->send(p); });
+  }
+  if (mReliableSender) {
+    sendBundles(
+        count, [](const PendingNotification &n) { return !n.hasSource; },
+        [this](osc::Packet &p) { mReliableSender->send(p); });
+  }
+}
+
+void OSCNotifier::sendBundles(
+    size_t count, const std::function<bool(const PendingNotification &)> &use,
+    const std::function<void(osc::Packet &)> &send) {
+  auto padded = [](size_t size) { return (size + 3) & ~size_t(3); };
+  osc::Packet &bundle = *mBundle;
+  int messages = 0;
+  for (size_t i = 0; i < count; i++) {
+    const PendingNotification &n = mSending[i];
+    if (!use(n)) {
+      continue;
+    }
+    // Element size, address, type tags and arguments
+    size_t size = 4 + padded(n.address.size() + 1) +
+                  padded(n.typeTags.size() + 2) +
+                  (n.typeTags == "s" ? padded(n.stringValue.size() + 1)
+                                     : 4 * n.typeTags.size());
+    if (messages > 0 && bundle.size() + size > size_t(mMaxPacketSize)) {
+      bundle.endBundle();
+      send(bundle);
+      messages = 0;
+    }
+    if (messages == 0) {
+      bundle.clear();
+      bundle.beginBundle();
+    }
+    bundle.beginMessage(n.address);
+    if (n.typeTags == "s") {
+      bundle << n.stringValue;
+    } else if (n.typeTags == "i") {
+      bundle << int(n.intValue);
+    } else {
+      for (size_t j = 0; j < n.typeTags.size(); j++) {
+        bundle << n.floats[j];
+      }
+    }
+    bundle.endMessage();
+    messages++;
+  }
+  if (messages > 0) {
+    bundle.endBundle();
+    send(bundle);
+  }
+}
+
 void OSCNotifier::notifyListeners(std::string OSCaddress, float value,
                                   ValueSource *src) {
+  if (queueNotification(OSCaddress, "f", &value, 0, "", src)) {
+    return;
+  }
   mListenerLock.lock();
   for (osc::Send *sender : mOSCSenders) {
     auto ip = Socket::nameToIp(sender->address());
@@ -31,11 +208,15 @@ void OSCNotifier::notifyListeners(std::string OSCaddress, float value,
     //		std::cout << "Notifying " << sender->address() << ":" <<
     // sender->port() << " -- " << OSCaddress << std::endl;
   }
+  notifyReliable(src, OSCaddress, value);
   mListenerLock.unlock();
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, int value,
                                   ValueSource *src) {
+  if (queueNotification(OSCaddress, "i", nullptr, value, "", src)) {
+    return;
+  }
   mListenerLock.lock();
   for (osc::Send *sender : mOSCSenders) {
     auto ip = Socket::nameToIp(sender->address());
@@ -47,11 +228,15 @@ void OSCNotifier::notifyListeners(std::string OSCaddress, int value,
     //        std::cout << "Notifying " << sender->address() << ":" <<
     //        sender->port() << " -- " << OSCaddress << std::endl;
   }
+  notifyReliable(src, OSCaddress, value);
   mListenerLock.unlock();
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, std::string value,
                                   ValueSource *src) {
+  if (queueNotification(OSCaddress, "s", nullptr, 0, value, src)) {
+    return;
+  }
   mListenerLock.lock();
   for (osc::Send *sender : mOSCSenders) {
     auto ip = Socket::nameToIp(sender->address());
@@ -64,11 +249,15 @@ void OSCNotifier::notifyListeners(std::string OSCaddress, std::string value,
     //    sender->port()
     //              << " -- " << OSCaddress << std::endl;
   }
+  notifyReliable(src, OSCaddress, value);
   mListenerLock.unlock();
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, Vec3f value,
                                   ValueSource *src) {
+  if (queueNotification(OSCaddress, "fff", value.elems(), 0, "", src)) {
+    return;
+  }
   mListenerLock.lock();
   for (osc::Send *sender : mOSCSenders) {
     auto ip = Socket::nameToIp(sender->address());
@@ -80,11 +269,15 @@ void OSCNotifier::notifyListeners(std::string OSCaddress, Vec3f value,
     //		std::cout << "Notifying " << sender->address() << ":" <<
     // sender->port() << " -- " << OSCaddress << std::endl;
   }
+  notifyReliable(src, OSCaddress, value[0], value[1], value[2]);
   mListenerLock.unlock();
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, Vec4f value,
                                   ValueSource *src) {
+  if (queueNotification(OSCaddress, "ffff", value.elems(), 0, "", src)) {
+    return;
+  }
   mListenerLock.lock();
   for (osc::Send *sender : mOSCSenders) {
     auto ip = Socket::nameToIp(sender->address());
@@ -96,11 +289,19 @@ void OSCNotifier::notifyListeners(std::string OSCaddress, Vec4f value,
     //		std::cout << "Notifying " << sender->address() << ":" <<
     // sender->port() << " -- " << OSCaddress << std::endl;
   }
+  notifyReliable(src, OSCaddress, value[0], value[1], value[2], value[3]);
   mListenerLock.unlock();
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, Pose value,
                                   ValueSource *src) {
+  float poseValues[7] = {
+      (float)value.pos()[0], (float)value.pos()[1], (float)value.pos()[2],
+      (float)value.quat().w, (float)value.quat().x, (float)value.quat().y,
+      (float)value.quat().z};
+  if (queueNotification(OSCaddress, "fffffff", poseValues, 0, "", src)) {
+    return;
+  }
   mListenerLock.lock();
   for (osc::Send *sender : mOSCSenders) {
     auto ip = Socket::nameToIp(sender->address());
@@ -115,11 +316,19 @@ void OSCNotifier::notifyListeners(std::string OSCaddress, Pose value,
     //		std::cout << "Notifying " << sender->address() << ":" <<
     // sender->port() << " -- " << OSCaddress << std::endl;
   }
+  notifyReliable(src, OSCaddress, (float)value.pos()[0],
+                 (float)value.pos()[1], (float)value.pos()[2],
+                 (float)value.quat().w, (float)value.quat().x,
+                 (float)value.quat().y, (float)value.quat().z);
   mListenerLock.unlock();
 }
 
 void OSCNotifier::notifyListeners(std::string OSCaddress, Color value,
                                   ValueSource *src) {
+  float colorValues[3] = {value.r, value.g, value.b};
+  if (queueNotification(OSCaddress, "fff", colorValues, 0, "", src)) {
+    return;
+  }
   mListenerLock.lock();
   for (osc::Send *sender : mOSCSenders) {
     auto ip = Socket::nameToIp(sender->address());
@@ -131,6 +340,8 @@ void OSCNotifier::notifyListeners(std::string OSCaddress, Color value,
     //		std::cout << "Notifying " << sender->address() << ":" <<
     // sender->port() << " -- " << OSCaddress << std::endl;
   }
+  notifyReliable(src, OSCaddress, float(value.r), float(value.g),
+                 float(value.b));
   mListenerLock.unlock();
 }
 
@@ -203,7 +414,7 @@ void OSCNotifier::startHandshakeServer(std::string address) {
 
 ParameterServer::ParameterServer(std::string oscAddress, int oscPort,
                                  bool autoStart)
-    : mServer(nullptr) {
+    : mServer(nullptr), mAddressIndex(std::make_shared<AddressIndex>()) {
   mOscAddress = oscAddress;
   mOscPort = oscPort;
   OSCNotifier::mHandshakeHandler.mParameterServer = this;
@@ -243,6 +454,7 @@ bool ParameterServer::listen(int oscPort, std::string oscAddress) {
   mServer = new osc::Recv();
   if (mServer) {
     if (mServer->open(oscPort, oscAddress.c_str())) {
+      mReliableReceiver.port(oscPort);
       mServer->handler(*this);
       mServer->start();
     } else {
@@ -257,9 +469,35 @@ bool ParameterServer::listen(int oscPort, std::string oscAddress) {
   return true;
 }
 
+bool ParameterServer::listenMulticast(int oscPort, std::string group,
+                                      std::string interfaceAddress) {
+  std::unique_lock<std::mutex> lk(mServerLock);
+  if (mServer) {
+    mServer->stop();
+    delete mServer;
+    mServer = nullptr;
+  }
+  mOscPort = oscPort;
+  mOscAddress = group;
+  mServer = new osc::Recv();
+  if (!mServer->openMulticast(oscPort, group.c_str(),
+                              interfaceAddress.c_str())) {
+    std::cout << "Error joining multicast group " << group << ":" << oscPort
+              << std::endl;
+    delete mServer;
+    mServer = nullptr;
+    return false;
+  }
+  mReliableReceiver.port(oscPort);
+  mServer->handler(*this);
+  mServer->start();
+  return true;
+}
+
 ParameterServer &ParameterServer::registerParameter(ParameterMeta &param) {
   mParameterLock.lock();
   mParameters.push_back(&param);
+  rebuildAddressIndex();
   mParameterLock.unlock();
   mListenerLock.lock();
   if (strcmp(typeid(param).name(), typeid(ParameterBool).name()) ==
@@ -346,6 +584,7 @@ ParameterServer &ParameterServer::registerParameter(ParameterMeta &param) {
 
 ParameterServer &
 ParameterServer::registerParameterBundle(ParameterBundle &bundle) {
+  std::unique_lock<std::mutex> lk(mParameterLock);
   if (mCurrentActiveBundle.find(bundle.name()) == mCurrentActiveBundle.end()) {
     mParameterBundles[bundle.name()] = std::vector<ParameterBundle *>();
     mCurrentActiveBundle[bundle.name()] = 0;
@@ -356,45 +595,91 @@ ParameterServer::registerParameterBundle(ParameterBundle &bundle) {
   return *this;
 }
 
+namespace {
+// Server whose onMessage() is running on this thread
+thread_local const ParameterServer *dispatchingServer = nullptr;
+} // namespace
+
 void ParameterServer::unregisterParameter(ParameterMeta &param) {
-  std::unique_lock<std::mutex> lk(mParameterLock);
-  auto it = mParameters.begin();
-  for (it = mParameters.begin(); it != mParameters.end(); it++) {
-    if (*it == &param) {
-      mParameters.erase(it);
+  std::shared_ptr<const AddressIndex> previousIndex;
+  {
+    std::unique_lock<std::mutex> lk(mParameterLock);
+    auto it = std::find(mParameters.begin(), mParameters.end(), &param);
+    if (it == mParameters.end()) {
+      return;
+    }
+    mParameters.erase(it);
+    previousIndex = std::atomic_load(&mAddressIndex);
+    rebuildAddressIndex();
+  }
+  // Messages being dispatched hold the previous index until they are done.
+  // Wait for them so the parameter is not set after this returns, unless
+  // called from a dispatch on this thread, which would wait for itself.
+  if (dispatchingServer != this) {
+    while (previousIndex.use_count() > 1) {
+      std::this_thread::yield();
     }
+    std::atomic_thread_fence(std::memory_order_acquire);
   }
 }
 
 void ParameterServer::onMessage(osc::Message &m) {
+  // Messages unwrapped from reliable packets come back through onMessage()
+  if (mReliableReceiver.handleMessage(m)) {
+    return;
+  }
   m.resetStream(); // Needs to be moved to caller...
   if (mVerbose) {
     m.print();
   }
-  mParameterLock.lock();
-  for (ParameterMeta *param : mParameters) {
-    if (setParameterValueFromMessage(param, m.addressPattern(), m)) {
-      m.resetStream();
+  // Held until the message is dispatched, see unregisterParameter()
+  auto index = std::atomic_load(&mAddressIndex);
+  const ParameterServer *outerServer = dispatchingServer;
+  dispatchingServer = this;
+  ValueSource source{m.senderAddress(), 0};
+  const std::string &address = m.addressPattern();
+  bool found = false;
+  if (!osc::isPattern(address)) {
+    auto setters = index->setters.find(address);
+    if (setters != index->setters.end()) {
+      found = true;
+      for (auto &setter : setters->second) {
+        setter(m, &source);
+        m.resetStream();
+      }
+    }
+  } else {
+    for (auto &setters : index->setters) {
+      if (osc::patternMatches(address.c_str(), setters.first.c_str())) {
+        found = true;
+        for (auto &setter : setters.second) {
+          setter(m, &source);
+          m.resetStream();
+        }
+      }
     }
   }
-  for (auto &bundleGroup : mParameterBundles) {
-    auto oscAddress = m.addressPattern();
-    setValuesForBundleGroup(m, bundleGroup.second, oscAddress);
+  // Bundles can change after registration, so they are not indexed
+  if (!found) {
+    std::unique_lock<std::mutex> lk(mParameterLock);
+    for (auto &bundleGroup : mParameterBundles) {
+      setValuesForBundleGroup(m, bundleGroup.second, address);
+    }
   }
 
   // FIXME these handlers should not be kept by ParameterServer, but should be
   // set for the Recv object.
-  for (osc::PacketHandler *handler : mPacketHandlers) {
+  for (osc::PacketHandler *handler : index->handlers) {
     m.resetStream();
     handler->onMessage(m);
   }
-  for (auto consumer : mMessageConsumers) {
+  for (auto &consumer : index->consumers) {
     m.resetStream();
     if (consumer.first->consumeMessage(m, consumer.second)) {
       break;
     }
   }
-  mParameterLock.unlock();
+  dispatchingServer = outerServer;
 }
 
 void ParameterServer::print(std::ostream &stream) {
@@ -494,6 +779,7 @@ std::vector<ParameterPose *> ParameterServer::poseParameters() {
 void ParameterServer::registerOSCListener(osc::PacketHandler *handler) {
   mParameterLock.lock();
   mPacketHandlers.push_back(handler);
+  rebuildAddressIndex();
   mParameterLock.unlock();
 }
 
@@ -501,9 +787,163 @@ void ParameterServer::registerOSCConsumer(osc::MessageConsumer *consumer,
                                           std::string rootPath) {
   mParameterLock.lock();
   mMessageConsumers.push_back({consumer, rootPath});
+  rebuildAddressIndex();
   mParameterLock.unlock();
 }
 
+void ParameterServer::rebuildAddressIndex() {
+  auto index = std::make_shared<AddressIndex>();
+  for (ParameterMeta *param : mParameters) {
+    addSetters(*index, param);
+  }
+  index->handlers = mPacketHandlers;
+  index->consumers = mMessageConsumers;
+  std::atomic_store(&mAddressIndex,
+                    std::shared_ptr<const AddressIndex>(std::move(index)));
+}
+
+namespace {
+
+template <class ParameterType, class ValueType>
+std::function<bool(osc::Message &, ValueSource *)>
+valueSetter(ParameterType *p, const char *typeTags) {
+  return [p, typeTags](osc::Message &m, ValueSource *src) {
+    if (m.typeTags() != typeTags) {
+      return false;
+    }
+    ValueType value;
+    m >> value;
+    p->set(value, src);
+    return true;
+  };
+}
+
+} // namespace
+
+void ParameterServer::addSetters(AddressIndex &index, ParameterMeta *param) {
+  const std::string address = param->getFullAddress();
+  auto &setters = index.setters;
+  if (strcmp(typeid(*param).name(), typeid(ParameterBool).name()) ==
+      0) { // ParameterBool
+    setters[address].push_back(valueSetter<ParameterBool, float>(
+        static_cast<ParameterBool *>(param), "f"));
+  } else if (strcmp(typeid(*param).name(), typeid(Parameter).name()) ==
+             0) { // Parameter
+    setters[address].push_back(
+        valueSetter<Parameter, float>(static_cast<Parameter *>(param), "f"));
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterInt).name()) ==
+             0) { // ParameterInt
+    setters[address].push_back(valueSetter<ParameterInt, int>(
+        static_cast<ParameterInt *>(param), "i"));
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterString).name()) ==
+             0) { // ParameterString
+    setters[address].push_back(valueSetter<ParameterString, std::string>(
+        static_cast<ParameterString *>(param), "s"));
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterPose).name()) ==
+             0) { // ParameterPose
+    ParameterPose *p = static_cast<ParameterPose *>(param);
+    setters[address].push_back([p](osc::Message &m, ValueSource *src) {
+      if (m.typeTags() != "fffffff") {
+        return false;
+      }
+      float x, y, z, w, qx, qy, qz;
+      m >> x >> y >> z >> w >> qx >> qy >> qz;
+      p->set(Pose(Vec3d(x, y, z), Quatd(w, qx, qy, qz)), src);
+      return true;
+    });
+    setters[address + "/pos"].push_back([p](osc::Message &m, ValueSource *src) {
+      if (m.typeTags() != "fff") {
+        return false;
+      }
+      float x, y, z;
+      m >> x >> y >> z;
+      Pose currentPose = p->get();
+      currentPose.pos() = Vec3d(x, y, z);
+      p->set(currentPose, src);
+      return true;
+    });
+    for (int i = 0; i < 3; i++) {
+      std::string component = std::string("/pos/") + "xyz"[i];
+      setters[address + component].push_back(
+          [p, i](osc::Message &m, ValueSource *src) {
+            if (m.typeTags() != "f") {
+              return false;
+            }
+            float value;
+            m >> value;
+            Pose currentPose = p->get();
+            currentPose.pos()[i] = value;
+            p->set(currentPose, src);
+            return true;
+          });
+    }
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterMenu).name()) ==
+             0) { // ParameterMenu
+    setters[address].push_back(valueSetter<ParameterMenu, int>(
+        static_cast<ParameterMenu *>(param), "i"));
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterChoice).name()) ==
+             0) { // ParameterChoice
+    setters[address].push_back(valueSetter<ParameterChoice, int>(
+        static_cast<ParameterChoice *>(param), "i"));
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterVec3).name()) ==
+             0) { // ParameterVec3
+    ParameterVec3 *p = static_cast<ParameterVec3 *>(param);
+    setters[address].push_back([p](osc::Message &m, ValueSource *src) {
+      if (m.typeTags() != "fff") {
+        return false;
+      }
+      float x, y, z;
+      m >> x >> y >> z;
+      p->set(Vec3f(x, y, z), src);
+      return true;
+    });
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterVec4).name()) ==
+             0) { // ParameterVec4
+    ParameterVec4 *p = static_cast<ParameterVec4 *>(param);
+    setters[address].push_back([p](osc::Message &m, ValueSource *src) {
+      if (m.typeTags() != "ffff") {
+        return false;
+      }
+      float a, b, c, d;
+      m >> a >> b >> c >> d;
+      p->set(Vec4f(a, b, c, d), src);
+      return true;
+    });
+  } else if (strcmp(typeid(*param).name(), typeid(ParameterColor).name()) ==
+             0) { // ParameterColor
+    ParameterColor *p = static_cast<ParameterColor *>(param);
+    setters[address].push_back([p](osc::Message &m, ValueSource *src) {
+      if (m.typeTags() != "ffff") {
+        return false;
+      }
+      float r, g, b, a;
+      m >> r >> g >> b >> a;
+      p->set(Color(r, g, b, a), src);
+      return true;
+    });
+  } else if (strcmp(typeid(*param).name(), typeid(Trigger).name()) ==
+             0) { // Trigger
+    Trigger *p = static_cast<Trigger *>(param);
+    setters[address].push_back([p](osc::Message &m, ValueSource *src) {
+      if (m.typeTags().size() == 0) {
+        p->trigger();
+        return true;
+      } else if (m.typeTags() == "f") {
+        float val;
+        m >> val;
+        if (val == 1.0) {
+          p->trigger();
+        }
+        return true;
+      }
+      return false;
+    });
+  } else {
+    std::cout << "Unsupported registered Parameter " << typeid(*param).name()
+              << std::endl;
+  }
+}
+
 void ParameterServer::notifyAll() {
   for (ParameterMeta *param : mParameters) {
     notifyListeners(param->getFullAddress(), param, nullptr);
@@ -0,0 +1,572 @@
+
+#include "al/ui/al_PresetBank.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "al/ui/al_PresetHandler.hpp"
+
+using namespace al;
+
+// File layout ----------------------------------------------------------------
+
+namespace {
+
+const char kMagic[8] = {'A', 'L', 'P', 'B', 'A', 'N', 'K', '\0'};
+const uint32_t kVersion = 1;
+// Read back in a different order when the bank was written on a machine of
+// different endianness
+const uint32_t kByteOrder = 0x01020304;
+
+struct BankHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t schemaCount;
+  uint32_t fieldCount;
+  uint32_t recordCount;
+  uint32_t recordSize;
+  uint64_t schemaOffset;
+  uint64_t indexOffset;
+  uint64_t recordsOffset;
+  uint64_t stringsOffset;
+  uint64_t stringsSize;
+};
+
+struct BankSchemaEntry {
+  uint32_t address; // Offsets in the string table
+  uint32_t types;
+  uint32_t firstField;
+  uint32_t fieldCount;
+};
+
+struct BankIndexEntry {
+  int32_t index; // -1 when not in the preset map
+  uint32_t name;
+};
+
+static_assert(sizeof(BankHeader) == 72, "Unexpected padding in bank header");
+static_assert(sizeof(BankSchemaEntry) == 16, "Unexpected padding in schema");
+static_assert(sizeof(BankIndexEntry) == 8, "Unexpected padding in index");
+
+// Strings are stored as a uint32_t length followed by the characters, and
+// each distinct string is stored once
+struct StringTable {
+  std::vector<char> data;
+  std::unordered_map<std::string, uint32_t> offsets;
+
+  uint32_t add(const std::string &s) {
+    auto found = offsets.find(s);
+    if (found != offsets.end()) {
+      return found->second;
+    }
+    uint32_t offset = uint32_t(data.size());
+    uint32_t length = uint32_t(s.size());
+    data.resize(data.size() + sizeof(length) + s.size());
+    std::memcpy(data.data() + offset, &length, sizeof(length));
+    std::memcpy(data.data() + offset + sizeof(length), s.data(), s.size());
+    offsets[s] = offset;
+    return offset;
+  }
+};
+
+char fieldTypeTag(const ParameterField &field) {
+  switch (field.type()) {
+  case ParameterField::FLOAT:
+    return 'f';
+  case ParameterField::INT32:
+    return 'i';
+  case ParameterField::STRING:
+    return 's';
+  case ParameterField::NULLDATA:
+    break;
+  }
+  return '\0';
+}
+
+// Field tags are compatible if both are numbers or both are strings
+bool compatibleTypes(const std::string &types,
+                     const std::vector<ParameterField> &fields) {
+  if (types.size() != fields.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < fields.size(); i++) {
+    char tag = fieldTypeTag(fields[i]);
+    if (tag == '\0' || (tag == 's') != (types[i] == 's')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t encodeField(const ParameterField &field, char type,
+                     StringTable &strings) {
+  uint32_t slot = 0;
+  if (type == 'f') {
+    float value = field.type() == ParameterField::FLOAT
+                      ? field.get<float>()
+                      : float(field.get<int32_t>());
+    std::memcpy(&slot, &value, sizeof(slot));
+  } else if (type == 'i') {
+    int32_t value = field.type() == ParameterField::INT32
+                        ? field.get<int32_t>()
+                        : int32_t(field.get<float>());
+    std::memcpy(&slot, &value, sizeof(slot));
+  } else {
+    slot = strings.add(field.get<std::string>());
+  }
+  return slot;
+}
+
+} // namespace
+
+// PresetBank -----------------------------------------------------------------
+
+bool PresetBank::open(std::string fileName) {
+  std::lock_guard<std::mutex> lock(mLock);
+  clear();
+  mFileName = fileName;
+  mGeneration++;
+  if (!File::exists(fileName)) {
+    return true;
+  }
+  if (!mFile.open(fileName)) {
+    std::cerr << "ERROR: PresetBank could not open " << fileName << std::endl;
+    return false;
+  }
+  if (!readIndex()) {
+    std::cerr << "ERROR: Invalid preset bank " << fileName << std::endl;
+    clear();
+    return false;
+  }
+  return true;
+}
+
+void PresetBank::close() {
+  std::lock_guard<std::mutex> lock(mLock);
+  clear();
+  mFileName.clear();
+  mGeneration++;
+}
+
+std::string PresetBank::fileName() {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mFileName;
+}
+
+size_t PresetBank::size() {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mRecords.size();
+}
+
+bool PresetBank::has(std::string name) {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mRecordIndex.find(name) != mRecordIndex.end();
+}
+
+std::vector<std::string> PresetBank::presetNames() {
+  std::lock_guard<std::mutex> lock(mLock);
+  std::vector<std::string> names;
+  names.reserve(mRecords.size());
+  for (auto &record : mRecords) {
+    names.push_back(record.name);
+  }
+  return names;
+}
+
+bool PresetBank::load(std::string name, ParameterStates &values) {
+  std::lock_guard<std::mutex> lock(mLock);
+  auto found = mRecordIndex.find(name);
+  if (found == mRecordIndex.end()) {
+    return false;
+  }
+  loadRecord(found->second, values);
+  return true;
+}
+
+bool PresetBank::store(std::string name, const ParameterStates &values,
+                       int index) {
+  std::vector<Preset> presets{{name, index, values}};
+  return store(presets);
+}
+
+bool PresetBank::store(const std::vector<Preset> &presets) {
+  std::lock_guard<std::mutex> lock(mLock);
+  return rewrite(presets, {}, nullptr);
+}
+
+bool PresetBank::remove(std::string name) {
+  std::lock_guard<std::mutex> lock(mLock);
+  if (mRecordIndex.find(name) == mRecordIndex.end()) {
+    return false;
+  }
+  return rewrite({}, {name}, nullptr);
+}
+
+std::map<int, std::string> PresetBank::presetMap() {
+  std::lock_guard<std::mutex> lock(mLock);
+  std::map<int, std::string> presetsMap;
+  for (auto &record : mRecords) {
+    if (record.index >= 0) {
+      presetsMap[record.index] = record.name;
+    }
+  }
+  return presetsMap;
+}
+
+bool PresetBank::setPresetMap(const std::map<int, std::string> &presetsMap) {
+  std::lock_guard<std::mutex> lock(mLock);
+  return rewrite({}, {}, &presetsMap);
+}
+
+uint64_t PresetBank::generation() {
+  std::lock_guard<std::mutex> lock(mLock);
+  return mGeneration;
+}
+
+bool PresetBank::importPresets(std::string directory, std::string mapName) {
+  directory = File::conformDirectory(directory);
+  FileList presetFiles = filterInDir(directory, [](const FilePath &f) {
+    return al::checkExtension(f, ".preset");
+  });
+  std::vector<Preset> presets;
+  for (int i = 0; i < presetFiles.count(); i++) {
+    const std::string &file = presetFiles[i].file();
+    presets.push_back({file.substr(0, file.size() - 7), -1,
+                       PresetHandler::readPresetFile(
+                           presetFiles[i].filepath())});
+  }
+  std::map<int, std::string> presetsMap;
+  std::string mapFile = directory + mapName + ".presetMap";
+  if (File::exists(mapFile)) {
+    presetsMap = PresetHandler::readPresetMapFile(mapFile);
+  }
+  std::lock_guard<std::mutex> lock(mLock);
+  return rewrite(presets, {}, presetsMap.size() > 0 ? &presetsMap : nullptr);
+}
+
+bool PresetBank::exportPresets(std::string directory, std::string mapName) {
+  directory = File::conformDirectory(directory);
+  if (!File::isDirectory(directory) && !Dir::make(directory)) {
+    std::cerr << "ERROR: Could not create directory " << directory
+              << std::endl;
+    return false;
+  }
+  bool ok = true;
+  for (auto &name : presetNames()) {
+    ParameterStates values;
+    if (load(name, values)) {
+      ok = PresetHandler::writePresetFile(directory + name + ".preset", name,
+                                          values) &&
+           ok;
+    }
+  }
+  ok = PresetHandler::writePresetMapFile(
+           directory + mapName + ".presetMap", presetMap()) &&
+       ok;
+  return ok;
+}
+
+void PresetBank::clear() {
+  mFile.close();
+  mSchema.clear();
+  mSchemaIndex.clear();
+  mFieldCount = 0;
+  mBitmapWords = 0;
+  mRecordSize = 0;
+  mRecords.clear();
+  mRecordIndex.clear();
+  mRecordsData = nullptr;
+  mStrings = nullptr;
+  mStringsSize = 0;
+}
+
+bool PresetBank::readIndex() {
+  const char *data = mFile.data();
+  uint64_t size = mFile.size();
+  BankHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    return false;
+  }
+  if (header.byteOrder != kByteOrder) {
+    std::cerr << "ERROR: Preset bank written with a different byte order. "
+                 "Use exportPresets() on the original machine."
+              << std::endl;
+    return false;
+  }
+  uint64_t bitmapWords = (uint64_t(header.schemaCount) + 31) / 32;
+  if (header.recordSize != 4 * (bitmapWords + header.fieldCount) ||
+      header.schemaOffset + uint64_t(header.schemaCount) *
+                                sizeof(BankSchemaEntry) > size ||
+      header.indexOffset + uint64_t(header.recordCount) *
+                               sizeof(BankIndexEntry) > size ||
+      header.recordsOffset + uint64_t(header.recordCount) *
+                                 header.recordSize > size ||
+      header.stringsOffset + header.stringsSize > size) {
+    return false;
+  }
+  mStrings = data + header.stringsOffset;
+  mStringsSize = header.stringsSize;
+  mRecordsData = data + header.recordsOffset;
+  mFieldCount = header.fieldCount;
+  mBitmapWords = uint32_t(bitmapWords);
+  mRecordSize = header.recordSize;
+
+  mSchema.resize(header.schemaCount);
+  for (uint32_t i = 0; i < header.schemaCount; i++) {
+    BankSchemaEntry entry;
+    std::memcpy(&entry, data + header.schemaOffset + i * sizeof(entry),
+                sizeof(entry));
+    mSchema[i] = {readString(entry.address), readString(entry.types),
+                  entry.firstField};
+    if (mSchema[i].types.size() != entry.fieldCount ||
+        uint64_t(entry.firstField) + entry.fieldCount > mFieldCount) {
+      return false;
+    }
+    mSchemaIndex[mSchema[i].address] = i;
+  }
+  mRecords.resize(header.recordCount);
+  mRecordIndex.reserve(header.recordCount);
+  for (uint32_t i = 0; i < header.recordCount; i++) {
+    BankIndexEntry entry;
+    std::memcpy(&entry, data + header.indexOffset + i * sizeof(entry),
+                sizeof(entry));
+    mRecords[i] = {readString(entry.name), entry.index};
+    mRecordIndex[mRecords[i].name] = i;
+  }
+  return true;
+}
+
+std::string PresetBank::readString(uint32_t offset) {
+  uint32_t length;
+  if (uint64_t(offset) + sizeof(length) > mStringsSize) {
+    return std::string();
+  }
+  std::memcpy(&length, mStrings + offset, sizeof(length));
+  if (uint64_t(offset) + sizeof(length) + length > mStringsSize) {
+    return std::string();
+  }
+  return std::string(mStrings + offset + sizeof(length), length);
+}
+
+void PresetBank::loadRecord(uint32_t record, ParameterStates &values) {
+  const char *data = recordData(record);
+  const char *fields = data + 4 * mBitmapWords;
+  for (uint32_t word = 0; word < mBitmapWords; word++) {
+    uint32_t bits;
+    std::memcpy(&bits, data + 4 * word, sizeof(bits));
+    for (uint32_t bit = 0; bits != 0; bit++, bits >>= 1) {
+      if (!(bits & 1)) {
+        continue;
+      }
+      if (word * 32 + bit >= mSchema.size()) {
+        break; // Padding bits of a corrupt record
+      }
+      const SchemaEntry &entry = mSchema[word * 32 + bit];
+      std::vector<ParameterField> &parameterFields = values[entry.address];
+      parameterFields.clear();
+      parameterFields.reserve(entry.types.size());
+      const char *slot = fields + 4 * size_t(entry.firstField);
+      for (char type : entry.types) {
+        if (type == 'f') {
+          float value;
+          std::memcpy(&value, slot, sizeof(value));
+          parameterFields.emplace_back(value);
+        } else if (type == 'i') {
+          int32_t value;
+          std::memcpy(&value, slot, sizeof(value));
+          parameterFields.emplace_back(value);
+        } else {
+          uint32_t offset;
+          std::memcpy(&offset, slot, sizeof(offset));
+          parameterFields.emplace_back(readString(offset));
+        }
+        slot += 4;
+      }
+    }
+  }
+}
+
+bool PresetBank::rewrite(const std::vector<Preset> &presets,
+                         const std::set<std::string> &removed,
+                         const std::map<int, std::string> *presetsMap) {
+  if (mFileName.empty()) {
+    std::cerr << "ERROR: PresetBank has no file" << std::endl;
+    return false;
+  }
+  // Parameters not in the bank yet are added at the end of the schema, so
+  // existing records only need to be extended
+  std::vector<SchemaEntry> schema = mSchema;
+  std::unordered_map<std::string, uint32_t> schemaIndex = mSchemaIndex;
+  uint32_t fieldCount = mFieldCount;
+  for (auto &preset : presets) {
+    for (auto &value : preset.values) {
+      auto found = schemaIndex.find(value.first);
+      if (found != schemaIndex.end()) {
+        if (!compatibleTypes(schema[found->second].types, value.second)) {
+          std::cerr << "ERROR: Fields of " << value.first << " in preset "
+                    << preset.name << " don't match the preset bank"
+                    << std::endl;
+          return false;
+        }
+        continue;
+      }
+      std::string types;
+      for (auto &field : value.second) {
+        char tag = fieldTypeTag(field);
+        if (tag == '\0') {
+          std::cerr << "ERROR: Empty field in " << value.first
+                    << " in preset " << preset.name << std::endl;
+          return false;
+        }
+        types += tag;
+      }
+      schemaIndex[value.first] = uint32_t(schema.size());
+      schema.push_back({value.first, types, fieldCount});
+      fieldCount += uint32_t(types.size());
+    }
+  }
+
+  struct OutputRecord {
+    std::string name;
+    int index;
+    int64_t oldRecord; // Record to copy from the current file, or -1
+    const ParameterStates *values;
+  };
+  std::vector<OutputRecord> records;
+  std::unordered_map<std::string, size_t> recordIndex;
+  for (uint32_t i = 0; i < mRecords.size(); i++) {
+    if (removed.find(mRecords[i].name) == removed.end()) {
+      recordIndex[mRecords[i].name] = records.size();
+      records.push_back({mRecords[i].name, mRecords[i].index, i, nullptr});
+    }
+  }
+  for (auto &preset : presets) {
+    auto found = recordIndex.find(preset.name);
+    if (found == recordIndex.end()) {
+      recordIndex[preset.name] = records.size();
+      records.push_back({preset.name, preset.index, -1, &preset.values});
+      found = recordIndex.find(preset.name);
+    } else {
+      OutputRecord &record = records[found->second];
+      record.oldRecord = -1;
+      record.values = &preset.values;
+      if (preset.index >= 0) {
+        record.index = preset.index;
+      }
+    }
+    // An index in the preset map refers to a single preset
+    if (preset.index >= 0) {
+      for (auto &record : records) {
+        if (record.index == preset.index && record.name != preset.name) {
+          record.index = -1;
+        }
+      }
+    }
+  }
+  if (presetsMap) {
+    std::unordered_map<std::string, int> indices;
+    for (auto &entry : *presetsMap) {
+      indices[entry.second] = entry.first;
+      if (recordIndex.find(entry.second) == recordIndex.end()) {
+        recordIndex[entry.second] = records.size();
+        records.push_back({entry.second, -1, -1, nullptr});
+      }
+    }
+    for (auto &record : records) {
+      auto found = indices.find(record.name);
+      record.index = found != indices.end() ? found->second : -1;
+    }
+  }
+
+  BankHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.byteOrder = kByteOrder;
+  header.schemaCount = uint32_t(schema.size());
+  header.fieldCount = fieldCount;
+  header.recordCount = uint32_t(records.size());
+  uint32_t bitmapWords = (header.schemaCount + 31) / 32;
+  header.recordSize = 4 * (bitmapWords + fieldCount);
+  header.schemaOffset = sizeof(header);
+  header.indexOffset =
+      header.schemaOffset + schema.size() * sizeof(BankSchemaEntry);
+  header.recordsOffset =
+      header.indexOffset + records.size() * sizeof(BankIndexEntry);
+  header.stringsOffset =
+      header.recordsOffset + uint64_t(records.size()) * header.recordSize;
+
+  StringTable strings;
+  std::vector<char> data(header.stringsOffset);
+  for (size_t i = 0; i < schema.size(); i++) {
+    BankSchemaEntry entry{strings.add(schema[i].address),
+                          strings.add(schema[i].types), schema[i].firstField,
+                          uint32_t(schema[i].types.size())};
+    std::memcpy(data.data() + header.schemaOffset + i * sizeof(entry), &entry,
+                sizeof(entry));
+  }
+  std::vector<uint32_t> slots(header.recordSize / 4);
+  for (size_t i = 0; i < records.size(); i++) {
+    OutputRecord &record = records[i];
+    BankIndexEntry entry{int32_t(record.index), strings.add(record.name)};
+    std::memcpy(data.data() + header.indexOffset + i * sizeof(entry), &entry,
+                sizeof(entry));
+
+    std::fill(slots.begin(), slots.end(), 0);
+    uint32_t *bitmap = slots.data();
+    uint32_t *fields = slots.data() + bitmapWords;
+    if (record.oldRecord >= 0) {
+      // Bitmap and fields keep their positions, only strings move
+      const char *old = recordData(uint32_t(record.oldRecord));
+      std::memcpy(bitmap, old, 4 * mBitmapWords);
+      std::memcpy(fields, old + 4 * mBitmapWords, 4 * size_t(mFieldCount));
+      for (uint32_t s = 0; s < mSchema.size(); s++) {
+        if (!(bitmap[s / 32] & (1u << (s % 32)))) {
+          continue;
+        }
+        for (size_t f = 0; f < mSchema[s].types.size(); f++) {
+          if (mSchema[s].types[f] == 's') {
+            uint32_t &slot = fields[mSchema[s].firstField + f];
+            slot = strings.add(readString(slot));
+          }
+        }
+      }
+    } else if (record.values) {
+      for (auto &value : *record.values) {
+        uint32_t s = schemaIndex[value.first];
+        bitmap[s / 32] |= 1u << (s % 32);
+        for (size_t f = 0; f < value.second.size(); f++) {
+          fields[schema[s].firstField + f] =
+              encodeField(value.second[f], schema[s].types[f], strings);
+        }
+      }
+    }
+    std::memcpy(data.data() + header.recordsOffset + i * header.recordSize,
+                slots.data(), header.recordSize);
+  }
+  header.stringsSize = strings.data.size();
+  std::memcpy(data.data(), &header, sizeof(header));
+  data.insert(data.end(), strings.data.begin(), strings.data.end());
+
+  // The file can't be replaced while it is mapped on Windows
+  clear();
+  bool ok = File::writeAtomic(mFileName, data.data(), data.size());
+  if (!ok) {
+    std::cerr << "ERROR: Could not write preset bank " << mFileName
+              << std::endl;
+  }
+  if (File::exists(mFileName) && !(mFile.open(mFileName) && readIndex())) {
+    std::cerr << "ERROR: Could not read preset bank " << mFileName
+              << std::endl;
+    clear();
+    ok = false;
+  }
+  mGeneration++;
+  return ok;
+}
@@ -2,6 +2,7 @@
 #include "al/ui/al_PresetHandler.hpp"
 
 #include <cassert>
+#include <chrono>
 #include <cstring>
 #include <fstream>
 #include <iostream>
@@ -204,9 +205,25 @@ void PresetHandler::storePreset(int index, std::string name, bool overwrite) {
     }
   }
 
-  savePresetValues(values, name, overwrite);
-  mPresetsMap[index] = name;
-  storeCurrentPresetMap();
+  if (mBank) {
+    // The bank holds the preset map, store the preset with its index in a
+    // single write
+    std::string presetName = name;
+    int number = 0;
+    while (!overwrite && mBank->has(name)) {
+      name = presetName + "_" + std::to_string(number);
+      number++;
+    }
+    if (!mBank->store(name, values, index) && mVerbose) {
+      std::cout << "Error while writing preset to bank: " << mBank->fileName()
+                << std::endl;
+    }
+    mPresetsMap = mBank->presetMap();
+  } else {
+    savePresetValues(values, name, overwrite);
+    mPresetsMap[index] = name;
+    storeCurrentPresetMap();
+  }
   mCurrentPresetName = name;
   mFileLock.unlock();
 
@@ -242,9 +259,15 @@ void PresetHandler::recallPreset(std::string name) {
 void PresetHandler::setInterpolatedPreset(std::string presetName1,
                                           std::string presetName2,
                                           double factor) {
-  ParameterStates values1 = loadPresetValues(presetName1);
-  ParameterStates values2 = loadPresetValues(presetName2);
-  setInterpolatedValues(values1, values2, factor);
+  auto values1 = cachedPresetValues(presetName1);
+  auto values2 = cachedPresetValues(presetName2);
+  std::lock_guard<std::mutex> lk(mInterpolationLock);
+  if (values1 != mInterpolationStart || values2 != mInterpolationEnd) {
+    compileMorphPlan(*values1, *values2, mInterpolationPlan, true);
+    mInterpolationStart = values1;
+    mInterpolationEnd = values2;
+  }
+  mInterpolationPlan.apply(factor);
 }
 
 void PresetHandler::setInterpolatedPreset(int index1, int index2,
@@ -299,6 +322,7 @@ void PresetHandler::morphTo(ParameterStates &parameterStates, float morphTime) {
       processBundleGroup(bundleGroup.second, prefix);
     }
 
+    compileMorphPlan(mStartValues, mTargetValues, mMorphPlan, false);
     mMorphStepCount = 0;
     if (mMorphTime.get() <= 0.0) {
       mTotalSteps.store(1);
@@ -469,6 +493,7 @@ std::string PresetHandler::getPresetName(int index) {
 }
 
 void PresetHandler::skipParameter(std::string parameterAddr, bool skip) {
+  invalidateInterpolationPlan();
   std::unique_lock<std::mutex> lk(mSkipParametersLock);
   if (skip) {
     if (std::find(mSkipParameters.begin(), mSkipParameters.end(),
@@ -544,6 +569,7 @@ void PresetHandler::print() {
 
 PresetHandler &PresetHandler::registerParameter(ParameterMeta &parameter) {
   mParameters.push_back(&parameter);
+  invalidateInterpolationPlan();
   return *this;
 }
 
@@ -552,17 +578,25 @@ PresetHandler &PresetHandler::registerParameterBundle(ParameterBundle &bundle) {
     mBundles[bundle.name()] = std::vector<ParameterBundle *>();
   }
   mBundles[bundle.name()].push_back(&bundle);
+  invalidateInterpolationPlan();
   return *this;
 }
 
 std::map<int, std::string> PresetHandler::readPresetMap(std::string mapName) {
+  if (mBank) {
+    return mBank->presetMap();
+  }
+  return readPresetMapFile(buildMapPath(mapName, true), mVerbose);
+}
+
+std::map<int, std::string>
+PresetHandler::readPresetMapFile(std::string fileName, bool verbose) {
   std::map<int, std::string> presetsMap;
-  std::string mapFullPath = buildMapPath(mapName, true);
-  std::ifstream f(mapFullPath);
+  std::ifstream f(fileName);
   if (!f.is_open()) {
-    if (mVerbose) {
+    if (verbose) {
       std::cout << "Error while opening preset map file for reading: "
-                << mapFullPath << std::endl;
+                << fileName << std::endl;
     }
     return presetsMap;
   }
@@ -572,7 +606,7 @@ std::map<int, std::string> PresetHandler::readPresetMap(std::string mapName) {
       continue;
     }
     if (line.substr(0, 2) == "::") {
-      if (mVerbose) {
+      if (verbose) {
         std::cout << "End preset map." << std::endl;
       }
       break;
@@ -585,17 +619,49 @@ std::map<int, std::string> PresetHandler::readPresetMap(std::string mapName) {
     //			std::cout << index << ":" << name << std::endl;
   }
   if (f.bad()) {
-    if (mVerbose) {
+    if (verbose) {
       std::cout << "Error while opening preset map file for reading: "
-                << mapFullPath << std::endl;
+                << fileName << std::endl;
     }
   }
   return presetsMap;
 }
 
+bool PresetHandler::writePresetMapFile(
+    std::string fileName, const std::map<int, std::string> &presetsMap) {
+  std::ostringstream f;
+  for (auto const &preset : presetsMap) {
+    std::string line = std::to_string(preset.first) + ":" + preset.second;
+    f << line << std::endl;
+  }
+  f << "::" << std::endl;
+  std::string text = f.str();
+  return File::writeAtomic(fileName, text.data(), text.size());
+}
+
+bool PresetHandler::usePresetBank(std::string fileName) {
+  {
+    std::lock_guard<std::mutex> lock(mFileLock);
+    if (fileName.size() > 0) {
+      std::unique_ptr<PresetBank> bank = std::make_unique<PresetBank>();
+      if (!bank->open(fileName)) {
+        return false;
+      }
+      mBank = std::move(bank);
+    } else {
+      mBank.reset();
+    }
+  }
+  clearPresetCache();
+  setCurrentPresetMap(mCurrentMapName.size() > 0 ? mCurrentMapName
+                                                 : "default");
+  return true;
+}
+
 void PresetHandler::setCurrentPresetMap(std::string mapName, bool autoCreate) {
   std::string mapFullPath = buildMapPath(mapName, true);
-  if (autoCreate && !File::exists(mapFullPath) &&
+  // A bank always holds its preset map
+  if (autoCreate && !mBank && !File::exists(mapFullPath) &&
       !File::isDirectory(mapFullPath)) {
     std::cout << "No preset map. Creating default." << std::endl;
     std::vector<std::string> presets;
@@ -795,123 +861,169 @@ void PresetHandler::storeCurrentPresetMap(std::string mapName,
   if (mapName.size() > 0) {
     mCurrentMapName = mapName;
   }
-  std::string mapFullPath = buildMapPath(mCurrentMapName, useSubDirectory);
-  std::ofstream f(mapFullPath);
-  if (!f.is_open()) {
-    if (mVerbose) {
-      std::cout << "Error while opening preset map file: " << mapFullPath
-                << std::endl;
+  if (mBank) {
+    if (!mBank->setPresetMap(mPresetsMap) && mVerbose) {
+      std::cout << "Error while writing preset map to bank: "
+                << mBank->fileName() << std::endl;
     }
     return;
   }
-  for (auto const &preset : mPresetsMap) {
-    std::string line = std::to_string(preset.first) + ":" + preset.second;
-    f << line << std::endl;
-  }
-  f << "::" << std::endl;
-  if (f.bad()) {
+  std::string mapFullPath = buildMapPath(mCurrentMapName, useSubDirectory);
+  if (!writePresetMapFile(mapFullPath, mPresetsMap)) {
     if (mVerbose) {
       std::cout << "Error while writing preset map file: " << mapFullPath
                 << std::endl;
     }
   }
-  f.close();
 }
 
 void PresetHandler::setInterpolatedValues(ParameterStates &startValues,
                                           ParameterStates &endValues,
                                           double factor) {
-  for (auto startValue : startValues) {
-    std::vector<ParameterField> interpValues;
-    for (auto endValue : endValues) {
-      if (startValue.first == endValue.first) {
-        assert(startValue.second.size() == endValue.second.size());
-        if (factor != 1.0) {
-          for (size_t i = 0; i < endValue.second.size(); i++) {
-            if (startValue.second[i].type() != endValue.second[i].type()) {
-              if (startValue.second[i].type() == ParameterField::FLOAT &&
-                  endValue.second[i].type() == ParameterField::INT32) {
-                endValue.second[i] =
-                    ParameterField(float(endValue.second[i].get<int32_t>()));
-              } else if (endValue.second[i].type() == ParameterField::FLOAT &&
-                         startValue.second[i].type() == ParameterField::INT32) {
-                startValue.second[i] =
-                    ParameterField(float(startValue.second[i].get<int32_t>()));
-              } else {
-                std::cerr << "Parameter data type mismatch. Aborting."
-                          << std::endl;
-                return;
-              }
-            }
-            if (startValue.second[i].type() == ParameterField::FLOAT) {
-              interpValues.push_back(ParameterField(
-                  startValue.second[i].get<float>() +
-                  (factor * (endValue.second[i].get<float>() -
-                             startValue.second[i].get<float>()))));
-            } else if (startValue.second[i].type() == ParameterField::INT32) {
-              float value =
-                  startValue.second[i].get<int32_t>() +
-                  (factor * (endValue.second[i].get<int32_t>() -
-                             (float)startValue.second[i].get<int32_t>()));
-              interpValues.push_back(ParameterField((int32_t)value));
-            } else if (startValue.second[i].type() == ParameterField::STRING) {
-              interpValues.push_back(endValue.second[i]);
-            }
-          }
-        } else {
-          assert(startValue.second.size() == endValue.second.size());
-          for (size_t i = 0; i < endValue.second.size(); i++) {
-            if (startValue.second[i].type() == ParameterField::FLOAT &&
-                endValue.second[i].type() == ParameterField::INT32) {
-              endValue.second[i] =
-                  ParameterField(float(endValue.second[i].get<int32_t>()));
-            } else if (endValue.second[i].type() == ParameterField::FLOAT &&
-                       startValue.second[i].type() == ParameterField::INT32) {
-              endValue.second[i] =
-                  ParameterField(int32_t(endValue.second[i].get<float>()));
-            }
-          }
-          interpValues = endValue.second;
-        }
+  MorphPlan plan;
+  compileMorphPlan(startValues, endValues, plan, false);
+  plan.apply(factor);
+}
 
-        for (auto *param : mParameters) {
-          if (param->getFullAddress() == startValue.first &&
-              interpValues.size() > 0) {
-            param->setFields(interpValues);
-            break;
+std::map<std::string, ParameterMeta *> PresetHandler::parameterAddresses() {
+  std::map<std::string, ParameterMeta *> addresses;
+  for (auto *param : mParameters) {
+    addresses.insert({param->getFullAddress(), param});
+  }
+  std::function<void(std::vector<ParameterBundle *>, std::string)>
+      processBundleGroup = [&](std::vector<ParameterBundle *> bundles,
+                               std::string prefix) {
+        for (unsigned int i = 0; i < bundles.size(); i++) {
+          std::string bundlePrefix = prefix + std::to_string(i);
+          for (auto *param : bundles.at(i)->parameters()) {
+            addresses.insert({bundlePrefix + param->getFullAddress(), param});
+          }
+          for (auto bundleGroup : bundles.at(i)->bundles()) {
+            prefix += "/" + bundleGroup.first + "/";
+            processBundleGroup({bundleGroup.second}, prefix);
           }
         }
+      };
+  for (auto bundleGroup : mBundles) {
+    std::string prefix = "/" + bundleGroup.first + "/";
+    processBundleGroup(bundleGroup.second, prefix);
+  }
+  return addresses;
+}
 
-        std::function<void(std::vector<ParameterBundle *>, std::string)>
-            processBundleGroup = [&](std::vector<ParameterBundle *> bundles,
-                                     std::string prefix) {
-              for (unsigned int i = 0; i < bundles.size(); i++) {
-                std::string bundlePrefix = prefix + std::to_string(i);
-                for (auto *param : bundles.at(i)->parameters()) {
-                  if (bundlePrefix + param->getFullAddress() ==
-                          startValue.first &&
-                      interpValues.size() > 0) {
-                    param->setFields(interpValues);
-                    break;
-                  }
-                }
-                for (auto bundleGroup : bundles.at(i)->bundles()) {
-                  prefix += "/" + bundleGroup.first + "/";
-                  processBundleGroup({bundleGroup.second}, prefix);
-                }
-              }
-            };
-
-        for (auto bundleGroup : mBundles) {
-          std::string prefix = "/" + bundleGroup.first + "/";
-          processBundleGroup(bundleGroup.second, prefix);
+void PresetHandler::compileMorphPlan(const ParameterStates &startValues,
+                                     const ParameterStates &endValues,
+                                     MorphPlan &plan, bool useSkipList) {
+  plan.targets.clear();
+  plan.startValues.clear();
+  plan.endValues.clear();
+  auto addresses = parameterAddresses();
+  std::unique_lock<std::mutex> lk(mSkipParametersLock, std::defer_lock);
+  if (useSkipList) {
+    lk.lock();
+  }
+  for (auto &startValue : startValues) {
+    auto endValue = endValues.find(startValue.first);
+    auto address = addresses.find(startValue.first);
+    if (endValue == endValues.end() || address == addresses.end()) {
+      continue;
+    }
+    if (useSkipList &&
+        std::find(mSkipParameters.begin(), mSkipParameters.end(),
+                  startValue.first) != mSkipParameters.end()) {
+      continue;
+    }
+    // Fields are copied as the accessors of ParameterField are not const
+    std::vector<ParameterField> start = startValue.second;
+    std::vector<ParameterField> end = endValue->second;
+    if (start.size() != end.size() || start.size() == 0) {
+      std::cerr << "Parameter field count mismatch for " << startValue.first
+                << ". Ignoring." << std::endl;
+      continue;
+    }
+    MorphPlan::Target target;
+    target.param = address->second;
+    target.floatParameter = nullptr;
+    target.offset = plan.startValues.size();
+    target.count = start.size();
+    bool valid = true;
+    for (size_t i = 0; i < start.size(); i++) {
+      auto startType = start[i].type();
+      auto endType = end[i].type();
+      if (startType == ParameterField::STRING ||
+          endType == ParameterField::STRING) {
+        if (startType != endType) {
+          valid = false;
+          break;
         }
+        // Strings jump to the end value
+        target.fields.push_back(end[i]);
+        plan.startValues.push_back(0.0f);
+        plan.endValues.push_back(0.0f);
         continue;
       }
+      if (startType == ParameterField::NULLDATA ||
+          endType == ParameterField::NULLDATA) {
+        valid = false;
+        break;
+      }
+      plan.startValues.push_back(startType == ParameterField::INT32
+                                     ? float(start[i].get<int32_t>())
+                                     : start[i].get<float>());
+      plan.endValues.push_back(endType == ParameterField::INT32
+                                   ? float(end[i].get<int32_t>())
+                                   : end[i].get<float>());
+      // Values are set with the type of the start state
+      target.fields.push_back(start[i]);
+    }
+    if (!valid) {
+      std::cerr << "Parameter data type mismatch for " << startValue.first
+                << ". Ignoring." << std::endl;
+      plan.startValues.resize(target.offset);
+      plan.endValues.resize(target.offset);
+      continue;
+    }
+    if (target.count == 1 && target.fields[0].type() == ParameterField::FLOAT) {
+      target.floatParameter = dynamic_cast<Parameter *>(target.param);
+    }
+    plan.targets.push_back(std::move(target));
+  }
+  plan.values.resize(plan.startValues.size());
+}
+
+void PresetHandler::MorphPlan::apply(double factor) {
+  const float endWeight = float(factor);
+  const float startWeight = 1.0f - endWeight;
+  const float *start = startValues.data();
+  const float *end = endValues.data();
+  float *current = values.data();
+  const size_t size = values.size();
+  for (size_t i = 0; i < size; i++) {
+    current[i] = startWeight * start[i] + endWeight * end[i];
+  }
+  for (auto &target : targets) {
+    if (target.floatParameter) {
+      target.floatParameter->set(current[target.offset]);
+      continue;
+    }
+    for (size_t i = 0; i < target.count; i++) {
+      auto &field = target.fields[i];
+      if (field.type() == ParameterField::FLOAT) {
+        field.set<float>(current[target.offset + i]);
+      } else if (field.type() == ParameterField::INT32) {
+        field.set<int32_t>(int32_t(current[target.offset + i]));
+      }
     }
+    target.param->setFields(target.fields);
   }
 }
 
+void PresetHandler::invalidateInterpolationPlan() {
+  std::lock_guard<std::mutex> lk(mInterpolationLock);
+  mInterpolationStart = nullptr;
+  mInterpolationEnd = nullptr;
+}
+
 void PresetHandler::stepMorphing() {
   uint64_t totalSteps = mTotalSteps.load();
   uint64_t stepCount = mMorphStepCount.fetch_add(1);
@@ -921,7 +1033,7 @@ void PresetHandler::stepMorphing() {
       morphPhase = 1.0;
     }
     std::lock_guard<std::mutex> lk(mTargetLock);
-    setInterpolatedValues(mStartValues, mTargetValues, morphPhase);
+    mMorphPlan.apply(morphPhase);
   }
 }
 
@@ -953,24 +1065,130 @@ PresetHandler::getBundleStates(ParameterBundle *bundle, std::string id) {
 
 PresetHandler::ParameterStates
 PresetHandler::loadPresetValues(std::string name) {
+  auto values = cachedPresetValues(name);
   ParameterStates preset;
+  std::lock_guard<std::mutex> lock(mSkipParametersLock); // Protect skip list
+  for (auto &value : *values) {
+    if (std::find(mSkipParameters.begin(), mSkipParameters.end(),
+                  value.first) == mSkipParameters.end()) {
+      preset.insert(value);
+    }
+  }
+  return preset;
+}
+
+void PresetHandler::clearPresetCache() {
+  std::lock_guard<std::mutex> lock(mPresetCacheLock);
+  mPresetCache.clear();
+}
+
+std::shared_ptr<const PresetHandler::ParameterStates>
+PresetHandler::cachedPresetValues(std::string name) {
   std::lock_guard<std::mutex> lock(mFileLock); // Protect loading and saving
-  std::lock_guard<std::mutex> lock2(mSkipParametersLock); // Protect skip list
+  if (mBank) {
+    // The bank is only written through this class, so its generation tells
+    // whether a cached preset is current
+    std::string key = "bank:" + name;
+    uint64_t generation = mBank->generation();
+    {
+      std::lock_guard<std::mutex> cacheLock(mPresetCacheLock);
+      auto cached = mPresetCache.find(key);
+      if (cached != mPresetCache.end() &&
+          cached->second.generation == generation) {
+        return cached->second.values;
+      }
+    }
+    auto values = std::make_shared<ParameterStates>();
+    if (!mBank->load(name, *values) && mVerbose) {
+      std::cout << "Preset not found in bank: " << name << std::endl;
+    }
+    std::lock_guard<std::mutex> cacheLock(mPresetCacheLock);
+    CachedPreset &cached = mPresetCache[key];
+    cached.generation = generation;
+    cached.values = values;
+    return values;
+  }
   std::string path = getCurrentPath();
   if (path.back() != '/') {
     path += "/";
   }
-  std::string line;
-  std::ifstream f(path + name + ".preset");
-  if (!f.is_open()) {
+  std::string fileName = path + name + ".preset";
+  // Taken before reading, so a change during the read shows up next time
+  File::Stamp stamp = File::stamp(fileName);
+  std::shared_ptr<const ParameterStates> values;
+  std::string text;
+  {
+    std::lock_guard<std::mutex> cacheLock(mPresetCacheLock);
+    auto cached = mPresetCache.find(fileName);
+    if (cached != mPresetCache.end() && cached->second.stamp == stamp) {
+      if (cached->second.settled) {
+        return cached->second.values;
+      }
+      values = cached->second.values;
+      text = cached->second.text;
+    }
+  }
+  if (stamp.size < 0) {
     if (mVerbose) {
-      std::cout << "Error while opening preset file: "
-                << path + name + ".preset" << std::endl;
+      std::cout << "Error while opening preset file: " << fileName
+                << std::endl;
+    }
+    std::lock_guard<std::mutex> cacheLock(mPresetCacheLock);
+    mPresetCache.erase(fileName);
+    return std::make_shared<const ParameterStates>();
+  }
+  std::ifstream f(fileName, std::ios::binary);
+  std::string newText((std::istreambuf_iterator<char>(f)),
+                      std::istreambuf_iterator<char>());
+  if (!values || newText != text) {
+    std::istringstream stream(newText);
+    values = std::make_shared<const ParameterStates>(
+        parsePreset(stream, mVerbose));
+  }
+  // A file rewritten within the resolution of its modification time keeps
+  // the same stamp, so entries for recently modified files keep their text
+  // and are compared against the file until they are older than any file
+  // system's timestamp resolution.
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch())
+                    .count();
+  const int64_t kSettleTime = 2000000000; // FAT has 2 s resolution
+  std::lock_guard<std::mutex> cacheLock(mPresetCacheLock);
+  CachedPreset &cached = mPresetCache[fileName];
+  cached.stamp = stamp;
+  cached.settled = now - stamp.modified > kSettleTime;
+  cached.text = cached.settled ? std::string() : std::move(newText);
+  cached.values = values;
+  return values;
+}
+
+PresetHandler::ParameterStates
+PresetHandler::readPresetFile(std::string fileName, bool verbose) {
+  std::ifstream f(fileName);
+  if (!f.is_open()) {
+    if (verbose) {
+      std::cout << "Error while opening preset file: " << fileName
+                << std::endl;
+    }
+  }
+  ParameterStates preset = parsePreset(f, verbose);
+  if (f.bad()) {
+    if (verbose) {
+      std::cout << "Error while writing preset file: " << fileName
+                << std::endl;
     }
   }
+  f.close();
+  return preset;
+}
+
+PresetHandler::ParameterStates PresetHandler::parsePreset(std::istream &f,
+                                                          bool verbose) {
+  ParameterStates preset;
+  std::string line;
   while (getline(f, line)) {
     if (line.substr(0, 2) == "::") {
-      if (mVerbose) {
+      if (verbose) {
         std::cout << "Found preset : " << line << std::endl;
       }
       while (getline(f, line)) {
@@ -978,7 +1196,7 @@ PresetHandler::loadPresetValues(std::string name) {
           continue;
         }
         if (line.substr(0, 2) == "::") {
-          if (mVerbose) {
+          if (verbose) {
             std::cout << "End preset." << std::endl;
           }
           break;
@@ -1007,10 +1225,7 @@ PresetHandler::loadPresetValues(std::string name) {
           ++currentType;
         }
 
-        if (address.size() > 0 && address[0] != '#' && type.size() > 0 &&
-            std::find(mSkipParameters.begin(), mSkipParameters.end(),
-                      address) == mSkipParameters.end()) {
-          // Address is not in ignore list, so add to values loaded
+        if (address.size() > 0 && address[0] != '#' && type.size() > 0) {
           // Should we make sure the address corresponds to an existing
           // preset?
           preset[address] = values;
@@ -1018,38 +1233,13 @@ PresetHandler::loadPresetValues(std::string name) {
       }
     }
   }
-  if (f.bad()) {
-    if (mVerbose) {
-      std::cout << "Error while writing preset file: "
-                << path + name + ".preset" << std::endl;
-    }
-  }
-  f.close();
   return preset;
 }
 
-bool PresetHandler::savePresetValues(const ParameterStates &values,
-                                     std::string presetName, bool overwrite) {
-  bool ok = true;
-  std::string path = getCurrentPath();
-  std::string fileName = path + presetName + ".preset";
-  std::ifstream infile(fileName);
-  int number = 0;
-  while (infile.good() && !overwrite) {
-    fileName = path + presetName + "_" + std::to_string(number) + ".preset";
-    infile.close();
-    infile.open(fileName);
-    number++;
-  }
-  infile.close();
-  std::ofstream f(fileName);
-  if (!f.is_open()) {
-    if (mVerbose) {
-      std::cout << "Error while opening preset file fro write: " << fileName
-                << std::endl;
-    }
-    return false;
-  }
+bool PresetHandler::writePresetFile(std::string fileName,
+                                    std::string presetName,
+                                    const ParameterStates &values) {
+  std::ostringstream f;
   f << "::" + presetName << std::endl;
   for (auto value : values) {
     std::string types, valueString;
@@ -1070,13 +1260,49 @@ bool PresetHandler::savePresetValues(const ParameterStates &values,
     f << line << std::endl;
   }
   f << "::" << std::endl;
-  if (f.bad()) {
+  std::string text = f.str();
+  return File::writeAtomic(fileName, text.data(), text.size());
+}
+
+bool PresetHandler::savePresetValues(const ParameterStates &values,
+                                     std::string presetName, bool overwrite) {
+  bool ok = true;
+  if (mBank) {
+    std::string name = presetName;
+    int number = 0;
+    while (!overwrite && mBank->has(name)) {
+      name = presetName + "_" + std::to_string(number);
+      number++;
+    }
+    ok = mBank->store(name, values);
+    if (!ok && mVerbose) {
+      std::cout << "Error while writing preset to bank: " << mBank->fileName()
+                << std::endl;
+    }
+    return ok;
+  }
+  std::string path = getCurrentPath();
+  std::string fileName = path + presetName + ".preset";
+  std::ifstream infile(fileName);
+  int number = 0;
+  while (infile.good() && !overwrite) {
+    fileName = path + presetName + "_" + std::to_string(number) + ".preset";
+    infile.close();
+    infile.open(fileName);
+    number++;
+  }
+  infile.close();
+  // Written to a temporary file and renamed, so a preset being read is
+  // either the old or the new one, never a partial file
+  if (!writePresetFile(fileName, presetName, values)) {
     if (mVerbose) {
       std::cout << "Error while writing preset file: " << fileName << std::endl;
     }
     ok = false;
   }
-  f.close();
+  // The modification time might not change if the file is rewritten within
+  // its resolution, so don't rely on it. Stores are rare, drop everything.
+  clearPresetCache();
   return ok;
 }
 
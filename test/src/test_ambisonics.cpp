@@ -0,0 +1,220 @@
+#include "catch.hpp"
+
+#include <cmath>
+#include <vector>
+
+#include "al/sound/al_Ambisonics.hpp"
+
+using namespace al;
+
+namespace {
+
+// Exposes the per order decode weights
+class OrderWeightDecode : public AmbiDecode {
+public:
+  using AmbiDecode::AmbiDecode;
+  float orderWeight(int order) const { return mWOrder[order]; }
+};
+
+} // namespace
+
+TEST_CASE("Ambisonics channel counts") {
+  for (int order = 0; order <= AMBI_MAX_ORDER; order++) {
+    REQUIRE(AmbiBase::channelsToOrder(2, AmbiBase::orderToChannels(2, order)) ==
+            order);
+    REQUIRE(AmbiBase::channelsToOrder(3, AmbiBase::orderToChannels(3, order)) ==
+            order);
+  }
+  // 9 channels are second order in 3D and fourth order in 2D
+  REQUIRE(AmbiBase::channelsToOrder(3, 9) == 2);
+  REQUIRE(AmbiBase::channelsToOrder(2, 9) == 4);
+  REQUIRE(AmbiBase::channelsToOrder(3, 10) == -1);
+  REQUIRE(AmbiBase::channelsToOrder(2, 10) == -1);
+  REQUIRE(AmbiBase::channelsToOrder(3, 0) == -1);
+  REQUIRE(AmbiBase::channelsToOrder(3, (AMBI_MAX_ORDER + 2) *
+                                           (AMBI_MAX_ORDER + 2)) == -1);
+
+  REQUIRE(AmbiBase::channelsToOrder(3) == 1);
+  REQUIRE(AmbiBase::channelsToOrder(9) == 2);
+  REQUIRE(AmbiBase::channelsToDimensions(3) == 2);
+  REQUIRE(AmbiBase::channelsToDimensions(16) == 3);
+  REQUIRE(AmbiBase::channelsToDimensions(25) == -1);
+}
+
+TEST_CASE("Ambisonics encode weights") {
+  float weights[AMBI_MAX_CHANNELS];
+  float fuma[AMBI_MAX_CHANNELS];
+  const float azimuth = 0.7f;
+  const float elevation = 0.3f;
+  const float x = std::cos(azimuth) * std::cos(elevation);
+  const float y = std::sin(azimuth) * std::cos(elevation);
+  const float z = std::sin(elevation);
+
+  // Up to third order the weights are FuMa
+  for (int dim = 2; dim <= 3; dim++) {
+    for (int order = 0; order <= 3; order++) {
+      AmbiBase::encodeWeights(weights, dim, order, x, y, z);
+      AmbiBase::encodeWeightsFuMa(fuma, dim, order, x, y, z);
+      for (int c = 0; c < AmbiBase::orderToChannels(dim, order); c++) {
+        REQUIRE(weights[c] == fuma[c]);
+      }
+    }
+  }
+
+  // Higher orders in 3D are ACN/SN3D
+  AmbiBase::encodeWeights(weights, 3, AMBI_MAX_ORDER, x, y, z);
+  REQUIRE(weights[0] == Approx(1.0f));
+  REQUIRE(weights[1] == Approx(y));
+  REQUIRE(weights[2] == Approx(z));
+  REQUIRE(weights[3] == Approx(x));
+  REQUIRE(weights[6] == Approx(0.5f * (3.0f * z * z - 1.0f)));
+  REQUIRE(weights[8] == Approx(std::sqrt(3.0f) / 2.0f * (x * x - y * y)));
+  // The SN3D harmonics of each order have unit energy in any direction
+  for (int l = 0; l <= AMBI_MAX_ORDER; l++) {
+    double energy = 0.0;
+    for (int c = l * l; c < (l + 1) * (l + 1); c++) {
+      energy += double(weights[c]) * weights[c];
+    }
+    REQUIRE(energy == Approx(1.0).epsilon(1e-4));
+  }
+  float fromAngles[AMBI_MAX_CHANNELS];
+  AmbiBase::encodeWeights(fromAngles, 3, AMBI_MAX_ORDER, azimuth, elevation);
+  for (int c = 0; c < AmbiBase::orderToChannels(3, AMBI_MAX_ORDER); c++) {
+    REQUIRE(fromAngles[c] == Approx(weights[c]).margin(1e-4));
+  }
+
+  // Higher orders in 2D are W followed by cos(mA), sin(mA) pairs
+  AmbiBase::encodeWeights(weights, 2, 7, azimuth, 0.0f);
+  REQUIRE(weights[0] == 1.0f);
+  for (int m = 1; m <= 7; m++) {
+    REQUIRE(weights[2 * m - 1] == Approx(std::cos(m * azimuth)).margin(1e-5));
+    REQUIRE(weights[2 * m] == Approx(std::sin(m * azimuth)).margin(1e-5));
+  }
+
+  AmbiEncode encoder(3, 5);
+  REQUIRE(encoder.channels() == 36);
+  encoder.direction(x, y, z);
+  AmbiBase::encodeWeights(weights, 3, 5, x, y, z);
+  for (int c = 0; c < encoder.channels(); c++) {
+    REQUIRE(encoder.weights()[c] == weights[c]);
+  }
+}
+
+TEST_CASE("Ambisonics decode flavor weights") {
+  // The table up to fourth order is used as is
+  OrderWeightDecode tableDecoder(3, 4, 8, 2);
+  REQUIRE(tableDecoder.orderWeight(1) == Approx(0.667f));
+  REQUIRE(tableDecoder.orderWeight(4) == Approx(0.008f));
+
+  const int M = 5;
+  OrderWeightDecode decoder(3, M, 8, 0);
+  for (int l = 0; l <= M; l++) {
+    REQUIRE(decoder.orderWeight(l) == 1.0f);
+  }
+  REQUIRE(decoder.orderWeight(M + 1) == 0.0f);
+
+  // In-phase: M! (M + 1)! / ((M + l + 1)! (M - l)!) in 3D
+  decoder.flavor(2);
+  REQUIRE(decoder.orderWeight(0) == Approx(1.0f));
+  REQUIRE(decoder.orderWeight(1) == Approx(5.0f / 7.0f));
+  REQUIRE(decoder.orderWeight(2) == Approx(20.0f / 56.0f));
+  REQUIRE(decoder.orderWeight(5) == Approx(120.0f / (7 * 8 * 9 * 10 * 11)));
+
+  // Max-rE: Legendre polynomials at cos(137.9 deg / (M + 1.51)) in 3D
+  const double rE = std::cos(137.9 * M_PI / 180.0 / (M + 1.51));
+  decoder.flavor(3);
+  REQUIRE(decoder.orderWeight(0) == Approx(1.0f));
+  REQUIRE(decoder.orderWeight(1) == Approx(rE));
+  REQUIRE(decoder.orderWeight(2) == Approx(0.5 * (3.0 * rE * rE - 1.0)));
+  // The default flavor uses max-rE above the table
+  decoder.flavor(1);
+  REQUIRE(decoder.orderWeight(1) == Approx(rE));
+
+  // In 2D: M!^2 / ((M + l)! (M - l)!) and cos(l pi / (2M + 2))
+  OrderWeightDecode decoder2D(2, M, 12, 2);
+  REQUIRE(decoder2D.orderWeight(1) == Approx(5.0f / 6.0f));
+  REQUIRE(decoder2D.orderWeight(2) == Approx(20.0f / 42.0f));
+  decoder2D.flavor(3);
+  for (int l = 0; l <= M; l++) {
+    REQUIRE(decoder2D.orderWeight(l) ==
+            Approx(std::cos(l * M_PI / (2 * M + 2))));
+  }
+
+  // Each order's channel weights are scaled by its number of harmonics and
+  // by the number of speakers
+  decoder.flavor(2);
+  for (int l = 0; l <= M; l++) {
+    for (int c = l * l; c < (l + 1) * (l + 1); c++) {
+      REQUIRE(decoder.weights()[c] ==
+              Approx((2 * l + 1) * decoder.orderWeight(l) / 8.0f));
+    }
+  }
+  decoder2D.flavor(0);
+  REQUIRE(decoder2D.weights()[0] == Approx(1.0f / 12.0f));
+  REQUIRE(decoder2D.weights()[2 * M] == Approx(2.0f / 12.0f));
+}
+
+TEST_CASE("Ambisonics decode") {
+  // Uniform ring of speakers
+  const int order = 5;
+  const int numSpeakers = 14;
+  const int numFrames = 37; // Exercises the SIMD remainder loops
+  AmbiDecode decoder(2, order, numSpeakers, 0);
+  for (int s = 0; s < numSpeakers; s++) {
+    decoder.setSpeaker(s, s, 360.0f * s / numSpeakers);
+  }
+  AmbiEncode encoder(2, order);
+  const int channels = encoder.channels();
+  REQUIRE(decoder.channels() == channels);
+
+  std::vector<float> ambi(channels * numFrames, 0.0f);
+  std::vector<float> input(numFrames);
+  for (int i = 0; i < numFrames; i++) {
+    input[i] = std::sin(0.3f * i);
+  }
+  const int sourceSpeaker = 3;
+  encoder.direction(2.0f * float(M_PI) * sourceSpeaker / numSpeakers, 0.0f);
+  encoder.encode(ambi.data(), input.data(), numFrames);
+
+  std::vector<float> output(numSpeakers * numFrames, 0.0f);
+  decoder.decode(output.data(), ambi.data(), numFrames);
+  for (int s = 0; s < numSpeakers; s++) {
+    for (int i = 0; i < numFrames; i++) {
+      float expected = 0.0f;
+      for (int c = 0; c < channels; c++) {
+        expected += decoder.decodeWeight(s, c) * ambi[c * numFrames + i];
+      }
+      REQUIRE(output[s * numFrames + i] == Approx(expected).margin(1e-5));
+    }
+  }
+  // The speakers add up to the source and the loudest is the one it points
+  // at, with 2M + 1 parts of the N speakers' total
+  for (int i = 0; i < numFrames; i++) {
+    float sum = 0.0f;
+    for (int s = 0; s < numSpeakers; s++) {
+      sum += output[s * numFrames + i];
+    }
+    REQUIRE(sum == Approx(input[i]).margin(1e-5));
+  }
+  const int frame = 5;
+  for (int s = 0; s < numSpeakers; s++) {
+    if (s != sourceSpeaker) {
+      REQUIRE(std::abs(output[s * numFrames + frame]) <
+              std::abs(output[sourceSpeaker * numFrames + frame]));
+    }
+  }
+  REQUIRE(output[sourceSpeaker * numFrames + frame] ==
+          Approx(input[frame] * (2 * order + 1) / numSpeakers).margin(1e-5));
+
+  // Muted speakers are skipped and their output left untouched
+  decoder.setSpeaker(sourceSpeaker, sourceSpeaker,
+                     360.0f * sourceSpeaker / numSpeakers, 0.0f, 0.0f);
+  std::vector<float> muted(numSpeakers * numFrames, 0.0f);
+  decoder.decode(muted.data(), ambi.data(), numFrames);
+  for (int s = 0; s < numSpeakers; s++) {
+    for (int i = 0; i < numFrames; i++) {
+      REQUIRE(muted[s * numFrames + i] ==
+              (s == sourceSpeaker ? 0.0f : output[s * numFrames + i]));
+    }
+  }
+}
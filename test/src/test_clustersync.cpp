@@ -0,0 +1,150 @@
+#include "catch.hpp"
+
+#include <algorithm>
+#include <random>
+
+#include "al/protocol/al_ClusterSync.hpp"
+
+#ifndef AL_WINDOWS
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace al;
+
+TEST_CASE("Clock estimator") {
+  ClockEstimator clock;
+  std::minstd_rand random(1);
+  std::uniform_real_distribution<double> delay(0.0001, 0.0005);
+  const double offset = 3.5;
+  const double drift = 100e-6;
+  for (int i = 0; i < 64; i++) {
+    al_sec send = 1000.0 + i * 0.05;
+    al_sec answered = send + delay(random);
+    al_sec remote = answered + offset + drift * answered;
+    al_sec receive = answered + delay(random);
+    clock.addSample(send, remote, receive);
+  }
+  REQUIRE(clock.samples() == 64);
+  REQUIRE(clock.offset(1002.0) ==
+          Approx(offset + drift * 1002.0).margin(0.0003));
+  REQUIRE(clock.drift() == Approx(drift).margin(30e-6));
+  REQUIRE(clock.roundTrip() < 0.001);
+  REQUIRE(clock.toLocal(clock.toRemote(1002.0)) == Approx(1002.0));
+}
+
+#ifndef AL_WINDOWS
+
+namespace {
+
+// Node clock that is ahead of the server clock and runs fast
+class SkewedClient : public ClusterSyncClient {
+protected:
+  al_sec localTime() override { return al_steady_time() * (1.0 + 200e-6) + 12.5; }
+};
+
+struct PresentRecord {
+  uint64_t frame;
+  al_sec time;
+};
+
+} // namespace
+
+TEST_CASE("Cluster frame barrier across processes") {
+  const int numNodes = 3;
+  const int numFrames = 200;
+  const uint16_t port = 34561;
+
+  int startPipe[2], resultPipe[2];
+  REQUIRE(pipe(startPipe) == 0);
+  REQUIRE(pipe(resultPipe) == 0);
+
+  // Nodes inherit the steady clock origin, so their presentation times can be
+  // compared with the server's. Fork before any threads are started.
+  al_start_steady_clock();
+  std::vector<pid_t> nodes;
+  for (int i = 0; i < numNodes; i++) {
+    pid_t pid = fork();
+    REQUIRE(pid >= 0);
+    if (pid == 0) {
+      close(startPipe[1]);
+      close(resultPipe[0]);
+      char go;
+      if (read(startPipe[0], &go, 1) != 1) {
+        _exit(1);
+      }
+      SkewedClient client;
+      if (!client.start(port, "localhost")) {
+        _exit(2);
+      }
+      for (int frame = 0; frame < numFrames; frame++) {
+        if (client.frameBarrier(2.0)) {
+          PresentRecord record{client.frame(), al_steady_time()};
+          if (write(resultPipe[1], &record, sizeof(record)) < 0) {
+            _exit(3);
+          }
+        }
+      }
+      client.stop();
+      _exit(0);
+    }
+    nodes.push_back(pid);
+  }
+  close(startPipe[0]);
+  close(resultPipe[1]);
+
+  ClusterSyncServer server;
+  server.syncInterval(0.05);
+  REQUIRE(server.start(port, "localhost"));
+  char go[numNodes] = {0};
+  REQUIRE(write(startPipe[1], go, numNodes) == numNodes);
+  REQUIRE(server.waitForConnections(numNodes, 5.0) == numNodes);
+  // Let the clock estimates settle
+  al_sleep(1.5);
+
+  std::vector<al_sec> serverTimes(numFrames + 1);
+  std::vector<NodeSyncStats> stats;
+  for (int i = 0; i < numFrames; i++) {
+    REQUIRE(server.frameBarrier(1.0));
+    serverTimes[server.frame()] = al_steady_time();
+    if (i == numFrames / 2) {
+      stats = server.stats();
+    }
+  }
+
+  for (auto pid : nodes) {
+    int status;
+    waitpid(pid, &status, 0);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+  server.stop();
+  REQUIRE(server.barrierTimeouts() == 0);
+
+  REQUIRE(stats.size() == numNodes);
+  for (auto &node : stats) {
+    REQUIRE(node.offset ==
+            Approx(al_steady_time() * 200e-6 + 12.5).margin(0.001));
+    REQUIRE(node.drift == Approx(200e-6).margin(100e-6));
+  }
+
+  // Skip frames released before all nodes caught up
+  std::vector<al_sec> skews;
+  PresentRecord record;
+  while (read(resultPipe[0], &record, sizeof(record)) == sizeof(record)) {
+    if (record.frame > 10 && record.frame <= uint64_t(numFrames)) {
+      skews.push_back(std::abs(record.time - serverTimes[record.frame]));
+    }
+  }
+  close(resultPipe[0]);
+  close(startPipe[1]);
+
+  REQUIRE(skews.size() > size_t(numNodes * (numFrames - 20)));
+  std::sort(skews.begin(), skews.end());
+  INFO("median skew " << skews[skews.size() / 2] << " max skew "
+                      << skews.back());
+  REQUIRE(skews[skews.size() / 2] < 0.001);
+  REQUIRE(skews[skews.size() * 9 / 10] < 0.005);
+}
+
+#endif
@@ -0,0 +1,200 @@
+#include "catch.hpp"
+
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "al/protocol/al_CommandConnection.hpp"
+
+using namespace al;
+
+namespace {
+
+class RecordingServer : public CommandServer {
+public:
+  ~RecordingServer() { stop(); }
+
+  bool processIncomingMessage(Message &message, Socket *src) override {
+    std::unique_lock<std::mutex> lk(mLock);
+    mMessages.emplace_back(message.data(), message.data() + message.size());
+    mReceived.notify_all();
+    return true;
+  }
+
+  std::vector<std::vector<uint8_t>> waitForMessages(size_t count) {
+    std::unique_lock<std::mutex> lk(mLock);
+    mReceived.wait_for(lk, std::chrono::seconds(5),
+                       [&]() { return mMessages.size() >= count; });
+    return mMessages;
+  }
+
+private:
+  std::mutex mLock;
+  std::condition_variable mReceived;
+  std::vector<std::vector<uint8_t>> mMessages;
+};
+
+std::vector<uint8_t> frame(const std::vector<uint8_t> &message) {
+  std::vector<uint8_t> bytes(4 + message.size());
+  uint32_t length = uint32_t(message.size());
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = uint8_t(length >> (8 * i));
+  }
+  std::copy(message.begin(), message.end(), bytes.begin() + 4);
+  return bytes;
+}
+
+std::vector<uint8_t> pattern(size_t size, uint8_t first) {
+  std::vector<uint8_t> message(size);
+  for (size_t i = 0; i < size; i++) {
+    message[i] = uint8_t(first + i * 7);
+  }
+  return message;
+}
+
+bool sendBytes(Socket &socket, const uint8_t *data, size_t size) {
+  while (size > 0) {
+    long sent = long(socket.send((const char *)data, size));
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= size_t(sent);
+  }
+  return true;
+}
+
+bool receiveBytes(Socket &socket, uint8_t *data, size_t size) {
+  while (size > 0) {
+    long received = long(socket.recv((char *)data, size));
+    if (received <= 0) {
+      return false;
+    }
+    data += received;
+    size -= size_t(received);
+  }
+  return true;
+}
+
+// Connect a raw socket to the server and complete the handshake
+bool connectRaw(Socket &socket, uint16_t port) {
+  if (!socket.open(port, "localhost", 1.0, Socket::TCP) || !socket.connect()) {
+    return false;
+  }
+  auto handshake = frame({CommandConnection::HANDSHAKE, 0, 0, 0, 0});
+  // One byte at a time, so the header and message arrive in pieces
+  for (auto byte : handshake) {
+    if (!sendBytes(socket, &byte, 1)) {
+      return false;
+    }
+    al_sleep(0.002);
+  }
+  uint8_t ack[9];
+  return receiveBytes(socket, ack, sizeof(ack)) &&
+         ack[4] == CommandConnection::HANDSHAKE_ACK;
+}
+
+} // namespace
+
+TEST_CASE("Command connection partial reads") {
+  const uint16_t port = 34571;
+  RecordingServer server;
+  REQUIRE(server.start(port, "localhost"));
+  Socket client;
+  REQUIRE(connectRaw(client, port));
+  REQUIRE(server.waitForConnections(1, 1.0) == 1);
+
+  // Split within the header and within the message
+  auto first = frame(pattern(1000, 1));
+  REQUIRE(sendBytes(client, first.data(), 2));
+  al_sleep(0.02);
+  REQUIRE(sendBytes(client, first.data() + 2, 12));
+  al_sleep(0.02);
+  REQUIRE(sendBytes(client, first.data() + 14, first.size() - 14));
+
+  // Several messages in one write, one larger than the receive buffer
+  std::vector<uint8_t> bytes;
+  for (auto message : {pattern(3, 2), pattern(20000, 3), pattern(1, 4)}) {
+    auto framed = frame(message);
+    bytes.insert(bytes.end(), framed.begin(), framed.end());
+  }
+  REQUIRE(sendBytes(client, bytes.data(), bytes.size()));
+
+  auto messages = server.waitForMessages(4);
+  REQUIRE(messages.size() == 4);
+  REQUIRE(messages[0] == pattern(1000, 1));
+  REQUIRE(messages[1] == pattern(3, 2));
+  REQUIRE(messages[2] == pattern(20000, 3));
+  REQUIRE(messages[3] == pattern(1, 4));
+
+  client.close();
+  server.stop();
+}
+
+TEST_CASE("Command connection backpressure") {
+  const uint16_t port = 34572;
+  RecordingServer server;
+  const size_t messageSize = 1 << 16;
+  server.sendQueueLimit(4 * messageSize, 0.05);
+  REQUIRE(server.start(port, "localhost"));
+  Socket client;
+  REQUIRE(connectRaw(client, port));
+  REQUIRE(server.waitForConnections(1, 1.0) == 1);
+
+  // The client doesn't read, so the socket buffers and then the send queue
+  // fill up and messages are dropped
+  uint32_t sent = 0;
+  while (sent < 4096) {
+    auto message = pattern(messageSize, uint8_t(sent));
+    std::memcpy(message.data(), &sent, sizeof(sent));
+    if (!server.sendMessage(message.data(), message.size())) {
+      break;
+    }
+    sent++;
+  }
+  REQUIRE(sent < 4096);
+
+  // Accepted messages arrive whole and in order, dropped ones not at all
+  std::vector<uint8_t> framed(4 + messageSize);
+  for (uint32_t i = 0; i < sent; i++) {
+    REQUIRE(receiveBytes(client, framed.data(), framed.size()));
+    auto message = pattern(messageSize, uint8_t(i));
+    std::memcpy(message.data(), &i, sizeof(i));
+    REQUIRE(framed == frame(message));
+  }
+  client.timeout(0.1);
+  uint8_t extra;
+  REQUIRE(long(client.recv((char *)&extra, 1)) <= 0);
+
+  // The queue drains, so sending works again
+  auto message = pattern(10, 5);
+  REQUIRE(server.sendMessage(message.data(), message.size()));
+  client.timeout(1.0);
+  std::vector<uint8_t> received(4 + message.size());
+  REQUIRE(receiveBytes(client, received.data(), received.size()));
+  REQUIRE(received == frame(message));
+
+  client.close();
+  server.stop();
+}
+
+TEST_CASE("Command client start against a closing server") {
+  const uint16_t port = 34573;
+  Socket listener;
+  REQUIRE(listener.open(port, "localhost", 1.0, Socket::TCP));
+  REQUIRE(listener.bind());
+  REQUIRE(listener.listen());
+  std::thread closer([&]() {
+    Socket connection;
+    if (listener.accept(connection)) {
+      connection.close();
+    }
+  });
+  CommandClient client;
+  REQUIRE(!client.start(port, "localhost"));
+  REQUIRE(!client.isConnected());
+  closer.join();
+  listener.close();
+}
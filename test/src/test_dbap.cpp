@@ -0,0 +1,63 @@
+#include <math.h>
+
+#include "al/io/al_AudioIO.hpp"
+#include "al/sound/al_Dbap.hpp"
+#include "catch.hpp"
+
+using namespace al;
+
+TEST_CASE("DBAP focus change") {
+  const int fpb = 16;
+
+  Speakers sl = OctalSpeakerLayout();
+  Dbap dbapPanner(sl);
+
+  AudioIOData audioData;
+  audioData.framesPerBuffer(fpb);
+  audioData.framesPerSecond(44100);
+  audioData.channelsIn(0);
+  audioData.channelsOut(sl.size());
+
+  AudioIOData reference;
+  reference.framesPerBuffer(fpb);
+  reference.channelsIn(0);
+  reference.channelsOut(sl.size());
+
+  float samples[fpb];
+  for (int i = 0; i < fpb; i++) {
+    samples[i] = 1.0;
+  }
+
+  Pose pose;
+  pose.pos(1, 0, -2);
+  SpatializerSource source;
+  for (int block = 0; block < 2; block++) {
+    audioData.zeroOut();
+    dbapPanner.renderSource(audioData, pose, samples, fpb, source);
+  }
+  std::vector<float> focusOneGains;
+  for (unsigned int chan = 0; chan < sl.size(); chan++) {
+    focusOneGains.push_back(audioData.out(chan, fpb - 1));
+  }
+
+  // The pose is unchanged, but the cached gains must follow the new focus
+  dbapPanner.setFocus(3.0f);
+  audioData.zeroOut();
+  reference.zeroOut();
+  dbapPanner.renderSource(audioData, pose, samples, fpb, source);
+  dbapPanner.renderBuffer(reference, pose, samples, fpb);
+  bool changed = false;
+  for (unsigned int chan = 0; chan < sl.size(); chan++) {
+    // Ramps from the previous gains to the new ones across the block
+    REQUIRE(fabs(audioData.out(chan, fpb - 1) - reference.out(chan, 0)) <
+            0.00001);
+    changed |= fabs(reference.out(chan, 0) - focusOneGains[chan]) > 0.01;
+  }
+  REQUIRE(changed);
+
+  audioData.zeroOut();
+  dbapPanner.renderSource(audioData, pose, samples, fpb, source);
+  for (unsigned int chan = 0; chan < sl.size(); chan++) {
+    REQUIRE(fabs(audioData.out(chan, 0) - reference.out(chan, 0)) < 0.00001);
+  }
+}
@@ -73,3 +73,19 @@ TEST_CASE("Conform path to OS") {
 
   REQUIRE(File::isSamePath(conformed, "c:/test/other path/to/file"));
 }
+
+TEST_CASE("Mapped file") {
+  std::string path = "mapped_file_test.txt";
+  std::string contents = "mapped file contents";
+  REQUIRE(File::write(path, contents) > 0);
+
+  MappedFile mapped;
+  REQUIRE(mapped.open(path));
+  REQUIRE(mapped.size() == contents.size());
+  REQUIRE(std::string(mapped.data(), mapped.size()) == contents);
+  mapped.close();
+  REQUIRE(!mapped.opened());
+
+  REQUIRE(File::remove(path));
+  REQUIRE(!mapped.open(path));
+}
@@ -1,7 +1,11 @@
 
 #include "catch.hpp"
 
+#include <mutex>
+
 #include "al/protocol/al_OSC.hpp"
+#include "al/protocol/al_OSCRecvLoop.hpp"
+#include "al/protocol/al_ReliableOSC.hpp"
 
 using namespace al;
 
@@ -79,4 +83,185 @@ TEST_CASE( "OSC multiple receivers" ) {
     REQUIRE(handler2.inString == "world4");
 }
 
+TEST_CASE( "OSC multicast" ) {
+    Handler handler1;
+    Handler handler2;
+
+    // Both receivers share the port and join the group on loopback
+    osc::Recv server1;
+    osc::Recv server2;
+    REQUIRE(server1.openMulticast(10830, "239.255.0.1", "127.0.0.1"));
+    REQUIRE(server2.openMulticast(10830, "239.255.0.1", "127.0.0.1"));
+
+    server1.handler(handler1);
+    server2.handler(handler2);
+
+    server1.start();
+    server2.start();
+
+    osc::Send send(10830, "239.255.0.1");
+    REQUIRE(send.multicastInterface("127.0.0.1"));
+    REQUIRE(send.multicastLoopback(true));
+    REQUIRE(send.multicastTTL(1));
+    send.send("/hello", "group");
+
+    al_sleep(0.1);
+
+    REQUIRE(handler1.address == "/hello");
+    REQUIRE(handler1.inString == "group");
+    REQUIRE(handler2.address == "/hello");
+    REQUIRE(handler2.inString == "group");
+}
+
+class SequenceHandler : public osc::PacketHandler {
+public:
+    virtual void onMessage(osc::Message& m) override {
+        int value;
+        m >> value;
+        std::unique_lock<std::mutex> lk(lock);
+        values.push_back(value);
+    }
+
+    size_t size() {
+        std::unique_lock<std::mutex> lk(lock);
+        return values.size();
+    }
+
+    // Read only after the receiving thread has stopped
+    std::vector<int> values;
+    std::mutex lock;
+};
+
+TEST_CASE( "Reliable OSC with packet loss" ) {
+    SequenceHandler handler;
+    osc::ReliableReceiver reliableReceiver(handler, 10840);
+    reliableReceiver.simulateLoss(0.05f);
+
+    osc::Recv server;
+    REQUIRE(server.open(10840, "127.0.0.1"));
+    server.handler(reliableReceiver);
+    server.start();
+
+    osc::ReliableSender sender;
+    sender.simulateLoss(0.05f);
+    sender.heartbeatInterval(0.01);
+    REQUIRE(sender.open(10841, "127.0.0.1"));
+    REQUIRE(sender.addDestination(10840, "127.0.0.1"));
+
+    const int count = 1000;
+    osc::Packet p;
+    for (int i = 0; i < count; i++) {
+        p.clear();
+        p.addMessage("/value", i);
+        sender.send(p);
+        if (i % 100 == 99) {
+            al_sleep(0.01);
+        }
+    }
+
+    for (int i = 0; i < 200 && handler.size() < count; i++) {
+        al_sleep(0.01);
+    }
+    sender.close();
+    server.stop();
+
+    REQUIRE(handler.values.size() == count);
+    for (int i = 0; i < count; i++) {
+        REQUIRE(handler.values[i] == i);
+    }
+    REQUIRE(sender.retransmitted() > 0);
+    REQUIRE(reliableReceiver.lost() == 0);
+}
+
+TEST_CASE( "Reliable OSC first contact" ) {
+    osc::ReliableSender sender;
+    sender.heartbeatInterval(0.01);
+    REQUIRE(sender.open(10843, "127.0.0.1"));
+    REQUIRE(sender.addDestination(10842, "127.0.0.1"));
+
+    // Nothing listens yet, so the first packets of the stream are lost
+    osc::Packet p;
+    for (int i = 0; i < 10; i++) {
+        p.clear();
+        p.addMessage("/value", i);
+        sender.send(p);
+    }
+
+    SequenceHandler handler;
+    osc::ReliableReceiver reliableReceiver(handler, 10842);
+    osc::Recv server;
+    REQUIRE(server.open(10842, "127.0.0.1"));
+    server.handler(reliableReceiver);
+    server.start();
+
+    p.clear();
+    p.addMessage("/value", 10);
+    sender.send(p);
+
+    for (int i = 0; i < 100 && handler.size() < 11; i++) {
+        al_sleep(0.01);
+    }
+    sender.close();
+    server.stop();
+
+    REQUIRE(handler.values.size() == 11);
+    for (int i = 0; i < 11; i++) {
+        REQUIRE(handler.values[i] == i);
+    }
+    REQUIRE(sender.retransmitted() >= 10);
+    REQUIRE(reliableReceiver.lost() == 0);
+}
+
+TEST_CASE( "OSC receive loop" ) {
+    SequenceHandler handler1;
+    Handler handler2;
+
+    osc::RecvLoop loop;
+    REQUIRE(loop.open(10850, "127.0.0.1"));
+    REQUIRE(loop.open(10851, "127.0.0.1"));
+    REQUIRE(loop.appendHandler(10850, handler1));
+    REQUIRE(loop.appendHandler(10851, handler2));
+    REQUIRE(!loop.appendHandler(10852, handler2));
+
+    // Queue a burst before the loop starts so it is read in batches
+    osc::Send send1(10850, "127.0.0.1");
+    for (int i = 0; i < 100; i++) {
+        send1.send("/value", i);
+    }
+    osc::Send(10851, "127.0.0.1").send("/hello", "loop");
+
+    REQUIRE(loop.start());
+    al_sleep(0.1);
+    loop.stop();
+
+    REQUIRE(handler1.values.size() == 100);
+    for (int i = 0; i < 100; i++) {
+        REQUIRE(handler1.values[i] == i);
+    }
+    REQUIRE(handler2.address == "/hello");
+    REQUIRE(handler2.inString == "loop");
+    REQUIRE(loop.packets() == 101);
+#ifdef AL_LINUX
+    REQUIRE(loop.reads() < loop.packets());
+#endif
+}
+
+TEST_CASE( "OSC address patterns" ) {
+    REQUIRE(osc::patternMatches("/synth/amp", "/synth/amp"));
+    REQUIRE(!osc::patternMatches("/synth/amp", "/synth/ampl"));
+    REQUIRE(osc::patternMatches("/synth/?mp", "/synth/amp"));
+    REQUIRE(osc::patternMatches("/synth/*", "/synth/amp"));
+    REQUIRE(!osc::patternMatches("/synth/*", "/synth/voice/amp"));
+    REQUIRE(osc::patternMatches("/*/amp", "/synth/amp"));
+    REQUIRE(osc::patternMatches("/synth/a*p", "/synth/amp"));
+    REQUIRE(osc::patternMatches("/voice[0-9]/amp", "/voice3/amp"));
+    REQUIRE(!osc::patternMatches("/voice[!0-9]/amp", "/voice3/amp"));
+    REQUIRE(osc::patternMatches("/voice[ab]/amp", "/voiceb/amp"));
+    REQUIRE(osc::patternMatches("/synth/{amp,freq}", "/synth/freq"));
+    REQUIRE(!osc::patternMatches("/synth/{amp,freq}", "/synth/pan"));
+    REQUIRE(osc::isPattern("/synth/*"));
+    REQUIRE(!osc::isPattern("/synth/amp"));
+}
+
 // #endif
+
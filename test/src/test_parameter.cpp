@@ -0,0 +1,133 @@
+#include "catch.hpp"
+
+#include "al/ui/al_Parameter.hpp"
+
+using namespace al;
+
+TEST_CASE("Parameter smoothing") {
+  Parameter gain{"gain", "", 0.0f, 0.0f, 1.0f};
+  ParameterSmoother smoother(gain, 1000.0);
+  float buffer[64];
+
+  SECTION("No smoothing") {
+    REQUIRE_FALSE(smoother.process(buffer, 64));
+    gain.set(0.5f);
+    REQUIRE_FALSE(smoother.process(buffer, 64));
+    REQUIRE(smoother.value() == 0.5f);
+  }
+
+  SECTION("Linear") {
+    gain.smoothing(SmoothingMode::LINEAR, 0.1f); // 100 samples
+    gain.set(1.0f);
+    REQUIRE(smoother.process(buffer, 64));
+    REQUIRE(buffer[0] == Approx(0.01f));
+    REQUIRE(buffer[63] == Approx(0.64f));
+    REQUIRE(smoother.ramping());
+    REQUIRE(smoother.process(buffer, 64));
+    REQUIRE(buffer[35] == 1.0f);
+    REQUIRE(buffer[63] == 1.0f);
+    REQUIRE_FALSE(smoother.ramping());
+    REQUIRE_FALSE(smoother.process(buffer, 64));
+    REQUIRE(smoother.value() == 1.0f);
+
+    // New target mid ramp starts a new ramp from the current value
+    gain.set(0.0f);
+    smoother.process(buffer, 50);
+    REQUIRE(smoother.value() == Approx(0.5f));
+    gain.set(1.0f);
+    smoother.process(buffer, 50);
+    REQUIRE(smoother.value() == Approx(0.75f));
+  }
+
+  SECTION("Exponential") {
+    gain.smoothing(SmoothingMode::EXPONENTIAL, 0.1f);
+    gain.set(1.0f);
+    REQUIRE(smoother.process(buffer, 64));
+    for (int i = 1; i < 64; i++) {
+      REQUIRE(buffer[i] > buffer[i - 1]);
+    }
+    smoother.process(buffer, 35);
+    REQUIRE(smoother.value() == Approx(0.999f).margin(0.0005));
+    smoother.process(buffer, 1);
+    REQUIRE(smoother.value() == 1.0f);
+    REQUIRE_FALSE(smoother.process(buffer, 64));
+  }
+
+  SECTION("Reset") {
+    gain.smoothing(SmoothingMode::LINEAR, 0.1f);
+    gain.set(1.0f);
+    smoother.reset();
+    REQUIRE_FALSE(smoother.process(buffer, 64));
+    REQUIRE(smoother.value() == 1.0f);
+  }
+
+  SECTION("Empty blocks") {
+    gain.smoothing(SmoothingMode::LINEAR, 0.1f);
+    gain.set(1.0f);
+    REQUIRE(smoother.process(buffer, 10));
+    REQUIRE_FALSE(smoother.process(buffer, 0));
+    REQUIRE(smoother.value() == Approx(0.1f));
+    REQUIRE(smoother.ramping());
+
+    ParameterSmoother detached;
+    REQUIRE_FALSE(detached.process(buffer, 64));
+    REQUIRE(detached.value() == 0.0f);
+  }
+}
+
+TEST_CASE("Parameter callback queue") {
+  ParameterCallbackQueue queue;
+  Parameter freq{"freq", "", 440.0f, 20.0f, 20000.0f};
+  ParameterVec3 position{"position"};
+  freq.setCallbackQueue(&queue);
+  position.setCallbackQueue(&queue);
+
+  std::vector<float> values;
+  std::string sourceAddress;
+  freq.registerChangeCallback([&](float value) { values.push_back(value); });
+  freq.registerChangeCallback([&](float value, ValueSource *src) {
+    sourceAddress = src ? src->ipAddr : "";
+  });
+  int positionCalls = 0;
+  position.registerChangeCallback([&](Vec3f value) { positionCalls++; });
+
+  REQUIRE(queue.process() == 0);
+  for (int i = 0; i < 100; i++) {
+    freq.set(100.0f + i);
+  }
+  REQUIRE(values.empty());
+  REQUIRE(freq.get() == 199.0f);
+
+  ValueSource src{"10.0.0.2", 9011};
+  freq.set(300.0f, &src);
+  position.set(Vec3f(1, 2, 3));
+  REQUIRE(queue.process() == 2);
+  REQUIRE(values.size() == 1);
+  REQUIRE(values[0] == 300.0f);
+  REQUIRE(sourceAddress == "10.0.0.2");
+  REQUIRE(positionCalls == 1);
+
+  freq.set(400.0f);
+  REQUIRE(queue.process() == 1);
+  REQUIRE(values.back() == 400.0f);
+  REQUIRE(sourceAddress == "");
+
+  // setNoCalls() with a receiver to block defers callbacks the same way for
+  // every parameter type
+  int blocker;
+  freq.setNoCalls(450.0f, &blocker);
+  position.setNoCalls(Vec3f(4, 5, 6), &blocker);
+  REQUIRE(values.back() == 400.0f);
+  REQUIRE(positionCalls == 1);
+  REQUIRE(queue.process() == 2);
+  REQUIRE(values.back() == 450.0f);
+  REQUIRE(positionCalls == 2);
+  position.setNoCalls(Vec3f(7, 8, 9));
+  REQUIRE(queue.process() == 0);
+  REQUIRE(position.get() == Vec3f(7, 8, 9));
+
+  freq.setCallbackQueue(nullptr);
+  freq.set(500.0f);
+  REQUIRE(values.back() == 500.0f);
+  REQUIRE(queue.process() == 0);
+}
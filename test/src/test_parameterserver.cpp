@@ -0,0 +1,95 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include "al/io/al_Socket.hpp"
+#include "al/system/al_Time.hpp"
+#include "al/ui/al_ParameterServer.hpp"
+
+using namespace al;
+
+TEST_CASE("Parameter server unregister") {
+  ParameterServer server("127.0.0.1", 10870, false);
+  Parameter freq{"freq", "", 0.0f, 0.0f, 1000.0f};
+  std::atomic<bool> entered{false};
+  std::atomic<bool> finished{false};
+  freq.registerChangeCallback([&](float value) {
+    entered = true;
+    al_sleep(0.05);
+    finished = true;
+  });
+  server << freq;
+
+  osc::Packet p;
+  p.addMessage("/freq", 440.0f);
+  std::thread dispatch([&]() {
+    osc::Recv::parse(p.data(), int(p.size()), server, "127.0.0.1");
+  });
+  while (!entered) {
+    std::this_thread::yield();
+  }
+  // Returns once the message being dispatched is done with the parameter
+  server.unregisterParameter(freq);
+  CHECK(finished);
+  dispatch.join();
+  REQUIRE(freq.get() == 440.0f);
+
+  p.clear();
+  p.addMessage("/freq", 100.0f);
+  osc::Recv::parse(p.data(), int(p.size()), server, "127.0.0.1");
+  REQUIRE(freq.get() == 440.0f);
+}
+
+class ValueHandler : public osc::PacketHandler {
+public:
+  void onMessage(osc::Message &m) override {
+    float value;
+    m >> value;
+    values[m.addressPattern()].push_back(value);
+  }
+
+  std::map<std::string, std::vector<float>> values;
+};
+
+TEST_CASE("Parameter server coalesced notifications") {
+  SocketServer receiver(10880, "127.0.0.1", 1.0);
+  REQUIRE(receiver.opened());
+  OSCNotifier notifier;
+  notifier.addListener("127.0.0.1", 10880);
+  const int maxPacketSize = 256;
+  notifier.coalesceNotifications(0.2, maxPacketSize);
+
+  // All within one window
+  for (int i = 0; i < 100; i++) {
+    notifier.notifyListeners("/freq", float(i));
+  }
+  const int numAddresses = 40;
+  for (int i = 0; i < numAddresses; i++) {
+    notifier.notifyListeners("/value" + std::to_string(i), float(i));
+  }
+
+  ValueHandler handler;
+  char buffer[65536];
+  int packets = 0;
+  size_t received = 0;
+  while (received < numAddresses + 1) {
+    size_t size = receiver.recv(buffer, sizeof(buffer));
+    if (size == 0) {
+      break;
+    }
+    packets++;
+    REQUIRE(size <= size_t(maxPacketSize));
+    osc::Recv::parse(buffer, int(size), handler, "127.0.0.1");
+    received = handler.values.size();
+  }
+  REQUIRE(packets > 1);
+  REQUIRE(handler.values.size() == numAddresses + 1);
+  REQUIRE(handler.values["/freq"] == std::vector<float>{99.0f});
+  for (int i = 0; i < numAddresses; i++) {
+    REQUIRE(handler.values["/value" + std::to_string(i)] ==
+            std::vector<float>{float(i)});
+  }
+}
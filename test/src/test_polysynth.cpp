@@ -0,0 +1,434 @@
+#include "catch.hpp"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "al/io/al_File.hpp"
+#include "al/scene/al_PolySynth.hpp"
+#include "al/scene/al_SynthSequencer.hpp"
+#include "al/types/al_MPSCQueue.hpp"
+
+using namespace al;
+
+TEST_CASE("MPSC queue") {
+  MPSCQueue<int> queue(5);
+  REQUIRE(queue.capacity() == 8);
+
+  int value;
+  REQUIRE(!queue.pop(value));
+  for (int i = 0; i < 8; i++) {
+    REQUIRE(queue.push(i));
+  }
+  REQUIRE(!queue.push(8));
+  REQUIRE(queue.size() == 8);
+  for (int i = 0; i < 8; i++) {
+    REQUIRE(queue.pop(value));
+    REQUIRE(value == i);
+  }
+  REQUIRE(!queue.pop(value));
+
+  // Each producer's elements come out in the order they were pushed
+  const int producers = 4;
+  const int count = 20000;
+  queue.resize(64);
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&queue, p]() {
+      for (int i = 0; i < count; i++) {
+        while (!queue.push(p * count + i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  std::vector<int> next(producers, 0);
+  int received = 0;
+  bool ordered = true;
+  while (received < producers * count) {
+    if (!queue.pop(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int p = value / count;
+    ordered = ordered && value % count == next[p];
+    next[p] = value % count + 1;
+    received++;
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  REQUIRE(ordered);
+  REQUIRE(!queue.pop(value));
+}
+
+static std::atomic<int> triggerOns{0};
+static std::atomic<int> triggerOffs{0};
+
+class CountingVoice : public SynthVoice {
+public:
+  void onTriggerOn() override { triggerOns++; }
+  void onTriggerOff() override {
+    triggerOffs++;
+    free();
+  }
+};
+
+TEST_CASE("PolySynth command order") {
+  triggerOns = 0;
+  triggerOffs = 0;
+  PolySynth synth(TimeMasterMode::TIME_MASTER_FREE);
+  synth.setVoiceCommandQueueSize(4);
+
+  // Commands past the queue size go through the overflow list in order
+  std::vector<int> ids;
+  for (int i = 0; i < 32; i++) {
+    ids.push_back(synth.triggerOn(synth.getVoice<CountingVoice>()));
+    synth.triggerOff(ids.back());
+  }
+  synth.processVoices();
+  synth.processInactiveVoices();
+  REQUIRE(triggerOns == 32);
+  REQUIRE(triggerOffs == 32);
+
+  // A trigger off issued after its trigger on is never applied before it,
+  // also while other threads overflow the queue
+  triggerOns = 0;
+  triggerOffs = 0;
+  const int producers = 3;
+  const int count = 2000;
+  std::atomic<int> done{0};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; p++) {
+    threads.emplace_back([&]() {
+      for (int i = 0; i < count; i++) {
+        int id = synth.triggerOn(synth.getVoice<CountingVoice>());
+        synth.triggerOff(id);
+      }
+      done++;
+    });
+  }
+  while (done < producers || triggerOffs < producers * count) {
+    synth.processVoices();
+    synth.processInactiveVoices();
+    if (done == producers && triggerOns == producers * count) {
+      break; // Any trigger off still missing was lost
+    }
+    std::this_thread::yield();
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  synth.processVoices();
+  synth.processInactiveVoices();
+  REQUIRE(triggerOns == producers * count);
+  REQUIRE(triggerOffs == producers * count);
+}
+
+class UnregisteredVoice : public SynthVoice {};
+
+TEST_CASE("PolySynth unregistered voices") {
+  PolySynth synth(TimeMasterMode::TIME_MASTER_FREE);
+  auto *voice = new UnregisteredVoice;
+  synth.insertFreeVoice(voice);
+  REQUIRE(synth.getVoice("UnregisteredVoice") == voice);
+  synth.insertFreeVoice(voice);
+  REQUIRE(synth.getVoice(typeid(UnregisteredVoice).name()) == voice);
+  REQUIRE(synth.getVoice("UnknownVoice") == nullptr);
+
+  // Triggered voices return to the pool created when they were triggered
+  auto *triggered = new UnregisteredVoice;
+  synth.triggerOn(triggered);
+  synth.processVoices();
+  triggered->free();
+  synth.processInactiveVoices();
+  REQUIRE(synth.getVoice("UnregisteredVoice") == triggered);
+  REQUIRE(synth.getVoice("UnregisteredVoice") == nullptr);
+  synth.insertFreeVoice(voice);
+  synth.insertFreeVoice(triggered);
+
+  // Pools created by inserting voices have no way to create voices
+  synth.allocatePolyphony("UnregisteredVoice", 4);
+  auto *first = synth.getVoice("UnregisteredVoice");
+  auto *second = synth.getVoice("UnregisteredVoice");
+  REQUIRE(first);
+  REQUIRE(second);
+  REQUIRE(synth.getVoice("UnregisteredVoice") == nullptr);
+  synth.insertFreeVoice(first);
+  synth.insertFreeVoice(second);
+}
+
+class BudgetVoice : public SynthVoice {};
+
+TEST_CASE("PolySynth voice budgets") {
+  PolySynth synth(TimeMasterMode::TIME_MASTER_FREE);
+  synth.setVoiceStealFadeFrames(0);
+
+  SECTION("Steal oldest") {
+    synth.setVoiceBudget<BudgetVoice>(2);
+    std::vector<SynthVoice *> voices;
+    for (int i = 0; i < 3; i++) {
+      voices.push_back(synth.getVoice<BudgetVoice>());
+      synth.triggerOn(voices.back());
+      synth.processVoices();
+    }
+    REQUIRE(!voices[0]->active());
+    REQUIRE(voices[1]->active());
+    REQUIRE(voices[2]->active());
+  }
+
+  SECTION("Steal none") {
+    synth.setVoiceBudget<BudgetVoice>(2, VoiceStealPolicy::STEAL_NONE);
+    std::vector<SynthVoice *> voices;
+    for (int i = 0; i < 3; i++) {
+      voices.push_back(synth.getVoice<BudgetVoice>());
+      synth.triggerOn(voices.back());
+    }
+    synth.processVoices();
+    REQUIRE(voices[0]->active());
+    REQUIRE(voices[1]->active());
+    REQUIRE(!voices[2]->active());
+  }
+
+  SECTION("Max polyphony") {
+    synth.setMaxPolyphony<BudgetVoice>(2);
+    auto *first = synth.getVoice<BudgetVoice>();
+    auto *second = synth.getVoice<BudgetVoice>();
+    REQUIRE(first);
+    REQUIRE(second);
+    REQUIRE(!synth.getVoice<BudgetVoice>());
+    synth.insertFreeVoice(first);
+    REQUIRE(synth.getVoice<BudgetVoice>() == first);
+    synth.insertFreeVoice(first);
+    synth.insertFreeVoice(second);
+  }
+}
+
+TEST_CASE("PolySynth voice budgets without audio rendering") {
+  // Nothing renders audio to advance the fade, so stolen voices must be
+  // removed when the commands are processed
+  PolySynth synth(TimeMasterMode::TIME_MASTER_UPDATE);
+  synth.setVoiceStealFadeFrames(256);
+  synth.setVoiceBudget<BudgetVoice>(1);
+  auto *first = synth.getVoice<BudgetVoice>();
+  synth.triggerOn(first);
+  synth.update(0.01);
+  auto *second = synth.getVoice<BudgetVoice>();
+  synth.triggerOn(second);
+  synth.update(0.01);
+  REQUIRE(!first->active());
+  REQUIRE(second->active());
+  REQUIRE(synth.getFreeVoices() == first);
+
+  // The stolen voice no longer counts against the budget
+  auto *third = synth.getVoice<BudgetVoice>();
+  REQUIRE(third == first);
+  synth.triggerOn(third);
+  synth.update(0.01);
+  REQUIRE(!second->active());
+  REQUIRE(third->active());
+}
+
+struct SequenceLogEntry {
+  int step;
+  std::string voice;
+  bool on;
+  float value;
+  std::string label;
+
+  bool operator==(const SequenceLogEntry &other) const {
+    return step == other.step && voice == other.voice && on == other.on &&
+           value == other.value && label == other.label;
+  }
+};
+
+static std::vector<SequenceLogEntry> sequenceLog;
+static int sequenceStep = 0;
+
+class NoteVoice : public SynthVoice {
+public:
+  void init() override {
+    createInternalTriggerParameter("value");
+    createInternalTriggerParameter("other");
+  }
+  void onTriggerOn() override {
+    sequenceLog.push_back(
+        {sequenceStep, "NoteVoice", true, getInternalParameterValue("value"),
+         ""});
+  }
+  void onTriggerOff() override {
+    sequenceLog.push_back({sequenceStep, "NoteVoice", false, 0.0f, ""});
+    free();
+  }
+};
+
+class LabelVoice : public SynthVoice {
+public:
+  Parameter value{"value"};
+  ParameterString label{"label"};
+
+  void init() override { registerTriggerParameters(value, label); }
+  void onTriggerOn() override {
+    sequenceLog.push_back(
+        {sequenceStep, "LabelVoice", true, value.get(), label.get()});
+  }
+  void onTriggerOff() override {
+    sequenceLog.push_back({sequenceStep, "LabelVoice", false, 0.0f, ""});
+    free();
+  }
+};
+
+static std::vector<SequenceLogEntry> playLogged(SynthSequencer &sequencer,
+                                                bool compiled) {
+  sequenceLog.clear();
+  if (compiled) {
+    REQUIRE(sequencer.playCompiledSequence("test"));
+  } else {
+    REQUIRE(sequencer.playSequence("test"));
+  }
+  for (sequenceStep = 0; sequenceStep < 256; sequenceStep++) {
+    sequencer.update(1.0 / 64.0);
+  }
+  return sequenceLog;
+}
+
+TEST_CASE("Compiled sequence playback") {
+  std::string directory = "test_sequence_data";
+  Dir::make(directory);
+  {
+    std::ofstream f(directory + "/test.synthSequence");
+    f << "@ 0.0 0.5 LabelVoice 1 first" << std::endl;
+    f << "@ 0.25 0.5 LabelVoice 2 \"second label\"" << std::endl;
+    f << "@ 0.5 1 NoteVoice 3 0" << std::endl;
+    f << "+ 0.75 7 NoteVoice 4 0" << std::endl;
+    f << "t 120" << std::endl;
+    f << "> 1" << std::endl;
+    f << "@ 1 1 LabelVoice 5 tempo" << std::endl;
+    f << "- 2 7" << std::endl;
+    f << "@ 1.5 0.25 NoteVoice 6 0" << std::endl;
+  }
+
+  SynthSequencer sequencer(TimeMasterMode::TIME_MASTER_UPDATE);
+  sequencer.setDirectory(directory);
+  sequencer.synth().registerSynthClass<NoteVoice>();
+  sequencer.synth().registerSynthClass<LabelVoice>();
+  REQUIRE(sequencer.compileSequence("test"));
+
+  CompiledSequence compiledSequence;
+  REQUIRE(compiledSequence.open(sequencer.buildCompiledPath("test")));
+  REQUIRE(compiledSequence.size() == 6);
+  REQUIRE(compiledSequence.numNames() == 2);
+  compiledSequence.close();
+
+  auto textLog = playLogged(sequencer, false);
+  auto compiledLog = playLogged(sequencer, true);
+  REQUIRE(textLog.size() == 12);
+  REQUIRE(compiledLog.size() == textLog.size());
+  for (size_t i = 0; i < textLog.size(); i++) {
+    REQUIRE(compiledLog[i] == textLog[i]);
+  }
+  REQUIRE(textLog[0].label == "first");
+  REQUIRE(textLog[1].label == "second label");
+
+  // Files with string offsets outside the string data are rejected
+  std::string path = sequencer.buildCompiledPath("test");
+  CompiledSequence::Header header;
+  {
+    std::ifstream f(path, std::ios::binary);
+    f.read(reinterpret_cast<char *>(&header), sizeof(header));
+  }
+  {
+    std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+    uint32_t offset = uint32_t(header.stringDataSize);
+    f.seekp(std::streamoff(header.stringOffsetsOffset));
+    f.write(reinterpret_cast<const char *>(&offset), sizeof(offset));
+  }
+  REQUIRE(!compiledSequence.open(path));
+  REQUIRE(!sequencer.playCompiledSequence("test"));
+
+  File::remove(sequencer.buildFullPath("test"));
+  File::remove(path);
+  Dir::remove(directory);
+}
+
+static int onsetBlock = 0;
+
+class OnsetVoice : public SynthVoice {
+public:
+  // Records the first frame the voice renders
+  void onProcess(AudioIOData &io) override {
+    if (firstBlock < 0 && io()) {
+      firstBlock = onsetBlock;
+      firstFrame = int(io.frame());
+    }
+  }
+
+  int firstBlock{-1};
+  int firstFrame{-1};
+};
+
+// Exposes the event lock so a block can be rendered while it is held
+class LockableSequencer : public SynthSequencer {
+public:
+  using SynthSequencer::SynthSequencer;
+  std::mutex &eventLock() { return mEventLock; }
+};
+
+TEST_CASE("Sequencer onset frames") {
+  const int fpb = 64;
+  const double sr = 44100.0;
+  AudioIOData io;
+  io.framesPerBuffer(fpb);
+  io.framesPerSecond(sr);
+  io.channelsIn(0);
+  io.channelsOut(2);
+
+  LockableSequencer sequencer(TimeMasterMode::TIME_MASTER_AUDIO);
+  auto &onTime = sequencer.add<OnsetVoice>((2 * fpb + 10) / sr);
+  auto &deferred = sequencer.add<OnsetVoice>((4 * fpb + 20) / sr);
+  auto &carried = sequencer.add<OnsetVoice>((5 * fpb + 5) / sr);
+
+  auto renderBlock = [&]() {
+    io.zeroOut();
+    sequencer.render(io);
+    onsetBlock++;
+  };
+  for (int i = 0; i < 4; i++) {
+    renderBlock();
+  }
+  // Starts within its block at the event's frame
+  REQUIRE(onTime.firstBlock == 2);
+  REQUIRE(onTime.firstFrame == 10);
+
+  // While another thread holds the event lock the block's events wait for
+  // the next block, keeping their offsets from the block they belong to
+  std::atomic<int> holderState{0};
+  std::thread holder([&]() {
+    std::unique_lock<std::mutex> lk(sequencer.eventLock());
+    holderState = 1;
+    while (holderState == 1) {
+      std::this_thread::yield();
+    }
+  });
+  while (holderState == 0) {
+    std::this_thread::yield();
+  }
+  renderBlock();
+  REQUIRE(deferred.firstBlock == -1);
+  holderState = 2;
+  holder.join();
+
+  renderBlock();
+  REQUIRE(deferred.firstBlock == 5);
+  REQUIRE(deferred.firstFrame == 20);
+  // An event in the block that caught up runs past its end and is carried
+  // into the following block
+  REQUIRE(carried.firstBlock == -1);
+  renderBlock();
+  REQUIRE(carried.firstBlock == 6);
+  REQUIRE(carried.firstFrame == 5);
+  sequencer.stopSequence();
+}
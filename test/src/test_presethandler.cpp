@@ -0,0 +1,199 @@
+#include "catch.hpp"
+
+#include <fstream>
+
+#include "al/io/al_File.hpp"
+#include "al/ui/al_PresetHandler.hpp"
+
+using namespace al;
+
+TEST_CASE("Preset interpolation") {
+  Parameter freq{"freq", "", 0.0f, 0.0f, 1000.0f};
+  ParameterInt count{"count", "", 0, 0, 100};
+  ParameterVec3 position{"position"};
+  PresetHandler presets(TimeMasterMode::TIME_MASTER_FREE,
+                        "test_presethandler_data");
+  presets << freq << count << position;
+
+  freq.set(100.0f);
+  count.set(10);
+  position.set(Vec3f(0, 0, 0));
+  presets.storePreset(0, "one");
+  freq.set(300.0f);
+  count.set(30);
+  position.set(Vec3f(2, 4, 6));
+  presets.storePreset(1, "two");
+
+  presets.setInterpolatedPreset("one", "two", 0.5);
+  REQUIRE(freq.get() == Approx(200.0f));
+  REQUIRE(count.get() == 20);
+  REQUIRE(position.get() == Vec3f(1, 2, 3));
+
+  presets.setInterpolatedPreset(0, 1, 0.0);
+  REQUIRE(freq.get() == 100.0f);
+  REQUIRE(position.get() == Vec3f(0, 0, 0));
+  presets.setInterpolatedPreset(0, 1, 1.0);
+  REQUIRE(freq.get() == 300.0f);
+  REQUIRE(count.get() == 30);
+
+  // Storing a preset replaces the cached copy
+  freq.set(500.0f);
+  presets.storePreset(1, "two");
+  presets.setInterpolatedPreset("one", "two", 0.5);
+  REQUIRE(freq.get() == Approx(300.0f));
+
+  presets.skipParameter("/count");
+  count.set(0);
+  presets.setInterpolatedPreset("one", "two", 0.5);
+  REQUIRE(count.get() == 0);
+  REQUIRE(presets.loadPresetValues("two").count("/count") == 0);
+  presets.skipParameter("/count", false);
+
+  // Morphing steps through the same plans
+  presets.setMorphStepTime(0.1f);
+  presets.recallPresetSynchronous("one");
+  REQUIRE(freq.get() == 100.0f);
+  presets.morphTo("two", 0.4f);
+  presets.stepMorphing();
+  REQUIRE(freq.get() == Approx(100.0f));
+  presets.stepMorphing();
+  REQUIRE(freq.get() == Approx(200.0f));
+  presets.stepMorphing();
+  presets.stepMorphing();
+  presets.stepMorphing();
+  REQUIRE(freq.get() == 500.0f);
+  REQUIRE(count.get() == 30);
+  REQUIRE(position.get() == Vec3f(2, 4, 6));
+}
+
+TEST_CASE("Preset cache") {
+  Parameter freq{"freq", "", 0.0f, 0.0f, 1000.0f};
+  PresetHandler presets(TimeMasterMode::TIME_MASTER_FREE,
+                        "test_presethandler_data");
+  presets << freq;
+  freq.set(100.0f);
+  presets.storePreset(0, "cached");
+  REQUIRE(presets.loadPresetValues("cached")["/freq"][0].get<float>() ==
+          100.0f);
+
+  // Files rewritten by others right away, with the same size, are reloaded
+  std::string fileName = presets.getCurrentPath() + "cached.preset";
+  for (float value : {777.0f, 555.0f}) {
+    std::ofstream f(fileName);
+    f << "::cached" << std::endl
+      << "/freq f " << std::to_string(value) << std::endl
+      << "::" << std::endl;
+    f.close();
+    REQUIRE(presets.loadPresetValues("cached")["/freq"][0].get<float>() ==
+            value);
+    REQUIRE(presets.loadPresetValues("cached")["/freq"][0].get<float>() ==
+            value);
+  }
+}
+
+TEST_CASE("Preset bank") {
+  std::string bankFile = "test_presetbank.bank";
+  std::string exportDir = "test_presetbank_export";
+  File::remove(bankFile);
+
+  PresetBank::ParameterStates one{{"/freq", {440.0f}},
+                                  {"/count", {int32_t(3)}},
+                                  {"/name", {"first"}}};
+  PresetBank::ParameterStates two{{"/freq", {880.0f}},
+                                  {"/position", {1.0f, 2.0f, 3.0f}}};
+  {
+    PresetBank bank;
+    REQUIRE(bank.open(bankFile));
+    REQUIRE(bank.size() == 0);
+    REQUIRE(bank.store({{"one", 0, one}, {"two", 1, two}}));
+  }
+
+  PresetBank bank(bankFile);
+  REQUIRE(bank.size() == 2);
+  PresetBank::ParameterStates values;
+  REQUIRE(bank.load("one", values));
+  REQUIRE(values.size() == 3);
+  REQUIRE(values["/freq"][0].get<float>() == 440.0f);
+  REQUIRE(values["/count"][0].get<int32_t>() == 3);
+  REQUIRE(values["/name"][0].get<std::string>() == "first");
+  values.clear();
+  REQUIRE(bank.load("two", values));
+  REQUIRE(values.size() == 2);
+  REQUIRE(values["/position"][2].get<float>() == 3.0f);
+  REQUIRE_FALSE(bank.load("three", values));
+
+  // Replacing a preset keeps its index, numbers are converted to the type
+  // stored in the bank
+  REQUIRE(bank.store("one", {{"/freq", {int32_t(220)}}}));
+  values.clear();
+  REQUIRE(bank.load("one", values));
+  REQUIRE(values.size() == 1);
+  REQUIRE(values["/freq"][0].get<float>() == 220.0f);
+  std::map<int, std::string> expectedMap{{0, "one"}, {1, "two"}};
+  REQUIRE(bank.presetMap() == expectedMap);
+  REQUIRE_FALSE(bank.store("one", {{"/freq", {"text"}}}));
+
+  expectedMap = {{5, "two"}};
+  REQUIRE(bank.setPresetMap(expectedMap));
+  REQUIRE(bank.presetMap() == expectedMap);
+
+  REQUIRE(bank.exportPresets(exportDir));
+  REQUIRE(bank.remove("two"));
+  REQUIRE(bank.size() == 1);
+  REQUIRE(bank.importPresets(exportDir));
+  REQUIRE(bank.size() == 2);
+  REQUIRE(bank.presetMap() == expectedMap);
+  values.clear();
+  REQUIRE(bank.load("two", values));
+  REQUIRE(values["/position"][1].get<float>() == 2.0f);
+
+  // PresetHandler stores presets and the preset map in the bank
+  Parameter freq{"freq", "", 0.0f, 0.0f, 1000.0f};
+  PresetHandler presets(TimeMasterMode::TIME_MASTER_FREE,
+                        "test_presethandler_data");
+  presets << freq;
+  REQUIRE(presets.usePresetBank(bankFile));
+  REQUIRE(presets.availablePresets() == bank.presetMap());
+  freq.set(100.0f);
+  presets.storePreset(2, "three");
+  freq.set(0.0f);
+  presets.recallPresetSynchronous(2);
+  REQUIRE(freq.get() == 100.0f);
+  presets.recallPresetSynchronous("one");
+  REQUIRE(freq.get() == 220.0f);
+
+  REQUIRE(bank.open(bankFile));
+  expectedMap = {{2, "three"}, {5, "two"}};
+  REQUIRE(bank.presetMap() == expectedMap);
+}
+
+TEST_CASE("Preset bank corrupt record") {
+  std::string bankFile = "test_presetbank_corrupt.bank";
+  File::remove(bankFile);
+  {
+    PresetBank bank;
+    REQUIRE(bank.open(bankFile));
+    REQUIRE(bank.store({{"one", 0, {{"/freq", {440.0f}}}}}));
+  }
+
+  // Set a presence bit past the end of the schema in the first record. The
+  // records offset follows the magic and six 32 bit header fields.
+  std::fstream f(bankFile, std::ios::in | std::ios::out | std::ios::binary);
+  uint64_t recordsOffset;
+  f.seekg(8 + 6 * 4 + 2 * 8);
+  f.read(reinterpret_cast<char *>(&recordsOffset), sizeof(recordsOffset));
+  uint32_t bits;
+  f.seekg(std::streamoff(recordsOffset));
+  f.read(reinterpret_cast<char *>(&bits), sizeof(bits));
+  bits |= 1u << 31;
+  f.seekp(std::streamoff(recordsOffset));
+  f.write(reinterpret_cast<const char *>(&bits), sizeof(bits));
+  f.close();
+  REQUIRE(f);
+
+  PresetBank bank(bankFile);
+  PresetBank::ParameterStates values;
+  REQUIRE(bank.load("one", values));
+  REQUIRE(values.size() == 1);
+  REQUIRE(values["/freq"][0].get<float>() == 440.0f);
+}
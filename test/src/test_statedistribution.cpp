@@ -0,0 +1,192 @@
+#include "catch.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "al/app/al_StateDistributionDomain.hpp"
+#include "al/system/al_Time.hpp"
+
+using namespace al;
+
+namespace {
+
+struct LargeState {
+  float values[4000];
+};
+
+struct SmallState {
+  int32_t value;
+};
+
+struct DeltaState {
+  int32_t values[256];
+};
+
+// Sends one fragment holding the whole SmallState
+void sendFragment(osc::Send &send, int frame, int keyframe, int index,
+                  int count, int32_t value) {
+  unsigned char record[12];
+  uint32_t offset = 0, size = sizeof(value);
+  std::memcpy(record, &offset, 4);
+  std::memcpy(record + 4, &size, 4);
+  std::memcpy(record + 8, &value, 4);
+  send.beginMessage(StateFragment::address());
+  send << std::string("small") << frame << keyframe << index << count
+       << osc::Blob(record, sizeof(record));
+  send.endMessage();
+  send.send();
+}
+
+// Ticks the receiver until it takes in a state, returning the new states
+template <class TSharedState>
+int waitForStates(StateReceiveDomain<TSharedState> &receiver) {
+  for (int i = 0; i < 50; i++) {
+    al_sleep(0.002);
+    receiver.tick();
+    if (receiver.newStates() > 0) {
+      return receiver.newStates();
+    }
+  }
+  return 0;
+}
+
+} // namespace
+
+TEST_CASE("State distribution fragments") {
+  StateDistributionDomain<LargeState> distribution;
+  auto sentState = std::make_shared<LargeState>();
+  auto receivedState = std::make_shared<LargeState>();
+  for (int i = 0; i < 4000; i++) {
+    sentState->values[i] = float(i);
+    receivedState->values[i] = 0.0f;
+  }
+
+  // Packet sizes that are not a multiple of 4 must still fit padded blobs
+  auto receiver = std::make_shared<StateReceiveDomain<LargeState>>();
+  receiver->configure(10890, "large", "127.0.0.1", 1401);
+  receiver->setStatePointer(receivedState);
+  REQUIRE(receiver->init(&distribution));
+  auto sender = std::make_shared<StateSendDomain<LargeState>>();
+  REQUIRE(sender->init(&distribution));
+  sender->configure(10890, "large", "127.0.0.1", 1401);
+  sender->setStatePointer(sentState);
+
+  int newStates = 0;
+  for (int frame = 0; frame < 3; frame++) {
+    sentState->values[frame] = -float(frame);
+    sender->tick();
+    for (int i = 0; i < 50; i++) {
+      al_sleep(0.002);
+      receiver->tick();
+      if (receiver->newStates() > 0) {
+        newStates += receiver->newStates();
+        break;
+      }
+    }
+    REQUIRE(receiver->state()->values[frame] == -float(frame));
+  }
+  REQUIRE(newStates == 3);
+  for (int i = 0; i < 4000; i++) {
+    REQUIRE(receiver->state()->values[i] == sentState->values[i]);
+  }
+  REQUIRE(receiver->lateStates() == 0);
+
+  receiver->cleanup();
+  sender->cleanup();
+}
+
+TEST_CASE("State distribution dropped and late states") {
+  StateDistributionDomain<SmallState> distribution;
+  auto receivedState = std::make_shared<SmallState>();
+  receivedState->value = 0;
+  auto receiver = std::make_shared<StateReceiveDomain<SmallState>>();
+  receiver->configure(10891, "small", "127.0.0.1");
+  receiver->setStatePointer(receivedState);
+  REQUIRE(receiver->init(&distribution));
+  osc::Send send(10891, "127.0.0.1");
+
+  // States completed before tick() takes them in replace each other
+  for (int frame = 1; frame <= 3; frame++) {
+    sendFragment(send, frame, frame, 0, 1, frame * 10);
+  }
+  al_sleep(0.1);
+  receiver->tick();
+  REQUIRE(receiver->newStates() == 3);
+  REQUIRE(receiver->droppedStates() == 2);
+  REQUIRE(receiver->lateStates() == 0);
+  REQUIRE(receiver->state()->value == 30);
+
+  // A frame still incomplete when a newer one arrives is late, and so is a
+  // frame arriving after a newer one
+  sendFragment(send, 4, 4, 0, 2, 40);
+  sendFragment(send, 5, 5, 0, 1, 50);
+  sendFragment(send, 4, 4, 0, 2, 40);
+  sendFragment(send, 4, 4, 1, 2, 40);
+  al_sleep(0.1);
+  receiver->tick();
+  REQUIRE(receiver->newStates() == 1);
+  REQUIRE(receiver->droppedStates() == 0);
+  REQUIRE(receiver->lateStates() == 2);
+  REQUIRE(receiver->state()->value == 50);
+
+  // Counts cover only the states since the previous tick
+  receiver->tick();
+  REQUIRE(receiver->newStates() == 0);
+  REQUIRE(receiver->droppedStates() == 0);
+  REQUIRE(receiver->lateStates() == 0);
+  REQUIRE(receiver->state()->value == 50);
+
+  receiver->cleanup();
+}
+
+TEST_CASE("State distribution delta mode") {
+  StateDistributionDomain<DeltaState> distribution;
+  auto sentState = std::make_shared<DeltaState>();
+  auto receivedState = std::make_shared<DeltaState>();
+  std::memset(sentState.get(), 0, sizeof(DeltaState));
+  std::memset(receivedState.get(), 0, sizeof(DeltaState));
+
+  auto receiver = std::make_shared<StateReceiveDomain<DeltaState>>();
+  receiver->configure(10892, "delta", "127.0.0.1");
+  receiver->setStatePointer(receivedState);
+  REQUIRE(receiver->init(&distribution));
+  auto sender = std::make_shared<StateSendDomain<DeltaState>>();
+  REQUIRE(sender->init(&distribution));
+  sender->configure(10892, "delta", "127.0.0.1");
+  sender->setStatePointer(sentState);
+  sender->setDeltaMode(true, 4);
+
+  // Keyframes are frames 0, 4 and 8. Dropping delta frame 2 only loses that
+  // frame, but after dropping keyframe 4 the deltas against it are ignored
+  // until keyframe 8.
+  DeltaState lastReceived = *receivedState;
+  for (int frame = 0; frame < 10; frame++) {
+    sentState->values[frame * 16] = frame + 1;
+    bool dropped = frame == 2 || frame == 4;
+    if (dropped) {
+      sender->configure(10893, "delta", "127.0.0.1");
+    }
+    sender->tick();
+    if (dropped) {
+      sender->configure(10892, "delta", "127.0.0.1");
+    }
+
+    if (dropped || (frame > 4 && frame < 8)) {
+      al_sleep(0.02);
+      receiver->tick();
+      REQUIRE(receiver->newStates() == 0);
+      REQUIRE(std::memcmp(receiver->state().get(), &lastReceived,
+                          sizeof(DeltaState)) == 0);
+    } else {
+      REQUIRE(waitForStates(*receiver) == 1);
+      REQUIRE(std::memcmp(receiver->state().get(), sentState.get(),
+                          sizeof(DeltaState)) == 0);
+      lastReceived = *receiver->state();
+    }
+  }
+  REQUIRE(receiver->lateStates() == 0);
+
+  receiver->cleanup();
+  sender->cleanup();
+}